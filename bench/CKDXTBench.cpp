@@ -0,0 +1,137 @@
+#include "CKRasterizer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+/*******************************************************************
+ DXT benchmark
+ Measures the DXT1/3/5 compression and decompression throughput,
+ with the calling thread only and with the worker threads, and
+ checks the round-trip error. Returns 1 if a check fails.
+*******************************************************************/
+#define BENCH_WIDTH 1024
+#define BENCH_HEIGHT 1024
+#define BENCH_REPEAT 4
+
+static void BenchFillImage(CKDWORD *pixels, int width, int height)
+{
+    // Smooth gradients with some detail, alpha varying slowly
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+        {
+            int r = (x * 255) / width;
+            int g = (y * 255) / height;
+            int b = (int)(128.0f + 127.0f * sinf(x * 0.05f + y * 0.03f));
+            int a = (int)(128.0f + 127.0f * cosf(x * 0.02f));
+            pixels[y * width + x] = ((CKDWORD)a << 24) | (r << 16) | (g << 8) | b;
+        }
+}
+
+static void BenchImageDesc(CKDWORD *pixels, int width, int height, VxImageDescEx &desc)
+{
+    desc.Width = width;
+    desc.Height = height;
+    desc.BitsPerPixel = 32;
+    desc.BytesPerLine = width * 4;
+    desc.AlphaMask = 0xFF000000;
+    desc.RedMask = 0x00FF0000;
+    desc.GreenMask = 0x0000FF00;
+    desc.BlueMask = 0x000000FF;
+    desc.Image = (XBYTE *)pixels;
+}
+
+// Root mean square error of the components from FirstShift to LastShift
+static float BenchRMSE(const CKDWORD *a, const CKDWORD *b, int count, int FirstShift, int LastShift)
+{
+    double error = 0.0;
+    for (int i = 0; i < count; ++i)
+        for (int shift = FirstShift; shift <= LastShift; shift += 8)
+        {
+            int d = (int)((a[i] >> shift) & 0xFF) - (int)((b[i] >> shift) & 0xFF);
+            error += d * d;
+        }
+    return (float)sqrt(error / (count * ((LastShift - FirstShift) / 8 + 1)));
+}
+
+int main()
+{
+    const int pixelCount = BENCH_WIDTH * BENCH_HEIGHT;
+    const float mpix = (float)pixelCount * BENCH_REPEAT / 1000000.0f;
+
+    // DXT1 only keeps 1 bit alpha (transparent pixels are black) : it is given an opaque copy
+    XArray<CKDWORD> image, opaqueImage, decoded;
+    image.Resize(pixelCount);
+    opaqueImage.Resize(pixelCount);
+    decoded.Resize(pixelCount);
+    BenchFillImage(image.Begin(), BENCH_WIDTH, BENCH_HEIGHT);
+    for (int i = 0; i < pixelCount; ++i)
+        opaqueImage[i] = image[i] | 0xFF000000;
+
+    VxImageDescEx dst;
+    BenchImageDesc(decoded.Begin(), BENCH_WIDTH, BENCH_HEIGHT, dst);
+
+    CKRasterizerThreadPool pool;
+    pool.Start();
+    printf("%dx%d image, %d worker threads\n", BENCH_WIDTH, BENCH_HEIGHT, pool.GetThreadCount());
+
+    static const VX_PIXELFORMAT formats[3] = {_DXT1, _DXT3, _DXT5};
+    static const char *names[3] = {"DXT1", "DXT3", "DXT5"};
+    // Maximum round-trip error (color, alpha) of each format on the test image
+    static const float maxColorError[3] = {4.0f, 4.0f, 4.0f};
+    static const float maxAlphaError[3] = {0.0f, 8.0f, 4.0f};
+
+    int failures = 0;
+    VxTimeProfiler profiler;
+    for (int f = 0; f < 3; ++f)
+    {
+        const CKDWORD *source = (formats[f] == _DXT1) ? opaqueImage.Begin() : image.Begin();
+        VxImageDescEx src;
+        BenchImageDesc((CKDWORD *)source, BENCH_WIDTH, BENCH_HEIGHT, src);
+
+        for (int quality = 0; quality < 2; ++quality)
+        {
+            CKDWORD flags = quality ? CKRST_DXTCOMPRESS_HIGHQUALITY : 0;
+            XArray<CKBYTE> blocks, pooledBlocks;
+            blocks.Resize(CKRSTGetDXTImageSize(formats[f], BENCH_WIDTH, BENCH_HEIGHT));
+            pooledBlocks.Resize(blocks.Size());
+
+            profiler.Reset();
+            for (int r = 0; r < BENCH_REPEAT; ++r)
+                CKRSTCompressDXT(src, formats[f], blocks.Begin(), flags);
+            float encodeTime = profiler.Current();
+
+            profiler.Reset();
+            for (int r = 0; r < BENCH_REPEAT; ++r)
+                CKRSTCompressDXT(src, formats[f], pooledBlocks.Begin(), flags, &pool);
+            float pooledEncodeTime = profiler.Current();
+
+            profiler.Reset();
+            for (int r = 0; r < BENCH_REPEAT; ++r)
+                CKRSTDecompressDXT(blocks.Begin(), formats[f], dst);
+            float decodeTime = profiler.Current();
+
+            profiler.Reset();
+            for (int r = 0; r < BENCH_REPEAT; ++r)
+                CKRSTDecompressDXT(blocks.Begin(), formats[f], dst, &pool);
+            float pooledDecodeTime = profiler.Current();
+
+            float colorError = BenchRMSE(source, decoded.Begin(), pixelCount, 0, 16);
+            float alphaError = BenchRMSE(source, decoded.Begin(), pixelCount, 24, 24);
+
+            CKBOOL same = memcmp(blocks.Begin(), pooledBlocks.Begin(), blocks.Size()) == 0;
+            CKBOOL ok = same && colorError <= maxColorError[f] && alphaError <= maxAlphaError[f];
+            if (!ok)
+                ++failures;
+
+            printf("%s%s : encode %7.2f MPix/s (%7.2f threaded), decode %7.2f MPix/s (%7.2f threaded), rmse color %.2f alpha %.2f%s\n",
+                   names[f], quality ? " HQ" : "   ",
+                   mpix * 1000.0f / encodeTime, mpix * 1000.0f / pooledEncodeTime,
+                   mpix * 1000.0f / decodeTime, mpix * 1000.0f / pooledDecodeTime,
+                   colorError, alphaError, ok ? "" : same ? " FAILED" : " FAILED (threaded result differs)");
+        }
+    }
+
+    pool.Stop();
+    return failures ? 1 : 0;
+}
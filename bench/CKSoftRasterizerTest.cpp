@@ -0,0 +1,272 @@
+#include "CKRasterizer.h"
+#include "CKSoftRasterizer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+/*******************************************************************
+ Software rasterizer test
+ Draws a few known scenes with the software rasterizer, reads them
+ back with CopyToMemoryBuffer and checks some of their pixels.
+ Returns 1 if a check fails.
+*******************************************************************/
+#define TEST_WIDTH 64
+#define TEST_HEIGHT 64
+
+struct TestVertex
+{
+    float x, y, z, rhw;
+    CKDWORD Color;
+    float u, v;
+};
+
+static int g_Failures = 0;
+
+static void TestCheck(CKBOOL Ok, const char *Name)
+{
+    printf("%-48s %s\n", Name, Ok ? "ok" : "FAILED");
+    if (!Ok)
+        ++g_Failures;
+}
+
+static void TestDraw(CKRasterizerContext *Context, VXPRIMITIVETYPE Type, TestVertex *Vertices, int Count, CKBOOL Textured)
+{
+    VxDrawPrimitiveData data;
+    memset(&data, 0, sizeof(data));
+    data.VertexCount = Count;
+    data.Flags = CKRST_DP_DIFFUSE | (Textured ? CKRST_DP_STAGES0 : 0);
+    data.PositionPtr = &Vertices[0].x;
+    data.PositionStride = sizeof(TestVertex);
+    data.ColorPtr = &Vertices[0].Color;
+    data.ColorStride = sizeof(TestVertex);
+    if (Textured)
+    {
+        data.TexCoordPtr = &Vertices[0].u;
+        data.TexCoordStride = sizeof(TestVertex);
+    }
+    Context->DrawPrimitive(Type, NULL, Count, &data);
+}
+
+static void TestReadBack(CKRasterizerContext *Context, CKDWORD *Pixels)
+{
+    VxImageDescEx desc;
+    VxPixelFormat2ImageDesc(_32_ARGB8888, desc);
+    desc.Width = TEST_WIDTH;
+    desc.Height = TEST_HEIGHT;
+    desc.BytesPerLine = TEST_WIDTH * 4;
+    desc.Image = (XBYTE *)Pixels;
+    memset(Pixels, 0xCD, TEST_WIDTH * TEST_HEIGHT * 4);
+    Context->CopyToMemoryBuffer(NULL, VXBUFFER_BACKBUFFER, desc);
+}
+
+static CKBOOL TestColor(CKDWORD Color, CKDWORD Expected, int Tolerance)
+{
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        int d = (int)((Color >> shift) & 0xFF) - (int)((Expected >> shift) & 0xFF);
+        if (d < -Tolerance || d > Tolerance)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+// Signed distance of (x, y) to the nearest edge of a clockwise quad (positive inside)
+static float TestQuadDistance(const TestVertex *Quad, float x, float y)
+{
+    float distance = 1e30f;
+    for (int i = 0; i < 4; ++i)
+    {
+        const TestVertex &a = Quad[i];
+        const TestVertex &b = Quad[(i + 1) & 3];
+        float ex = b.x - a.x, ey = b.y - a.y;
+        float d = (ex * (y - a.y) - ey * (x - a.x)) / sqrtf(ex * ex + ey * ey);
+        if (d < distance)
+            distance = d;
+    }
+    return distance;
+}
+
+int main()
+{
+    CKRasterizer rasterizer;
+    rasterizer.Start(NULL);
+    CKRasterizerDriver *driver = NULL;
+    for (int d = 0; d < rasterizer.GetDriverCount(); ++d)
+        if (rasterizer.GetDriver(d)->m_3DCaps.CKRasterizerSpecificCaps & CKRST_SPECIFICCAPS_SOFTWARE)
+            driver = rasterizer.GetDriver(d);
+    if (!driver)
+    {
+        printf("No software rasterizer driver\n");
+        return 1;
+    }
+
+    CKRasterizerContext *context = driver->CreateContext();
+    if (!context || !context->Create(NULL, 0, 0, TEST_WIDTH, TEST_HEIGHT))
+    {
+        printf("Context creation failed\n");
+        return 1;
+    }
+
+    XArray<CKDWORD> pixels;
+    pixels.Resize(TEST_WIDTH * TEST_HEIGHT);
+    CKDWORD *p = pixels.Begin();
+
+    context->SetRenderState(VXRENDERSTATE_CULLMODE, VXCULL_NONE);
+    context->SetRenderState(VXRENDERSTATE_LIGHTING, FALSE);
+
+    //--- Clear
+    context->Clear(CKRST_CTXCLEAR_ALL, 0xFF203040, 1.0f);
+    TestReadBack(context, p);
+    TestCheck(p[0] == 0xFF203040 && p[TEST_WIDTH * TEST_HEIGHT - 1] == 0xFF203040, "Clear");
+
+    //--- Two triangles sharing an edge, added to the target : the pixels of the shared edge
+    //--- must be covered once (0x40), never twice (0x80) or not at all (0). The shared edge
+    //--- goes through pixel centers, so that the top-left rule decides who covers them
+    {
+        TestVertex quad[4] = {
+            {4.0f, 4.0f, 0.5f, 1.0f, 0xFF404040, 0.0f, 0.0f},
+            {60.6f, 9.1f, 0.5f, 1.0f, 0xFF404040, 0.0f, 0.0f},
+            {60.0f, 60.0f, 0.5f, 1.0f, 0xFF404040, 0.0f, 0.0f},
+            {1.1f, 55.4f, 0.5f, 1.0f, 0xFF404040, 0.0f, 0.0f},
+        };
+        TestVertex triangles[6] = {quad[0], quad[1], quad[2], quad[0], quad[2], quad[3]};
+        context->Clear(CKRST_CTXCLEAR_ALL, 0xFF000000, 1.0f);
+        context->SetRenderState(VXRENDERSTATE_ZENABLE, FALSE);
+        context->SetRenderState(VXRENDERSTATE_ALPHABLENDENABLE, TRUE);
+        context->SetRenderState(VXRENDERSTATE_SRCBLEND, VXBLEND_ONE);
+        context->SetRenderState(VXRENDERSTATE_DESTBLEND, VXBLEND_ONE);
+        TestDraw(context, VX_TRIANGLELIST, triangles, 6, FALSE);
+        context->SetRenderState(VXRENDERSTATE_ALPHABLENDENABLE, FALSE);
+        TestReadBack(context, p);
+
+        CKBOOL once = TRUE, inside = TRUE, outside = TRUE;
+        for (int y = 0; y < TEST_HEIGHT; ++y)
+            for (int x = 0; x < TEST_WIDTH; ++x)
+            {
+                CKDWORD c = p[y * TEST_WIDTH + x] & 0x00FFFFFF;
+                if (c != 0 && c != 0x404040)
+                    once = FALSE;
+                // Pixel centers closer to an edge than the vertex snapping can go either way
+                float distance = TestQuadDistance(quad, x + 0.5f, y + 0.5f);
+                if (distance > 0.1f && c != 0x404040)
+                    inside = FALSE;
+                if (distance < -0.1f && c != 0)
+                    outside = FALSE;
+            }
+        TestCheck(once, "Shared edge covered exactly once");
+        TestCheck(inside && outside, "Triangle list coverage");
+    }
+
+    //--- Strip
+    {
+        TestVertex strip[4] = {
+            {8.0f, 8.0f, 0.5f, 1.0f, 0xFFFF0000, 0.0f, 0.0f},
+            {40.0f, 8.0f, 0.5f, 1.0f, 0xFFFF0000, 0.0f, 0.0f},
+            {8.0f, 24.0f, 0.5f, 1.0f, 0xFFFF0000, 0.0f, 0.0f},
+            {40.0f, 24.0f, 0.5f, 1.0f, 0xFFFF0000, 0.0f, 0.0f},
+        };
+        context->Clear(CKRST_CTXCLEAR_ALL, 0xFF000000, 1.0f);
+        TestDraw(context, VX_TRIANGLESTRIP, strip, 4, FALSE);
+        TestReadBack(context, p);
+        TestCheck(p[8 * TEST_WIDTH + 8] == 0xFFFF0000 && p[23 * TEST_WIDTH + 39] == 0xFFFF0000 &&
+                  p[16 * TEST_WIDTH + 24] == 0xFFFF0000 && p[7 * TEST_WIDTH + 8] == 0xFF000000 &&
+                  p[24 * TEST_WIDTH + 39] == 0xFF000000 && p[16 * TEST_WIDTH + 40] == 0xFF000000,
+                  "Triangle strip");
+    }
+
+    //--- Textured quad (2x2 texture, nearest filtering)
+    {
+        CKTextureDesc textureDesc;
+        VxPixelFormat2ImageDesc(_32_ARGB8888, textureDesc.Format);
+        textureDesc.Format.Width = 2;
+        textureDesc.Format.Height = 2;
+        CKDWORD texture = rasterizer.CreateObjectIndex(CKRST_OBJ_TEXTURE);
+        CKDWORD texels[4] = {0xFFFF0000, 0xFF00FF00, 0xFF0000FF, 0xFFFFFFFF};
+        VxImageDescEx image;
+        VxPixelFormat2ImageDesc(_32_ARGB8888, image);
+        image.Width = 2;
+        image.Height = 2;
+        image.BytesPerLine = 8;
+        image.Image = (XBYTE *)texels;
+        CKBOOL loaded = context->CreateObject(texture, CKRST_OBJ_TEXTURE, &textureDesc) &&
+                        context->LoadTexture(texture, image);
+        TestCheck(loaded, "Texture load");
+
+        TestVertex quad[4] = {
+            {0.0f, 0.0f, 0.5f, 1.0f, 0xFFFFFFFF, 0.0f, 0.0f},
+            {32.0f, 0.0f, 0.5f, 1.0f, 0xFFFFFFFF, 1.0f, 0.0f},
+            {32.0f, 32.0f, 0.5f, 1.0f, 0xFFFFFFFF, 1.0f, 1.0f},
+            {0.0f, 32.0f, 0.5f, 1.0f, 0xFFFFFFFF, 0.0f, 1.0f},
+        };
+        context->Clear(CKRST_CTXCLEAR_ALL, 0xFF000000, 1.0f);
+        context->SetTexture(texture);
+        context->SetTextureStageState(0, CKRST_TSS_MINFILTER, VXTEXTUREFILTER_NEAREST);
+        context->SetTextureStageState(0, CKRST_TSS_MAGFILTER, VXTEXTUREFILTER_NEAREST);
+        TestDraw(context, VX_TRIANGLEFAN, quad, 4, TRUE);
+        context->SetTexture(0);
+        TestReadBack(context, p);
+        TestCheck(p[8 * TEST_WIDTH + 8] == 0xFFFF0000 && p[8 * TEST_WIDTH + 24] == 0xFF00FF00 &&
+                  p[24 * TEST_WIDTH + 8] == 0xFF0000FF && p[24 * TEST_WIDTH + 24] == 0xFFFFFFFF &&
+                  p[8 * TEST_WIDTH + 40] == 0xFF000000,
+                  "Textured quad");
+        context->DeleteObject(texture, CKRST_OBJ_TEXTURE);
+    }
+
+    //--- Blended draw : half transparent red over blue
+    {
+        TestVertex quad[4] = {
+            {0.0f, 0.0f, 0.5f, 1.0f, 0x80FF0000, 0.0f, 0.0f},
+            {32.0f, 0.0f, 0.5f, 1.0f, 0x80FF0000, 0.0f, 0.0f},
+            {32.0f, 32.0f, 0.5f, 1.0f, 0x80FF0000, 0.0f, 0.0f},
+            {0.0f, 32.0f, 0.5f, 1.0f, 0x80FF0000, 0.0f, 0.0f},
+        };
+        context->Clear(CKRST_CTXCLEAR_ALL, 0xFF0000FF, 1.0f);
+        context->SetRenderState(VXRENDERSTATE_ALPHABLENDENABLE, TRUE);
+        context->SetRenderState(VXRENDERSTATE_SRCBLEND, VXBLEND_SRCALPHA);
+        context->SetRenderState(VXRENDERSTATE_DESTBLEND, VXBLEND_INVSRCALPHA);
+        TestDraw(context, VX_TRIANGLEFAN, quad, 4, FALSE);
+        context->SetRenderState(VXRENDERSTATE_ALPHABLENDENABLE, FALSE);
+        TestReadBack(context, p);
+        TestCheck(TestColor(p[16 * TEST_WIDTH + 16] & 0x00FFFFFF, 0x0080007F, 1) && p[16 * TEST_WIDTH + 48] == 0xFF0000FF,
+                  "Alpha blending");
+    }
+
+    //--- Depth test, kept across a render to texture
+    {
+        TestVertex nearTriangle[3] = {
+            {0.0f, 0.0f, 0.3f, 1.0f, 0xFF00FF00, 0.0f, 0.0f},
+            {60.0f, 0.0f, 0.3f, 1.0f, 0xFF00FF00, 0.0f, 0.0f},
+            {0.0f, 60.0f, 0.3f, 1.0f, 0xFF00FF00, 0.0f, 0.0f},
+        };
+        TestVertex farTriangle[3] = {
+            {0.0f, 0.0f, 0.6f, 1.0f, 0xFFFF0000, 0.0f, 0.0f},
+            {60.0f, 0.0f, 0.6f, 1.0f, 0xFFFF0000, 0.0f, 0.0f},
+            {0.0f, 60.0f, 0.6f, 1.0f, 0xFFFF0000, 0.0f, 0.0f},
+        };
+        CKTextureDesc targetDesc;
+        VxPixelFormat2ImageDesc(_32_ARGB8888, targetDesc.Format);
+        targetDesc.Format.Width = 32;
+        targetDesc.Format.Height = 32;
+        CKDWORD target = rasterizer.CreateObjectIndex(CKRST_OBJ_TEXTURE);
+        context->CreateObject(target, CKRST_OBJ_TEXTURE, &targetDesc);
+
+        context->Clear(CKRST_CTXCLEAR_ALL, 0xFF000000, 1.0f);
+        context->SetRenderState(VXRENDERSTATE_ZENABLE, TRUE);
+        context->SetRenderState(VXRENDERSTATE_ZWRITEENABLE, TRUE);
+        context->SetRenderState(VXRENDERSTATE_ZFUNC, VXCMP_LESSEQUAL);
+        TestDraw(context, VX_TRIANGLELIST, nearTriangle, 3, FALSE);
+        CKBOOL switched = context->SetTargetTexture(target);
+        context->Clear(CKRST_CTXCLEAR_ALL, 0xFF000000, 1.0f);
+        TestDraw(context, VX_TRIANGLELIST, farTriangle, 3, FALSE);
+        context->SetTargetTexture(0);
+        TestDraw(context, VX_TRIANGLELIST, farTriangle, 3, FALSE);
+        TestReadBack(context, p);
+        TestCheck(switched && p[10 * TEST_WIDTH + 10] == 0xFF00FF00 && p[50 * TEST_WIDTH + 50] == 0xFF000000,
+                  "Depth test across a render target switch");
+        context->DeleteObject(target, CKRST_OBJ_TEXTURE);
+    }
+
+    driver->DestroyContext(context);
+    return g_Failures ? 1 : 0;
+}
@@ -0,0 +1,116 @@
+#include "CKRasterizer.h"
+
+#include <stdio.h>
+#include <math.h>
+
+/*******************************************************************
+ Vertex codec benchmark
+ Measures the vertex data uploaded per frame with and without the
+ compressed attributes, the cost of encoding and decoding them,
+ and the error introduced by the quantization.
+*******************************************************************/
+#define BENCH_VERTEXCOUNT 65536
+#define BENCH_FRAMECOUNT 100
+
+struct BenchVertex
+{
+    VxVector Pos;
+    VxVector Normal;
+    float UV[2];
+};
+
+static void BenchFillVertices(BenchVertex *vertices, int count)
+{
+    // A displaced sphere, so positions span a few hundred units
+    for (int i = 0; i < count; ++i)
+    {
+        float a = (float)i * 0.0137f;
+        float b = (float)i * 0.0071f;
+        float r = 250.0f + 10.0f * sinf(a * 7.0f);
+        VxVector n(cosf(a) * sinf(b), cosf(b), sinf(a) * sinf(b));
+        vertices[i].Normal = n;
+        vertices[i].Pos = VxVector(n.x * r, n.y * r, n.z * r);
+        vertices[i].UV[0] = fmodf(a, 8.0f);
+        vertices[i].UV[1] = -fmodf(b, 8.0f);
+    }
+}
+
+static float BenchMaxError(const CKBYTE *decoded, const BenchVertex *vertices, int count, int component)
+{
+    float maxError = 0.0f;
+    for (int i = 0; i < count; ++i)
+    {
+        const float *d = (const float *)(decoded + i * sizeof(BenchVertex));
+        const float *s = (const float *)&vertices[i];
+        float e = fabsf(d[component] - s[component]);
+        if (e > maxError)
+            maxError = e;
+    }
+    return maxError;
+}
+
+int main()
+{
+    XArray<BenchVertex> vertices;
+    vertices.Resize(BENCH_VERTEXCOUNT);
+    BenchFillVertices(vertices.Begin(), BENCH_VERTEXCOUNT);
+
+    VxDrawPrimitiveData data;
+    memset(&data, 0, sizeof(data));
+    data.VertexCount = BENCH_VERTEXCOUNT;
+    data.PositionPtr = &vertices[0].Pos;
+    data.PositionStride = sizeof(BenchVertex);
+    data.NormalPtr = &vertices[0].Normal;
+    data.NormalStride = sizeof(BenchVertex);
+    data.TexCoordPtr = vertices[0].UV;
+    data.TexCoordStride = sizeof(BenchVertex);
+
+    CKVertexBufferDesc floatVB;
+    floatVB.m_VertexFormat = CKRST_VF_VERTEX;
+    floatVB.m_VertexSize = CKRSTGetVertexSize(floatVB.m_VertexFormat);
+
+    CKVertexBufferDesc packedVB;
+    packedVB.m_VertexFormat = CKRST_VF_VERTEX;
+    packedVB.m_Compression = CKRST_VC_POSITIONQ16 | CKRST_VC_NORMALPACKED | CKRST_VC_TEXHALF;
+    packedVB.m_VertexSize = CKRSTGetVertexSize(packedVB.m_VertexFormat, packedVB.m_Compression);
+    CKRSTComputePositionQuantization(&data, packedVB.m_PositionScale, packedVB.m_PositionBias);
+
+    XArray<CKBYTE> floatMem, packedMem, decodedMem;
+    floatMem.Resize(BENCH_VERTEXCOUNT * floatVB.m_VertexSize);
+    packedMem.Resize(BENCH_VERTEXCOUNT * packedVB.m_VertexSize);
+    decodedMem.Resize(BENCH_VERTEXCOUNT * floatVB.m_VertexSize);
+
+    VxTimeProfiler profiler;
+    for (int f = 0; f < BENCH_FRAMECOUNT; ++f)
+        CKRSTLoadVertexBuffer(floatMem.Begin(), &floatVB, &data);
+    float floatTime = profiler.Current();
+
+    profiler.Reset();
+    for (int f = 0; f < BENCH_FRAMECOUNT; ++f)
+        CKRSTLoadVertexBuffer(packedMem.Begin(), &packedVB, &data);
+    float encodeTime = profiler.Current();
+
+    profiler.Reset();
+    for (int f = 0; f < BENCH_FRAMECOUNT; ++f)
+        CKRSTDecodeVertexBuffer(decodedMem.Begin(), packedMem.Begin(), &packedVB, BENCH_VERTEXCOUNT);
+    float decodeTime = profiler.Current();
+
+    const float mvert = (float)BENCH_VERTEXCOUNT * BENCH_FRAMECOUNT / 1000000.0f;
+    printf("%d vertices per frame\n", BENCH_VERTEXCOUNT);
+    printf("  float  : %2d bytes/vertex, %8d bytes/frame, load   %8.2f Mvert/s\n",
+           (int)floatVB.m_VertexSize, BENCH_VERTEXCOUNT * (int)floatVB.m_VertexSize, mvert * 1000.0f / floatTime);
+    printf("  packed : %2d bytes/vertex, %8d bytes/frame, encode %8.2f Mvert/s, decode %8.2f Mvert/s\n",
+           (int)packedVB.m_VertexSize, BENCH_VERTEXCOUNT * (int)packedVB.m_VertexSize,
+           mvert * 1000.0f / encodeTime, mvert * 1000.0f / decodeTime);
+    printf("  saved  : %.1f%% of the vertex bandwidth\n",
+           100.0f * (1.0f - (float)packedVB.m_VertexSize / (float)floatVB.m_VertexSize));
+
+    // Quantization error, for each float of the decoded vertex
+    static const char *names[8] = {"x", "y", "z", "nx", "ny", "nz", "u", "v"};
+    printf("  max error :");
+    for (int c = 0; c < 8; ++c)
+        printf(" %s %g", names[c], BenchMaxError(decodedMem.Begin(), vertices.Begin(), BENCH_VERTEXCOUNT, c));
+    printf("\n");
+
+    return 0;
+}
@@ -49,6 +49,80 @@ struct CKRasterizerInfo
  */
 typedef void (*CKRST_GETINFO)(CKRasterizerInfo *);
 
+/// Function called by the thread pool for each item of a job
+typedef void (*CKRST_JOBFUNCTION)(void *Data, int Index);
+
+struct CKRSTThreadPoolData;
+
+/// Worker threads shared by the contexts of a rasterizer
+/**
+ * A job is a function called once for each item index in [0, Count). Submit returns a ticket
+ * that can be polled with IsComplete or waited for with Wait (by a single thread), the waiting
+ * thread runs the items of the job that were not started yet.
+ *
+ * When the pool has no worker thread, jobs are run by the calling thread during Submit.
+ * Job functions must not call the rasterizer context since the render devices are not thread safe.
+ */
+class CKRasterizerThreadPool
+{
+public:
+    CKRasterizerThreadPool();
+
+    ~CKRasterizerThreadPool();
+
+    //--- Starts ThreadCount worker threads (-1 : one per processor besides the calling thread)
+    CKBOOL Start(int ThreadCount = -1);
+    void Stop();
+    int GetThreadCount() const;
+
+    //--- Jobs
+    CKDWORD Submit(CKRST_JOBFUNCTION Function, void *Data, int Count);
+    CKBOOL IsComplete(CKDWORD Ticket);
+    void Wait(CKDWORD Ticket);
+
+    //--- Runs a job and waits for its completion
+    void ParallelFor(CKRST_JOBFUNCTION Function, void *Data, int Count);
+
+protected:
+    CKRSTThreadPoolData *m_Data;
+};
+
+/// Staging memory arena
+/**
+ * A buddy allocator handing out system memory for the copies of locked textures (see CKGLTexLockData).
+ * Blocks are rounded to a power of 2 (CKRST_STAGING_MINBLOCK bytes at least) and taken from pages
+ * allocated on demand and given back to the system when they are empty, blocks bigger than a page
+ * are allocated on their own. The memory reserved never exceeds MaxSize : Allocate returns NULL instead.
+ * The arena is not thread safe : the context arena is only used from the render thread.
+ */
+class CKRasterizerStagingArena
+{
+public:
+    CKRasterizerStagingArena(CKDWORD MaxSize = CKRST_STAGING_DEFAULTSIZE);
+
+    ~CKRasterizerStagingArena();
+
+    //--- Limit of the reserved memory (the blocks in use are kept if it is lowered)
+    void SetMaxSize(CKDWORD MaxSize) { m_MaxSize = MaxSize; }
+    CKDWORD GetMaxSize() const { return m_MaxSize; }
+
+    void *Allocate(CKDWORD Size);
+    void Free(void *Memory);
+
+    const CKStagingStats &GetStats() const { return m_Stats; }
+    void ResetHighWaterMarks();
+
+protected:
+    CKBOOL Reserve(CKDWORD Size);
+    void Unreserve(CKDWORD Size);
+    int AllocateBlock(CKStagingPage *Page, int Order);
+
+    XArray<CKStagingPage *> m_Pages;
+    XArray<CKStagingBlock> m_Blocks; // Blocks bigger than a page
+    CKDWORD m_MaxSize;
+    CKStagingStats m_Stats;
+};
+
 /// Main class for rasterizer declaration
 /**
  * A render engine is started by calling CKRasterizerStart which will try to create a CKRasterizer and initialize it.
@@ -91,6 +165,9 @@ public:
     void LinkRasterizer(CKRasterizer *rst);
     void RemoveLinkedRasterizer(CKRasterizer *rst);
 
+    //--- Worker threads (started on first use)
+    CKRasterizerThreadPool *GetThreadPool();
+
     //----- Buggy driver information
     CKBOOL LoadVideoCardFile(const char *FileName);
     CKDriverProblems *FindDriverProblems(const XString &Vendor, const XString &Renderer, const XString &Version,
@@ -107,6 +184,7 @@ public:
 
     XClassArray<CKDriverProblems> m_ProblematicDrivers; // List of driver with identified problems
     XArray<CKRasterizerDriver *> m_Drivers;
+    CKRasterizerThreadPool m_ThreadPool;
 
     // Implementation specific data to follow....
 };
@@ -166,23 +244,197 @@ void ConvertAttenuationModelFromDX5(float &_a0, float &_a1, float &_a2, float ra
 CKDWORD CKRSTGetVertexFormat(CKRST_DPFLAGS DpFlags, CKDWORD &VertexSize);
 
 /**
- * This utility function returns the size of a vertex from a given CKRST_VERTEXFORMAT format.
+ * This utility function returns the size of a vertex from a given CKRST_VERTEXFORMAT format,
+ * its attributes being stored as given by Compression (CKRST_VERTEXCOMPRESSION).
+ */
+CKDWORD CKRSTGetVertexSize(CKDWORD VertexFormat, CKDWORD Compression = 0);
+
+/**
+ * This utility function returns the layout (offset and size of each attribute) of a given CKRST_VERTEXFORMAT format,
+ * its attributes being stored as given by Compression (CKRST_VERTEXCOMPRESSION).
+ * Layouts are computed once per format and cached, the returned pointer stays valid.
  */
-CKDWORD CKRSTGetVertexSize(CKDWORD VertexFormat);
+const CKVertexLayout *CKRSTGetVertexLayout(CKDWORD VertexFormat, CKDWORD Compression = 0);
 
 /**
  * This utility function returns the new location of the current VBuffer memory pointer.
  * Copy the content of a DrawPrimitive Data structure inside a Vertex Buffer memory buffer.
  * No assumption or tests are made to check the coherence between the vertex format and incoming data.
+ * The attributes are not compressed : use the overload taking the vertex buffer description for
+ * vertex buffers with compressed attributes.
  */
 CKBYTE *CKRSTLoadVertexBuffer(CKBYTE *VBMem, CKDWORD VFormat, CKDWORD VSize, VxDrawPrimitiveData *data);
 
+/**
+ * Same as above but uses the vertex buffer description : its compressed attributes (m_Compression)
+ * are encoded from the float data, CKRST_VC_POSITIONQ16 positions with its position scale and bias
+ * (see CKRSTComputePositionQuantization).
+ */
+CKBYTE *CKRSTLoadVertexBuffer(CKBYTE *VBMem, CKVertexBufferDesc *VB, VxDrawPrimitiveData *data);
+
 /**
  * This utility function setups the DpData structure (data pointers and stride only)
  * according the DpData.Flags and VBMem pointer...
+ * For compressed attributes the pointers reference the encoded data, use CKRSTDecodeVertexBuffer
+ * to get back float data.
  */
 void CKRSTSetupDPFromVertexBuffer(CKBYTE *VBMem, CKVertexBufferDesc *VB, VxDrawPrimitiveData &DpData);
 
+/**
+ * This utility function computes the scale and bias to use with CKRST_VC_POSITIONQ16
+ * so that the positions given in data fit the quantization range.
+ */
+void CKRSTComputePositionQuantization(VxDrawPrimitiveData *data, VxVector &Scale, VxVector &Bias);
+
+/**
+ * This utility function decodes VertexCount vertices of a vertex buffer using compressed attributes
+ * into Dest, using the vertex format of the buffer without compression and its natural vertex size.
+ * It is meant for software implementations, returns the new location of the Dest pointer.
+ */
+CKBYTE *CKRSTDecodeVertexBuffer(CKBYTE *Dest, const CKBYTE *VBMem, CKVertexBufferDesc *VB, CKDWORD VertexCount);
+
+/**
+ * Primitive conversion utilities.
+ * CKRSTGetListType returns the list type a primitive type converts to (VX_TRIANGLELIST for strips and fans,
+ * VX_LINELIST for line strips) and CKRSTGetListIndexCount the maximum number of indices of the converted list.
+ * CKRSTConvertToList converts IndexCount 16 or 32 bits indices (IndexSize = 2 or 4), or a non indexed primitive
+ * if Indices is NULL, into a list written in Dest, optionally removing the degenerate primitives.
+ * Returns the number of indices written.
+ * CKRSTStripifyTriangleList restitches a triangle list into a single strip (the strips found are joined with degenerate
+ * triangles), Dest must be able to hold 2 * IndexCount indices. Returns the number of indices written.
+ */
+VXPRIMITIVETYPE CKRSTGetListType(VXPRIMITIVETYPE pType);
+int CKRSTGetListIndexCount(VXPRIMITIVETYPE pType, int IndexCount);
+int CKRSTConvertToList(CKDWORD *Dest, VXPRIMITIVETYPE pType, const void *Indices, CKDWORD IndexSize, int IndexCount,
+                       CKBOOL RemoveDegenerates);
+int CKRSTStripifyTriangleList(CKDWORD *Dest, const CKDWORD *Indices, int IndexCount, int VertexCount);
+
+/**
+ * This utility function optimizes an indexed triangle list in place (CKRST_MESHOPTFLAGS steps) :
+ * triangles are reordered for the vertex cache and overdraw, then vertices are reordered
+ * for fetch locality. Indices can be 16 or 32 bits (IndexSize = 2 or 4).
+ * Positions must be the first attribute of the vertices (as in every CKRST_VERTEXFORMAT), Compression gives
+ * how the attributes are stored (CKRST_VERTEXCOMPRESSION) : quantized positions are not ordered for overdraw.
+ * Stats (optional) receives the ACMR before and after optimization.
+ */
+CKBOOL CKRSTOptimizeMesh(CKBYTE *Vertices, CKDWORD Compression, CKDWORD VertexSize, int VertexCount,
+                         void *Indices, CKDWORD IndexSize, int IndexCount, CKDWORD Flags, CKMeshOptimizeStats *Stats = NULL);
+
+/**
+ * The steps of CKRSTOptimizeMesh, working on 32 bits indices of a triangle list.
+ * CKRSTComputeACMR returns the average number of cache misses per triangle with a FIFO cache of CacheSize vertices.
+ * CKRSTOptimizeVertexCache writes the reordered indices in Dest (Forsyth algorithm).
+ * CKRSTOptimizeOverdraw sorts the cache clusters of Indices so that outward facing ones are drawn first.
+ * CKRSTOptimizeVertexFetch reorders Vertices (can be NULL) by first use, remaps Indices
+ * and returns the number of referenced vertices.
+ */
+float CKRSTComputeACMR(const CKDWORD *Indices, int IndexCount, int CacheSize = CKRST_VERTEXCACHE_SIZE);
+void CKRSTOptimizeVertexCache(CKDWORD *Dest, const CKDWORD *Indices, int IndexCount, int VertexCount);
+void CKRSTOptimizeOverdraw(CKDWORD *Indices, int IndexCount, const CKBYTE *Positions, CKDWORD PositionStride, int VertexCount);
+int CKRSTOptimizeVertexFetch(CKBYTE *Vertices, CKDWORD VertexSize, int VertexCount, CKDWORD *Indices, int IndexCount);
+
+/**
+ * A pixel row converter : converts Count pixels from Src to Dst, X and Y give the position
+ * of the first pixel in the image (for the dither pattern), Flags are CKRST_PIXELCONVERTFLAGS.
+ */
+typedef void (*CKRST_PIXELCONVERTFUNCTION)(const CKBYTE *Src, CKBYTE *Dst, int Count, int X, int Y, CKDWORD Flags);
+
+/**
+ * This utility function returns the row converter between two pixel formats (SSE2 when available),
+ * or NULL if one of them is not supported : _32_ARGB8888, _32_RGB888, _24_RGB888, _16_RGB565, _16_RGB555,
+ * _16_ARGB1555, _16_ARGB4444, _8_RGB332 and _8_ARGB2222.
+ * Converters are chosen at compile time, the returned function can be kept (eg. per texture format).
+ */
+CKRST_PIXELCONVERTFUNCTION CKRSTGetPixelConverter(VX_PIXELFORMAT SrcFormat, VX_PIXELFORMAT DstFormat);
+
+/**
+ * This utility function converts the pixels of Src into Dst (the smallest of the two sizes is converted).
+ * Returns FALSE if the formats are not supported by CKRSTGetPixelConverter, VxDoBlit can be used instead.
+ */
+CKBOOL CKRSTConvertPixels(const VxImageDescEx &Src, VxImageDescEx &Dst, CKDWORD Flags = 0);
+
+/**
+ * These utility functions return the size of a 4x4 block and of a whole image
+ * in the _DXT1 to _DXT5 formats (0 for other formats).
+ */
+int CKRSTGetDXTBlockSize(VX_PIXELFORMAT Format);
+int CKRSTGetDXTImageSize(VX_PIXELFORMAT Format, int Width, int Height);
+
+/**
+ * This utility function compresses Src (a format supported by CKRSTGetPixelConverter) to
+ * _DXT1, _DXT3 or _DXT5 in Dst, which must be CKRSTGetDXTImageSize bytes long.
+ * Flags are CKRST_DXTCOMPRESSFLAGS. Rows of blocks are compressed in parallel when a Pool is given.
+ * CKRSTCompressDXTBlock compresses the 16 ARGB8888 pixels of a block (row by row).
+ */
+CKBOOL CKRSTCompressDXT(const VxImageDescEx &Src, VX_PIXELFORMAT Format, CKBYTE *Dst, CKDWORD Flags = 0,
+                        CKRasterizerThreadPool *Pool = NULL);
+void CKRSTCompressDXTBlock(const CKDWORD *Pixels, VX_PIXELFORMAT Format, CKBYTE *Dst, CKDWORD Flags = 0);
+
+/**
+ * These utility functions decompress _DXT1 to _DXT5 images to Dst (its size gives the image size,
+ * its format must be supported by CKRSTGetPixelConverter), in parallel when a Pool is given,
+ * or a single block to 16 ARGB8888 pixels (row by row).
+ */
+CKBOOL CKRSTDecompressDXT(const CKBYTE *Src, VX_PIXELFORMAT Format, VxImageDescEx &Dst, CKRasterizerThreadPool *Pool = NULL);
+CKBOOL CKRSTDecompressDXTBlock(const CKBYTE *Block, VX_PIXELFORMAT Format, CKDWORD *Pixels);
+
+/**
+ * This utility function filters Src to Dst, usually the next mipmap level (half the size rounded down,
+ * odd sizes are handled), both images must be 32 bits ARGB8888. Flags are CKRST_MIPMAPFLAGS, with
+ * CKRST_MIPMAP_ALPHACOVERAGE the alpha of Dst is scaled so that the fraction of pixels with an alpha above
+ * AlphaRef (0..1) is the same as in Src. Bands of rows are filtered in parallel when a Pool is given.
+ */
+CKBOOL CKRSTGenerateMipMap(const VxImageDescEx &Src, VxImageDescEx &Dst, CKDWORD Flags = 0, float AlphaRef = 0.5f,
+                           CKRasterizerThreadPool *Pool = NULL);
+
+/**
+ * These utility functions compute a 64 bits hash of a memory block or of an image (its description
+ * and the used part of its rows) with SSE2 when available, the hash of the previous data can be
+ * given as Seed to hash several blocks.
+ */
+CKImageHash CKRSTHashMemory(const void *Data, int Size, const CKImageHash &Seed = CKImageHash());
+CKImageHash CKRSTHashImage(const VxImageDescEx &Image, const CKImageHash &Seed = CKImageHash());
+
+/// Cache of decoded DXT blocks
+/**
+ * Keeps the last decoded 4x4 blocks of DXT images so that software paths can sample
+ * compressed textures without decompressing them entirely. Blocks are identified by
+ * the address of the compressed image : Invalidate must be called when an image
+ * is modified or freed. The cache is not thread safe.
+ */
+class CKDXTTileCache
+{
+public:
+    CKDXTTileCache(int Capacity = 256);
+
+    //--- Number of decoded blocks kept (changing it empties the cache)
+    void SetCapacity(int Capacity);
+    int GetCapacity() const { return m_Capacity; }
+
+    //--- Decoded pixels of a block (valid until the next call), or a single texel (clamped coordinates)
+    const CKDWORD *GetTile(const CKBYTE *Image, VX_PIXELFORMAT Format, int Width, int BlockX, int BlockY);
+    CKDWORD GetTexel(const CKBYTE *Image, VX_PIXELFORMAT Format, int Width, int Height, int X, int Y);
+
+    //--- Forgets the blocks of an image (all the blocks if NULL)
+    void Invalidate(const CKBYTE *Image = NULL);
+
+    int GetHitCount() const { return m_Hits; }
+    int GetMissCount() const { return m_Misses; }
+
+protected:
+    void Unlink(int Tile);
+    void LinkFront(int Tile);
+    void LinkBack(int Tile);
+
+    XArray<CKDXTTile> m_Tiles;
+    XHashTable<int, CKDXTTileKey, CKDXTTileKeyHash> m_Index; // Tile of each cached block
+    int m_Capacity;
+    int m_Head; // Most recently used tile
+    int m_Tail; // Least recently used tile
+    int m_Hits;
+    int m_Misses;
+};
+
 /// Rasterizer context abstraction class
 /**
  * A context is used to identify where the rendering take place and to specify how primitives should be drawn.
@@ -214,7 +466,11 @@ public:
     virtual CKBOOL Resize(int PosX = 0, int PosY = 0, int Width = 0, int Height = 0, CKDWORD Flags = 0) { return TRUE; }
     virtual CKBOOL Clear(CKDWORD Flags = CKRST_CTXCLEAR_ALL, CKDWORD Ccol = 0, float Z = 1.0f, CKDWORD Stencil = 0, int RectCount = 0,
                          CKRECT *rects = NULL) { return FALSE; }
-    virtual CKBOOL BackToFront(CKBOOL vsync) { return FALSE; }
+    virtual CKBOOL BackToFront(CKBOOL vsync)
+    {
+        NextFrame();
+        return FALSE;
+    }
 
     //------------------------------------------------------
     //--- Starting/stopping primitive drawing
@@ -225,6 +481,8 @@ public:
     //--- Lighting & Material States
     virtual CKBOOL SetLight(CKDWORD LightIndex, CKLightData *data)
     {
+        if (m_BatchVertexCount != 0)
+            FlushBatch();
         if (data && LightIndex < RST_MAX_LIGHT)
             m_CurrentLightData[LightIndex] = *data;
         return FALSE;
@@ -283,6 +541,15 @@ public:
                                    CKWORD *indices = NULL, int indexcount = NULL) { return FALSE; }
     virtual CKBOOL DrawPrimitiveVBIB(VXPRIMITIVETYPE pType, CKDWORD VB, CKDWORD IB, CKDWORD MinVIndex, CKDWORD VertexCount,
                                      CKDWORD StartIndex, int Indexcount) { return FALSE; }
+    // 32 bits indices versions : implementations reporting CKRST_SPECIFICCAPS_INDEX32 should override them,
+    // the default implementation splits the draw in ranges of at most 65536 vertices drawn with 16 bits indices
+    // by DrawPrimitive/DrawPrimitiveVB (strips and fans are converted to lists when they must be split).
+    // A primitive whose vertices are more than 65535 apart is drawn with its vertices gathered, in a
+    // dynamic vertex buffer for DrawPrimitiveVB32 : the vertex buffer must then be readable
+    // (not CKRST_VB_WRITEONLY) and not use compressed attributes, otherwise the draw returns FALSE.
+    virtual CKBOOL DrawPrimitive32(VXPRIMITIVETYPE pType, CKDWORD *indices, int indexcount, VxDrawPrimitiveData *data);
+    virtual CKBOOL DrawPrimitiveVB32(VXPRIMITIVETYPE pType, CKDWORD VertexBuffer, CKDWORD StartIndex, CKDWORD VertexCount,
+                                     CKDWORD *indices, int indexcount);
 
     //-------------------------------------------------------------
     //--- Creation of Textures, Sprites and Vertex Buffer
@@ -417,10 +684,257 @@ public:
     // vertex buffer, so it can be used when drawing dynamic primitives
     // the returned buffer that can be filled and render with DrawPrimitiveVB
     // (Implemented by Lib)
-    // AddKey is a value that must be < 255 that can be used to have different
+    // AddKey is a value that can be used to have different
     // dynamic vertex buffer with the same vertex format
+    // VertexSize can be 0 to use the size given by the vertex format layout
+    // Buffers are kept in a registry keyed by (VertexFormat, VertexSize, AddKey), they grow
+    // geometrically and the buffers replaced when growing are kept for reuse.
     CKDWORD GetDynamicVertexBuffer(CKDWORD VertexFormat, CKDWORD VertexCount, CKDWORD VertexSize, CKDWORD AddKey);
 
+    // Streaming mode for the dynamic vertex buffers : successive calls append
+    // VertexCount vertices into the dynamic vertex buffer (locked with CKRST_LOCK_NOOVERWRITE)
+    // and only discard its content when it wraps (CKRST_LOCK_DISCARD).
+    // Returns the locked memory, VB and StartVertex receive the vertex buffer index and
+    // the first vertex to give to DrawPrimitiveVB. The buffer must be unlocked with UnlockVertexBuffer.
+    // (Implemented by Lib)
+    void *LockDynamicVertexBuffer(CKDWORD VertexFormat, CKDWORD VertexCount, CKDWORD VertexSize, CKDWORD AddKey,
+                                  CKDWORD &VB, CKDWORD &StartVertex);
+
+    //-------------- Dynamic Index buffers --------------
+    // Same as GetDynamicVertexBuffer for index buffers : returns an index buffer
+    // that can hold at least IndexCount indices, AddKey can be used to have different buffers.
+    // (Implemented by Lib)
+    CKDWORD GetDynamicIndexBuffer(CKDWORD IndexCount, CKDWORD AddKey);
+
+    // Streaming mode for the dynamic index buffers : successive calls append IndexCount
+    // indices (CKRST_LOCK_NOOVERWRITE) and discard the buffer only when it wraps.
+    // Returns the locked memory, IB and StartIndex receive the index buffer index and
+    // the first index to give to DrawPrimitiveVBIB. The buffer must be unlocked with UnlockIndexBuffer.
+    // (Implemented by Lib)
+    void *LockDynamicIndexBuffer(CKDWORD IndexCount, CKDWORD AddKey, CKDWORD &IB, CKDWORD &StartIndex);
+
+    //-------------- Mesh optimization --------------
+    // Optimizes the first VertexCount vertices of a vertex buffer and the first IndexCount indices
+    // of the index buffer (triangle list) it is drawn with. Indices must be relative to the start
+    // of the vertex buffer and lower than VertexCount. Both ranges are rewritten so the buffers
+    // must be readable (not CKRST_VB_WRITEONLY).
+    // This is meant to be done once on static geometry at load time, see CKRSTOptimizeMesh.
+    // (Implemented by Lib)
+    CKBOOL OptimizeMesh(CKDWORD VB, CKDWORD IB, CKDWORD VertexCount, CKDWORD IndexCount,
+                        CKDWORD Flags = CKRST_MESHOPT_ALL, CKMeshOptimizeStats *Stats = NULL);
+
+    //-------------- Sprite atlas --------------
+    // When enabled, CreateSprite packs sprites of at most MaxSpriteSize pixels into shared
+    // textures of PageSize x PageSize pixels (a page per texture format) instead of creating
+    // pow2 sub-textures for each sprite, bigger sprites are still split in sub-textures.
+    // The CKSPRTextInfo of a packed sprite gives its position (tx,ty) in the page texture (sw x sh)
+    // so implementations must offset texture coordinates by (tx / sw, ty / sh) when drawing sprites.
+    // The space used by a deleted sprite is only reclaimed when its page is empty.
+    // LoadSprite only updates a system memory copy of the page : the pages changed since their last
+    // upload are loaded once by FlushSpriteAtlas, which NextFrame calls and implementations
+    // must call at the beginning of DrawSprite.
+    // (Implemented by Lib)
+    void EnableSpriteAtlas(CKBOOL Enable, int PageSize = 1024, int MaxSpriteSize = 256);
+    void FlushSpriteAtlas();
+
+    //-------------- Texture compression --------------
+    // Compresses SurfDesc to _DXT1, _DXT3 or _DXT5 with the rasterizer worker threads, for implementations
+    // loading a compressed texture from an uncompressed image. Returns the compressed blocks (lib scratch
+    // memory valid until the next call) or NULL if the formats are not supported.
+    // (Implemented by Lib)
+    CKBYTE *CompressTextureImage(const VxImageDescEx &SurfDesc, VX_PIXELFORMAT Format, CKDWORD Flags = 0);
+
+    //-------------- Mipmap generation --------------
+    // Loads SurfDesc in the level 0 of a texture and the MipMapCount next levels of its CKTextureDesc
+    // generated by CKRSTGenerateMipMap (Flags are CKRST_MIPMAPFLAGS) with the rasterizer worker threads,
+    // each level being given to LoadTexture. SurfDesc must be a format supported by CKRSTGetPixelConverter.
+    // (Implemented by Lib)
+    CKBOOL LoadTextureMipMaps(CKDWORD Texture, const VxImageDescEx &SurfDesc, CKDWORD Flags = 0, float AlphaRef = 0.5f);
+
+    //-------------- Non power of 2 textures --------------
+    // Drivers without CKRST_TEXTURECAPS_POW2 can create textures of any size, drivers with
+    // CKRST_TEXTURECAPS_CONDITIONALNONPOW2 only textures without mipmaps (to be used with clamp addressing).
+    // When allowed, CreateSprite creates sub-textures of the exact sprite size and GetTextureSize, which
+    // implementations should use when creating a texture, keeps the exact size of sprites and textures
+    // created with CKRST_TEXTURE_CONDITIONALNONPOW2 (other sizes are rounded to the next power of 2).
+    // GetNonPow2MemorySaved returns the memory saved by the existing non power of 2 textures (in bytes).
+    // (Implemented by Lib)
+    CKBOOL CanCreateNonPow2Texture(CKDWORD Flags, int MipMapCount);
+    void GetTextureSize(CKDWORD Texture, const CKTextureDesc *Format, int &Width, int &Height);
+    CKDWORD GetNonPow2MemorySaved() { return m_NonPow2MemorySaved; }
+
+    //-------------- Primitive conversion --------------
+    // Converts a strip, fan or list into a triangle (or line) list without degenerate primitives,
+    // or into a single strip if ToStrip is TRUE (triangles only). indices can be NULL for a non indexed
+    // primitive of indexcount vertices. pType and indexcount receive the converted primitive type and count.
+    // The result is stored in lib scratch memory valid until the next call.
+    // (Implemented by Lib)
+    CKDWORD *ConvertPrimitive(VXPRIMITIVETYPE &pType, const CKWORD *indices, int &indexcount, CKBOOL ToStrip = FALSE);
+
+    // Same conversion for a range of a static index buffer : the result is stored in an index buffer created
+    // and cached by the lib so that the conversion is only done once (it is redone if the source buffer is recreated,
+    // deleting the source buffer deletes it). The source buffer must be readable (not CKRST_VB_WRITEONLY).
+    // Returns the converted index buffer (its indices start at 0) or 0 if the conversion failed,
+    // pType and IndexCount receive the converted primitive type and count.
+    // (Implemented by Lib)
+    CKDWORD GetConvertedIndexBuffer(CKDWORD IB, VXPRIMITIVETYPE &pType, CKDWORD StartIndex, int &IndexCount, CKBOOL ToStrip = FALSE);
+
+    //-------------- Small draws batching --------------
+    // When batching is enabled, implementations call BatchPrimitive at the beginning of DrawPrimitive :
+    // draws of at most MaxVertexCount vertices with the same vertex format as the current
+    // batch are appended into a dynamic vertex buffer with their indices rebased (strips and fans
+    // are converted to lists) and the whole batch is later drawn with a single DrawPrimitiveVB.
+    // BatchPrimitive returns FALSE, after flushing the pending batch, if the draw must be rendered directly.
+    // The lib flushes the batch on a render state cache miss, on matrix, light, material and viewport changes
+    // and at the end of the frame, implementations must call FlushBatch before any other state
+    // change (textures, texture stage states, shaders...) or drawing method.
+    // (Implemented by Lib)
+    void EnableBatching(CKBOOL Enable, CKDWORD MaxVertexCount = 256);
+    CKBOOL BatchPrimitive(VXPRIMITIVETYPE pType, CKWORD *indices, int indexcount, VxDrawPrimitiveData *data);
+    void FlushBatch();
+
+    //-------------- Procedural textures --------------
+    // When several frames are in flight, textures created with CKRST_TEXTURE_HINTPROCEDURAL
+    // are given one copy per frame slot so loading them does not wait for the frames
+    // still using the previous content. LoadFrameTexture loads the copy of the current
+    // frame slot (all the levels that are used must be loaded during the same frame)
+    // and GetFrameTexture returns the texture index implementations must bind when
+    // asked to use Texture (Texture itself if it has no copies).
+    // (Implemented by Lib)
+    CKBOOL LoadFrameTexture(CKDWORD Texture, const VxImageDescEx &SurfDesc, int miplevel = -1);
+    CKDWORD GetFrameTexture(CKDWORD Texture);
+
+    //-------------- Texture streaming --------------
+    // A streamed texture is first loaded with its coarsest levels only (the levels of at most
+    // ResidentSize pixels, read at once with Read), its finer levels are read with Read on the
+    // rasterizer worker threads when they are needed and loaded with LoadTexture by NextFrame.
+    // Each frame textures are given the screen size they are drawn at (RequestTextureScreenSize,
+    // or RequestTextureBox with the screen extents of a box given by ComputeBoxVisibility) which
+    // gives the finest level they need, the textures drawn the biggest are read first.
+    // With a memory budget (0 for none) the finest levels of the least needed textures are evicted
+    // to make room : implementations must not sample the levels finer than GetStreamedTextureLevel
+    // (eg. IDirect3DBaseTexture9::SetLOD, which also frees the video memory of managed textures).
+    // (Implemented by Lib)
+    CKBOOL StreamTexture(CKDWORD Texture, CKRST_MIPREADFUNCTION Read, void *Argument, int ResidentSize = 64);
+    void StopTextureStreaming(CKDWORD Texture);
+    void RequestTextureScreenSize(CKDWORD Texture, float Width, float Height);
+    void RequestTextureBox(CKDWORD Texture, const VxBbox &Box, CKBOOL World = FALSE);
+    void SetTextureStreamingBudget(CKDWORD Bytes, int MaxReads = 4);
+    int GetStreamedTextureLevel(CKDWORD Texture);
+    CKDWORD GetTextureStreamingMemory() { return m_StreamingMemory; }
+
+    //-------------- Asynchronous loads --------------
+    // Same as LoadTexture, LoadCubeMapTexture and LoadSprite but the image is converted to the
+    // format of the texture or sprite (compressed for DXT textures) on the rasterizer worker
+    // threads. The converted image is uploaded by NextFrame, in the order of the calls, at most
+    // UploadBudget bytes per frame (0 for no limit, at least one image is uploaded per frame).
+    // SurfDesc must stay valid until the load is complete : IsLoadComplete returns TRUE and
+    // Callback, if any, is called with the result. WaitLoad uploads a load and the previous ones
+    // at once. Loads of a deleted object fail, loads are dropped without callback by FlushObjects.
+    // (Implemented by Lib)
+    CKDWORD LoadTextureAsync(CKDWORD Texture, const VxImageDescEx &SurfDesc, int miplevel = -1,
+                             CKRST_LOADCALLBACK Callback = NULL, void *Argument = NULL);
+    CKDWORD LoadCubeMapTextureAsync(CKDWORD Texture, const VxImageDescEx &SurfDesc, CKRST_CUBEFACE Face, int miplevel = -1,
+                                    CKRST_LOADCALLBACK Callback = NULL, void *Argument = NULL);
+    CKDWORD LoadSpriteAsync(CKDWORD Sprite, const VxImageDescEx &SurfDesc, CKRST_LOADCALLBACK Callback = NULL, void *Argument = NULL);
+    CKBOOL IsLoadComplete(CKDWORD Ticket);
+    void WaitLoad(CKDWORD Ticket);
+    void SetUploadBudget(CKDWORD Bytes) { m_UploadBudget = Bytes; }
+
+    //-------------- Render target pool --------------
+    // AcquireRenderTarget returns a texture created with CKRST_TEXTURE_RENDERTARGET to be used with SetTargetTexture,
+    // of the given size and format (those of the context when 0 or UNKNOWN_PF), taken from the pool when a free
+    // target matches. ReleaseRenderTarget gives it back to the pool : passes whose targets do not live at the same
+    // time during a frame (a target released before the next pass acquires its own) use the same texture. Transient
+    // targets are given back by NextFrame, free targets unused for CKRST_RENDERTARGET_MAXUNUSEDFRAMES frames are
+    // destroyed. A target released with ReleaseObjectIndex leaves the pool.
+    // (Implemented by Lib)
+    CKDWORD AcquireRenderTarget(int Width = 0, int Height = 0, VX_PIXELFORMAT Format = UNKNOWN_PF, CKBOOL CubeMap = FALSE,
+                                CKBOOL Transient = TRUE);
+    void ReleaseRenderTarget(CKDWORD Texture);
+    int GetRenderTargetPoolSize() { return m_RenderTargets.Size(); }
+
+    //-------------- Texture sharing --------------
+    // LoadSharedTexture loads a texture like LoadTexture unless a texture with the same description was
+    // already loaded with the same image (same CKRSTHashImage) : the texture then uses the CKTextureDesc, and
+    // so the device texture, of the first one and its own desc is deleted. A shared desc is only deleted with
+    // the last texture using it, implementations overriding DeleteObject must call the lib one and not release
+    // the resources of a texture still shared (IsTextureShared), and implementations of CreateObject must call
+    // UnshareTexture before deleting the previous desc of a texture. A shared texture must only be reloaded
+    // with LoadSharedTexture or the other lib loads (LoadTextureMipMaps, LoadFrameTexture, streaming and
+    // asynchronous loads), which first give it its own desc. Only whole textures (miplevel -1 or 0 without
+    // mipmaps) are shared. GetSharedTextureMemorySaved returns the memory of the textures not loaded (bytes).
+    // (Implemented by Lib)
+    CKBOOL LoadSharedTexture(CKDWORD Texture, const VxImageDescEx &SurfDesc, int miplevel = -1);
+    CKBOOL IsTextureShared(CKDWORD Texture);
+    CKDWORD GetSharedTextureMemorySaved() { return m_SharedTextureMemorySaved; }
+
+    //-------------- Staging memory --------------
+    // Implementations needing a system memory copy of a texture while it is locked (eg. CKGLTexLockData)
+    // borrow it from the context staging arena and give it back on unlock, instead of keeping a copy per
+    // texture. AllocateStaging returns NULL when the arena limit (see m_StagingArena) would be exceeded.
+    // The arena is not locked : these must only be called from the render thread, the worker thread
+    // jobs (eg. the asynchronous loads) use their own memory.
+    // (Implemented by Lib)
+    void *AllocateStaging(CKDWORD Size) { return m_StagingArena.Allocate(Size); }
+    void FreeStaging(void *Memory) { m_StagingArena.Free(Memory); }
+
+    //-------------- Frame management --------------
+    // Must be called by implementations once per presented frame (from BackToFront)
+    // to reset the lib per-frame counters (m_FrameStats). A fence is inserted at the end
+    // of the frame and the fence of the frame slot about to be reused is waited for.
+    void NextFrame();
+
+    // Sets the number of frames the dynamic resources are buffered for (1 to CKRST_MAX_FRAMES_IN_FLIGHT),
+    // existing dynamic buffers are released. (Implemented by Lib)
+    void SetFramesInFlight(CKDWORD Count);
+    CKDWORD GetFramesInFlight() { return m_FramesInFlight; }
+
+    //-------------- Fences --------------
+    // A fence is a marker in the command stream, it completes when the GPU has processed
+    // everything submitted before it. InsertFence returns a non-zero fence value, fences
+    // complete in order. The default implementation simulates a GPU that is one frame
+    // late : inserting a fence completes the previous one. Implementations with real
+    // fences should override the three methods and set m_SimulatedFences to FALSE.
+    virtual CKDWORD InsertFence();
+    virtual CKBOOL IsFenceComplete(CKDWORD Fence);
+    virtual void WaitFence(CKDWORD Fence);
+
+protected:
+    CKDynamicVertexBuffer *GetDynamicVertexBufferEntry(CKDWORD VertexFormat, CKDWORD VertexCount, CKDWORD VertexSize, CKDWORD AddKey);
+    CKDWORD CreateDynamicVertexBuffer(CKDWORD VertexFormat, CKDWORD VertexSize, CKDWORD VertexCount, CKDWORD AddKey, CKDWORD VB);
+    CKDynamicIndexBuffer *GetDynamicIndexBufferEntry(CKDWORD IndexCount, CKDWORD AddKey);
+    CKBOOL DrawIndexed32(VXPRIMITIVETYPE pType, CKDWORD VB, CKDWORD StartIndex, CKDWORD *indices, int indexcount, VxDrawPrimitiveData *data);
+    CKBOOL DrawIndexRange16(VXPRIMITIVETYPE pType, CKDWORD VB, CKDWORD StartIndex, CKDWORD MinIndex, CKDWORD VertexCount,
+                            CKWORD *indices, int indexcount, VxDrawPrimitiveData *data);
+    CKBOOL DrawGathered(VXPRIMITIVETYPE pType, CKDWORD VB, CKDWORD StartIndex, const CKDWORD *indices, int indexcount,
+                        VxDrawPrimitiveData *data);
+    void ReleaseDynamicBuffers();
+    void ReleaseFrameTextures(CKDWORD Texture);
+    void ReleaseFrameTextures();
+    int ConvertIndices(VXPRIMITIVETYPE &pType, const void *indices, CKDWORD IndexSize, int indexcount, CKBOOL ToStrip);
+    void ReleaseConvertedIndexBuffers(CKDWORD IB);
+    void ReleaseConvertedIndexBuffers();
+    CKBOOL CreateAtlasSprite(CKSpriteDesc *sprite, CKSpriteDesc *DesiredFormat);
+    CKSpriteAtlasPage *GetAtlasPage(CKDWORD Texture);
+    void GetAtlasPageDesc(CKSpriteAtlasPage *page, VxImageDescEx &desc);
+    void ReleaseAtlasSprite(CKSpriteDesc *sprite);
+    void ReleaseSpriteAtlas();
+    void SetNonPow2Saving(CKDWORD Texture, CKDWORD Bytes);
+    void UpdateTextureStreaming();
+    CKBOOL MakeStreamingRoom(CKDWORD Size, float Priority);
+    void ReleaseStreamedTextures();
+    CKBOOL PrepareTextureLoad(CKDWORD Texture);
+    CKBOOL UnshareTexture(CKDWORD Texture);
+    void ReleaseSharedTextures();
+    void UpdateRenderTargetPool();
+    void RemovePooledRenderTarget(CKDWORD Texture);
+    void ReleaseRenderTargetPool();
+    CKDWORD SubmitAsyncLoad(CKAsyncLoad *Load, const VxImageDescEx &Format);
+    void UploadAsyncLoads(CKDWORD Ticket);
+    void CancelAsyncLoads(CKRST_OBJECTTYPE Type, CKDWORD Object);
+    void ReleaseAsyncLoads();
+
 public:
     CKRasterizerDriver *m_Driver; // Driver that was used to create this context
 
@@ -511,6 +1025,94 @@ public:
     //--- the default value is 0, and it's the rasterizer implementation
     //--- responsibility to update and use this value.
     CKDWORD m_UnityMatrixMask;
+
+    //----------------------------------------------------------------------
+    //--- Frame counters maintained by the lib
+    CKDWORD m_FrameCounter;                   // Incremented by NextFrame
+    CKRasterizerFrameStats m_FrameStats;      // Counters for the current frame
+    CKRasterizerFrameStats m_LastFrameStats;  // Counters of the last complete frame
+
+    //----------------------------------------------------------------------
+    //--- Dynamic buffers registry
+    XHashTable<CKDynamicVertexBuffer, CKDynamicVBKey, CKDynamicVBKeyHash> m_DynamicVBs; // Dynamic VB currently used for a key
+    XArray<CKDWORD> m_FreeDynamicVBs;                                                  // Dynamic VB replaced by a bigger one, kept for reuse
+    XHashTable<CKDynamicIndexBuffer, CKDynamicVBKey, CKDynamicVBKeyHash> m_DynamicIBs;  // Dynamic IB currently used for a key
+    XHashTable<CKFrameTexture, CKDWORD> m_FrameTextures;                               // Per-frame copies of procedural textures
+
+    //----------------------------------------------------------------------
+    //--- Frame ring
+    CKDWORD m_FramesInFlight;                            // Number of frame slots (see SetFramesInFlight)
+    CKDWORD m_FrameSlot;                                 // Slot of the current frame (m_FrameCounter % m_FramesInFlight)
+    CKDWORD m_FrameFences[CKRST_MAX_FRAMES_IN_FLIGHT];   // Fence inserted at the end of the last frame that used each slot
+    CKBOOL m_SimulatedFences;                            // TRUE if the fences are the lib simulated ones
+    CKDWORD m_LastFence;                                 // Last inserted fence (simulated fences)
+    CKDWORD m_CompletedFence;                            // Last completed fence (simulated fences)
+
+    //----------------------------------------------------------------------
+    //--- Small draws batching
+    CKBOOL m_Batching;               // Batching enabled (see EnableBatching)
+    CKBOOL m_FlushingBatch;          // A batch is being drawn
+    CKDWORD m_BatchMaxVertexCount;   // Biggest draw that can be batched
+    VXPRIMITIVETYPE m_BatchType;     // Primitive type of the current batch (a list type)
+    CKDWORD m_BatchVertexFormat;     // Vertex format and size of the current batch
+    CKDWORD m_BatchVertexSize;       //
+    CKDWORD m_BatchVB;               // Dynamic vertex buffer the current batch is stored in
+    CKDWORD m_BatchStartVertex;      // First vertex of the current batch
+    CKDWORD m_BatchVertexCount;      // Number of vertices in the current batch (0 if no batch)
+    XArray<CKWORD> m_BatchIndices;   // Rebased indices of the current batch
+
+    //----------------------------------------------------------------------
+    //--- Scratch buffers used to split 32 bits indices draws
+    XArray<CKDWORD> m_Index32Scratch;
+    XArray<CKWORD> m_Index16Scratch;
+    XArray<CKBYTE> m_GatherScratch;
+
+    //----------------------------------------------------------------------
+    //--- Sprite atlas
+    CKBOOL m_SpriteAtlas;                    // Atlas mode enabled (see EnableSpriteAtlas)
+    int m_AtlasPageSize;                     // Size of the atlas pages
+    int m_AtlasMaxSpriteSize;                // Biggest sprite packed in a page
+    XArray<CKSpriteAtlasPage *> m_AtlasPages;
+
+    //--- Non power of 2 textures
+    XHashTable<CKDWORD, CKDWORD> m_NonPow2Savings; // Memory saved by each non power of 2 texture
+    CKDWORD m_NonPow2MemorySaved;                  // Total of m_NonPow2Savings
+
+    //--- Texture compression
+    XArray<CKBYTE> m_CompressScratch;              // Result of CompressTextureImage
+    XArray<CKDWORD> m_MipMapScratch;               // Levels of LoadTextureMipMaps
+
+    //--- Texture streaming
+    XHashTable<CKStreamedTexture, CKDWORD> m_StreamedTextures; // Streamed textures (see StreamTexture)
+    XArray<CKStreamedMipRead *> m_StreamingReads;              // Levels being read (cancelled ones included)
+    CKDWORD m_StreamingBudget;                                 // Memory allowed for the streamed textures (0 for no limit)
+    CKDWORD m_StreamingMemory;                                 // Total of the streamed textures Memory
+    int m_StreamingMaxReads;                                   // Levels read at the same time
+
+    //--- Render target pool
+    XArray<CKPooledRenderTarget> m_RenderTargets; // Targets created by AcquireRenderTarget
+
+    //--- Texture sharing
+    XHashTable<CKSharedTexture, CKImageHash, CKImageHashHash> m_SharedTextures; // Textures loaded by LoadSharedTexture, by content
+    XHashTable<CKImageHash, CKDWORD> m_TextureContents;                          // Content of each texture loaded by LoadSharedTexture
+    CKDWORD m_SharedTextureMemorySaved;                                          // Memory of the textures using another one desc
+
+    //--- Staging memory of the locked textures
+    CKRasterizerStagingArena m_StagingArena;
+
+    //--- Asynchronous loads
+    XArray<CKAsyncLoad *> m_AsyncLoads; // Loads not uploaded yet, in the order of the calls
+    CKDWORD m_LoadTicket;               // Last ticket returned
+    CKDWORD m_UploadBudget;             // Bytes uploaded per frame (0 for no limit)
+
+    //--- Sprite upload
+    XArray<CKBYTE> m_SpriteScratch;          // Padded tiles waiting for LoadTexture
+    XArray<CKSpriteRowBand> m_SpriteBands;   // Copies done by LoadSprite (in parallel for big sprites)
+
+    //----------------------------------------------------------------------
+    //--- Primitive conversion
+    XArray<CKDWORD> m_ConvertScratch;                                                            // Result of the last conversion
+    XHashTable<CKConvertedIndexBuffer, CKConvertedIBKey, CKConvertedIBKeyHash> m_ConvertedIBs;  // Converted static index buffers
 };
 
 /*******************************************************************************
@@ -547,6 +1149,8 @@ inline CKBOOL CKRasterizerContext::InternalSetRenderState(VXRENDERSTATETYPE Stat
     }
     else
     {
+        if (m_BatchVertexCount != 0)
+            FlushBatch();
         m_RenderStateCacheMiss++;
         m_StateCache[State].Value = Value;
         m_StateCache[State].Valid = TRUE;
@@ -6,6 +6,15 @@
 #define DEFAULT_VB_SIZE	 4096UL
 #define RST_MAX_LIGHT	 128
 
+#define CKRST_MAX_FRAMES_IN_FLIGHT	   3	// Maximum number of frames the lib keeps dynamic resources copies for
+#define CKRST_DEFAULT_FRAMES_IN_FLIGHT 2
+
+#define CKRST_STAGING_MINBLOCK		   4096						// Smallest block of the staging arena
+#define CKRST_STAGING_PAGEORDER		   10						// Pages of the staging arena are CKRST_STAGING_MINBLOCK << CKRST_STAGING_PAGEORDER bytes (4 MB)
+#define CKRST_STAGING_DEFAULTSIZE	   (64 * 1024 * 1024)		// Default limit of the staging arena
+
+#define CKRST_RENDERTARGET_MAXUNUSEDFRAMES 8	// Frames a free render target stays in the pool before being destroyed
+
 /****************************************************************************
 // ComputeBoxVisibility possible results
 ******************************************************************************/
@@ -201,6 +210,16 @@ typedef enum CKRST_VERTEXFORMAT
 
 } CKRST_VERTEXFORMAT;
 
+//--- Compressed attributes of a vertex buffer (CKVertexBufferDesc::m_Compression)
+// They change how the attributes of the CKRST_VERTEXFORMAT are stored, not which attributes there are
+typedef enum CKRST_VERTEXCOMPRESSION
+{
+    CKRST_VC_POSITIONQ16	= 0x0001,	// Position (and weights variants) stored as 4 signed normalized shorts (X,Y,Z,0)
+                                        // decoded with the vertex buffer position scale and bias
+    CKRST_VC_NORMALPACKED	= 0x0002,	// Normal stored as a signed normalized 10:10:10:2 CKDWORD
+    CKRST_VC_TEXHALF		= 0x0004,	// All texture coordinates stored as 16 bits floats (1-2 floats : 4 bytes, 3-4 floats : 8 bytes)
+} CKRST_VERTEXCOMPRESSION;
+
 /*********************************************
 *********************************************/
 typedef	enum CKRST_MATMASK
@@ -227,8 +246,57 @@ typedef enum CKRST_VBFLAGS
     CKRST_VB_WRITEONLY  = 0x00000004,	// Hint : Vertex buffer will only be written to (should always be there)
     CKRST_VB_DYNAMIC    = 0x00000008,	// Hint : Dynamic vertex buffer...	
     CKRST_VB_SHARED	    = 0x00000010,	// This vertex buffer is being used to hold other shared vertex buffers
+    CKRST_VB_INDEX32    = 0x00000020,	// Index buffer only : indices are 32 bits (CKDWORD) instead of 16 bits
 } CKRST_VBFLAGS;
 
+/******************************************************************
+//--- Lib specific caps, set in Vx3DCapsDesc::CKRasterizerSpecificCaps
+//--- by implementations (bits not used by CKRST_SPECIFICCAPS)
+*******************************************************************/
+#define CKRST_SPECIFICCAPS_INDEX32 0x01000000	// 32 bits indices are supported (DrawPrimitive32, DrawPrimitiveVB32 and CKRST_VB_INDEX32 index buffers)
+
+/******************************************************************
+//--- Mesh optimization steps (see CKRSTOptimizeMesh)
+*******************************************************************/
+typedef enum CKRST_MESHOPTFLAGS
+{
+    CKRST_MESHOPT_VERTEXCACHE = 0x00000001,	// Reorder triangles for the post-transform vertex cache
+    CKRST_MESHOPT_OVERDRAW	  = 0x00000002,	// Reorder clusters of triangles to reduce overdraw (needs float positions)
+    CKRST_MESHOPT_VERTEXFETCH = 0x00000004,	// Reorder vertices by first use and remap indices
+    CKRST_MESHOPT_ALL		  = 0x00000007,
+} CKRST_MESHOPTFLAGS;
+
+#define CKRST_VERTEXCACHE_SIZE 16	// Size of the FIFO vertex cache used for the ACMR statistics
+
+/******************************************************************
+//--- Pixel conversion options (see CKRSTConvertPixels)
+*******************************************************************/
+typedef enum CKRST_PIXELCONVERTFLAGS
+{
+    CKRST_PIXELCONVERT_DITHER = 0x00000001,	// Ordered dither when components lose bits
+    CKRST_PIXELCONVERT_SWAPRB = 0x00000002,	// Swap red and blue (formats of CKDriverProblems::m_TextureFormatsRGBABug)
+} CKRST_PIXELCONVERTFLAGS;
+
+/******************************************************************
+//--- DXT compression options (see CKRSTCompressDXT), can be combined
+//--- with CKRST_PIXELCONVERT_SWAPRB
+*******************************************************************/
+typedef enum CKRST_DXTCOMPRESSFLAGS
+{
+    CKRST_DXTCOMPRESS_HIGHQUALITY = 0x00000100,	// Principal axis endpoints refined by least squares (slower)
+} CKRST_DXTCOMPRESSFLAGS;
+
+/******************************************************************
+//--- Mipmap generation options (see CKRSTGenerateMipMap)
+*******************************************************************/
+typedef enum CKRST_MIPMAPFLAGS
+{
+    CKRST_MIPMAP_BOX			= 0x00000000,	// Box filter (average of the covered pixels)
+    CKRST_MIPMAP_KAISER			= 0x00000001,	// Kaiser windowed sinc filter (sharper, slower)
+    CKRST_MIPMAP_LINEARLIGHT	= 0x00000002,	// Colors are sRGB : filter them in linear light
+    CKRST_MIPMAP_ALPHACOVERAGE	= 0x00000004,	// Keep the fraction of pixels passing the alpha test (alpha tested textures)
+} CKRST_MIPMAPFLAGS;
+
 /*****************************************************************
 When locking a vertex buffer to write new data : behavior
 ******************************************************************/
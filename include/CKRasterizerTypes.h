@@ -68,6 +68,44 @@ typedef struct CKRasterizerStats
     int NbVerticesProcessed; // Number of vertices transformed during one frame
 } CKRasterizerStats;
 
+/***********************************************************
+ Lib counters, reset at each frame (see CKRasterizerContext::NextFrame)
+*********************************************************/
+typedef struct CKRasterizerFrameStats
+{
+    int DynamicVBWraps;  // Number of times a streamed dynamic vertex buffer wrapped (locked with CKRST_LOCK_DISCARD)
+    int DynamicVBStalls; // Number of wraps of a buffer already discarded during the frame (the driver may have to wait)
+    int DynamicVBCreations; // Number of dynamic vertex buffers created or recreated (to grow them)
+    int DynamicIBWraps;     // Same counters for the dynamic index buffers
+    int DynamicIBStalls;    //
+    int DynamicIBCreations; //
+    int FenceWaits;         // Number of times the CPU had to wait for a frame fence before reusing per-frame resources
+    int BatchedDraws;       // Number of DrawPrimitive calls appended to a batch
+    int BatchFlushes;       // Number of batches drawn (BatchedDraws - BatchFlushes draws were merged)
+    int StreamedLevels;     // Number of streamed texture levels loaded
+    int EvictedLevels;      // Number of streamed texture levels evicted to stay within the budget
+    int AsyncUploads;       // Number of asynchronous loads uploaded
+    int AsyncUploadBytes;   // Size of the images they uploaded
+    int RenderTargetCreations; // Number of render targets created by AcquireRenderTarget
+    int RenderTargetReuses;    // Number of render targets AcquireRenderTarget took from the pool
+    int HiZTriangles;          // Software rasterizer : triangles tested against the hierarchical Z of a tile
+    int HiZRejectedTriangles;  // Number of them entirely hidden (reject rate : HiZRejectedTriangles / HiZTriangles)
+    int HiZBlocks;             // Same counters for the 8x8 blocks of the triangles left
+    int HiZRejectedBlocks;     //
+} CKRasterizerFrameStats;
+
+/***********************************************************
+ Mesh optimization statistics (see CKRSTOptimizeMesh)
+ ACMR : average number of vertices transformed per triangle
+*********************************************************/
+typedef struct CKMeshOptimizeStats
+{
+    float ACMRBefore;    // ACMR of the original index order
+    float ACMRAfter;     // ACMR after optimization
+    int TriangleCount;   // Number of triangles
+    int UsedVertexCount; // Number of vertices referenced by the indices (they come first after a vertex fetch optimization)
+} CKMeshOptimizeStats;
+
 /***********************************************************
  Light Structure passed to CKRasterizerContext::SetLight()
 *********************************************************/
@@ -144,6 +182,84 @@ struct CKSPRTextInfo
     short int h;          //  "    "
     short int sw;         //	Real texture size
     short int sh;         //   "    "
+    short int tx;         //	Position in the texture (non zero when the sprite is packed in an atlas page)
+    short int ty;         //   "    "
+};
+
+/*************************************************************
+Rows of a sprite tile copied to its upload buffer by LoadSprite,
+rows and columns beyond the sprite image are cleared
+************************************************************/
+struct CKSpriteRowBand
+{
+    const CKBYTE *Src; // First row of the tile in the sprite image
+    CKBYTE *Dst;       // First row of the tile upload buffer
+    int SrcPitch;
+    int DstPitch;
+    int RowBytes;  // Bytes of each row coming from the image
+    int ImageRows; // Rows coming from the image
+    int FirstRow;  // Rows handled by this band
+    int RowCount;
+};
+
+/*************************************************************
+Sprite atlas page : small sprites are packed in shared textures
+(see CKRasterizerContext::EnableSpriteAtlas)
+************************************************************/
+struct CKSpriteAtlasNode
+{
+    short int x; // Skyline segment : starts at x, is w pixels wide
+    short int y; // and the used space below it goes up to y
+    short int w;
+};
+
+struct CKSpriteAtlasPage
+{
+    CKDWORD Texture;                   // Texture object of the page
+    CKDWORD Flags;                     // Texture flags and format the page was created with
+    VxImageDescEx Format;              //
+    XArray<CKSpriteAtlasNode> Skyline; // Free space of the page
+    int SpriteCount;                   // Number of sprites using the page (released when it reaches 0)
+    XArray<CKBYTE> Image;              // System memory copy of the page (32 bits ARGB) reloaded when a sprite changes
+    CKBOOL Dirty;                      // Image changed since the page texture was last loaded
+
+    CKSpriteAtlasPage() : Texture(0), Flags(0), SpriteCount(0), Dirty(FALSE) {}
+};
+
+/***********************************************************
+//---- Staging memory (see CKRasterizerStagingArena)
+************************************************************/
+struct CKStagingStats
+{
+    CKDWORD UsedMemory;        // Size of the blocks handed out (rounded to a power of 2)
+    CKDWORD ReservedMemory;    // Memory allocated from the system (pages and big blocks)
+    CKDWORD UsedHighWater;     // Maximum values reached (see ResetHighWaterMarks)
+    CKDWORD ReservedHighWater; //
+    int BlockCount;            // Blocks handed out
+    int Failures;              // Allocations refused because of the size limit
+
+    CKStagingStats() : UsedMemory(0), ReservedMemory(0), UsedHighWater(0), ReservedHighWater(0), BlockCount(0), Failures(0) {}
+};
+
+// A page of the buddy allocator : a block of order n is CKRST_STAGING_MINBLOCK << n bytes
+// and starts on a multiple of its size, State gives for each min block the order + 1 of the
+// block starting there (with CKRST_STAGING_FREE if it is free) or 0
+#define CKRST_STAGING_FREE 0x80
+
+struct CKStagingPage
+{
+    CKBYTE *Memory;
+    XArray<CKBYTE> State;
+    XArray<int> FreeBlocks[CKRST_STAGING_PAGEORDER + 1]; // Free blocks of each order (index of their first min block)
+    CKDWORD UsedMemory;
+
+    CKStagingPage() : Memory(NULL), UsedMemory(0) {}
+};
+
+struct CKStagingBlock
+{
+    CKBYTE *Memory; // Block bigger than a page
+    CKDWORD Size;
 };
 
 /*************************************************************
@@ -193,10 +309,13 @@ struct CKVertexBufferDesc : CKRasterizerObjectDesc
     CKDWORD m_MaxVertexCount; // Max number of vertices this buffer can contain
     CKDWORD m_VertexSize;     // Size in bytes taken by a vertex..
     CKDWORD m_CurrentVCount;  // For dynamic buffers, current number of vertices taken in this buffer
+    CKDWORD m_Compression;    // Compressed attributes : CKRST_VERTEXCOMPRESSION (0 for none)
+    VxVector m_PositionScale; // With CKRST_VC_POSITIONQ16 : Position = Quantized * Scale + Bias
+    VxVector m_PositionBias;  //
 
-    CKVertexBufferDesc()
+    CKVertexBufferDesc() : m_PositionScale(1.0f, 1.0f, 1.0f), m_PositionBias(0.0f, 0.0f, 0.0f)
     {
-        m_Flags = m_VertexFormat = m_MaxVertexCount = m_VertexSize = m_CurrentVCount = 0;
+        m_Flags = m_VertexFormat = m_MaxVertexCount = m_VertexSize = m_CurrentVCount = m_Compression = 0;
     }
     virtual ~CKVertexBufferDesc() {}
 
@@ -207,6 +326,9 @@ struct CKVertexBufferDesc : CKRasterizerObjectDesc
         m_MaxVertexCount = b.m_MaxVertexCount;
         m_VertexSize = b.m_VertexSize;
         m_CurrentVCount = b.m_CurrentVCount;
+        m_Compression = b.m_Compression;
+        m_PositionScale = b.m_PositionScale;
+        m_PositionBias = b.m_PositionBias;
         return *this;
     }
 };
@@ -226,6 +348,9 @@ struct CKIndexBufferDesc : CKRasterizerObjectDesc
     }
     virtual ~CKIndexBufferDesc() {}
 
+    // Size in bytes of an index of this buffer (see CKRST_VB_INDEX32)
+    CKDWORD GetIndexSize() const { return (m_Flags & CKRST_VB_INDEX32) ? sizeof(CKDWORD) : sizeof(CKWORD); }
+
     CKIndexBufferDesc &operator=(const CKIndexBufferDesc &b)
     {
         m_Flags = b.m_Flags;
@@ -235,6 +360,282 @@ struct CKIndexBufferDesc : CKRasterizerObjectDesc
     }
 };
 
+/***********************************************************
+//---- Vertex Layout :
+//---- Offsets and sizes (in bytes) of every attribute of a
+//---- vertex format (a size of 0 means the attribute is absent)
+//---- Layouts are computed once per format, see CKRSTGetVertexLayout
+************************************************************/
+struct CKVertexLayout
+{
+    CKDWORD VertexFormat;   // CKRST_VERTEXFORMAT described by this layout
+    CKDWORD Compression;    // CKRST_VERTEXCOMPRESSION of the attributes
+    CKDWORD VertexSize;     // Size in bytes taken by a vertex
+    CKDWORD PositionSize;   // 12 (X,Y,Z) or 16 (X,Y,Z,W) bytes, always at offset 0
+    CKDWORD WeightOffset;   // Blend weights (last one holds matrix indices with CKRST_VF_MATRIXPAL)
+    CKDWORD WeightCount;    //
+    CKDWORD NormalOffset;   // Normal (X,Y,Z)
+    CKDWORD NormalSize;     //
+    CKDWORD PSizeOffset;    // Point size
+    CKDWORD PSizeSize;      //
+    CKDWORD DiffuseOffset;  // Diffuse color
+    CKDWORD DiffuseSize;    //
+    CKDWORD SpecularOffset; // Specular color
+    CKDWORD SpecularSize;   //
+    CKDWORD TexCount;       // Number of texture coordinates sets
+    CKDWORD TexOffset[CKRST_MAX_STAGES];
+    CKDWORD TexSize[CKRST_MAX_STAGES];
+    void *FillKernel;       // {secret} Specialised fill function used by CKRSTLoadVertexBuffer (or NULL)
+};
+
+/***********************************************************
+//---- Dynamic buffers registry (see CKRasterizerContext::GetDynamicVertexBuffer)
+//---- A dynamic vertex buffer is identified by its vertex format, vertex size, user key
+//---- and the slot of the frame ring it is used by. Index buffers use the same key
+//---- with a null format and the index size.
+************************************************************/
+struct CKDynamicVBKey
+{
+    CKDWORD VertexFormat;
+    CKDWORD VertexSize;
+    CKDWORD AddKey;
+    CKDWORD FrameSlot;
+
+    CKDynamicVBKey() : VertexFormat(0), VertexSize(0), AddKey(0), FrameSlot(0) {}
+    CKDynamicVBKey(CKDWORD Format, CKDWORD Size, CKDWORD Key, CKDWORD Slot)
+        : VertexFormat(Format), VertexSize(Size), AddKey(Key), FrameSlot(Slot) {}
+
+    int operator==(const CKDynamicVBKey &k) const
+    {
+        return VertexFormat == k.VertexFormat && VertexSize == k.VertexSize && AddKey == k.AddKey && FrameSlot == k.FrameSlot;
+    }
+};
+
+struct CKDynamicVBKeyHash
+{
+    int operator()(const CKDynamicVBKey &k) const
+    {
+        return (int)(k.VertexFormat * 2654435761U ^ k.VertexSize * 40503U ^ k.AddKey * 2246822519U ^ k.FrameSlot * 3266489917U);
+    }
+};
+
+struct CKDynamicVertexBuffer
+{
+    CKDWORD VB;           // Vertex buffer index (obtained with CreateObjectIndex)
+    CKDWORD DiscardFrame; // Last frame the buffer was discarded when streaming (0xFFFFFFFF if never)
+    CKDWORD UseFrame;     // Last frame the buffer was locked when streaming (0xFFFFFFFF if never)
+
+    CKDynamicVertexBuffer() : VB(0), DiscardFrame(0xFFFFFFFF), UseFrame(0xFFFFFFFF) {}
+};
+
+struct CKDynamicIndexBuffer
+{
+    CKDWORD IB;           // Index buffer index (obtained with CreateObjectIndex)
+    CKDWORD DiscardFrame; // Last frame the buffer was discarded when streaming (0xFFFFFFFF if never)
+    CKDWORD UseFrame;     // Last frame the buffer was locked when streaming (0xFFFFFFFF if never)
+
+    CKDynamicIndexBuffer() : IB(0), DiscardFrame(0xFFFFFFFF), UseFrame(0xFFFFFFFF) {}
+};
+
+/***********************************************************
+//---- Index buffers converted by the lib (see CKRasterizerContext::GetConvertedIndexBuffer)
+//---- identified by the source index buffer, the conversion and the range converted
+************************************************************/
+struct CKConvertedIBKey
+{
+    CKDWORD IB;         // Source index buffer
+    CKDWORD Conversion; // Source primitive type, | 0x100 when converted to a strip
+    CKDWORD StartIndex;
+    CKDWORD IndexCount;
+
+    CKConvertedIBKey() : IB(0), Conversion(0), StartIndex(0), IndexCount(0) {}
+    CKConvertedIBKey(CKDWORD ib, CKDWORD conv, CKDWORD start, CKDWORD count) : IB(ib), Conversion(conv), StartIndex(start), IndexCount(count) {}
+
+    int operator==(const CKConvertedIBKey &k) const
+    {
+        return IB == k.IB && Conversion == k.Conversion && StartIndex == k.StartIndex && IndexCount == k.IndexCount;
+    }
+};
+
+struct CKConvertedIBKeyHash
+{
+    int operator()(const CKConvertedIBKey &k) const
+    {
+        return (int)(k.IB * 2654435761U ^ k.Conversion * 40503U ^ k.StartIndex * 2246822519U ^ k.IndexCount * 3266489917U);
+    }
+};
+
+struct CKConvertedIndexBuffer
+{
+    CKIndexBufferDesc *Source; // Description of the source buffer when converted (the conversion is redone if it changes)
+    CKDWORD IB;                // Index buffer holding the converted indices
+    VXPRIMITIVETYPE Type;      // Primitive type of the converted indices
+    int IndexCount;            // Number of converted indices
+
+    CKConvertedIndexBuffer() : Source(NULL), IB(0), Type(VX_TRIANGLELIST), IndexCount(0) {}
+};
+
+/***********************************************************
+//---- Content hash of an image (see CKRSTHashImage)
+************************************************************/
+struct CKImageHash
+{
+    CKDWORD Low;
+    CKDWORD High;
+
+    CKImageHash() : Low(0), High(0) {}
+    CKImageHash(CKDWORD low, CKDWORD high) : Low(low), High(high) {}
+
+    int operator==(const CKImageHash &k) const { return Low == k.Low && High == k.High; }
+};
+
+struct CKImageHashHash
+{
+    int operator()(const CKImageHash &k) const { return (int)(k.Low ^ k.High * 2654435761U); }
+};
+
+/***********************************************************
+//---- Textures sharing the same content (see CKRasterizerContext::LoadSharedTexture)
+************************************************************/
+struct CKSharedTexture
+{
+    CKTextureDesc *Desc; // Description used by all the textures with this content
+    int RefCount;        // Number of textures using it
+    CKDWORD Size;        // Memory of the texture (bytes)
+    VxImageDescEx Image; // Format of the image loaded (without its pixels), checked along with the hash
+
+    CKSharedTexture() : Desc(NULL), RefCount(0), Size(0) {}
+};
+
+/***********************************************************
+//---- Render target of the pool (see CKRasterizerContext::AcquireRenderTarget)
+//---- Targets are reused for the same size, format and type
+************************************************************/
+struct CKPooledRenderTarget
+{
+    CKDWORD Texture;       // Texture index
+    int Width;             //
+    int Height;            //
+    VX_PIXELFORMAT Format; //
+    CKBOOL CubeMap;        //
+    CKBOOL InUse;          // Acquired and not released yet
+    CKBOOL Transient;      // Released by NextFrame
+    CKDWORD LastUsedFrame; // Frame of the last acquisition or release
+
+    CKPooledRenderTarget() : Texture(0), Width(0), Height(0), Format(UNKNOWN_PF), CubeMap(FALSE), InUse(FALSE), Transient(FALSE), LastUsedFrame(0) {}
+};
+
+/***********************************************************
+//---- Texture streaming (see CKRasterizerContext::StreamTexture)
+//---- Levels are numbered from the finest one (0), the levels
+//---- LoadedLevel to LevelCount - 1 of a texture are loaded
+************************************************************/
+// Reads a level of a streamed texture into Desc (sized for the level, in the texture format)
+typedef CKBOOL (*CKRST_MIPREADFUNCTION)(CKDWORD Texture, int MipLevel, VxImageDescEx &Desc, void *Argument);
+
+struct CKStreamedMipRead
+{
+    CKDWORD Texture;
+    int Level;
+    CKRST_MIPREADFUNCTION Read;
+    void *Argument;
+    VxImageDescEx Desc;  // Level image, Desc.Image points into Data
+    XArray<CKBYTE> Data;
+    CKDWORD Size;        // Memory reserved for the level (bytes)
+    CKDWORD Ticket;      // Job of the thread pool
+    CKBOOL Result;       // Returned by Read
+    CKBOOL Cancelled;    // The texture is no longer streamed
+};
+
+struct CKStreamedTexture
+{
+    CKRST_MIPREADFUNCTION Read;
+    void *Argument;
+    int LevelCount;
+    int ResidentLevel;          // Finest of the levels never evicted
+    int LoadedLevel;            // Finest level loaded
+    int WantedLevel;            // Finest level needed by the requests of the frame
+    float Priority;             // Biggest screen area requested during the frame (pixels)
+    CKDWORD RequestFrame;       // Frame of the last request
+    CKDWORD Memory;             // Loaded levels and level being read (bytes)
+    CKStreamedMipRead *Pending; // Level being read (LoadedLevel - 1)
+
+    CKStreamedTexture() : Read(NULL), Argument(NULL), LevelCount(0), ResidentLevel(0), LoadedLevel(0), WantedLevel(0),
+                          Priority(0.0f), RequestFrame(0), Memory(0), Pending(NULL) {}
+};
+
+/***********************************************************
+//---- Asynchronous loads (see CKRasterizerContext::LoadTextureAsync)
+************************************************************/
+// Called by the render thread when an asynchronous load is complete
+typedef void (*CKRST_LOADCALLBACK)(CKDWORD Ticket, CKBOOL Result, void *Argument);
+
+struct CKAsyncLoad
+{
+    CKDWORD Ticket;              // Returned to the caller
+    CKDWORD Job;                 // Thread pool job converting the image
+    CKRST_OBJECTTYPE Type;       // CKRST_OBJ_TEXTURE or CKRST_OBJ_SPRITE
+    CKDWORD Object;              // Texture or sprite index
+    int MipLevel;                //
+    CKBOOL CubeMap;              // Face of a cube map
+    CKRST_CUBEFACE Face;         //
+    VxImageDescEx Src;           // Image given by the caller
+    VxImageDescEx Desc;          // Image to upload (Src or converted in Data)
+    XArray<CKBYTE> Data;         //
+    CKDWORD Size;                // Size of Desc (bytes)
+    CKRST_LOADCALLBACK Callback; //
+    void *Argument;              //
+    CKBOOL Cancelled;            // The object was deleted
+};
+
+/***********************************************************
+//---- Per-frame copies of a procedural texture (see CKRasterizerContext::LoadFrameTexture)
+//---- Copies[0] is the texture itself, the other copies are created on demand
+************************************************************/
+struct CKFrameTexture
+{
+    CKDWORD Copies[CKRST_MAX_FRAMES_IN_FLIGHT]; // Texture index used for each slot of the frame ring
+    CKDWORD Latest;                             // Slot of the last loaded copy (the one to render with)
+
+    CKFrameTexture() : Latest(0)
+    {
+        for (int i = 0; i < CKRST_MAX_FRAMES_IN_FLIGHT; ++i)
+            Copies[i] = 0;
+    }
+};
+
+/***********************************************************
+//---- Decoded DXT block (see CKDXTTileCache)
+************************************************************/
+struct CKDXTTileKey
+{
+    const CKBYTE *Image; // Compressed image
+    int Block;           // Index of the block in the image
+
+    CKDXTTileKey() : Image(NULL), Block(0) {}
+    CKDXTTileKey(const CKBYTE *image, int block) : Image(image), Block(block) {}
+
+    int operator==(const CKDXTTileKey &k) const { return Image == k.Image && Block == k.Block; }
+};
+
+struct CKDXTTileKeyHash
+{
+    int operator()(const CKDXTTileKey &k) const
+    {
+        return (int)((CKDWORD)(size_t)k.Image * 2654435761U ^ (CKDWORD)k.Block * 2246822519U);
+    }
+};
+
+struct CKDXTTile
+{
+    CKDXTTileKey Key;
+    CKDWORD Pixels[16]; // Decoded ARGB8888 pixels, row by row
+    int Prev;           // Neighbours in the LRU list (-1 at the ends)
+    int Next;
+
+    CKDXTTile() : Prev(-1), Next(-1) {}
+};
+
 //--- Default format of a prelit vertex (Position,Colors,and texture coordinates)
 struct CKVertex
 {
@@ -0,0 +1,285 @@
+/**
+ * @file CKSoftRasterizer.h
+ * @brief Software implementation of the rasterizer classes.
+ *
+ * The software driver renders into system memory, without a window or a graphic card : the images are read back
+ * with CKRasterizerContext::CopyToMemoryBuffer. It is enumerated by CKRasterizer::Start after the NULL driver.
+ *
+ * Triangles are transformed, lit and clipped when they are drawn, then binned into screen tiles of
+ * CKRST_SOFT_TILESIZE pixels. The tiles are rasterized in parallel by the rasterizer thread pool (half-space
+ * edge functions evaluated on 4 pixels at a time) when the frame ends, when the render target, a texture or the
+ * buffers are changed, or when CKRST_SOFT_MAXTRIANGLES triangles are waiting.
+ *
+ * Supported : triangle lists, strips and fans, per-vertex lighting (diffuse and ambient of point, spot and
+ * directional lights), Gouraud and flat shading, depth test and write, culling, alpha test, alpha blending and
+ * one texture stage (modulated with the diffuse color, nearest or bilinear filtering, wrap or clamp addressing).
+ * The depth buffer is doubled by the min and max depth of each CKRST_SOFT_HIZBLOCKSIZE block (hierarchical Z) :
+ * with the depth test enabled, the triangles and blocks which can not pass it are skipped before being shaded.
+ * Lines, points, fog, specular, stencil, mipmaps, cube maps and shaders are not.
+ */
+#ifndef CKSOFTRASTERIZER_H
+#define CKSOFTRASTERIZER_H
+
+#include "CKRasterizer.h"
+
+#define CKRST_SOFT_TILESIZE		 64		// Size of the screen tiles rasterized in parallel (pixels, multiple of 4)
+#define CKRST_SOFT_MAXTRIANGLES	 65536	// Triangles binned before the tiles are rasterized
+#define CKRST_SOFT_SUBPIXELS	 16		// Vertex positions are snapped to 1/16 pixel
+#define CKRST_SOFT_HIZBLOCKSIZE	 8		// Size of the hierarchical Z blocks (pixels, divides CKRST_SOFT_TILESIZE)
+
+/****************************************************************
+Software rasterizer draw state flags (see CKSoftDrawState)
+*****************************************************************/
+typedef enum CKRST_SOFTSTATEFLAGS
+{
+    CKRST_SOFT_ZTEST	 = 0x00000001,	// Depth test (ZFunc)
+    CKRST_SOFT_ZWRITE	 = 0x00000002,	// Depth write
+    CKRST_SOFT_BLEND	 = 0x00000004,	// Alpha blending (SrcBlend, DestBlend)
+    CKRST_SOFT_ALPHATEST = 0x00000008,	// Alpha test (AlphaFunc, AlphaRef)
+    CKRST_SOFT_TEXTURE	 = 0x00000010,	// Texture modulated with the diffuse color
+    CKRST_SOFT_BILINEAR	 = 0x00000020,	// Bilinear filtering (nearest otherwise)
+    CKRST_SOFT_CLAMPU	 = 0x00000040,	// Clamped texture coordinates (wrapped otherwise)
+    CKRST_SOFT_CLAMPV	 = 0x00000080	//
+} CKRST_SOFTSTATEFLAGS;
+
+/***********************************************************
+//---- Objects of the software rasterizer : the memory is kept with the desc
+//---- Textures are stored as 32 bits ARGB (level 0 only)
+************************************************************/
+struct CKSoftTextureDesc : public CKTextureDesc
+{
+    XArray<CKDWORD> Pixels;
+};
+
+struct CKSoftVertexBufferDesc : public CKVertexBufferDesc
+{
+    XArray<CKBYTE> Memory;
+};
+
+struct CKSoftIndexBufferDesc : public CKIndexBufferDesc
+{
+    XArray<CKBYTE> Memory;
+};
+
+/***********************************************************
+//---- Vertex after transform and lighting (clip space position)
+************************************************************/
+struct CKSoftVertex
+{
+    float X, Y, Z, W;
+    float R, G, B, A;
+    float U, V;
+};
+
+/***********************************************************
+//---- Render states used by a set of binned triangles
+************************************************************/
+struct CKSoftDrawState
+{
+    CKDWORD Flags;          // CKRST_SOFTSTATEFLAGS
+    VXCMPFUNC ZFunc;        //
+    VXCMPFUNC AlphaFunc;    //
+    CKDWORD AlphaRef;       // 0..255
+    VXBLEND_MODE SrcBlend;  //
+    VXBLEND_MODE DestBlend; //
+    const CKDWORD *Texels;  // Texture (CKRST_SOFT_TEXTURE)
+    int TexWidth;           //
+    int TexHeight;          //
+};
+
+/***********************************************************
+//---- Binned triangle
+//---- Edge i is inside where EdgeA[i] * (x - EdgeX[i]) + EdgeB[i] * (y - EdgeY[i]) > 0 (>= 0 for
+//---- the top-left edges), the edges shared by two triangles use the same origin so they cover each
+//---- pixel once. The attributes are interpolated as Value + Dx * (x - X0) + Dy * (y - Y0) : depth,
+//---- 1/w and then the color and texture coordinates divided by w.
+************************************************************/
+#define CKRST_SOFT_PLANECOUNT 8
+
+struct CKSoftTriangle
+{
+    float EdgeA[3];
+    float EdgeB[3];
+    float EdgeX[3];
+    float EdgeY[3];
+    CKDWORD TopLeft; // Bit i set if edge i is a top or left edge
+    float X0, Y0;
+    float Planes[CKRST_SOFT_PLANECOUNT][3]; // Value, Dx, Dy
+    float MinZ, MaxZ; // Depth range of the vertices
+    int MinX, MinY;  // Covered pixels (MaxX and MaxY excluded)
+    int MaxX, MaxY;  //
+    int State;       // Index of the CKSoftDrawState
+};
+
+/***********************************************************
+//---- Depth range of a block of the depth buffer (hierarchical Z)
+//---- Every depth of the block is within [MinZ, MaxZ]
+************************************************************/
+struct CKSoftHiZBlock
+{
+    float MinZ;
+    float MaxZ;
+};
+
+/***********************************************************
+//---- Depth buffer of a render target with its hierarchical Z
+//---- blocks. It keeps its content when the context switches
+//---- to another render target and back
+************************************************************/
+struct CKSoftDepthBuffer
+{
+    XArray<float> Depth;
+    int Pitch;                  // Multiple of 4 pixels
+    int Width;                  //
+    int Height;                 //
+    XArray<CKSoftHiZBlock> HiZ; // Depth range of each CKRST_SOFT_HIZBLOCKSIZE block
+    int BlocksX;                //
+    int BlocksY;                //
+
+    CKSoftDepthBuffer() : Pitch(0), Width(0), Height(0), BlocksX(0), BlocksY(0) {}
+};
+
+/***********************************************************
+//---- Hierarchical Z counters of a tile, added to the frame stats
+//---- once the tiles are rasterized
+************************************************************/
+struct CKSoftTileStats
+{
+    int Triangles;
+    int RejectedTriangles;
+    int Blocks;
+    int RejectedBlocks;
+};
+
+/// Software driver
+class CKSoftRasterizerDriver : public CKRasterizerDriver
+{
+public:
+    CKSoftRasterizerDriver();
+
+    virtual ~CKSoftRasterizerDriver();
+
+    //--- Contexts creation
+    virtual CKRasterizerContext *CreateContext();
+
+public:
+    void InitSoftRasterizerCaps(CKRasterizer *Owner);
+};
+
+/// Software render context
+class CKSoftRasterizerContext : public CKRasterizerContext
+{
+public:
+    CKSoftRasterizerContext();
+
+    virtual ~CKSoftRasterizerContext();
+
+    //--- Creation
+    virtual CKBOOL Create(WIN_HANDLE Window, int PosX = 0, int PosY = 0, int Width = 0, int Height = 0, int Bpp = -1,
+                          CKBOOL Fullscreen = FALSE, int RefreshRate = 0, int Zbpp = -1, int StencilBpp = -1);
+
+    //---
+    virtual CKBOOL Resize(int PosX = 0, int PosY = 0, int Width = 0, int Height = 0, CKDWORD Flags = 0);
+    virtual CKBOOL Clear(CKDWORD Flags = CKRST_CTXCLEAR_ALL, CKDWORD Ccol = 0, float Z = 1.0f, CKDWORD Stencil = 0, int RectCount = 0,
+                         CKRECT *rects = NULL);
+    virtual CKBOOL BackToFront(CKBOOL vsync);
+
+    //--- Scene
+    virtual CKBOOL BeginScene();
+    virtual CKBOOL EndScene();
+
+    //--- Lighting & Material States
+    virtual CKBOOL EnableLight(CKDWORD LightIndex, CKBOOL Enable);
+
+    //--- Rendering states
+    virtual CKBOOL SetRenderState(VXRENDERSTATETYPE State, CKDWORD Value);
+
+    //--- Texture States
+    virtual CKBOOL SetTexture(CKDWORD Texture, int Stage = 0);
+    virtual CKBOOL SetTextureStageState(int Stage, CKRST_TEXTURESTAGESTATETYPE Tss, CKDWORD Value);
+
+    //--- Primitive Drawing
+    virtual CKBOOL DrawPrimitive(VXPRIMITIVETYPE pType, CKWORD *indices, int indexcount, VxDrawPrimitiveData *data);
+    virtual CKBOOL DrawPrimitiveVB(VXPRIMITIVETYPE pType, CKDWORD VertexBuffer, CKDWORD StartIndex, CKDWORD VertexCount,
+                                   CKWORD *indices = NULL, int indexcount = NULL);
+    virtual CKBOOL DrawPrimitiveVBIB(VXPRIMITIVETYPE pType, CKDWORD VB, CKDWORD IB, CKDWORD MinVIndex, CKDWORD VertexCount,
+                                     CKDWORD StartIndex, int Indexcount);
+    virtual CKBOOL DrawPrimitive32(VXPRIMITIVETYPE pType, CKDWORD *indices, int indexcount, VxDrawPrimitiveData *data);
+    virtual CKBOOL DrawPrimitiveVB32(VXPRIMITIVETYPE pType, CKDWORD VertexBuffer, CKDWORD StartIndex, CKDWORD VertexCount,
+                                     CKDWORD *indices, int indexcount);
+
+    //--- Objects
+    virtual CKBOOL CreateObject(CKDWORD ObjIndex, CKRST_OBJECTTYPE Type, void *DesiredFormat);
+    virtual CKBOOL DeleteObject(CKDWORD ObjIndex, CKRST_OBJECTTYPE Type);
+    virtual CKBOOL FlushObjects(CKDWORD TypeMask);
+
+    //--- Textures
+    virtual CKBOOL LoadTexture(CKDWORD Texture, const VxImageDescEx &SurfDesc, int miplevel = -1);
+    virtual CKBOOL SetTargetTexture(CKDWORD TextureObject, int Width = 0, int Height = 0, CKRST_CUBEFACE Face = CKRST_CUBEFACE_XPOS);
+
+    //--- Vertex & Index Buffers
+    virtual void *LockVertexBuffer(CKDWORD VB, CKDWORD StartVertex, CKDWORD VertexCount, CKRST_LOCKFLAGS Lock = CKRST_LOCK_DEFAULT);
+    virtual CKBOOL UnlockVertexBuffer(CKDWORD VB);
+    virtual void *LockIndexBuffer(CKDWORD IB, CKDWORD StartIndex, CKDWORD IndexCount, CKRST_LOCKFLAGS Lock = CKRST_LOCK_DEFAULT);
+    virtual CKBOOL UnlockIndexBuffer(CKDWORD IB);
+
+    //--- Read back of the color buffer (VXBUFFER_BACKBUFFER only)
+    virtual int CopyToMemoryBuffer(CKRECT *rect, VXBUFFER_TYPE buffer, VxImageDescEx &img_desc);
+
+    //--- Rasterizes the binned triangles
+    void FlushTiles();
+
+protected:
+    CKBOOL CreateBuffers(int Width, int Height);
+    void UseTarget(CKDWORD *Color, int Pitch, int Width, int Height, CKSoftDepthBuffer &Depth);
+    CKBOOL ProcessVertices(VxDrawPrimitiveData *data);
+    void LightVertices(VxDrawPrimitiveData *data);
+    template <class T>
+    void DrawTriangles(VXPRIMITIVETYPE pType, const T *Indices, int IndexCount, int BaseIndex);
+    void DrawTriangle(const CKSoftVertex *v0, const CKSoftVertex *v1, const CKSoftVertex *v2);
+    void SetupTriangle(const CKSoftVertex *v0, const CKSoftVertex *v1, const CKSoftVertex *v2);
+    CKBOOL ProcessVertexBuffer(CKDWORD VB, CKDWORD StartVertex, CKDWORD VertexCount);
+    int GetDrawState();
+    void RasterizeTile(int Tile);
+    void UpdateHiZ(int X0, int Y0, int X1, int Y1);
+    static void RasterizeTileJob(void *Data, int Tile);
+
+public:
+    //--- Render target
+    XArray<CKDWORD> m_BackBuffer; // Color buffer of the context
+    CKDWORD *m_ColorBuffer;       // Current render target (back buffer or texture)
+    int m_ColorPitch;             // Pixels
+    int m_TargetWidth;            //
+    int m_TargetHeight;           //
+    CKDWORD m_TargetTexture;      // Texture rendered to (0 for the back buffer)
+    CKSoftDepthBuffer m_BackDepth;    // Depth of the back buffer
+    CKSoftDepthBuffer m_TextureDepth; // Depth of the texture targets, cleared when the target size changes
+    float *m_DepthBuffer;             // Depth of the current render target (m_BackDepth or m_TextureDepth)
+    int m_DepthPitch;                 //
+    CKSoftHiZBlock *m_HiZ;            //
+    int m_HiZBlocksX;                 //
+    int m_HiZBlocksY;                 //
+
+    //--- States
+    CKDWORD m_CurrentTexture;
+    CKDWORD m_TextureFlags;        // CKRST_SOFT_CLAMPU and CKRST_SOFT_CLAMPV
+    CKDWORD m_MinFilter;           // Bilinear filtering unless both filters are VXTEXTUREFILTER_NEAREST
+    CKDWORD m_MagFilter;           //
+    CKBYTE m_LightEnabled[RST_MAX_LIGHT];
+    CKBOOL m_DrawStateUptodate;    // Is the last m_DrawStates entry the current state ?
+
+    //--- Vertices of the draw in progress
+    XArray<CKSoftVertex> m_Vertices;
+    XArray<CKBYTE> m_DecodedVertices; // Vertex buffers with compressed attributes
+
+    //--- Binned triangles
+    XArray<CKSoftTriangle> m_Triangles;
+    XArray<CKSoftDrawState> m_DrawStates;
+    XArray<int> m_TileStart;     // First entry of each tile in m_TileTriangles (tile count + 1 entries)
+    XArray<int> m_TileTriangles; // Triangles of each tile, in drawing order
+    XArray<CKSoftTileStats> m_TileStats;
+    int m_TilesX;
+    int m_TilesY;
+};
+
+#endif // CKSOFTRASTERIZER_H
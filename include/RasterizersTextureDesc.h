@@ -143,11 +143,18 @@ typedef struct CKGLTexParameter
 // Video memory of a texture can not be locked directly
 // instead we can copy it to a system memory surface
 // and return the pointer to the user...
+// The copy is either kept in ImageMemory or borrowed
+// from the context staging arena in StagingMemory
+// (CKRasterizerContext::AllocateStaging), which must be
+// given back with FreeStaging when the texture is unlocked.
+// The staging arena is only used from the render thread
 typedef struct CKGLTexLockData
 {
     VxImageDescEx Image;
     VxMemoryPool ImageMemory;
     CKDWORD LockFlags;
+    void *StagingMemory;
+    CKGLTexLockData() : LockFlags(0), StagingMemory(NULL) {}
 } CKGLTexLockData;
 
 /*******************************************
@@ -1,4 +1,7 @@
 #include "CKRasterizer.h"
+#include "CKRasterizerSIMD.h"
+#include "CKRasterizerThreads.h"
+#include "CKSoftRasterizer.h"
 
 #ifdef CKNULLRASTERIZER_DLL
 
@@ -86,6 +89,8 @@ CKRasterizer::~CKRasterizer()
 {
     m_FullscreenContext = NULL;
 
+    m_ThreadPool.Stop();
+
     // Clean up drivers
     for (int i = 0; i < m_Drivers.Size(); ++i)
     {
@@ -105,6 +110,10 @@ CKBOOL CKRasterizer::Start(WIN_HANDLE AppWnd)
     CKRasterizerDriver *driver = new CKRasterizerDriver;
     driver->InitNULLRasterizerCaps(this);
     m_Drivers.PushBack(driver);
+
+    CKSoftRasterizerDriver *softDriver = new CKSoftRasterizerDriver;
+    softDriver->InitSoftRasterizerCaps(this);
+    m_Drivers.PushBack(softDriver);
     return TRUE;
 }
 
@@ -184,6 +193,13 @@ XBYTE *CKRasterizer::AllocateObjects(int size)
     return (XBYTE *)m_Objects.Buffer();
 }
 
+CKRasterizerThreadPool *CKRasterizer::GetThreadPool()
+{
+    // Does nothing once started
+    m_ThreadPool.Start();
+    return &m_ThreadPool;
+}
+
 void CKRasterizer::LinkRasterizer(CKRasterizer *rst)
 {
     if (rst != this)
@@ -410,6 +426,268 @@ void ConvertAttenuationModelFromDX5(float &_a0, float &_a1, float &_a2, float ra
     _a2 = _a0 * _a2 * _a0 / (range * range) + _a1 * _a1 / _a0;
 }
 
+/*******************************************************************
+ Vertex buffer fill kernels
+ Each kernel interleaves all the attributes of a vertex in a single
+ pass over the source streams (instead of one VxCopyStructure call
+ per attribute). Attribute offsets are resolved at compile time.
+*******************************************************************/
+typedef CKBYTE *(*CKRST_LOADVBFCT)(CKBYTE *VBMem, CKDWORD VSize, VxDrawPrimitiveData *data);
+
+template <int PosSize, int Normal, int Diffuse, int Specular, int TexCount>
+struct CKVertexFillKernel
+{
+    enum
+    {
+        NormalOffset = PosSize,
+        DiffuseOffset = NormalOffset + Normal * sizeof(VxVector),
+        SpecularOffset = DiffuseOffset + Diffuse * sizeof(CKDWORD),
+        TexOffset = SpecularOffset + Specular * sizeof(CKDWORD)
+    };
+
+    static CKBOOL CanLoad(VxDrawPrimitiveData *data)
+    {
+        if (!data->PositionPtr)
+            return FALSE;
+        if (Normal && !data->NormalPtr)
+            return FALSE;
+        if (Diffuse && !data->ColorPtr)
+            return FALSE;
+        if (Specular && !data->SpecularColorPtr)
+            return FALSE;
+        if (TexCount > 0 && !data->TexCoordPtr)
+            return FALSE;
+        if (TexCount > 1 && !data->TexCoordPtrs[0])
+            return FALSE;
+        return TRUE;
+    }
+
+    static CKBYTE *Load(CKBYTE *VBMem, CKDWORD VSize, VxDrawPrimitiveData *data)
+    {
+        const CKBYTE *pos = (const CKBYTE *)data->PositionPtr;
+        const CKBYTE *nrm = (const CKBYTE *)data->NormalPtr;
+        const CKBYTE *col = (const CKBYTE *)data->ColorPtr;
+        const CKBYTE *spe = (const CKBYTE *)data->SpecularColorPtr;
+        const CKBYTE *uv0 = (const CKBYTE *)data->TexCoordPtr;
+        const CKBYTE *uv1 = (const CKBYTE *)data->TexCoordPtrs[0];
+        const CKDWORD posStride = data->PositionStride;
+        const CKDWORD nrmStride = data->NormalStride;
+        const CKDWORD colStride = data->ColorStride;
+        const CKDWORD speStride = data->SpecularColorStride;
+        const CKDWORD uv0Stride = data->TexCoordStride;
+        const CKDWORD uv1Stride = data->TexCoordStrides[0];
+
+        CKBYTE *dst = VBMem;
+        for (int v = 0; v < data->VertexCount; ++v)
+        {
+            if (PosSize == sizeof(VxVector4))
+                CKRSTCopy16(dst, pos);
+            else
+                CKRSTCopy12(dst, pos);
+            pos += posStride;
+
+            if (Normal)
+            {
+                CKRSTCopy12(dst + NormalOffset, nrm);
+                nrm += nrmStride;
+            }
+            if (Diffuse)
+            {
+                CKRSTCopy4(dst + DiffuseOffset, col);
+                col += colStride;
+            }
+            if (Specular)
+            {
+                CKRSTCopy4(dst + SpecularOffset, spe);
+                spe += speStride;
+            }
+            if (TexCount > 0)
+            {
+                CKRSTCopy8(dst + TexOffset, uv0);
+                uv0 += uv0Stride;
+            }
+            if (TexCount > 1)
+            {
+                CKRSTCopy8(dst + TexOffset + 2 * sizeof(float), uv1);
+                uv1 += uv1Stride;
+            }
+            dst += VSize;
+        }
+        return dst;
+    }
+};
+
+struct CKVertexFillKernelDesc
+{
+    CKDWORD VertexFormat;
+    CKBOOL (*CanLoad)(VxDrawPrimitiveData *data);
+    CKRST_LOADVBFCT Load;
+};
+
+#define CKRST_FILLKERNEL(Format, PosSize, Normal, Diffuse, Specular, TexCount)              \
+    {Format, &CKVertexFillKernel<PosSize, Normal, Diffuse, Specular, TexCount>::CanLoad, \
+     &CKVertexFillKernel<PosSize, Normal, Diffuse, Specular, TexCount>::Load}
+
+static const CKVertexFillKernelDesc g_VertexFillKernels[] = {
+    CKRST_FILLKERNEL(CKRST_VF_TLVERTEX, sizeof(VxVector4), 0, 1, 1, 1),
+    CKRST_FILLKERNEL(CKRST_VF_RASTERPOS | CKRST_VF_DIFFUSE | CKRST_VF_SPECULAR | CKRST_VF_TEX2, sizeof(VxVector4), 0, 1, 1, 2),
+    CKRST_FILLKERNEL(CKRST_VF_RASTERPOS | CKRST_VF_DIFFUSE | CKRST_VF_TEX1, sizeof(VxVector4), 0, 1, 0, 1),
+    CKRST_FILLKERNEL(CKRST_VF_LVERTEX, sizeof(VxVector), 0, 1, 1, 1),
+    CKRST_FILLKERNEL(CKRST_VF_POSITION | CKRST_VF_DIFFUSE | CKRST_VF_SPECULAR | CKRST_VF_TEX2, sizeof(VxVector), 0, 1, 1, 2),
+    CKRST_FILLKERNEL(CKRST_VF_POSITION | CKRST_VF_DIFFUSE | CKRST_VF_TEX1, sizeof(VxVector), 0, 1, 0, 1),
+    CKRST_FILLKERNEL(CKRST_VF_VERTEX, sizeof(VxVector), 1, 0, 0, 1),
+    CKRST_FILLKERNEL(CKRST_VF_POSITION | CKRST_VF_NORMAL | CKRST_VF_TEX2, sizeof(VxVector), 1, 0, 0, 2),
+    CKRST_FILLKERNEL(CKRST_VF_POSITION | CKRST_VF_NORMAL, sizeof(VxVector), 1, 0, 0, 0),
+    CKRST_FILLKERNEL(CKRST_VF_POSITION | CKRST_VF_TEX1, sizeof(VxVector), 0, 0, 0, 1),
+};
+
+#undef CKRST_FILLKERNEL
+
+static const CKVertexFillKernelDesc *CKRSTFindFillKernel(CKDWORD VFormat)
+{
+    const int count = sizeof(g_VertexFillKernels) / sizeof(g_VertexFillKernels[0]);
+    for (int i = 0; i < count; ++i)
+        if (g_VertexFillKernels[i].VertexFormat == VFormat)
+            return &g_VertexFillKernels[i];
+    return NULL;
+}
+
+/*******************************************************************
+ Vertex layouts
+ A layout is computed once per vertex format and kept in a small
+ open-addressing table, so the helpers below only do a lookup.
+ The lookups may come from the thread pool jobs : the table is only
+ read and filled under g_VertexLayoutLock, and an entry is never
+ moved or overwritten once filled so the returned pointers stay valid.
+ Formats which do not fit in the table get a layout of their own.
+*******************************************************************/
+#define CKRST_LAYOUTCACHE_SIZE 256
+
+static CKVertexLayout g_VertexLayouts[CKRST_LAYOUTCACHE_SIZE];
+static XArray<CKVertexLayout *> g_VertexLayoutOverflow;
+static CKVertexLayout g_NullVertexLayout;
+static CKBOOL g_NullVertexLayoutReady = FALSE;
+static CKRSTMutex g_VertexLayoutLock;
+
+static void CKRSTBuildVertexLayout(CKDWORD VertexFormat, CKDWORD Compression, CKVertexLayout &layout)
+{
+    memset(&layout, 0, sizeof(layout));
+
+    CKDWORD offset;
+    switch (VertexFormat & CKRST_VF_POSITIONMASK)
+    {
+    case CKRST_VF_RASTERPOS:
+        layout.PositionSize = sizeof(VxVector4);
+        break;
+    case CKRST_VF_POSITION:
+        layout.PositionSize = (VertexFormat & (CKRST_VF_POSITIONW & ~CKRST_VF_POSITION)) ? sizeof(VxVector4) : sizeof(VxVector);
+        break;
+    default:
+        // Position + weights, or an unknown value (handled as a simple position to avoid crashes)
+        layout.PositionSize = sizeof(VxVector);
+        layout.WeightCount = CKRST_VF_GETWCOUNT(VertexFormat);
+        break;
+    }
+    // Quantized positions : 4 shorts (transformed positions are never quantized)
+    if ((Compression & CKRST_VC_POSITIONQ16) && layout.PositionSize == sizeof(VxVector))
+        layout.PositionSize = 4 * sizeof(short);
+    offset = layout.PositionSize;
+
+    layout.WeightOffset = offset;
+    offset += layout.WeightCount * sizeof(float);
+
+    if (VertexFormat & CKRST_VF_NORMAL)
+    {
+        layout.NormalOffset = offset;
+        layout.NormalSize = (Compression & CKRST_VC_NORMALPACKED) ? sizeof(CKDWORD) : sizeof(VxVector);
+        offset += layout.NormalSize;
+    }
+
+    if (VertexFormat & CKRST_VF_PSIZE)
+    {
+        layout.PSizeOffset = offset;
+        layout.PSizeSize = sizeof(float);
+        offset += layout.PSizeSize;
+    }
+
+    if (VertexFormat & CKRST_VF_DIFFUSE)
+    {
+        layout.DiffuseOffset = offset;
+        layout.DiffuseSize = sizeof(CKDWORD);
+        offset += layout.DiffuseSize;
+    }
+
+    if (VertexFormat & CKRST_VF_SPECULAR)
+    {
+        layout.SpecularOffset = offset;
+        layout.SpecularSize = sizeof(CKDWORD);
+        offset += layout.SpecularSize;
+    }
+
+    // Tex coords size is given by 2 bits per stage (CKRST_VF_TEXSIZE_Fn)
+    static const CKDWORD texSize[4] = {2 * sizeof(float), 3 * sizeof(float), 4 * sizeof(float), sizeof(float)};
+    layout.TexCount = CKRST_VF_GETTEXCOUNT(VertexFormat);
+    if (layout.TexCount > CKRST_MAX_STAGES)
+        layout.TexCount = CKRST_MAX_STAGES;
+    for (CKDWORD i = 0; i < layout.TexCount; ++i)
+    {
+        layout.TexOffset[i] = offset;
+        layout.TexSize[i] = texSize[(VertexFormat >> (i * 2 + 16)) & 3];
+        // Half floats are padded to 2 or 4 components
+        if (Compression & CKRST_VC_TEXHALF)
+            layout.TexSize[i] = (layout.TexSize[i] <= 2 * sizeof(float)) ? 2 * sizeof(CKWORD) : 4 * sizeof(CKWORD);
+        offset += layout.TexSize[i];
+    }
+
+    layout.VertexSize = offset;
+
+    const CKVertexFillKernelDesc *kernel = NULL;
+    if (!Compression)
+        kernel = CKRSTFindFillKernel(VertexFormat);
+    layout.FillKernel = (void *)kernel;
+
+    layout.VertexFormat = VertexFormat;
+    layout.Compression = Compression;
+}
+
+const CKVertexLayout *CKRSTGetVertexLayout(CKDWORD VertexFormat, CKDWORD Compression)
+{
+    CKRSTScopedLock lock(g_VertexLayoutLock);
+
+    // Format 0 is used to mark free slots
+    if (VertexFormat == 0)
+    {
+        if (!g_NullVertexLayoutReady)
+        {
+            CKRSTBuildVertexLayout(0, 0, g_NullVertexLayout);
+            g_NullVertexLayoutReady = TRUE;
+        }
+        return &g_NullVertexLayout;
+    }
+
+    CKDWORD slot = ((VertexFormat ^ (Compression << 24)) * 2654435761U) >> 24;
+    for (int probe = 0; probe < CKRST_LAYOUTCACHE_SIZE; ++probe)
+    {
+        CKVertexLayout &layout = g_VertexLayouts[(slot + probe) & (CKRST_LAYOUTCACHE_SIZE - 1)];
+        if (layout.VertexFormat == VertexFormat && layout.Compression == Compression)
+            return &layout;
+        if (layout.VertexFormat == 0)
+        {
+            CKRSTBuildVertexLayout(VertexFormat, Compression, layout);
+            return &layout;
+        }
+    }
+
+    // Table is full
+    for (int i = 0; i < g_VertexLayoutOverflow.Size(); ++i)
+        if (g_VertexLayoutOverflow[i]->VertexFormat == VertexFormat && g_VertexLayoutOverflow[i]->Compression == Compression)
+            return g_VertexLayoutOverflow[i];
+    CKVertexLayout *layout = new CKVertexLayout;
+    CKRSTBuildVertexLayout(VertexFormat, Compression, *layout);
+    g_VertexLayoutOverflow.PushBack(layout);
+    return layout;
+}
+
 CKDWORD CKRSTGetVertexFormat(CKRST_DPFLAGS DpFlags, CKDWORD &VertexSize)
 {
     CKDWORD count = 0;
@@ -420,109 +698,36 @@ CKDWORD CKRSTGetVertexFormat(CKRST_DPFLAGS DpFlags, CKDWORD &VertexSize)
     if (DpFlags & CKRST_DP_TRANSFORM)
     {
         format = CKRST_VF_POSITION;
-        VertexSize = sizeof(VxVector);
-
         if (DpFlags & CKRST_DP_LIGHT)
         {
             format |= CKRST_VF_NORMAL;
-            VertexSize += sizeof(VxVector);
         }
         else
         {
             if (DpFlags & CKRST_DP_DIFFUSE)
-            {
                 format |= CKRST_VF_DIFFUSE;
-                VertexSize += sizeof(CKDWORD);
-            }
-
             if (DpFlags & CKRST_DP_SPECULAR)
-            {
                 format |= CKRST_VF_SPECULAR;
-                VertexSize += sizeof(CKDWORD);
-            }
         }
     }
     else
     {
         format = CKRST_VF_RASTERPOS;
-        VertexSize = sizeof(VxVector4);
-
         if (DpFlags & CKRST_DP_DIFFUSE)
-        {
             format |= CKRST_VF_DIFFUSE;
-            VertexSize += sizeof(CKDWORD);
-        }
-
         if (DpFlags & CKRST_DP_SPECULAR)
-        {
             format |= CKRST_VF_SPECULAR;
-            VertexSize += sizeof(CKDWORD);
-        }
     }
 
     format |= CKRST_VF_TEXCOUNT(count);
-    VertexSize += count * 2 * sizeof(float);
+    VertexSize = CKRSTGetVertexLayout(format)->VertexSize;
 
     return format;
 }
 
-CKDWORD CKRSTGetVertexSize(CKDWORD VertexFormat)
+CKDWORD CKRSTGetVertexSize(CKDWORD VertexFormat, CKDWORD Compression)
 {
-    CKDWORD vertexSize;
-    switch (VertexFormat & 0xF)
-    {
-    case CKRST_VF_POSITION:
-        vertexSize = 12;
-        break;
-    case CKRST_VF_RASTERPOS:
-    case CKRST_VF_POSITION1W:
-        vertexSize = 16;
-        break;
-    case CKRST_VF_POSITION2W:
-        vertexSize = 20;
-        break;
-    case CKRST_VF_POSITION3W:
-        vertexSize = 24;
-        break;
-    case CKRST_VF_POSITION4W:
-        vertexSize = 28;
-        break;
-    case CKRST_VF_POSITION5W:
-        vertexSize = 32;
-        break;
-    default:
-        // Default to the simplest vertex size to avoid crashes
-        vertexSize = 12; // Size of basic position vector
-        break;
-    }
-
-    if ((VertexFormat & CKRST_VF_NORMAL) != 0)
-        vertexSize += 12;
-    if ((VertexFormat & CKRST_VF_DIFFUSE) != 0)
-        vertexSize += 4;
-    if ((VertexFormat & CKRST_VF_PSIZE) != 0)
-        vertexSize += 4;
-    if ((VertexFormat & CKRST_VF_SPECULAR) != 0)
-        vertexSize += 4;
-
-    CKWORD tex = VertexFormat >> 16;
-    if (tex == 0)
-    {
-        vertexSize += 8 * ((VertexFormat & CKRST_VF_TEXMASK) >> 8);
-        return vertexSize;
-    }
-
-    if ((VertexFormat & CKRST_VF_TEXMASK) != 0)
-    {
-        CKDWORD texSize[4] = {8, 12, 16, 4};
-        for (int i = 0; i < CKRST_MAX_STAGES - 1; ++i)
-        {
-            vertexSize += texSize[tex & 3];
-            tex >>= 2;
-        }
-    }
-
-    return vertexSize;
+    return CKRSTGetVertexLayout(VertexFormat, Compression)->VertexSize;
 }
 
 CKBYTE *CKRSTLoadVertexBuffer(CKBYTE *VBMem, CKDWORD VFormat, CKDWORD VSize, VxDrawPrimitiveData *data)
@@ -540,68 +745,49 @@ CKBYTE *CKRSTLoadVertexBuffer(CKBYTE *VBMem, CKDWORD VFormat, CKDWORD VSize, VxD
         return &VBMem[data->VertexCount * sizeof(CKVertex)];
     }
 
-    int offset;
-    if (VFormat & CKRST_VF_RASTERPOS)
-    {
-        VxCopyStructure(data->VertexCount, VBMem, VSize, sizeof(VxVector4), data->PositionPtr, data->PositionStride);
-        offset = sizeof(VxVector4);
-    }
-    else
-    {
-        VxCopyStructure(data->VertexCount, VBMem, VSize, sizeof(VxVector), data->PositionPtr, data->PositionStride);
-        offset = sizeof(VxVector);
-    }
+    const CKVertexLayout *layout = CKRSTGetVertexLayout(VFormat);
 
-    if (VFormat & CKRST_VF_NORMAL)
-    {
-        if (data->NormalPtr)
-            VxCopyStructure(data->VertexCount, &VBMem[offset], VSize, sizeof(VxVector), data->NormalPtr, data->NormalStride);
-        offset += sizeof(VxVector);
-    }
+    const CKVertexFillKernelDesc *kernel = (const CKVertexFillKernelDesc *)layout->FillKernel;
+    if (kernel && kernel->CanLoad(data))
+        return kernel->Load(VBMem, VSize, data);
+
+    VxCopyStructure(data->VertexCount, VBMem, VSize, layout->PositionSize, data->PositionPtr, data->PositionStride);
+
+    if (layout->NormalSize && data->NormalPtr)
+        VxCopyStructure(data->VertexCount, &VBMem[layout->NormalOffset], VSize, layout->NormalSize, data->NormalPtr, data->NormalStride);
 
-    if (VFormat & CKRST_VF_DIFFUSE)
+    if (layout->DiffuseSize)
     {
         if (data->ColorPtr)
         {
-            VxCopyStructure(data->VertexCount, &VBMem[offset], VSize, sizeof(CKDWORD), data->ColorPtr, data->ColorStride);
+            VxCopyStructure(data->VertexCount, &VBMem[layout->DiffuseOffset], VSize, sizeof(CKDWORD), data->ColorPtr, data->ColorStride);
         }
         else
         {
             CKDWORD src = 0xFFFFFFFF;
-            VxFillStructure(data->VertexCount, &VBMem[offset], VSize, sizeof(CKDWORD), &src);
+            VxFillStructure(data->VertexCount, &VBMem[layout->DiffuseOffset], VSize, sizeof(CKDWORD), &src);
         }
-        offset += sizeof(CKDWORD);
     }
 
-    if (VFormat & CKRST_VF_SPECULAR)
+    if (layout->SpecularSize)
     {
         if (data->SpecularColorPtr)
         {
-            VxCopyStructure(data->VertexCount, &VBMem[offset], VSize, sizeof(CKDWORD), data->SpecularColorPtr, data->SpecularColorStride);
+            VxCopyStructure(data->VertexCount, &VBMem[layout->SpecularOffset], VSize, sizeof(CKDWORD), data->SpecularColorPtr, data->SpecularColorStride);
         }
         else
         {
             CKDWORD src = 0;
-            VxFillStructure(data->VertexCount, &VBMem[offset], VSize, sizeof(CKDWORD), &src);
+            VxFillStructure(data->VertexCount, &VBMem[layout->SpecularOffset], VSize, sizeof(CKDWORD), &src);
         }
-        offset += sizeof(CKDWORD);
     }
 
-    CKDWORD texCount = CKRST_VF_GETTEXCOUNT(VFormat);
-    if (texCount != 0)
+    if (layout->TexCount != 0 && data->TexCoordPtr)
+        VxCopyStructure(data->VertexCount, &VBMem[layout->TexOffset[0]], VSize, layout->TexSize[0], data->TexCoordPtr, data->TexCoordStride);
+    for (CKDWORD i = 1; i < layout->TexCount; ++i)
     {
-        if (data->TexCoordPtr)
-            VxCopyStructure(data->VertexCount, &VBMem[offset], VSize, 2 * sizeof(float), data->TexCoordPtr, data->TexCoordStride);
-        offset += 2 * sizeof(float);
-    }
-    if (texCount > 1)
-    {
-        for (CKDWORD i = 0; i < texCount - 1; ++i)
-        {
-            if (data->TexCoordPtrs[i])
-                VxCopyStructure(data->VertexCount, &VBMem[offset], VSize, 2 * sizeof(float), data->TexCoordPtrs[i], data->TexCoordStrides[i]);
-            offset += 2 * sizeof(float);
-        }
+        if (data->TexCoordPtrs[i - 1])
+            VxCopyStructure(data->VertexCount, &VBMem[layout->TexOffset[i]], VSize, layout->TexSize[i], data->TexCoordPtrs[i - 1], data->TexCoordStrides[i - 1]);
     }
 
     return &VBMem[data->VertexCount * VSize];
@@ -609,20 +795,16 @@ CKBYTE *CKRSTLoadVertexBuffer(CKBYTE *VBMem, CKDWORD VFormat, CKDWORD VSize, VxD
 
 void CKRSTSetupDPFromVertexBuffer(CKBYTE *VBMem, CKVertexBufferDesc *VB, VxDrawPrimitiveData &DpData)
 {
-    DpData.PositionPtr = VBMem;
-    DpData.PositionStride = VB->m_VertexSize;
+    const CKVertexLayout *layout = CKRSTGetVertexLayout(VB->m_VertexFormat, VB->m_Compression);
+    const CKDWORD stride = VB->m_VertexSize;
 
-    CKBYTE *ptr;
-    if ((VB->m_VertexFormat & CKRST_VF_POSITION) != 0)
-        ptr = VBMem + 12;
-    else
-        ptr = VBMem + 16;
+    DpData.PositionPtr = VBMem;
+    DpData.PositionStride = stride;
 
-    if ((VB->m_VertexFormat & CKRST_VF_NORMAL) != 0)
+    if (layout->NormalSize)
     {
-        DpData.NormalPtr = ptr;
-        DpData.NormalStride = VB->m_VertexSize;
-        ptr += 12;
+        DpData.NormalPtr = VBMem + layout->NormalOffset;
+        DpData.NormalStride = stride;
     }
     else
     {
@@ -630,11 +812,10 @@ void CKRSTSetupDPFromVertexBuffer(CKBYTE *VBMem, CKVertexBufferDesc *VB, VxDrawP
         DpData.NormalStride = 0;
     }
 
-    if ((VB->m_VertexFormat & CKRST_VF_DIFFUSE) != 0)
+    if (layout->DiffuseSize)
     {
-        DpData.ColorPtr = ptr;
-        DpData.ColorStride = VB->m_VertexSize;
-        ptr += 4;
+        DpData.ColorPtr = VBMem + layout->DiffuseOffset;
+        DpData.ColorStride = stride;
     }
     else
     {
@@ -642,11 +823,10 @@ void CKRSTSetupDPFromVertexBuffer(CKBYTE *VBMem, CKVertexBufferDesc *VB, VxDrawP
         DpData.ColorStride = 0;
     }
 
-    if ((VB->m_VertexFormat & CKRST_VF_SPECULAR) != 0)
+    if (layout->SpecularSize)
     {
-        DpData.SpecularColorPtr = ptr;
-        DpData.SpecularColorStride = VB->m_VertexSize;
-        ptr += 4;
+        DpData.SpecularColorPtr = VBMem + layout->SpecularOffset;
+        DpData.SpecularColorStride = stride;
     }
     else
     {
@@ -654,17 +834,22 @@ void CKRSTSetupDPFromVertexBuffer(CKBYTE *VBMem, CKVertexBufferDesc *VB, VxDrawP
         DpData.SpecularColorStride = 0;
     }
 
-    DpData.TexCoordPtr = ptr;
-    DpData.TexCoordStride = VB->m_VertexSize;
-    ptr += 8;
+    if (layout->TexCount != 0)
+    {
+        DpData.TexCoordPtr = VBMem + layout->TexOffset[0];
+        DpData.TexCoordStride = stride;
+    }
+    else
+    {
+        DpData.TexCoordPtr = NULL;
+        DpData.TexCoordStride = 0;
+    }
 
     memset(DpData.TexCoordPtrs, NULL, sizeof(DpData.TexCoordPtrs));
     memset(DpData.TexCoordStrides, 0, sizeof(DpData.TexCoordStrides));
-    if ((VB->m_VertexFormat & CKRST_VF_TEXMASK) > CKRST_VF_TEX1)
-        for (int i = 0; i < CKRST_MAX_STAGES - 1; ++i)
-        {
-            DpData.TexCoordPtrs[i] = ptr;
-            DpData.TexCoordStrides[i] = VB->m_VertexSize;
-            ptr += 8;
-        }
-}
\ No newline at end of file
+    for (CKDWORD i = 1; i < layout->TexCount; ++i)
+    {
+        DpData.TexCoordPtrs[i - 1] = VBMem + layout->TexOffset[i];
+        DpData.TexCoordStrides[i - 1] = stride;
+    }
+}
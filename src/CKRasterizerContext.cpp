@@ -118,12 +118,60 @@ CKRasterizerContext::CKRasterizerContext()
     m_InverseWinding = 0;
     m_EnsureVertexShader = 0;
     m_UnityMatrixMask = 0;
+
+    m_FrameCounter = 0;
+    memset(&m_FrameStats, 0, sizeof(m_FrameStats));
+    memset(&m_LastFrameStats, 0, sizeof(m_LastFrameStats));
+
+    m_FramesInFlight = CKRST_DEFAULT_FRAMES_IN_FLIGHT;
+    m_FrameSlot = 0;
+    memset(m_FrameFences, 0, sizeof(m_FrameFences));
+    m_SimulatedFences = TRUE;
+    m_LastFence = 0;
+    m_CompletedFence = 0;
+
+    m_Batching = FALSE;
+    m_FlushingBatch = FALSE;
+    m_BatchMaxVertexCount = 0;
+    m_BatchType = VX_TRIANGLELIST;
+    m_BatchVertexFormat = 0;
+    m_BatchVertexSize = 0;
+    m_BatchVB = 0;
+    m_BatchStartVertex = 0;
+    m_BatchVertexCount = 0;
+
+    m_SpriteAtlas = FALSE;
+    m_AtlasPageSize = 1024;
+    m_AtlasMaxSpriteSize = 256;
+
+    m_NonPow2MemorySaved = 0;
+
+    m_StreamingBudget = 0;
+    m_StreamingMemory = 0;
+    m_StreamingMaxReads = 4;
+
+    m_LoadTicket = 0;
+    m_UploadBudget = 0;
+
+    m_SharedTextureMemorySaved = 0;
 }
 
-CKRasterizerContext::~CKRasterizerContext() {}
+CKRasterizerContext::~CKRasterizerContext()
+{
+    ReleaseAsyncLoads();
+    ReleaseStreamedTextures();
+    ReleaseSharedTextures();
+    ReleaseRenderTargetPool();
+    ReleaseDynamicBuffers();
+    ReleaseFrameTextures();
+    ReleaseConvertedIndexBuffers();
+    ReleaseSpriteAtlas();
+}
 
 CKBOOL CKRasterizerContext::SetMaterial(CKMaterialData *mat)
 {
+    if (m_BatchVertexCount != 0)
+        FlushBatch();
     if (mat)
         memcpy(&m_CurrentMaterialData, mat, sizeof(m_CurrentMaterialData));
     return FALSE;
@@ -131,12 +179,16 @@ CKBOOL CKRasterizerContext::SetMaterial(CKMaterialData *mat)
 
 CKBOOL CKRasterizerContext::SetViewport(CKViewportData *data)
 {
+    if (m_BatchVertexCount != 0)
+        FlushBatch();
     memcpy(&m_ViewportData, data, sizeof(m_ViewportData));
     return TRUE;
 }
 
 CKBOOL CKRasterizerContext::SetTransformMatrix(VXMATRIX_TYPE Type, const VxMatrix &Mat)
 {
+    if (m_BatchVertexCount != 0)
+        FlushBatch();
     switch (Type)
     {
     case VXMATRIX_WORLD:
@@ -164,6 +216,13 @@ CKBOOL CKRasterizerContext::DeleteObject(CKDWORD ObjIndex, CKRST_OBJECTTYPE Type
     switch (Type)
     {
     case CKRST_OBJ_TEXTURE:
+        ReleaseFrameTextures(ObjIndex);
+        SetNonPow2Saving(ObjIndex, 0);
+        StopTextureStreaming(ObjIndex);
+        CancelAsyncLoads(Type, ObjIndex);
+        RemovePooledRenderTarget(ObjIndex);
+        // The desc of a shared texture is kept for the other textures
+        UnshareTexture(ObjIndex);
         if (ObjIndex < m_Textures.Size())
         {
             delete m_Textures[ObjIndex];
@@ -171,8 +230,10 @@ CKBOOL CKRasterizerContext::DeleteObject(CKDWORD ObjIndex, CKRST_OBJECTTYPE Type
         }
         break;
     case CKRST_OBJ_SPRITE:
+        CancelAsyncLoads(Type, ObjIndex);
         if (ObjIndex < m_Sprites.Size())
         {
+            ReleaseAtlasSprite(m_Sprites[ObjIndex]);
             delete m_Sprites[ObjIndex];
             m_Sprites[ObjIndex] = NULL;
         }
@@ -185,6 +246,7 @@ CKBOOL CKRasterizerContext::DeleteObject(CKDWORD ObjIndex, CKRST_OBJECTTYPE Type
         }
         break;
     case CKRST_OBJ_INDEXBUFFER:
+        ReleaseConvertedIndexBuffers(ObjIndex);
         if (ObjIndex < m_IndexBuffers.Size())
         {
             delete m_IndexBuffers[ObjIndex];
@@ -213,6 +275,22 @@ CKBOOL CKRasterizerContext::DeleteObject(CKDWORD ObjIndex, CKRST_OBJECTTYPE Type
 
 CKBOOL CKRasterizerContext::FlushObjects(CKDWORD TypeMask)
 {
+    if (TypeMask & (CKRST_OBJ_TEXTURE | CKRST_OBJ_SPRITE))
+        ReleaseAsyncLoads();
+
+    if (TypeMask & CKRST_OBJ_TEXTURE)
+    {
+        ReleaseFrameTextures();
+        ReleaseStreamedTextures();
+        ReleaseSharedTextures();
+        ReleaseRenderTargetPool();
+        m_NonPow2Savings.Clear();
+        m_NonPow2MemorySaved = 0;
+    }
+
+    if (TypeMask & (CKRST_OBJ_TEXTURE | CKRST_OBJ_SPRITE))
+        ReleaseSpriteAtlas();
+
     if (TypeMask & CKRST_OBJ_TEXTURE)
         for (XArray<CKTextureDesc *>::Iterator it = m_Textures.Begin(); it != m_Textures.End(); ++it)
         {
@@ -237,6 +315,9 @@ CKBOOL CKRasterizerContext::FlushObjects(CKDWORD TypeMask)
             *it = NULL;
         }
 
+    if (TypeMask & CKRST_OBJ_INDEXBUFFER)
+        ReleaseConvertedIndexBuffers();
+
     if (TypeMask & CKRST_OBJ_INDEXBUFFER)
         for (XArray<CKIndexBufferDesc *>::Iterator it = m_IndexBuffers.Begin(); it != m_IndexBuffers.End(); ++it)
         {
@@ -299,6 +380,29 @@ CKTextureDesc *CKRasterizerContext::GetTextureData(CKDWORD Texture)
     return data;
 }
 
+// Copies a band of rows of a sprite tile and clears its padding (job of the thread pool)
+static void CopySpriteRowBand(void *Data, int Index)
+{
+    const CKSpriteRowBand &band = ((const CKSpriteRowBand *)Data)[Index];
+    CKBYTE *dst = band.Dst + band.FirstRow * band.DstPitch;
+    const CKBYTE *src = band.Src + band.FirstRow * band.SrcPitch;
+    for (int row = band.FirstRow; row < band.FirstRow + band.RowCount; ++row)
+    {
+        if (row < band.ImageRows)
+        {
+            memcpy(dst, src, band.RowBytes);
+            if (band.DstPitch > band.RowBytes)
+                memset(dst + band.RowBytes, 0, band.DstPitch - band.RowBytes);
+        }
+        else
+        {
+            memset(dst, 0, band.DstPitch);
+        }
+        dst += band.DstPitch;
+        src += band.SrcPitch;
+    }
+}
+
 CKBOOL CKRasterizerContext::LoadSprite(CKDWORD Sprite, const VxImageDescEx &SurfDesc)
 {
     if (Sprite >= (CKDWORD)m_Sprites.Size())
@@ -311,33 +415,88 @@ CKBOOL CKRasterizerContext::LoadSprite(CKDWORD Sprite, const VxImageDescEx &Surf
     if (sprite->Textures.IsEmpty())
         return FALSE;
 
+    // Packed sprite : update the system memory copy of its page, the page
+    // is reloaded by FlushSpriteAtlas
+    CKSpriteAtlasPage *page = (sprite->Textures.Size() == 1) ? GetAtlasPage(sprite->Textures[0].IndexTexture) : NULL;
+    if (page)
+    {
+        CKSPRTextInfo &info = sprite->Textures[0];
+        VxImageDescEx src = SurfDesc;
+        src.Width = info.w;
+        src.Height = info.h;
+        VxImageDescEx dst;
+        GetAtlasPageDesc(page, dst);
+        dst.Width = info.w;
+        dst.Height = info.h;
+        dst.Image = &page->Image[info.ty * dst.BytesPerLine + info.tx * 4];
+        if (!CKRSTConvertPixels(src, dst))
+            VxDoBlit(src, dst);
+
+        page->Dirty = TRUE;
+        return TRUE;
+    }
+
     VxImageDescEx desc = SurfDesc;
     int bytesPerPixel = SurfDesc.BitsPerPixel / 8;
+    XArray<CKSPRTextInfo>::Iterator it;
 
-    CKBYTE *image = m_Driver->m_Owner->AllocateObjects((bytesPerPixel * sprite->Textures[0].sw * sprite->Textures[0].sh + sizeof(CKDWORD) - 1) / sizeof(CKDWORD));
-    if (!image)
-        return FALSE;
-    desc.Image = image;
+    // Tiles smaller than their texture are copied to the scratch buffer and padded,
+    // the others are loaded straight from the sprite image
+    int scratchSize = 0;
+    for (it = sprite->Textures.Begin(); it != sprite->Textures.End(); ++it)
+    {
+        if (it->w != it->sw || it->h != it->sh)
+            scratchSize += it->sw * it->sh * bytesPerPixel;
+    }
+    if (m_SpriteScratch.Size() < scratchSize)
+        m_SpriteScratch.Resize(scratchSize);
 
-    for (XArray<CKSPRTextInfo>::Iterator it = sprite->Textures.Begin(); it != sprite->Textures.End(); ++it)
+    m_SpriteBands.Resize(0);
+    CKBYTE *scratch = m_SpriteScratch.Begin();
+    for (it = sprite->Textures.Begin(); it != sprite->Textures.End(); ++it)
     {
-        image = desc.Image;
+        if (it->w == it->sw && it->h == it->sh)
+            continue;
+
+        CKSpriteRowBand band;
+        band.Src = &SurfDesc.Image[it->x * bytesPerPixel + it->y * SurfDesc.BytesPerLine];
+        band.Dst = scratch;
+        band.SrcPitch = SurfDesc.BytesPerLine;
+        band.DstPitch = it->sw * bytesPerPixel;
+        band.RowBytes = it->w * bytesPerPixel;
+        band.ImageRows = it->h;
+
+        // Bands of about 64 KB
+        int bandRows = 65536 / band.DstPitch;
+        if (bandRows < 1)
+            bandRows = 1;
+        for (band.FirstRow = 0; band.FirstRow < it->sh; band.FirstRow += bandRows)
+        {
+            band.RowCount = (it->sh - band.FirstRow < bandRows) ? it->sh - band.FirstRow : bandRows;
+            m_SpriteBands.PushBack(band);
+        }
+        scratch += it->sh * band.DstPitch;
+    }
 
-        int spriteBytesPerLine = it->w * bytesPerPixel;
-        int textureBytesPerLine = it->sw * bytesPerPixel;
+    if (m_SpriteBands.Size() > 1)
+        m_Driver->m_Owner->GetThreadPool()->ParallelFor(CopySpriteRowBand, m_SpriteBands.Begin(), m_SpriteBands.Size());
+    else if (m_SpriteBands.Size() == 1)
+        CopySpriteRowBand(m_SpriteBands.Begin(), 0);
 
+    scratch = m_SpriteScratch.Begin();
+    for (it = sprite->Textures.Begin(); it != sprite->Textures.End(); ++it)
+    {
         if (it->w != it->sw || it->h != it->sh)
-            memset(image, 0, it->sh * textureBytesPerLine);
-
-        XBYTE *src = &SurfDesc.Image[it->x * bytesPerPixel + it->y * SurfDesc.BytesPerLine];
-        for (int h = 0; h < it->h; ++h)
         {
-            memcpy(image, src, spriteBytesPerLine);
-            image += textureBytesPerLine;
-            src += SurfDesc.BytesPerLine;
+            desc.Image = scratch;
+            desc.BytesPerLine = it->sw * bytesPerPixel;
+            scratch += it->sh * desc.BytesPerLine;
+        }
+        else
+        {
+            desc.Image = &SurfDesc.Image[it->x * bytesPerPixel + it->y * SurfDesc.BytesPerLine];
+            desc.BytesPerLine = SurfDesc.BytesPerLine;
         }
-
-        desc.BytesPerLine = textureBytesPerLine;
         desc.Width = it->sw;
         desc.Height = it->sh;
         LoadTexture(it->IndexTexture, desc);
@@ -573,14 +732,34 @@ CKBOOL CKRasterizerContext::CreateSprite(CKDWORD Sprite, CKSpriteDesc *DesiredFo
     CKDWORD width = DesiredFormat->Format.Width;
     CKDWORD height = DesiredFormat->Format.Height;
 
+    // Small sprites are packed in the atlas pages when enabled
+    if (m_SpriteAtlas && width <= (CKDWORD)m_AtlasMaxSpriteSize && height <= (CKDWORD)m_AtlasMaxSpriteSize)
+    {
+        CKSpriteDesc *sprite = new CKSpriteDesc;
+        sprite->Owner = m_Driver->m_Owner;
+        if (CreateAtlasSprite(sprite, DesiredFormat))
+        {
+            if (m_Sprites[Sprite])
+            {
+                ReleaseAtlasSprite(m_Sprites[Sprite]);
+                delete m_Sprites[Sprite];
+            }
+            m_Sprites[Sprite] = sprite;
+            return TRUE;
+        }
+        delete sprite;
+    }
+
     short minWidth = (short)m_Driver->m_3DCaps.MinTextureWidth;
     short minHeight = (short)m_Driver->m_3DCaps.MinTextureHeight;
 
     const short maxWidth = (short)m_Driver->m_3DCaps.MaxTextureWidth;
     const short maxHeight = (short)m_Driver->m_3DCaps.MaxTextureHeight;
 
-    short texWidth = GetPow2(width);
-    short texHeight = GetPow2(height);
+    // Sub-textures of the exact sprite size when the driver allows it
+    CKBOOL nonPow2 = CanCreateNonPow2Texture(DesiredFormat->Flags | CKRST_TEXTURE_SPRITE, 0);
+    short texWidth = nonPow2 ? (short)width : (short)GetPow2(width);
+    short texHeight = nonPow2 ? (short)height : (short)GetPow2(height);
 
     if (minWidth < 8)
         minWidth = 8;
@@ -687,7 +866,10 @@ CKBOOL CKRasterizerContext::CreateSprite(CKDWORD Sprite, CKSpriteDesc *DesiredFo
 
     CKSpriteDesc *sprite = m_Sprites[Sprite];
     if (sprite)
+    {
+        ReleaseAtlasSprite(sprite);
         delete sprite;
+    }
 
     sprite = new CKSpriteDesc;
     sprite->Textures.Resize(wc * hc);
@@ -710,6 +892,8 @@ CKBOOL CKRasterizerContext::CreateSprite(CKDWORD Sprite, CKSpriteDesc *DesiredFo
             DesiredFormat->Format.Width = info->sw;
             DesiredFormat->Format.Height = info->sh;
             CreateObject(info->IndexTexture, CKRST_OBJ_TEXTURE, DesiredFormat);
+            if (nonPow2)
+                SetNonPow2Saving(info->IndexTexture, (GetPow2(info->sw) * GetPow2(info->sh) - info->sw * info->sh) * (DesiredFormat->Format.BitsPerPixel / 8));
         }
     }
 
@@ -729,6 +913,342 @@ CKBOOL CKRasterizerContext::CreateSprite(CKDWORD Sprite, CKSpriteDesc *DesiredFo
     return TRUE;
 }
 
+void CKRasterizerContext::EnableSpriteAtlas(CKBOOL Enable, int PageSize, int MaxSpriteSize)
+{
+    m_SpriteAtlas = Enable;
+    m_AtlasPageSize = (int)GetPow2(PageSize - 1);
+    m_AtlasMaxSpriteSize = (MaxSpriteSize < m_AtlasPageSize) ? MaxSpriteSize : m_AtlasPageSize;
+}
+
+CKBYTE *CKRasterizerContext::CompressTextureImage(const VxImageDescEx &SurfDesc, VX_PIXELFORMAT Format, CKDWORD Flags)
+{
+    int size = CKRSTGetDXTImageSize(Format, SurfDesc.Width, SurfDesc.Height);
+    if (size <= 0)
+        return NULL;
+    if (m_CompressScratch.Size() < size)
+        m_CompressScratch.Resize(size);
+
+    if (!CKRSTCompressDXT(SurfDesc, Format, m_CompressScratch.Begin(), Flags, m_Driver->m_Owner->GetThreadPool()))
+        return NULL;
+    return m_CompressScratch.Begin();
+}
+
+CKBOOL CKRasterizerContext::LoadTextureMipMaps(CKDWORD Texture, const VxImageDescEx &SurfDesc, CKDWORD Flags, float AlphaRef)
+{
+    if (!SurfDesc.Image || !PrepareTextureLoad(Texture))
+        return FALSE;
+    CKTextureDesc *desc = GetTextureData(Texture);
+    if (!LoadTexture(Texture, SurfDesc, 0))
+        return FALSE;
+    if (desc->MipMapCount == 0)
+        return TRUE;
+
+    // Levels alternate between the start of the scratch buffer and the
+    // end of the level 0 copy (a level is smaller than its previous level)
+    int width = SurfDesc.Width;
+    int height = SurfDesc.Height;
+    int size = width * height;
+    m_MipMapScratch.Resize(size + XMax(width / 2, 1) * XMax(height / 2, 1));
+
+    VxImageDescEx src;
+    VxPixelFormat2ImageDesc(_32_ARGB8888, src);
+    src.Width = width;
+    src.Height = height;
+    src.BytesPerLine = width * 4;
+    src.Image = (XBYTE *)m_MipMapScratch.Begin();
+    if (!CKRSTConvertPixels(SurfDesc, src))
+        return FALSE;
+
+    CKRasterizerThreadPool *pool = m_Driver->m_Owner->GetThreadPool();
+    for (int level = 1; level <= (int)desc->MipMapCount && (src.Width > 1 || src.Height > 1); ++level)
+    {
+        VxImageDescEx dst = src;
+        dst.Width = XMax(src.Width / 2, 1);
+        dst.Height = XMax(src.Height / 2, 1);
+        dst.BytesPerLine = dst.Width * 4;
+        dst.Image = (XBYTE *)((src.Image == (XBYTE *)m_MipMapScratch.Begin()) ? m_MipMapScratch.Begin() + size : m_MipMapScratch.Begin());
+        if (!CKRSTGenerateMipMap(src, dst, Flags, AlphaRef, pool))
+            return FALSE;
+        if (!LoadTexture(Texture, dst, level))
+            return FALSE;
+        src = dst;
+    }
+    return TRUE;
+}
+
+CKBOOL CKRasterizerContext::CanCreateNonPow2Texture(CKDWORD Flags, int MipMapCount)
+{
+    if (Flags & (CKRST_TEXTURE_FORCEPOW2 | CKRST_TEXTURE_COMPRESSION | CKRST_TEXTURE_CUBEMAP | CKRST_TEXTURE_VOLUMEMAP))
+        return FALSE;
+
+    CKDWORD caps = m_Driver->m_3DCaps.TextureCaps;
+    if (caps & CKRST_TEXTURECAPS_SQUAREONLY)
+        return FALSE;
+    if (!(caps & CKRST_TEXTURECAPS_POW2))
+        return TRUE;
+    return (caps & CKRST_TEXTURECAPS_CONDITIONALNONPOW2) && MipMapCount == 0;
+}
+
+void CKRasterizerContext::GetTextureSize(CKDWORD Texture, const CKTextureDesc *Format, int &Width, int &Height)
+{
+    Width = Format->Format.Width;
+    Height = Format->Format.Height;
+    if ((Format->Flags & (CKRST_TEXTURE_SPRITE | CKRST_TEXTURE_CONDITIONALNONPOW2)) &&
+        CanCreateNonPow2Texture(Format->Flags, Format->MipMapCount))
+    {
+        SetNonPow2Saving(Texture, (GetPow2(Width) * GetPow2(Height) - Width * Height) * (Format->Format.BitsPerPixel / 8));
+    }
+    else
+    {
+        Width = GetPow2(Width);
+        Height = GetPow2(Height);
+        SetNonPow2Saving(Texture, 0);
+    }
+}
+
+void CKRasterizerContext::SetNonPow2Saving(CKDWORD Texture, CKDWORD Bytes)
+{
+    CKDWORD *saving = m_NonPow2Savings.FindPtr(Texture);
+    if (saving)
+    {
+        m_NonPow2MemorySaved -= *saving;
+        m_NonPow2Savings.Remove(Texture);
+    }
+    if (Bytes > 0)
+    {
+        m_NonPow2Savings.Insert(Texture, Bytes, TRUE);
+        m_NonPow2MemorySaved += Bytes;
+    }
+}
+
+// Finds where to put a w x h rectangle in a skyline (lowest top first, then narrowest segment)
+static int AtlasFindPosition(const XArray<CKSpriteAtlasNode> &skyline, int width, int height, int w, int h, int &bestX, int &bestY)
+{
+    int best = -1;
+    int bestTop = height + 1;
+    int bestWidth = width + 1;
+    for (int i = 0; i < skyline.Size(); ++i)
+    {
+        int x = skyline[i].x;
+        if (x + w > width)
+            break;
+
+        int y = 0;
+        int left = w;
+        for (int j = i; left > 0; ++j)
+        {
+            if (skyline[j].y > y)
+                y = skyline[j].y;
+            left -= skyline[j].w;
+        }
+        if (y + h > height)
+            continue;
+
+        if (y + h < bestTop || (y + h == bestTop && skyline[i].w < bestWidth))
+        {
+            best = i;
+            bestTop = y + h;
+            bestWidth = skyline[i].w;
+            bestX = x;
+            bestY = y;
+        }
+    }
+    return best;
+}
+
+static void AtlasAddRect(XArray<CKSpriteAtlasNode> &skyline, int index, int x, int y, int w, int h)
+{
+    CKSpriteAtlasNode node;
+    node.x = (short)x;
+    node.y = (short)(y + h);
+    node.w = (short)w;
+    skyline.Insert(index, node);
+
+    // Shrink or remove the segments now under the new one
+    for (int i = index + 1; i < skyline.Size();)
+    {
+        int end = skyline[i - 1].x + skyline[i - 1].w;
+        if (skyline[i].x >= end)
+            break;
+        int shrink = end - skyline[i].x;
+        skyline[i].x = (short)(skyline[i].x + shrink);
+        skyline[i].w = (short)(skyline[i].w - shrink);
+        if (skyline[i].w > 0)
+            break;
+        skyline.RemoveAt(i);
+    }
+
+    // Merge segments at the same height
+    for (int i = 0; i + 1 < skyline.Size();)
+    {
+        if (skyline[i].y == skyline[i + 1].y)
+        {
+            skyline[i].w = (short)(skyline[i].w + skyline[i + 1].w);
+            skyline.RemoveAt(i + 1);
+        }
+        else
+            ++i;
+    }
+}
+
+CKBOOL CKRasterizerContext::CreateAtlasSprite(CKSpriteDesc *sprite, CKSpriteDesc *DesiredFormat)
+{
+    int pageWidth = m_AtlasPageSize;
+    int pageHeight = m_AtlasPageSize;
+    if (pageWidth > (int)m_Driver->m_3DCaps.MaxTextureWidth)
+        pageWidth = (int)m_Driver->m_3DCaps.MaxTextureWidth;
+    if (pageHeight > (int)m_Driver->m_3DCaps.MaxTextureHeight)
+        pageHeight = (int)m_Driver->m_3DCaps.MaxTextureHeight;
+
+    // One pixel of padding between sprites to avoid bleeding when filtering
+    int width = DesiredFormat->Format.Width;
+    int height = DesiredFormat->Format.Height;
+    int w = width + 1;
+    int h = height + 1;
+    if (w > pageWidth || h > pageHeight)
+        return FALSE;
+
+    const VxImageDescEx &fmt = DesiredFormat->Format;
+    CKSpriteAtlasPage *page = NULL;
+    int x = 0, y = 0;
+    for (int p = 0; p < m_AtlasPages.Size() && !page; ++p)
+    {
+        CKSpriteAtlasPage *candidate = m_AtlasPages[p];
+        if (candidate->Flags != DesiredFormat->Flags || candidate->Format.BitsPerPixel != fmt.BitsPerPixel ||
+            candidate->Format.RedMask != fmt.RedMask || candidate->Format.GreenMask != fmt.GreenMask ||
+            candidate->Format.BlueMask != fmt.BlueMask || candidate->Format.AlphaMask != fmt.AlphaMask)
+            continue;
+        int node = AtlasFindPosition(candidate->Skyline, pageWidth, pageHeight, w, h, x, y);
+        if (node < 0)
+            continue;
+        AtlasAddRect(candidate->Skyline, node, x, y, w, h);
+        page = candidate;
+    }
+
+    if (!page)
+    {
+        // Create a new page
+        CKDWORD texture = m_Driver->m_Owner->CreateObjectIndex(CKRST_OBJ_TEXTURE);
+        if (texture == 0)
+            return FALSE;
+        page = new CKSpriteAtlasPage;
+        page->Texture = texture;
+        page->Flags = DesiredFormat->Flags;
+        page->Format = fmt;
+
+        DesiredFormat->Format.Width = pageWidth;
+        DesiredFormat->Format.Height = pageHeight;
+        CKBOOL created = CreateObject(texture, CKRST_OBJ_TEXTURE, DesiredFormat);
+        DesiredFormat->Format.Width = width;
+        DesiredFormat->Format.Height = height;
+        if (!created || !m_Textures[texture])
+        {
+            m_Driver->m_Owner->ReleaseObjectIndex(texture, CKRST_OBJ_TEXTURE);
+            delete page;
+            return FALSE;
+        }
+
+        page->Image.Resize(pageWidth * pageHeight * 4);
+        page->Image.Memset(0);
+        CKSpriteAtlasNode node;
+        node.x = 0;
+        node.y = 0;
+        node.w = (short)pageWidth;
+        page->Skyline.PushBack(node);
+        x = y = 0;
+        AtlasAddRect(page->Skyline, 0, x, y, w, h);
+        m_AtlasPages.PushBack(page);
+    }
+
+    sprite->Textures.Resize(1);
+    sprite->Textures.Memset(0);
+    CKSPRTextInfo *info = &sprite->Textures[0];
+    info->IndexTexture = page->Texture;
+    info->w = (short)width;
+    info->h = (short)height;
+    info->sw = (short)pageWidth;
+    info->sh = (short)pageHeight;
+    info->tx = (short)x;
+    info->ty = (short)y;
+    ++page->SpriteCount;
+
+    CKTextureDesc *tex = m_Textures[page->Texture];
+    sprite->Flags = tex->Flags;
+    sprite->Format = tex->Format;
+    sprite->Format.Width = width;
+    sprite->Format.Height = height;
+    sprite->MipMapCount = 0;
+    return TRUE;
+}
+
+CKSpriteAtlasPage *CKRasterizerContext::GetAtlasPage(CKDWORD Texture)
+{
+    for (int p = 0; p < m_AtlasPages.Size(); ++p)
+        if (m_AtlasPages[p]->Texture == Texture)
+            return m_AtlasPages[p];
+    return NULL;
+}
+
+void CKRasterizerContext::GetAtlasPageDesc(CKSpriteAtlasPage *page, VxImageDescEx &desc)
+{
+    CKTextureDesc *tex = m_Textures[page->Texture];
+    desc.Width = tex->Format.Width;
+    desc.Height = tex->Format.Height;
+    desc.BitsPerPixel = 32;
+    desc.BytesPerLine = desc.Width * 4;
+    desc.AlphaMask = 0xFF000000;
+    desc.RedMask = 0x00FF0000;
+    desc.GreenMask = 0x0000FF00;
+    desc.BlueMask = 0x000000FF;
+    desc.Image = page->Image.Begin();
+}
+
+void CKRasterizerContext::FlushSpriteAtlas()
+{
+    for (int p = 0; p < m_AtlasPages.Size(); ++p)
+    {
+        CKSpriteAtlasPage *page = m_AtlasPages[p];
+        if (!page->Dirty)
+            continue;
+        VxImageDescEx pageDesc;
+        GetAtlasPageDesc(page, pageDesc);
+        LoadTexture(page->Texture, pageDesc);
+        page->Dirty = FALSE;
+    }
+}
+
+void CKRasterizerContext::ReleaseAtlasSprite(CKSpriteDesc *sprite)
+{
+    if (!sprite || sprite->Textures.Size() != 1)
+        return;
+
+    CKSpriteAtlasPage *page = GetAtlasPage(sprite->Textures[0].IndexTexture);
+    if (!page)
+        return;
+
+    sprite->Textures.Resize(0);
+    if (--page->SpriteCount > 0)
+        return;
+
+    m_AtlasPages.Remove(page);
+    if (m_Driver && m_Driver->m_Owner)
+        m_Driver->m_Owner->ReleaseObjectIndex(page->Texture, CKRST_OBJ_TEXTURE);
+    delete page;
+}
+
+void CKRasterizerContext::ReleaseSpriteAtlas()
+{
+    // The pages are removed first : releasing their textures calls DeleteObject back
+    XArray<CKSpriteAtlasPage *> pages;
+    pages.Swap(m_AtlasPages);
+    for (int p = 0; p < pages.Size(); ++p)
+    {
+        if (m_Driver && m_Driver->m_Owner)
+            m_Driver->m_Owner->ReleaseObjectIndex(pages[p]->Texture, CKRST_OBJ_TEXTURE);
+        delete pages[p];
+    }
+}
+
 void CKRasterizerContext::UpdateMatrices(CKDWORD Flags)
 {
     if (!(Flags & m_MatrixUptodate))
@@ -741,71 +1261,1617 @@ void CKRasterizerContext::UpdateMatrices(CKDWORD Flags)
     }
 }
 
-CKDWORD CKRasterizerContext::GetDynamicVertexBuffer(CKDWORD VertexFormat, CKDWORD VertexCount, CKDWORD VertexSize, CKDWORD AddKey)
+CKBOOL CKRasterizerContext::OptimizeMesh(CKDWORD VB, CKDWORD IB, CKDWORD VertexCount, CKDWORD IndexCount,
+                                         CKDWORD Flags, CKMeshOptimizeStats *Stats)
 {
-    if (VertexFormat == 0 || VertexCount == 0 || VertexSize == 0)
-        return 0;
+    CKVertexBufferDesc *vb = GetVertexBufferData(VB);
+    CKIndexBufferDesc *ib = GetIndexBufferData(IB);
+    if (!vb || !ib || (vb->m_Flags & CKRST_VB_WRITEONLY) || (ib->m_Flags & CKRST_VB_WRITEONLY))
+        return FALSE;
+    if (VertexCount == 0 || VertexCount > vb->m_MaxVertexCount || IndexCount > ib->m_MaxIndexCount)
+        return FALSE;
 
-    // Check if hardware supports vertex buffers
-    if (!(m_Driver->m_3DCaps.CKRasterizerSpecificCaps & CKRST_SPECIFICCAPS_CANDOVERTEXBUFFER))
-        return 0;
+    CKBYTE *vertices = (CKBYTE *)LockVertexBuffer(VB, 0, VertexCount);
+    if (!vertices)
+        return FALSE;
+    void *indices = LockIndexBuffer(IB, 0, IndexCount);
+    if (!indices)
+    {
+        UnlockVertexBuffer(VB);
+        return FALSE;
+    }
+
+    CKBOOL res = CKRSTOptimizeMesh(vertices, vb->m_Compression, vb->m_VertexSize, VertexCount,
+                                   indices, ib->GetIndexSize(), IndexCount, Flags, Stats);
+    UnlockIndexBuffer(IB);
+    UnlockVertexBuffer(VB);
+    return res;
+}
+
+CKBOOL CKRasterizerContext::DrawPrimitive32(VXPRIMITIVETYPE pType, CKDWORD *indices, int indexcount, VxDrawPrimitiveData *data)
+{
+    if (!data)
+        return FALSE;
+    if (!indices)
+        return DrawPrimitive(pType, NULL, 0, data);
+    return DrawIndexed32(pType, 0, 0, indices, indexcount, data);
+}
+
+CKBOOL CKRasterizerContext::DrawPrimitiveVB32(VXPRIMITIVETYPE pType, CKDWORD VertexBuffer, CKDWORD StartIndex, CKDWORD VertexCount,
+                                              CKDWORD *indices, int indexcount)
+{
+    if (!indices)
+        return DrawPrimitiveVB(pType, VertexBuffer, StartIndex, VertexCount, NULL, 0);
+    return DrawIndexed32(pType, VertexBuffer, StartIndex, indices, indexcount, NULL);
+}
+
+// Moves the pointers of a draw primitive data to its First vertex
+static void OffsetDrawPrimitiveData(VxDrawPrimitiveData &dp, CKDWORD First)
+{
+    if (dp.PositionPtr)
+        dp.PositionPtr = (CKBYTE *)dp.PositionPtr + First * dp.PositionStride;
+    if (dp.NormalPtr)
+        dp.NormalPtr = (CKBYTE *)dp.NormalPtr + First * dp.NormalStride;
+    if (dp.ColorPtr)
+        dp.ColorPtr = (CKBYTE *)dp.ColorPtr + First * dp.ColorStride;
+    if (dp.SpecularColorPtr)
+        dp.SpecularColorPtr = (CKBYTE *)dp.SpecularColorPtr + First * dp.SpecularColorStride;
+    if (dp.TexCoordPtr)
+        dp.TexCoordPtr = (CKBYTE *)dp.TexCoordPtr + First * dp.TexCoordStride;
+    for (int i = 0; i < CKRST_MAX_STAGES - 1; ++i)
+        if (dp.TexCoordPtrs[i])
+            dp.TexCoordPtrs[i] = (CKBYTE *)dp.TexCoordPtrs[i] + First * dp.TexCoordStrides[i];
+}
+
+CKBOOL CKRasterizerContext::DrawIndexRange16(VXPRIMITIVETYPE pType, CKDWORD VB, CKDWORD StartIndex, CKDWORD MinIndex, CKDWORD VertexCount,
+                                             CKWORD *indices, int indexcount, VxDrawPrimitiveData *data)
+{
+    if (!data)
+        return DrawPrimitiveVB(pType, VB, StartIndex + MinIndex, VertexCount, indices, indexcount);
+
+    VxDrawPrimitiveData dp = *data;
+    OffsetDrawPrimitiveData(dp, MinIndex);
+    dp.VertexCount = VertexCount;
+    return DrawPrimitive(pType, indices, indexcount, &dp);
+}
+
+CKBOOL CKRasterizerContext::DrawIndexed32(VXPRIMITIVETYPE pType, CKDWORD VB, CKDWORD StartIndex, CKDWORD *indices, int indexcount,
+                                          VxDrawPrimitiveData *data)
+{
+    if (indexcount <= 0)
+        return FALSE;
+
+    CKDWORD minIndex = indices[0];
+    CKDWORD maxIndex = indices[0];
+    for (int i = 1; i < indexcount; ++i)
+    {
+        if (indices[i] < minIndex)
+            minIndex = indices[i];
+        if (indices[i] > maxIndex)
+            maxIndex = indices[i];
+    }
+
+    // All the indices fit in a 16 bits range : a single rebased draw
+    if (maxIndex - minIndex <= 0xFFFF)
+    {
+        m_Index16Scratch.Resize(indexcount);
+        CKWORD *idx16 = m_Index16Scratch.Begin();
+        for (int i = 0; i < indexcount; ++i)
+            idx16[i] = (CKWORD)(indices[i] - minIndex);
+        return DrawIndexRange16(pType, VB, StartIndex, minIndex, maxIndex - minIndex + 1, idx16, indexcount, data);
+    }
+
+    // Otherwise convert to a list so that it can be cut at any primitive
+    VXPRIMITIVETYPE listType = CKRSTGetListType(pType);
+    int primSize = (listType == VX_TRIANGLELIST) ? 3 : (listType == VX_LINELIST) ? 2 : 1;
+    if (listType != VX_TRIANGLELIST && listType != VX_LINELIST && listType != VX_POINTLIST)
+        return FALSE;
+
+    const CKDWORD *list = indices;
+    int listCount = indexcount;
+    if (listType != pType)
+    {
+        m_Index32Scratch.Resize(CKRSTGetListIndexCount(pType, indexcount));
+        listCount = CKRSTConvertToList(m_Index32Scratch.Begin(), pType, indices, sizeof(CKDWORD), indexcount, FALSE);
+        list = m_Index32Scratch.Begin();
+    }
+
+    // Gather the primitives in ranges of at most 65536 vertices
+    CKBOOL res = TRUE;
+    int first = 0;
+    CKDWORD rangeMin = 0xFFFFFFFF;
+    CKDWORD rangeMax = 0;
+    for (int p = 0; p + primSize <= listCount + primSize; p += primSize)
+    {
+        CKDWORD primMin = 0xFFFFFFFF;
+        CKDWORD primMax = 0;
+        CKBOOL last = (p + primSize > listCount);
+        if (!last)
+        {
+            for (int k = 0; k < primSize; ++k)
+            {
+                if (list[p + k] < primMin)
+                    primMin = list[p + k];
+                if (list[p + k] > primMax)
+                    primMax = list[p + k];
+            }
+            CKDWORD newMin = (primMin < rangeMin) ? primMin : rangeMin;
+            CKDWORD newMax = (primMax > rangeMax) ? primMax : rangeMax;
+            if (newMax - newMin <= 0xFFFF)
+            {
+                rangeMin = newMin;
+                rangeMax = newMax;
+                continue;
+            }
+        }
+
+        // Draw the current range [first, p)
+        if (p > first)
+        {
+            int count = p - first;
+            m_Index16Scratch.Resize(count);
+            CKWORD *idx16 = m_Index16Scratch.Begin();
+            for (int i = 0; i < count; ++i)
+                idx16[i] = (CKWORD)(list[first + i] - rangeMin);
+            res &= DrawIndexRange16(listType, VB, StartIndex, rangeMin, rangeMax - rangeMin + 1, idx16, count, data);
+        }
+        if (last)
+            break;
+
+        first = p;
+        rangeMin = primMin;
+        rangeMax = primMax;
+        if (primMax - primMin <= 0xFFFF)
+            continue;
+
+        // A single primitive too wide for 16 bits indices : draw its vertices gathered
+        first = p + primSize;
+        rangeMin = 0xFFFFFFFF;
+        rangeMax = 0;
+        res &= DrawGathered(listType, VB, StartIndex, &list[p], primSize, data);
+    }
 
-    // Generate a unique index based on vertex format properties
-    // This ensures different types of vertex data get different buffers
-    CKDWORD index = 0;
-    // Extract position and normal flags
-    index = VertexFormat & (CKRST_VF_RASTERPOS | CKRST_VF_NORMAL);
-    // Incorporate diffuse, specular and texture coord flags with proper shifting
-    index |= (VertexFormat & (CKRST_VF_DIFFUSE | CKRST_VF_SPECULAR | CKRST_VF_TEXMASK)) >> 3;
-    // Shift down to make room for AddKey
-    index >>= 2;
-    // Incorporate AddKey into high bits
-    index |= AddKey << 7;
-    // Ensure index is not zero
-    index += 1;
+    return res;
+}
+
+// Key of the dynamic vertex buffers used to gather vertices of a vertex buffer
+#define GATHER_VB_KEY 0x6A7E0000
+
+CKBOOL CKRasterizerContext::DrawGathered(VXPRIMITIVETYPE pType, CKDWORD VB, CKDWORD StartIndex, const CKDWORD *indices, int indexcount,
+                                         VxDrawPrimitiveData *data)
+{
+    // Vertices from system memory are gathered in a temporary buffer
+    if (data)
+    {
+        CKDWORD vertexSize = 0;
+        CKDWORD vertexFormat = CKRSTGetVertexFormat((CKRST_DPFLAGS)data->Flags, vertexSize);
+        m_GatherScratch.Resize(indexcount * vertexSize);
+        for (int k = 0; k < indexcount; ++k)
+        {
+            VxDrawPrimitiveData dv = *data;
+            OffsetDrawPrimitiveData(dv, indices[k]);
+            dv.VertexCount = 1;
+            CKRSTLoadVertexBuffer(&m_GatherScratch[k * vertexSize], vertexFormat, vertexSize, &dv);
+        }
+        CKVertexBufferDesc gatherDesc;
+        gatherDesc.m_VertexFormat = vertexFormat;
+        gatherDesc.m_VertexSize = vertexSize;
+        VxDrawPrimitiveData dp = *data;
+        CKRSTSetupDPFromVertexBuffer(m_GatherScratch.Begin(), &gatherDesc, dp);
+        dp.VertexCount = indexcount;
+        return DrawPrimitive(pType, NULL, 0, &dp);
+    }
 
-    // Sanity check to make sure index is within valid range
-    if (index >= (CKDWORD)m_VertexBuffers.Size())
+    // Vertices from a vertex buffer (which must be readable) are copied in a dynamic vertex buffer,
+    // which does not use compressed attributes
+    CKVertexBufferDesc *vb = GetVertexBufferData(VB);
+    if (!vb || vb->m_Compression)
+        return FALSE;
+
+    CKDWORD gatherVB, startVertex;
+    CKBYTE *mem = (CKBYTE *)LockDynamicVertexBuffer(vb->m_VertexFormat, indexcount, vb->m_VertexSize, GATHER_VB_KEY, gatherVB, startVertex);
+    if (!mem)
+        return FALSE;
+    CKBOOL res = TRUE;
+    for (int k = 0; k < indexcount && res; ++k)
     {
-        // If index is out of bounds, fall back to a default index
-        index = 1; // Just use the first VB slot as fallback
+        void *src = LockVertexBuffer(VB, StartIndex + indices[k], 1);
+        res = (src != NULL);
+        if (src)
+        {
+            memcpy(&mem[k * vb->m_VertexSize], src, vb->m_VertexSize);
+            UnlockVertexBuffer(VB);
+        }
     }
+    UnlockVertexBuffer(gatherVB);
+    return res && DrawPrimitiveVB(pType, gatherVB, startVertex, indexcount, NULL, 0);
+}
+
+// Maximum number of replaced dynamic vertex buffers kept for reuse
+#define MAX_FREE_DYNAMIC_VB 16
+
+CKDWORD CKRasterizerContext::GetDynamicVertexBuffer(CKDWORD VertexFormat, CKDWORD VertexCount, CKDWORD VertexSize, CKDWORD AddKey)
+{
+    CKDynamicVertexBuffer *entry = GetDynamicVertexBufferEntry(VertexFormat, VertexCount, VertexSize, AddKey);
+    return entry ? entry->VB : 0;
+}
+
+CKDynamicVertexBuffer *CKRasterizerContext::GetDynamicVertexBufferEntry(CKDWORD VertexFormat, CKDWORD VertexCount, CKDWORD VertexSize, CKDWORD AddKey)
+{
+    if (VertexFormat == 0 || VertexCount == 0)
+        return NULL;
+
+    // A null vertex size means the natural size of the format
+    const CKVertexLayout *layout = CKRSTGetVertexLayout(VertexFormat);
+    if (VertexSize == 0)
+        VertexSize = layout->VertexSize;
+    else if (VertexSize < layout->VertexSize)
+        return NULL;
 
-    CKVertexBufferDesc *vb = m_VertexBuffers[index];
-    if (!vb || vb->m_MaxVertexCount < VertexCount || vb->m_VertexFormat != VertexFormat)
+    // Check if hardware supports vertex buffers
+    if (!(m_Driver->m_3DCaps.CKRasterizerSpecificCaps & CKRST_SPECIFICCAPS_CANDOVERTEXBUFFER))
+        return NULL;
+
+    CKDynamicVBKey key(VertexFormat, VertexSize, AddKey, m_FrameSlot);
+    CKDynamicVertexBuffer *entry = m_DynamicVBs.FindPtr(key);
+    if (entry)
     {
-        // Clean up existing vertex buffer if it exists
+        CKVertexBufferDesc *vb = (entry->VB < (CKDWORD)m_VertexBuffers.Size()) ? m_VertexBuffers[entry->VB] : NULL;
+        if (vb && vb->m_MaxVertexCount >= VertexCount)
+            return entry;
+
+        // Too small : grow geometrically, the old buffer is kept for reuse
+        // (if the buffer was flushed its index is recreated in place)
+        CKDWORD VB = entry->VB;
         if (vb)
         {
-            delete vb;
-            m_VertexBuffers[index] = NULL;
+            if (VertexCount < 2 * vb->m_MaxVertexCount)
+                VertexCount = 2 * vb->m_MaxVertexCount;
+            m_FreeDynamicVBs.PushBack(VB);
+            VB = 0;
+        }
+
+        entry->VB = CreateDynamicVertexBuffer(VertexFormat, VertexSize, VertexCount, AddKey, VB);
+        entry->DiscardFrame = 0xFFFFFFFF;
+        if (entry->VB == 0)
+        {
+            m_DynamicVBs.Remove(key);
+            return NULL;
         }
+        return entry;
+    }
+
+    CKDynamicVertexBuffer newEntry;
+    newEntry.VB = CreateDynamicVertexBuffer(VertexFormat, VertexSize, VertexCount, AddKey, 0);
+    if (newEntry.VB == 0)
+        return NULL;
 
-        // Initialize new vertex buffer descriptor
-        CKVertexBufferDesc nvb;
-        nvb.m_Flags = CKRST_VB_WRITEONLY | CKRST_VB_DYNAMIC;
+    m_DynamicVBs.Insert(key, newEntry, TRUE);
+    return m_DynamicVBs.FindPtr(key);
+}
 
-        // If AddKey is non-zero, this buffer might be shared across different types of geometry
-        if (AddKey != 0)
-            nvb.m_Flags |= CKRST_VB_SHARED;
+CKDWORD CKRasterizerContext::CreateDynamicVertexBuffer(CKDWORD VertexFormat, CKDWORD VertexSize, CKDWORD VertexCount, CKDWORD AddKey, CKDWORD VB)
+{
+    CKRasterizer *rst = m_Driver->m_Owner;
 
-        nvb.m_VertexFormat = VertexFormat;
-        nvb.m_VertexSize = VertexSize;
+    if (VB == 0)
+    {
+        // Reuse the largest fitting buffer with the same format among the replaced ones
+        int best = -1;
+        CKDWORD bestCount = 0;
+        for (int i = 0; i < m_FreeDynamicVBs.Size(); ++i)
+        {
+            CKVertexBufferDesc *vb = GetVertexBufferData(m_FreeDynamicVBs[i]);
+            if (vb && vb->m_VertexFormat == VertexFormat && vb->m_VertexSize == VertexSize &&
+                vb->m_MaxVertexCount >= VertexCount && vb->m_MaxVertexCount > bestCount)
+            {
+                best = i;
+                bestCount = vb->m_MaxVertexCount;
+            }
+        }
 
-        // Allocate more than requested to avoid frequent resizing
-        // Use at least DEFAULT_VB_SIZE for efficiency
-        nvb.m_MaxVertexCount = VertexCount + 100;
-        if (nvb.m_MaxVertexCount < DEFAULT_VB_SIZE)
-            nvb.m_MaxVertexCount = DEFAULT_VB_SIZE;
+        if (best >= 0)
+        {
+            VB = m_FreeDynamicVBs[best];
+            m_FreeDynamicVBs.RemoveAt(best);
+            m_VertexBuffers[VB]->m_CurrentVCount = 0;
+            return VB;
+        }
 
-        // Create the actual vertex buffer object
-        if (!CreateObject(index, CKRST_OBJ_VERTEXBUFFER, &nvb))
-            return 0;
+        // Too many buffers waiting for reuse : release the oldest one
+        while (m_FreeDynamicVBs.Size() >= MAX_FREE_DYNAMIC_VB)
+        {
+            rst->ReleaseObjectIndex(m_FreeDynamicVBs[0], CKRST_OBJ_VERTEXBUFFER);
+            m_FreeDynamicVBs.RemoveAt(0);
+        }
 
-        // Verify the vertex buffer was created successfully
-        if (!m_VertexBuffers[index])
+        VB = rst->CreateObjectIndex(CKRST_OBJ_VERTEXBUFFER);
+        if (VB == 0)
             return 0;
     }
 
-    return index;
-}
\ No newline at end of file
+    CKVertexBufferDesc nvb;
+    nvb.m_Flags = CKRST_VB_WRITEONLY | CKRST_VB_DYNAMIC;
+
+    // If AddKey is non-zero, this buffer might be shared across different types of geometry
+    if (AddKey != 0)
+        nvb.m_Flags |= CKRST_VB_SHARED;
+
+    nvb.m_VertexFormat = VertexFormat;
+    nvb.m_VertexSize = VertexSize;
+
+    // Allocate more than requested to avoid frequent resizing
+    // Use at least DEFAULT_VB_SIZE for efficiency
+    nvb.m_MaxVertexCount = VertexCount + 100;
+    if (nvb.m_MaxVertexCount < DEFAULT_VB_SIZE)
+        nvb.m_MaxVertexCount = DEFAULT_VB_SIZE;
+
+    ++m_FrameStats.DynamicVBCreations;
+
+    if (!CreateObject(VB, CKRST_OBJ_VERTEXBUFFER, &nvb) || !m_VertexBuffers[VB])
+    {
+        rst->ReleaseObjectIndex(VB, CKRST_OBJ_VERTEXBUFFER);
+        return 0;
+    }
+
+    return VB;
+}
+
+void CKRasterizerContext::ReleaseDynamicBuffers()
+{
+    if (!m_Driver || !m_Driver->m_Owner)
+        return;
+
+    CKRasterizer *rst = m_Driver->m_Owner;
+    for (XHashTable<CKDynamicVertexBuffer, CKDynamicVBKey, CKDynamicVBKeyHash>::Iterator it = m_DynamicVBs.Begin(); it != m_DynamicVBs.End(); ++it)
+        rst->ReleaseObjectIndex((*it).VB, CKRST_OBJ_VERTEXBUFFER);
+    for (int i = 0; i < m_FreeDynamicVBs.Size(); ++i)
+        rst->ReleaseObjectIndex(m_FreeDynamicVBs[i], CKRST_OBJ_VERTEXBUFFER);
+    for (XHashTable<CKDynamicIndexBuffer, CKDynamicVBKey, CKDynamicVBKeyHash>::Iterator it = m_DynamicIBs.Begin(); it != m_DynamicIBs.End(); ++it)
+        rst->ReleaseObjectIndex((*it).IB, CKRST_OBJ_INDEXBUFFER);
+
+    m_DynamicVBs.Clear();
+    m_FreeDynamicVBs.Clear();
+    m_DynamicIBs.Clear();
+}
+
+void *CKRasterizerContext::LockDynamicVertexBuffer(CKDWORD VertexFormat, CKDWORD VertexCount, CKDWORD VertexSize, CKDWORD AddKey,
+                                                   CKDWORD &VB, CKDWORD &StartVertex)
+{
+    StartVertex = 0;
+    VB = 0;
+    CKDynamicVertexBuffer *entry = GetDynamicVertexBufferEntry(VertexFormat, VertexCount, VertexSize, AddKey);
+    if (!entry)
+        return NULL;
+
+    VB = entry->VB;
+    CKVertexBufferDesc *vb = m_VertexBuffers[VB];
+    if (!vb)
+        return NULL;
+
+    // Append after the vertices already written, or wrap to the start of the buffer
+    CKRST_LOCKFLAGS lock = CKRST_LOCK_NOOVERWRITE;
+    if (entry->UseFrame != m_FrameCounter && m_FramesInFlight > 1)
+    {
+        // First use of this frame copy : the frame that last used it has been waited
+        // for in NextFrame, so it can be rewritten from the start
+        vb->m_CurrentVCount = 0;
+        if (m_SimulatedFences)
+            lock = CKRST_LOCK_DISCARD;
+    }
+    entry->UseFrame = m_FrameCounter;
+
+    if (vb->m_CurrentVCount + VertexCount > vb->m_MaxVertexCount)
+    {
+        lock = CKRST_LOCK_DISCARD;
+        vb->m_CurrentVCount = 0;
+        ++m_FrameStats.DynamicVBWraps;
+
+        if (entry->DiscardFrame == m_FrameCounter)
+            ++m_FrameStats.DynamicVBStalls;
+        entry->DiscardFrame = m_FrameCounter;
+    }
+
+    void *mem = LockVertexBuffer(VB, vb->m_CurrentVCount, VertexCount, lock);
+    if (!mem)
+        return NULL;
+
+    StartVertex = vb->m_CurrentVCount;
+    vb->m_CurrentVCount += VertexCount;
+    return mem;
+}
+
+CKDWORD CKRasterizerContext::GetDynamicIndexBuffer(CKDWORD IndexCount, CKDWORD AddKey)
+{
+    CKDynamicIndexBuffer *entry = GetDynamicIndexBufferEntry(IndexCount, AddKey);
+    return entry ? entry->IB : 0;
+}
+
+CKDynamicIndexBuffer *CKRasterizerContext::GetDynamicIndexBufferEntry(CKDWORD IndexCount, CKDWORD AddKey)
+{
+    if (IndexCount == 0)
+        return NULL;
+
+    CKDynamicVBKey key(0, sizeof(CKWORD), AddKey, m_FrameSlot);
+    CKDynamicIndexBuffer *entry = m_DynamicIBs.FindPtr(key);
+    CKIndexBufferDesc *ib = NULL;
+    if (entry)
+    {
+        ib = (entry->IB < (CKDWORD)m_IndexBuffers.Size()) ? m_IndexBuffers[entry->IB] : NULL;
+        if (ib && ib->m_MaxIndexCount >= IndexCount)
+            return entry;
+    }
+    else
+    {
+        CKDynamicIndexBuffer newEntry;
+        newEntry.IB = m_Driver->m_Owner->CreateObjectIndex(CKRST_OBJ_INDEXBUFFER);
+        if (newEntry.IB == 0)
+            return NULL;
+        m_DynamicIBs.Insert(key, newEntry, TRUE);
+        entry = m_DynamicIBs.FindPtr(key);
+    }
+
+    // (Re)create the buffer in place, growing geometrically
+    CKIndexBufferDesc nib;
+    nib.m_Flags = CKRST_VB_WRITEONLY | CKRST_VB_DYNAMIC;
+    nib.m_MaxIndexCount = IndexCount + 100;
+    if (ib && nib.m_MaxIndexCount < 2 * ib->m_MaxIndexCount)
+        nib.m_MaxIndexCount = 2 * ib->m_MaxIndexCount;
+    if (nib.m_MaxIndexCount < DEFAULT_VB_SIZE)
+        nib.m_MaxIndexCount = DEFAULT_VB_SIZE;
+
+    ++m_FrameStats.DynamicIBCreations;
+    entry->DiscardFrame = 0xFFFFFFFF;
+
+    if (!CreateObject(entry->IB, CKRST_OBJ_INDEXBUFFER, &nib) || !m_IndexBuffers[entry->IB])
+    {
+        m_Driver->m_Owner->ReleaseObjectIndex(entry->IB, CKRST_OBJ_INDEXBUFFER);
+        m_DynamicIBs.Remove(key);
+        return NULL;
+    }
+
+    return entry;
+}
+
+void *CKRasterizerContext::LockDynamicIndexBuffer(CKDWORD IndexCount, CKDWORD AddKey, CKDWORD &IB, CKDWORD &StartIndex)
+{
+    StartIndex = 0;
+    IB = 0;
+    CKDynamicIndexBuffer *entry = GetDynamicIndexBufferEntry(IndexCount, AddKey);
+    if (!entry)
+        return NULL;
+
+    IB = entry->IB;
+    CKIndexBufferDesc *ib = m_IndexBuffers[IB];
+    if (!ib)
+        return NULL;
+
+    // Append after the indices already written, or wrap to the start of the buffer
+    CKRST_LOCKFLAGS lock = CKRST_LOCK_NOOVERWRITE;
+    if (entry->UseFrame != m_FrameCounter && m_FramesInFlight > 1)
+    {
+        ib->m_CurrentICount = 0;
+        if (m_SimulatedFences)
+            lock = CKRST_LOCK_DISCARD;
+    }
+    entry->UseFrame = m_FrameCounter;
+
+    if (ib->m_CurrentICount + IndexCount > ib->m_MaxIndexCount)
+    {
+        lock = CKRST_LOCK_DISCARD;
+        ib->m_CurrentICount = 0;
+        ++m_FrameStats.DynamicIBWraps;
+
+        if (entry->DiscardFrame == m_FrameCounter)
+            ++m_FrameStats.DynamicIBStalls;
+        entry->DiscardFrame = m_FrameCounter;
+    }
+
+    void *mem = LockIndexBuffer(IB, ib->m_CurrentICount, IndexCount, lock);
+    if (!mem)
+        return NULL;
+
+    StartIndex = ib->m_CurrentICount;
+    ib->m_CurrentICount += IndexCount;
+    return mem;
+}
+
+int CKRasterizerContext::ConvertIndices(VXPRIMITIVETYPE &pType, const void *indices, CKDWORD IndexSize, int indexcount, CKBOOL ToStrip)
+{
+    VXPRIMITIVETYPE listType = CKRSTGetListType(pType);
+    m_ConvertScratch.Resize(CKRSTGetListIndexCount(pType, indexcount));
+    int count = CKRSTConvertToList(m_ConvertScratch.Begin(), pType, indices, IndexSize, indexcount, TRUE);
+    pType = listType;
+
+    if (ToStrip && listType == VX_TRIANGLELIST && count > 0)
+    {
+        CKDWORD vertexCount = 0;
+        for (int i = 0; i < count; ++i)
+            if (m_ConvertScratch[i] >= vertexCount)
+                vertexCount = m_ConvertScratch[i] + 1;
+
+        m_Index32Scratch.Resize(2 * count);
+        count = CKRSTStripifyTriangleList(m_Index32Scratch.Begin(), m_ConvertScratch.Begin(), count, vertexCount);
+        m_ConvertScratch.Swap(m_Index32Scratch);
+        pType = VX_TRIANGLESTRIP;
+    }
+    return count;
+}
+
+CKDWORD *CKRasterizerContext::ConvertPrimitive(VXPRIMITIVETYPE &pType, const CKWORD *indices, int &indexcount, CKBOOL ToStrip)
+{
+    indexcount = ConvertIndices(pType, indices, sizeof(CKWORD), indexcount, ToStrip);
+    return m_ConvertScratch.Begin();
+}
+
+CKDWORD CKRasterizerContext::GetConvertedIndexBuffer(CKDWORD IB, VXPRIMITIVETYPE &pType, CKDWORD StartIndex, int &IndexCount, CKBOOL ToStrip)
+{
+    CKIndexBufferDesc *ib = GetIndexBufferData(IB);
+    if (!ib || IndexCount <= 0 || StartIndex + IndexCount > ib->m_MaxIndexCount)
+        return 0;
+
+    CKConvertedIBKey key(IB, pType | (ToStrip ? 0x100 : 0), StartIndex, IndexCount);
+    CKConvertedIndexBuffer *entry = m_ConvertedIBs.FindPtr(key);
+    if (entry && entry->Source == ib && GetIndexBufferData(entry->IB))
+    {
+        pType = entry->Type;
+        IndexCount = entry->IndexCount;
+        return entry->IB;
+    }
+    if (ib->m_Flags & CKRST_VB_WRITEONLY)
+        return 0;
+
+    // Convert the source indices
+    void *src = LockIndexBuffer(IB, StartIndex, IndexCount, CKRST_LOCK_DEFAULT);
+    if (!src)
+        return 0;
+    CKDWORD indexSize = ib->GetIndexSize();
+    VXPRIMITIVETYPE type = pType;
+    int count = ConvertIndices(type, src, indexSize, IndexCount, ToStrip);
+    UnlockIndexBuffer(IB);
+    if (count == 0)
+        return 0;
+
+    // Store them in an index buffer (reused if the source was recreated)
+    if (!entry)
+    {
+        CKConvertedIndexBuffer newEntry;
+        newEntry.IB = m_Driver->m_Owner->CreateObjectIndex(CKRST_OBJ_INDEXBUFFER);
+        if (newEntry.IB == 0)
+            return 0;
+        m_ConvertedIBs.Insert(key, newEntry, TRUE);
+        entry = m_ConvertedIBs.FindPtr(key);
+    }
+
+    CKIndexBufferDesc nib;
+    nib.m_Flags = CKRST_VB_WRITEONLY | (ib->m_Flags & CKRST_VB_INDEX32);
+    nib.m_MaxIndexCount = count;
+    CKBYTE *dst = NULL;
+    if (CreateObject(entry->IB, CKRST_OBJ_INDEXBUFFER, &nib))
+        dst = (CKBYTE *)LockIndexBuffer(entry->IB, 0, count, CKRST_LOCK_DISCARD);
+    if (!dst)
+    {
+        m_Driver->m_Owner->ReleaseObjectIndex(entry->IB, CKRST_OBJ_INDEXBUFFER);
+        m_ConvertedIBs.Remove(key);
+        return 0;
+    }
+    if (indexSize == sizeof(CKDWORD))
+        memcpy(dst, m_ConvertScratch.Begin(), count * sizeof(CKDWORD));
+    else
+        for (int i = 0; i < count; ++i)
+            ((CKWORD *)dst)[i] = (CKWORD)m_ConvertScratch[i];
+    UnlockIndexBuffer(entry->IB);
+
+    entry->Source = ib;
+    entry->Type = type;
+    entry->IndexCount = count;
+    pType = type;
+    IndexCount = count;
+    return entry->IB;
+}
+
+void CKRasterizerContext::ReleaseConvertedIndexBuffers(CKDWORD IB)
+{
+    if (m_ConvertedIBs.Size() == 0 || !m_Driver || !m_Driver->m_Owner)
+        return;
+
+    // Collect first : releasing the converted buffers calls DeleteObject back
+    XArray<CKConvertedIBKey> keys;
+    for (XHashTable<CKConvertedIndexBuffer, CKConvertedIBKey, CKConvertedIBKeyHash>::Iterator it = m_ConvertedIBs.Begin(); it != m_ConvertedIBs.End(); ++it)
+        if (it.GetKey().IB == IB)
+            keys.PushBack(it.GetKey());
+
+    for (int i = 0; i < keys.Size(); ++i)
+    {
+        CKDWORD converted = m_ConvertedIBs.FindPtr(keys[i])->IB;
+        m_ConvertedIBs.Remove(keys[i]);
+        m_Driver->m_Owner->ReleaseObjectIndex(converted, CKRST_OBJ_INDEXBUFFER);
+    }
+}
+
+void CKRasterizerContext::ReleaseConvertedIndexBuffers()
+{
+    if (!m_Driver || !m_Driver->m_Owner)
+        return;
+
+    XArray<CKDWORD> converted;
+    for (XHashTable<CKConvertedIndexBuffer, CKConvertedIBKey, CKConvertedIBKeyHash>::Iterator it = m_ConvertedIBs.Begin(); it != m_ConvertedIBs.End(); ++it)
+        converted.PushBack((*it).IB);
+    m_ConvertedIBs.Clear();
+    for (int i = 0; i < converted.Size(); ++i)
+        m_Driver->m_Owner->ReleaseObjectIndex(converted[i], CKRST_OBJ_INDEXBUFFER);
+}
+
+// Key of the dynamic vertex buffers used for batching
+#define BATCH_VB_KEY 0xBA7C0000
+
+void CKRasterizerContext::EnableBatching(CKBOOL Enable, CKDWORD MaxVertexCount)
+{
+    FlushBatch();
+    m_Batching = Enable;
+    m_BatchMaxVertexCount = MaxVertexCount;
+}
+
+CKBOOL CKRasterizerContext::BatchPrimitive(VXPRIMITIVETYPE pType, CKWORD *indices, int indexcount, VxDrawPrimitiveData *data)
+{
+    if (!m_Batching || m_FlushingBatch)
+        return FALSE;
+
+    // Only small draws of list-convertible primitives are batched
+    VXPRIMITIVETYPE listType = CKRSTGetListType(pType);
+    if (listType != VX_TRIANGLELIST && listType != VX_LINELIST && listType != VX_POINTLIST)
+    {
+        FlushBatch();
+        return FALSE;
+    }
+
+    CKDWORD vertexCount = (CKDWORD)data->VertexCount;
+    CKDWORD vertexSize = 0;
+    CKDWORD vertexFormat = CKRSTGetVertexFormat((CKRST_DPFLAGS)data->Flags, vertexSize);
+    if (vertexCount == 0 || vertexCount > m_BatchMaxVertexCount || (data->Flags & CKRST_DP_VBUFFER))
+    {
+        FlushBatch();
+        return FALSE;
+    }
+
+    // Incompatible with the current batch
+    if (m_BatchVertexCount != 0 &&
+        (listType != m_BatchType || vertexFormat != m_BatchVertexFormat || m_BatchVertexCount + vertexCount > 0xFFFF))
+        FlushBatch();
+
+    // The vertices must follow the batch in the same buffer : flush if it would wrap
+    CKDynamicVertexBuffer *entry = GetDynamicVertexBufferEntry(vertexFormat, vertexCount, vertexSize, BATCH_VB_KEY);
+    if (!entry)
+    {
+        FlushBatch();
+        return FALSE;
+    }
+    CKVertexBufferDesc *vb = m_VertexBuffers[entry->VB];
+    if (m_BatchVertexCount != 0 &&
+        (entry->VB != m_BatchVB || entry->UseFrame != m_FrameCounter || vb->m_CurrentVCount + vertexCount > vb->m_MaxVertexCount))
+        FlushBatch();
+
+    CKDWORD VB, StartVertex;
+    CKBYTE *mem = (CKBYTE *)LockDynamicVertexBuffer(vertexFormat, vertexCount, vertexSize, BATCH_VB_KEY, VB, StartVertex);
+    if (!mem)
+    {
+        FlushBatch();
+        return FALSE;
+    }
+    CKRSTLoadVertexBuffer(mem, vertexFormat, vertexSize, data);
+    UnlockVertexBuffer(VB);
+
+    if (m_BatchVertexCount == 0)
+    {
+        m_BatchType = listType;
+        m_BatchVertexFormat = vertexFormat;
+        m_BatchVertexSize = vertexSize;
+        m_BatchVB = VB;
+        m_BatchStartVertex = StartVertex;
+        m_BatchIndices.Resize(0);
+    }
+
+    // Append the indices as a list without degenerates (generated for non indexed draws),
+    // rebased on the start of the batch
+    CKDWORD base = StartVertex - m_BatchStartVertex;
+    int count = indices ? indexcount : (int)vertexCount;
+    m_Index32Scratch.Resize(CKRSTGetListIndexCount(pType, count));
+    int listCount = CKRSTConvertToList(m_Index32Scratch.Begin(), pType, indices, sizeof(CKWORD), count, TRUE);
+    int first = m_BatchIndices.Size();
+    m_BatchIndices.Resize(first + listCount);
+    for (int i = 0; i < listCount; ++i)
+        m_BatchIndices[first + i] = (CKWORD)(base + m_Index32Scratch[i]);
+
+    m_BatchVertexCount += vertexCount;
+    ++m_FrameStats.BatchedDraws;
+    return TRUE;
+}
+
+void CKRasterizerContext::FlushBatch()
+{
+    if (m_BatchVertexCount == 0 || m_FlushingBatch)
+        return;
+
+    // The implementation may change states while drawing : do not flush recursively
+    m_FlushingBatch = TRUE;
+    if (m_BatchIndices.Size() > 0)
+        DrawPrimitiveVB(m_BatchType, m_BatchVB, m_BatchStartVertex, m_BatchVertexCount,
+                        m_BatchIndices.Begin(), m_BatchIndices.Size());
+    ++m_FrameStats.BatchFlushes;
+    m_FlushingBatch = FALSE;
+
+    m_BatchVertexCount = 0;
+    m_BatchIndices.Resize(0);
+}
+
+CKBOOL CKRasterizerContext::LoadFrameTexture(CKDWORD Texture, const VxImageDescEx &SurfDesc, int miplevel)
+{
+    if (!PrepareTextureLoad(Texture))
+        return FALSE;
+    CKTextureDesc *desc = GetTextureData(Texture);
+    if (!(desc->Flags & CKRST_TEXTURE_HINTPROCEDURAL) || m_FramesInFlight < 2)
+        return LoadTexture(Texture, SurfDesc, miplevel);
+
+    CKFrameTexture *entry = m_FrameTextures.FindPtr(Texture);
+    if (!entry)
+    {
+        CKFrameTexture newEntry;
+        newEntry.Copies[0] = Texture;
+        m_FrameTextures.Insert(Texture, newEntry, TRUE);
+        entry = m_FrameTextures.FindPtr(Texture);
+    }
+
+    CKDWORD copy = entry->Copies[m_FrameSlot];
+    if (copy == 0)
+    {
+        // Create a texture with the same format for this frame slot
+        copy = m_Driver->m_Owner->CreateObjectIndex(CKRST_OBJ_TEXTURE);
+        if (copy == 0)
+            return LoadTexture(Texture, SurfDesc, miplevel);
+
+        CKTextureDesc ntex;
+        ntex.Flags = desc->Flags & ~CKRST_TEXTURE_VALID;
+        ntex.Format = desc->Format;
+        ntex.MipMapCount = desc->MipMapCount;
+        if (!CreateObject(copy, CKRST_OBJ_TEXTURE, &ntex))
+        {
+            m_Driver->m_Owner->ReleaseObjectIndex(copy, CKRST_OBJ_TEXTURE);
+            return LoadTexture(Texture, SurfDesc, miplevel);
+        }
+        entry->Copies[m_FrameSlot] = copy;
+    }
+
+    if (!PrepareTextureLoad(copy) || !LoadTexture(copy, SurfDesc, miplevel))
+        return FALSE;
+    entry->Latest = m_FrameSlot;
+    return TRUE;
+}
+
+CKDWORD CKRasterizerContext::GetFrameTexture(CKDWORD Texture)
+{
+    CKFrameTexture *entry = m_FrameTextures.FindPtr(Texture);
+    if (!entry || entry->Copies[entry->Latest] == 0)
+        return Texture;
+    return entry->Copies[entry->Latest];
+}
+
+void CKRasterizerContext::ReleaseFrameTextures()
+{
+    XArray<CKDWORD> textures;
+    for (XHashTable<CKFrameTexture, CKDWORD>::Iterator it = m_FrameTextures.Begin(); it != m_FrameTextures.End(); ++it)
+        textures.PushBack(it.GetKey());
+    for (int i = 0; i < textures.Size(); ++i)
+        ReleaseFrameTextures(textures[i]);
+}
+
+void CKRasterizerContext::ReleaseFrameTextures(CKDWORD Texture)
+{
+    CKFrameTexture *entry = m_FrameTextures.FindPtr(Texture);
+    if (!entry || !m_Driver || !m_Driver->m_Owner)
+        return;
+
+    // Copy the entry first : releasing the copies calls DeleteObject back
+    CKFrameTexture copies = *entry;
+    m_FrameTextures.Remove(Texture);
+    for (int i = 1; i < CKRST_MAX_FRAMES_IN_FLIGHT; ++i)
+        if (copies.Copies[i])
+            m_Driver->m_Owner->ReleaseObjectIndex(copies.Copies[i], CKRST_OBJ_TEXTURE);
+}
+
+CKDWORD CKRasterizerContext::AcquireRenderTarget(int Width, int Height, VX_PIXELFORMAT Format, CKBOOL CubeMap, CKBOOL Transient)
+{
+    if (Width <= 0)
+        Width = m_Width;
+    if (Height <= 0)
+        Height = m_Height;
+    if (Format == UNKNOWN_PF)
+        Format = m_PixelFormat;
+    if (CubeMap)
+        Height = Width;
+
+    // Take the free target of the pool used the most recently
+    int best = -1;
+    for (int i = 0; i < m_RenderTargets.Size(); ++i)
+    {
+        CKPooledRenderTarget &target = m_RenderTargets[i];
+        if (target.InUse || target.Width != Width || target.Height != Height || target.Format != Format ||
+            target.CubeMap != CubeMap)
+            continue;
+        if (best < 0 || target.LastUsedFrame > m_RenderTargets[best].LastUsedFrame)
+            best = i;
+    }
+    if (best >= 0)
+    {
+        CKPooledRenderTarget &target = m_RenderTargets[best];
+        target.InUse = TRUE;
+        target.Transient = Transient;
+        target.LastUsedFrame = m_FrameCounter;
+        ++m_FrameStats.RenderTargetReuses;
+        return target.Texture;
+    }
+
+    if (!m_Driver || !m_Driver->m_Owner)
+        return 0;
+    CKDWORD texture = m_Driver->m_Owner->CreateObjectIndex(CKRST_OBJ_TEXTURE);
+    if (texture == 0)
+        return 0;
+
+    CKTextureDesc ntex;
+    VxPixelFormat2ImageDesc(Format, ntex.Format);
+    ntex.Flags = CKRST_TEXTURE_RENDERTARGET | (CubeMap ? CKRST_TEXTURE_CUBEMAP : 0);
+    ntex.Format.Width = Width;
+    ntex.Format.Height = Height;
+    ntex.MipMapCount = 0;
+    if (!CreateObject(texture, CKRST_OBJ_TEXTURE, &ntex))
+    {
+        m_Driver->m_Owner->ReleaseObjectIndex(texture, CKRST_OBJ_TEXTURE);
+        return 0;
+    }
+
+    CKPooledRenderTarget target;
+    target.Texture = texture;
+    target.Width = Width;
+    target.Height = Height;
+    target.Format = Format;
+    target.CubeMap = CubeMap;
+    target.InUse = TRUE;
+    target.Transient = Transient;
+    target.LastUsedFrame = m_FrameCounter;
+    m_RenderTargets.PushBack(target);
+    ++m_FrameStats.RenderTargetCreations;
+    return texture;
+}
+
+void CKRasterizerContext::ReleaseRenderTarget(CKDWORD Texture)
+{
+    for (int i = 0; i < m_RenderTargets.Size(); ++i)
+        if (m_RenderTargets[i].Texture == Texture)
+        {
+            m_RenderTargets[i].InUse = FALSE;
+            m_RenderTargets[i].LastUsedFrame = m_FrameCounter;
+            return;
+        }
+}
+
+void CKRasterizerContext::UpdateRenderTargetPool()
+{
+    // End of the frame : transient targets go back to the pool and
+    // the targets that were not used for a while are destroyed
+    XArray<CKDWORD> unused;
+    for (int i = m_RenderTargets.Size() - 1; i >= 0; --i)
+    {
+        CKPooledRenderTarget &target = m_RenderTargets[i];
+        if (target.InUse && target.Transient)
+        {
+            target.InUse = FALSE;
+            target.LastUsedFrame = m_FrameCounter;
+        }
+        if (!target.InUse && m_FrameCounter - target.LastUsedFrame >= CKRST_RENDERTARGET_MAXUNUSEDFRAMES)
+        {
+            unused.PushBack(target.Texture);
+            m_RenderTargets.RemoveAt(i);
+        }
+    }
+
+    if (m_Driver && m_Driver->m_Owner)
+        for (int i = 0; i < unused.Size(); ++i)
+            m_Driver->m_Owner->ReleaseObjectIndex(unused[i], CKRST_OBJ_TEXTURE);
+}
+
+void CKRasterizerContext::RemovePooledRenderTarget(CKDWORD Texture)
+{
+    for (int i = 0; i < m_RenderTargets.Size(); ++i)
+        if (m_RenderTargets[i].Texture == Texture)
+        {
+            m_RenderTargets.RemoveAt(i);
+            return;
+        }
+}
+
+void CKRasterizerContext::ReleaseRenderTargetPool()
+{
+    // Empty the pool first : releasing the targets calls DeleteObject back
+    XArray<CKPooledRenderTarget> targets = m_RenderTargets;
+    m_RenderTargets.Resize(0);
+    if (m_Driver && m_Driver->m_Owner)
+        for (int i = 0; i < targets.Size(); ++i)
+            m_Driver->m_Owner->ReleaseObjectIndex(targets[i].Texture, CKRST_OBJ_TEXTURE);
+}
+
+// Image of a level of a texture, returns its size in bytes
+static CKDWORD GetTextureLevelDesc(const CKTextureDesc *Texture, int Level, VxImageDescEx &Desc)
+{
+    Desc = Texture->Format;
+    Desc.Width = XMax(Texture->Format.Width >> Level, 1);
+    Desc.Height = XMax(Texture->Format.Height >> Level, 1);
+    Desc.Image = NULL;
+
+    VX_PIXELFORMAT format = VxImageDesc2PixelFormat(Texture->Format);
+    int size = CKRSTGetDXTImageSize(format, Desc.Width, Desc.Height);
+    if (size > 0)
+    {
+        Desc.BytesPerLine = ((Desc.Width + 3) / 4) * CKRSTGetDXTBlockSize(format);
+        return size;
+    }
+    Desc.BytesPerLine = Desc.Width * (Desc.BitsPerPixel / 8);
+    return Desc.BytesPerLine * Desc.Height;
+}
+
+// Reads a level of a streamed texture (job of the thread pool)
+static void ReadStreamedMip(void *Data, int Index)
+{
+    CKStreamedMipRead *read = (CKStreamedMipRead *)Data;
+    read->Result = read->Read(read->Texture, read->Level, read->Desc, read->Argument);
+}
+
+CKBOOL CKRasterizerContext::StreamTexture(CKDWORD Texture, CKRST_MIPREADFUNCTION Read, void *Argument, int ResidentSize)
+{
+    if (!Read || !PrepareTextureLoad(Texture))
+        return FALSE;
+    CKTextureDesc *desc = GetTextureData(Texture);
+    StopTextureStreaming(Texture);
+
+    CKStreamedTexture st;
+    st.Read = Read;
+    st.Argument = Argument;
+    st.LevelCount = 1;
+    while (st.LevelCount <= (int)desc->MipMapCount && ((desc->Format.Width | desc->Format.Height) >> st.LevelCount) != 0)
+        ++st.LevelCount;
+    while (st.ResidentLevel < st.LevelCount - 1 &&
+           XMax(desc->Format.Width >> st.ResidentLevel, desc->Format.Height >> st.ResidentLevel) > ResidentSize)
+        ++st.ResidentLevel;
+
+    // The resident levels are read now
+    XArray<CKBYTE> data;
+    for (int level = st.LevelCount - 1; level >= st.ResidentLevel; --level)
+    {
+        VxImageDescEx levelDesc;
+        CKDWORD size = GetTextureLevelDesc(desc, level, levelDesc);
+        data.Resize(size);
+        levelDesc.Image = (XBYTE *)data.Begin();
+        if (!Read(Texture, level, levelDesc, Argument) || !LoadTexture(Texture, levelDesc, level))
+            return FALSE;
+        st.Memory += size;
+    }
+    st.LoadedLevel = st.ResidentLevel;
+    st.WantedLevel = st.ResidentLevel;
+    st.RequestFrame = m_FrameCounter;
+
+    m_StreamingMemory += st.Memory;
+    m_StreamedTextures.Insert(Texture, st, TRUE);
+    return TRUE;
+}
+
+void CKRasterizerContext::StopTextureStreaming(CKDWORD Texture)
+{
+    CKStreamedTexture *st = m_StreamedTextures.FindPtr(Texture);
+    if (!st)
+        return;
+
+    // A level being read is dropped when the read completes
+    if (st->Pending)
+        st->Pending->Cancelled = TRUE;
+    m_StreamingMemory -= st->Memory;
+    m_StreamedTextures.Remove(Texture);
+}
+
+void CKRasterizerContext::RequestTextureScreenSize(CKDWORD Texture, float Width, float Height)
+{
+    CKStreamedTexture *st = m_StreamedTextures.FindPtr(Texture);
+    CKTextureDesc *desc = GetTextureData(Texture);
+    if (!st || !desc || Width <= 0.0f || Height <= 0.0f)
+        return;
+
+    // Finest level with at least one texel per pixel
+    float texels = XMax(desc->Format.Width / Width, desc->Format.Height / Height);
+    int level = 0;
+    while (texels >= 2.0f && level < st->ResidentLevel)
+    {
+        texels *= 0.5f;
+        ++level;
+    }
+
+    float area = Width * Height;
+    if (st->RequestFrame != m_FrameCounter)
+    {
+        st->RequestFrame = m_FrameCounter;
+        st->WantedLevel = level;
+        st->Priority = area;
+    }
+    else
+    {
+        st->WantedLevel = XMin(st->WantedLevel, level);
+        st->Priority = XMax(st->Priority, area);
+    }
+}
+
+void CKRasterizerContext::RequestTextureBox(CKDWORD Texture, const VxBbox &Box, CKBOOL World)
+{
+    if (!m_StreamedTextures.FindPtr(Texture))
+        return;
+
+    VxRect extents;
+    if (ComputeBoxVisibility(Box, World, &extents) == CBV_OFFSCREEN)
+        return;
+    RequestTextureScreenSize(Texture, extents.GetWidth(), extents.GetHeight());
+}
+
+void CKRasterizerContext::SetTextureStreamingBudget(CKDWORD Bytes, int MaxReads)
+{
+    m_StreamingBudget = Bytes;
+    m_StreamingMaxReads = (MaxReads > 0) ? MaxReads : 1;
+}
+
+int CKRasterizerContext::GetStreamedTextureLevel(CKDWORD Texture)
+{
+    CKStreamedTexture *st = m_StreamedTextures.FindPtr(Texture);
+    return st ? st->LoadedLevel : 0;
+}
+
+void CKRasterizerContext::UpdateTextureStreaming()
+{
+    if (m_StreamedTextures.Size() == 0 && m_StreamingReads.Size() == 0)
+        return;
+
+    CKRasterizerThreadPool *pool = m_Driver->m_Owner->GetThreadPool();
+
+    // Load the levels read
+    int i;
+    for (i = m_StreamingReads.Size() - 1; i >= 0; --i)
+    {
+        CKStreamedMipRead *read = m_StreamingReads[i];
+        if (!pool->IsComplete(read->Ticket))
+            continue;
+        m_StreamingReads.RemoveAt(i);
+
+        CKStreamedTexture *st = read->Cancelled ? NULL : m_StreamedTextures.FindPtr(read->Texture);
+        if (st)
+        {
+            st->Pending = NULL;
+            if (read->Result && PrepareTextureLoad(read->Texture) && LoadTexture(read->Texture, read->Desc, read->Level))
+            {
+                st->LoadedLevel = read->Level;
+                ++m_FrameStats.StreamedLevels;
+            }
+            else
+            {
+                st->Memory -= read->Size;
+                m_StreamingMemory -= read->Size;
+            }
+        }
+        delete read;
+    }
+
+    // Textures not drawn during the frame only need their resident levels
+    XHashTable<CKStreamedTexture, CKDWORD>::Iterator it;
+    for (it = m_StreamedTextures.Begin(); it != m_StreamedTextures.End(); ++it)
+    {
+        CKStreamedTexture &st = *it;
+        if (st.RequestFrame != m_FrameCounter)
+        {
+            st.WantedLevel = st.ResidentLevel;
+            st.Priority = 0.0f;
+        }
+    }
+
+    // The budget may have been lowered
+    MakeStreamingRoom(0, 1e30f);
+
+    // Read the next level of the textures drawn the biggest
+    while (m_StreamingReads.Size() < m_StreamingMaxReads)
+    {
+        CKDWORD texture = 0;
+        CKStreamedTexture *best = NULL;
+        for (it = m_StreamedTextures.Begin(); it != m_StreamedTextures.End(); ++it)
+        {
+            CKStreamedTexture &st = *it;
+            if (st.Pending || st.LoadedLevel <= st.WantedLevel)
+                continue;
+            if (!best || st.Priority > best->Priority)
+            {
+                best = &st;
+                texture = it.GetKey();
+            }
+        }
+        if (!best)
+            break;
+
+        CKTextureDesc *desc = GetTextureData(texture);
+        if (!desc)
+            break;
+        CKStreamedMipRead *read = new CKStreamedMipRead;
+        read->Size = GetTextureLevelDesc(desc, best->LoadedLevel - 1, read->Desc);
+        if (!MakeStreamingRoom(read->Size, best->Priority))
+        {
+            delete read;
+            break;
+        }
+        read->Texture = texture;
+        read->Level = best->LoadedLevel - 1;
+        read->Read = best->Read;
+        read->Argument = best->Argument;
+        read->Data.Resize(read->Size);
+        read->Desc.Image = (XBYTE *)read->Data.Begin();
+        read->Result = FALSE;
+        read->Cancelled = FALSE;
+
+        best->Pending = read;
+        best->Memory += read->Size;
+        m_StreamingMemory += read->Size;
+        m_StreamingReads.PushBack(read);
+        read->Ticket = pool->Submit(ReadStreamedMip, read, 1);
+    }
+}
+
+CKBOOL CKRasterizerContext::MakeStreamingRoom(CKDWORD Size, float Priority)
+{
+    if (m_StreamingBudget == 0)
+        return TRUE;
+
+    while (m_StreamingMemory + Size > m_StreamingBudget)
+    {
+        // Evict the finest level of the least needed texture : levels
+        // no longer needed first, then levels of less drawn textures
+        CKDWORD texture = 0;
+        CKStreamedTexture *victim = NULL;
+        CKBOOL victimUnneeded = FALSE;
+        XHashTable<CKStreamedTexture, CKDWORD>::Iterator it;
+        for (it = m_StreamedTextures.Begin(); it != m_StreamedTextures.End(); ++it)
+        {
+            CKStreamedTexture &st = *it;
+            if (st.Pending || st.LoadedLevel >= st.ResidentLevel)
+                continue;
+            CKBOOL unneeded = st.LoadedLevel < st.WantedLevel;
+            if (!unneeded && st.Priority >= Priority)
+                continue;
+            if (!victim || (unneeded && !victimUnneeded) || (unneeded == victimUnneeded && st.Priority < victim->Priority))
+            {
+                victim = &st;
+                victimUnneeded = unneeded;
+                texture = it.GetKey();
+            }
+        }
+        if (!victim)
+            return FALSE;
+
+        VxImageDescEx levelDesc;
+        CKTextureDesc *desc = GetTextureData(texture);
+        CKDWORD size = desc ? GetTextureLevelDesc(desc, victim->LoadedLevel, levelDesc) : 0;
+        ++victim->LoadedLevel;
+        victim->Memory -= size;
+        m_StreamingMemory -= size;
+        ++m_FrameStats.EvictedLevels;
+    }
+    return TRUE;
+}
+
+void CKRasterizerContext::ReleaseStreamedTextures()
+{
+    // Reads in progress use the read functions : wait for them (the
+    // pool is not restarted if the rasterizer is being destroyed)
+    for (int i = 0; i < m_StreamingReads.Size(); ++i)
+    {
+        m_Driver->m_Owner->m_ThreadPool.Wait(m_StreamingReads[i]->Ticket);
+        delete m_StreamingReads[i];
+    }
+    m_StreamingReads.Resize(0);
+    m_StreamedTextures.Clear();
+    m_StreamingMemory = 0;
+}
+
+// Do two images have the same size and pixel format ?
+static CKBOOL SameImageFormat(const VxImageDescEx &a, const VxImageDescEx &b)
+{
+    return a.Width == b.Width && a.Height == b.Height && a.BytesPerLine == b.BytesPerLine &&
+           a.BitsPerPixel == b.BitsPerPixel && a.RedMask == b.RedMask && a.GreenMask == b.GreenMask &&
+           a.BlueMask == b.BlueMask && a.AlphaMask == b.AlphaMask && a.Flags == b.Flags;
+}
+
+CKBOOL CKRasterizerContext::LoadSharedTexture(CKDWORD Texture, const VxImageDescEx &SurfDesc, int miplevel)
+{
+    // The content of the texture changes : it needs its own desc
+    if (!PrepareTextureLoad(Texture))
+        return FALSE;
+    CKTextureDesc *desc = GetTextureData(Texture);
+
+    if (!SurfDesc.Image || (miplevel != -1 && !(miplevel == 0 && desc->MipMapCount == 0)))
+        return LoadTexture(Texture, SurfDesc, miplevel);
+
+    // The texture description is part of the content
+    CKDWORD textureDesc[9] = {desc->Flags & ~CKRST_TEXTURE_VALID, (CKDWORD)desc->Format.Width, (CKDWORD)desc->Format.Height,
+                              (CKDWORD)desc->Format.BitsPerPixel, desc->Format.RedMask, desc->Format.GreenMask,
+                              desc->Format.BlueMask, desc->Format.AlphaMask, desc->MipMapCount};
+    CKImageHash hash = CKRSTHashImage(SurfDesc, CKRSTHashMemory(textureDesc, sizeof(textureDesc)));
+
+    // The hash is checked against the image format before the desc of the texture is deleted
+    CKSharedTexture *shared = m_SharedTextures.FindPtr(hash);
+    if (shared && SameImageFormat(shared->Image, SurfDesc))
+    {
+        delete m_Textures[Texture];
+        m_Textures[Texture] = shared->Desc;
+        ++shared->RefCount;
+        m_TextureContents.Insert(Texture, hash, TRUE);
+        m_SharedTextureMemorySaved += shared->Size;
+        return TRUE;
+    }
+
+    if (!LoadTexture(Texture, SurfDesc, miplevel))
+        return FALSE;
+    // A different image with the same hash is loaded but not shared
+    if (shared)
+        return TRUE;
+
+    CKSharedTexture entry;
+    entry.Desc = desc;
+    entry.RefCount = 1;
+    entry.Image = SurfDesc;
+    entry.Image.Image = NULL;
+    entry.Image.ColorMap = NULL;
+    for (int level = 0; level <= (int)desc->MipMapCount; ++level)
+    {
+        VxImageDescEx levelDesc;
+        entry.Size += GetTextureLevelDesc(desc, level, levelDesc);
+    }
+    m_SharedTextures.Insert(hash, entry, TRUE);
+    m_TextureContents.Insert(Texture, hash, TRUE);
+    return TRUE;
+}
+
+CKBOOL CKRasterizerContext::IsTextureShared(CKDWORD Texture)
+{
+    CKImageHash *hash = m_TextureContents.FindPtr(Texture);
+    if (!hash)
+        return FALSE;
+    CKSharedTexture *shared = m_SharedTextures.FindPtr(*hash);
+    return shared && shared->RefCount > 1;
+}
+
+// Gives a texture loaded with LoadSharedTexture its own desc and forgets its content : called
+// before the lib loads another image in a texture. Returns FALSE if the texture has no desc
+CKBOOL CKRasterizerContext::PrepareTextureLoad(CKDWORD Texture)
+{
+    CKTextureDesc *desc = GetTextureData(Texture);
+    if (!desc)
+        return FALSE;
+    if (!IsTextureShared(Texture))
+    {
+        UnshareTexture(Texture);
+        return TRUE;
+    }
+
+    CKTextureDesc ntex;
+    ntex.Flags = desc->Flags & ~CKRST_TEXTURE_VALID;
+    ntex.Format = desc->Format;
+    ntex.MipMapCount = desc->MipMapCount;
+    UnshareTexture(Texture);
+    return CreateObject(Texture, CKRST_OBJ_TEXTURE, &ntex) && GetTextureData(Texture);
+}
+
+// Forgets the content of a texture, returns TRUE if its desc was shared (it is then set to NULL)
+CKBOOL CKRasterizerContext::UnshareTexture(CKDWORD Texture)
+{
+    CKImageHash *hash = m_TextureContents.FindPtr(Texture);
+    if (!hash)
+        return FALSE;
+
+    CKImageHash content = *hash;
+    m_TextureContents.Remove(Texture);
+
+    CKSharedTexture *shared = m_SharedTextures.FindPtr(content);
+    if (!shared)
+        return FALSE;
+    if (shared->RefCount <= 1)
+    {
+        m_SharedTextures.Remove(content);
+        return FALSE;
+    }
+
+    // Another texture becomes the owner if this one held the desc
+    --shared->RefCount;
+    m_SharedTextureMemorySaved -= shared->Size;
+    m_Textures[Texture] = NULL;
+    return TRUE;
+}
+
+void CKRasterizerContext::ReleaseSharedTextures()
+{
+    // Leave a single texture pointing to each shared desc so that it is deleted once
+    for (XHashTable<CKImageHash, CKDWORD>::Iterator it = m_TextureContents.Begin(); it != m_TextureContents.End(); ++it)
+    {
+        CKSharedTexture *shared = m_SharedTextures.FindPtr(*it);
+        if (shared && shared->RefCount > 1)
+        {
+            --shared->RefCount;
+            m_Textures[it.GetKey()] = NULL;
+        }
+    }
+    m_TextureContents.Clear();
+    m_SharedTextures.Clear();
+    m_SharedTextureMemorySaved = 0;
+}
+
+// Converts the image of an asynchronous load (job of the thread pool)
+static void ConvertAsyncLoad(void *Data, int Index)
+{
+    CKAsyncLoad *load = (CKAsyncLoad *)Data;
+    load->Data.Resize(load->Size);
+    load->Desc.Image = (XBYTE *)load->Data.Begin();
+
+    VX_PIXELFORMAT format = VxImageDesc2PixelFormat(load->Desc);
+    CKBOOL converted;
+    if (CKRSTGetDXTBlockSize(format) > 0)
+        converted = CKRSTCompressDXT(load->Src, format, load->Data.Begin());
+    else
+        converted = CKRSTConvertPixels(load->Src, load->Desc);
+
+    // The implementation will convert the image itself
+    if (!converted)
+    {
+        load->Desc = load->Src;
+        load->Size = load->Src.BytesPerLine * load->Src.Height;
+    }
+}
+
+CKDWORD CKRasterizerContext::LoadTextureAsync(CKDWORD Texture, const VxImageDescEx &SurfDesc, int miplevel,
+                                              CKRST_LOADCALLBACK Callback, void *Argument)
+{
+    CKTextureDesc *desc = GetTextureData(Texture);
+    if (!desc || !SurfDesc.Image)
+        return 0;
+
+    CKAsyncLoad *load = new CKAsyncLoad;
+    load->Type = CKRST_OBJ_TEXTURE;
+    load->Object = Texture;
+    load->MipLevel = miplevel;
+    load->CubeMap = FALSE;
+    load->Face = CKRST_CUBEFACE_XPOS;
+    load->Src = SurfDesc;
+    load->Callback = Callback;
+    load->Argument = Argument;
+    return SubmitAsyncLoad(load, desc->Format);
+}
+
+CKDWORD CKRasterizerContext::LoadCubeMapTextureAsync(CKDWORD Texture, const VxImageDescEx &SurfDesc, CKRST_CUBEFACE Face,
+                                                     int miplevel, CKRST_LOADCALLBACK Callback, void *Argument)
+{
+    CKTextureDesc *desc = GetTextureData(Texture);
+    if (!desc || !SurfDesc.Image)
+        return 0;
+
+    CKAsyncLoad *load = new CKAsyncLoad;
+    load->Type = CKRST_OBJ_TEXTURE;
+    load->Object = Texture;
+    load->MipLevel = miplevel;
+    load->CubeMap = TRUE;
+    load->Face = Face;
+    load->Src = SurfDesc;
+    load->Callback = Callback;
+    load->Argument = Argument;
+    return SubmitAsyncLoad(load, desc->Format);
+}
+
+CKDWORD CKRasterizerContext::LoadSpriteAsync(CKDWORD Sprite, const VxImageDescEx &SurfDesc, CKRST_LOADCALLBACK Callback, void *Argument)
+{
+    CKSpriteDesc *desc = GetSpriteData(Sprite);
+    if (!desc || !SurfDesc.Image)
+        return 0;
+
+    CKAsyncLoad *load = new CKAsyncLoad;
+    load->Type = CKRST_OBJ_SPRITE;
+    load->Object = Sprite;
+    load->MipLevel = 0;
+    load->CubeMap = FALSE;
+    load->Face = CKRST_CUBEFACE_XPOS;
+    load->Src = SurfDesc;
+    load->Callback = Callback;
+    load->Argument = Argument;
+    return SubmitAsyncLoad(load, desc->Format);
+}
+
+CKDWORD CKRasterizerContext::SubmitAsyncLoad(CKAsyncLoad *Load, const VxImageDescEx &Format)
+{
+    Load->Ticket = ++m_LoadTicket;
+    if (Load->Ticket == 0)
+        Load->Ticket = ++m_LoadTicket;
+    Load->Cancelled = FALSE;
+    Load->Job = 0;
+
+    // Image in the object format, of the size of the given image
+    Load->Desc = Format;
+    Load->Desc.Width = Load->Src.Width;
+    Load->Desc.Height = Load->Src.Height;
+    Load->Desc.Image = NULL;
+    VX_PIXELFORMAT srcFormat = VxImageDesc2PixelFormat(Load->Src);
+    VX_PIXELFORMAT dstFormat = VxImageDesc2PixelFormat(Format);
+    int dxtSize = CKRSTGetDXTImageSize(dstFormat, Load->Desc.Width, Load->Desc.Height);
+    if (dxtSize > 0)
+    {
+        Load->Desc.BytesPerLine = ((Load->Desc.Width + 3) / 4) * CKRSTGetDXTBlockSize(dstFormat);
+        Load->Size = dxtSize;
+    }
+    else
+    {
+        Load->Desc.BytesPerLine = Load->Desc.Width * (Load->Desc.BitsPerPixel / 8);
+        Load->Size = Load->Desc.BytesPerLine * Load->Desc.Height;
+    }
+
+    if (srcFormat == dstFormat || (dxtSize > 0 ? !CKRSTGetPixelConverter(srcFormat, _32_ARGB8888) : !CKRSTGetPixelConverter(srcFormat, dstFormat)))
+    {
+        // Nothing the lib can convert : uploaded as is
+        Load->Desc = Load->Src;
+        Load->Size = Load->Src.BytesPerLine * Load->Src.Height;
+    }
+    else
+    {
+        Load->Job = m_Driver->m_Owner->GetThreadPool()->Submit(ConvertAsyncLoad, Load, 1);
+    }
+
+    m_AsyncLoads.PushBack(Load);
+    return Load->Ticket;
+}
+
+CKBOOL CKRasterizerContext::IsLoadComplete(CKDWORD Ticket)
+{
+    for (int i = 0; i < m_AsyncLoads.Size(); ++i)
+        if (m_AsyncLoads[i]->Ticket == Ticket)
+            return FALSE;
+    return TRUE;
+}
+
+void CKRasterizerContext::WaitLoad(CKDWORD Ticket)
+{
+    if (!IsLoadComplete(Ticket))
+        UploadAsyncLoads(Ticket);
+}
+
+// Uploads the converted loads in order, within the frame budget or up to Ticket (waiting for their conversion)
+void CKRasterizerContext::UploadAsyncLoads(CKDWORD Ticket)
+{
+    CKRasterizerThreadPool *pool = &m_Driver->m_Owner->m_ThreadPool;
+    CKDWORD uploaded = 0;
+    while (m_AsyncLoads.Size() > 0)
+    {
+        CKAsyncLoad *load = m_AsyncLoads[0];
+        if (Ticket != 0)
+        {
+            pool->Wait(load->Job);
+        }
+        else
+        {
+            if (!pool->IsComplete(load->Job))
+                break;
+            if (m_UploadBudget != 0 && uploaded > 0 && uploaded + load->Size > m_UploadBudget)
+                break;
+        }
+        m_AsyncLoads.RemoveAt(0);
+
+        CKBOOL result = FALSE;
+        if (!load->Cancelled)
+        {
+            if (load->Type == CKRST_OBJ_SPRITE)
+                result = LoadSprite(load->Object, load->Desc);
+            else if (!PrepareTextureLoad(load->Object))
+                result = FALSE;
+            else if (load->CubeMap)
+                result = LoadCubeMapTexture(load->Object, load->Desc, load->Face, load->MipLevel);
+            else
+                result = LoadTexture(load->Object, load->Desc, load->MipLevel);
+            uploaded += load->Size;
+            ++m_FrameStats.AsyncUploads;
+            m_FrameStats.AsyncUploadBytes += load->Size;
+        }
+        if (load->Callback)
+            load->Callback(load->Ticket, result, load->Argument);
+
+        CKDWORD ticket = load->Ticket;
+        delete load;
+        if (ticket == Ticket)
+            break;
+    }
+}
+
+void CKRasterizerContext::CancelAsyncLoads(CKRST_OBJECTTYPE Type, CKDWORD Object)
+{
+    for (int i = 0; i < m_AsyncLoads.Size(); ++i)
+        if (m_AsyncLoads[i]->Type == Type && m_AsyncLoads[i]->Object == Object)
+            m_AsyncLoads[i]->Cancelled = TRUE;
+}
+
+void CKRasterizerContext::ReleaseAsyncLoads()
+{
+    // The conversions in progress use the load data : wait for them
+    for (int i = 0; i < m_AsyncLoads.Size(); ++i)
+    {
+        m_Driver->m_Owner->m_ThreadPool.Wait(m_AsyncLoads[i]->Job);
+        delete m_AsyncLoads[i];
+    }
+    m_AsyncLoads.Resize(0);
+}
+
+void CKRasterizerContext::NextFrame()
+{
+    FlushBatch();
+    UpdateTextureStreaming();
+    UploadAsyncLoads(0);
+    FlushSpriteAtlas();
+    UpdateRenderTargetPool();
+
+    // End of the frame : remember the fence of its slot
+    m_FrameFences[m_FrameSlot] = InsertFence();
+
+    m_LastFrameStats = m_FrameStats;
+    memset(&m_FrameStats, 0, sizeof(m_FrameStats));
+    ++m_FrameCounter;
+    m_FrameSlot = m_FrameCounter % m_FramesInFlight;
+
+    // The resources of the new slot may only be rewritten once the
+    // frame that last used them has been processed
+    CKDWORD fence = m_FrameFences[m_FrameSlot];
+    if (fence != 0 && !IsFenceComplete(fence))
+    {
+        ++m_FrameStats.FenceWaits;
+        WaitFence(fence);
+    }
+}
+
+void CKRasterizerContext::SetFramesInFlight(CKDWORD Count)
+{
+    if (Count < 1)
+        Count = 1;
+    if (Count > CKRST_MAX_FRAMES_IN_FLIGHT)
+        Count = CKRST_MAX_FRAMES_IN_FLIGHT;
+    if (Count == m_FramesInFlight)
+        return;
+
+    // Wait for all the frames in flight before changing the ring
+    for (CKDWORD i = 0; i < CKRST_MAX_FRAMES_IN_FLIGHT; ++i)
+    {
+        if (m_FrameFences[i] != 0 && !IsFenceComplete(m_FrameFences[i]))
+            WaitFence(m_FrameFences[i]);
+        m_FrameFences[i] = 0;
+    }
+
+    ReleaseDynamicBuffers();
+    m_FramesInFlight = Count;
+    m_FrameSlot = m_FrameCounter % m_FramesInFlight;
+}
+
+CKDWORD CKRasterizerContext::InsertFence()
+{
+    // Simulated GPU : the previous fence completes when a new one is inserted
+    m_CompletedFence = m_LastFence;
+    if (++m_LastFence == 0)
+        ++m_LastFence;
+    return m_LastFence;
+}
+
+CKBOOL CKRasterizerContext::IsFenceComplete(CKDWORD Fence)
+{
+    return Fence <= m_CompletedFence;
+}
+
+void CKRasterizerContext::WaitFence(CKDWORD Fence)
+{
+    if (Fence > m_CompletedFence && Fence <= m_LastFence)
+        m_CompletedFence = Fence;
+}
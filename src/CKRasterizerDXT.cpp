@@ -0,0 +1,895 @@
+#include "CKRasterizer.h"
+#include "CKRasterizerSIMD.h"
+
+/*******************************************************************
+ DXT (BC1/BC2/BC3) block compression
+  - Color endpoints :
+     - fast mode : bounding box of the block colors, on the diagonal
+       following the sign of the color covariance, inset by 1/16
+     - high quality mode : principal axis of the colors, then the
+       endpoints are refined by least squares from the chosen indices
+  - DXT1 blocks with pixels whose alpha is below 128 use the 3 colors
+    mode (index 3 is transparent black)
+  - DXT3 alpha is quantized to 4 bits, DXT5 alpha uses the 8 values
+    mode (and the 6 values + 0 + 255 mode in high quality)
+ DXT decompression
+  - Blocks are decoded to ARGB8888 (DXT2 and DXT4 are decoded as DXT3
+    and DXT5, the colors stay premultiplied)
+  - The color block of DXT2-5 always uses the 4 colors mode
+*******************************************************************/
+
+static inline int Clamp255(int v)
+{
+    return (v < 0) ? 0 : ((v > 255) ? 255 : v);
+}
+
+static inline CKWORD PackColor565(int r, int g, int b)
+{
+    return (CKWORD)((((Clamp255(r) * 31 + 127) / 255) << 11) | (((Clamp255(g) * 63 + 127) / 255) << 5) | ((Clamp255(b) * 31 + 127) / 255));
+}
+
+static inline void UnpackColor565(CKWORD c, int *rgb)
+{
+    int r = (c >> 11) & 31;
+    int g = (c >> 5) & 63;
+    int b = c & 31;
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+}
+
+static inline int ColorDistance(const int *a, CKDWORD c)
+{
+    int dr = a[0] - (int)((c >> 16) & 0xFF);
+    int dg = a[1] - (int)((c >> 8) & 0xFF);
+    int db = a[2] - (int)(c & 0xFF);
+    return dr * dr + dg * dg + db * db;
+}
+
+// Colors of the block palette as decoded
+static int BuildColorPalette(CKWORD c0, CKWORD c1, CKBOOL FourColors, int Palette[4][3])
+{
+    UnpackColor565(c0, Palette[0]);
+    UnpackColor565(c1, Palette[1]);
+    for (int k = 0; k < 3; ++k)
+    {
+        if (FourColors)
+        {
+            Palette[2][k] = (2 * Palette[0][k] + Palette[1][k]) / 3;
+            Palette[3][k] = (Palette[0][k] + 2 * Palette[1][k]) / 3;
+        }
+        else
+        {
+            Palette[2][k] = (Palette[0][k] + Palette[1][k]) / 2;
+            Palette[3][k] = 0;
+        }
+    }
+    return FourColors ? 4 : 3;
+}
+
+// Chooses the nearest palette color of each pixel, returns the total error
+static int ChooseColorIndices(const CKDWORD *Pixels, CKWORD Transparent, const int Palette[4][3], int Count, CKDWORD &Indices)
+{
+    int error = 0;
+    Indices = 0;
+    for (int i = 0; i < 16; ++i)
+    {
+        int best = 3;
+        if (!(Transparent & (1 << i)))
+        {
+            int bestDist = ColorDistance(Palette[0], Pixels[i]);
+            best = 0;
+            for (int k = 1; k < Count; ++k)
+            {
+                int dist = ColorDistance(Palette[k], Pixels[i]);
+                if (dist < bestDist)
+                {
+                    bestDist = dist;
+                    best = k;
+                }
+            }
+            error += bestDist;
+        }
+        Indices |= (CKDWORD)best << (2 * i);
+    }
+    return error;
+}
+
+// Quantizes the endpoints and chooses the indices : Color[] receives the two 565 colors
+static int EncodeColorEndpoints(const CKDWORD *Pixels, CKWORD Transparent, const int *Max, const int *Min, CKWORD *Color, CKDWORD &Indices)
+{
+    CKWORD c0 = PackColor565(Max[0], Max[1], Max[2]);
+    CKWORD c1 = PackColor565(Min[0], Min[1], Min[2]);
+    int palette[4][3];
+
+    if (Transparent)
+    {
+        // 3 colors mode : c0 <= c1
+        if (c0 > c1)
+        {
+            CKWORD t = c0;
+            c0 = c1;
+            c1 = t;
+        }
+        BuildColorPalette(c0, c1, FALSE, palette);
+        Color[0] = c0;
+        Color[1] = c1;
+        return ChooseColorIndices(Pixels, Transparent, palette, 3, Indices);
+    }
+
+    // 4 colors mode : c0 > c1 (a single color block only uses index 0)
+    if (c0 < c1)
+    {
+        CKWORD t = c0;
+        c0 = c1;
+        c1 = t;
+    }
+    Color[0] = c0;
+    Color[1] = c1;
+    if (c0 == c1)
+    {
+        BuildColorPalette(c0, c1, TRUE, palette);
+        Indices = 0;
+        int error = 0;
+        for (int i = 0; i < 16; ++i)
+            error += ColorDistance(palette[0], Pixels[i]);
+        return error;
+    }
+    BuildColorPalette(c0, c1, TRUE, palette);
+    return ChooseColorIndices(Pixels, 0, palette, 4, Indices);
+}
+
+// Bounding box of the pixel colors (all pixels must be opaque ones)
+static void GetColorBox(const CKDWORD *Pixels, int *Min, int *Max)
+{
+#ifdef CKRST_SSE2
+    __m128i mn = _mm_loadu_si128((const __m128i *)Pixels);
+    __m128i mx = mn;
+    for (int k = 4; k < 16; k += 4)
+    {
+        __m128i p = _mm_loadu_si128((const __m128i *)(Pixels + k));
+        mn = _mm_min_epu8(mn, p);
+        mx = _mm_max_epu8(mx, p);
+    }
+    mn = _mm_min_epu8(mn, _mm_shuffle_epi32(mn, _MM_SHUFFLE(1, 0, 3, 2)));
+    mn = _mm_min_epu8(mn, _mm_shuffle_epi32(mn, _MM_SHUFFLE(2, 3, 0, 1)));
+    mx = _mm_max_epu8(mx, _mm_shuffle_epi32(mx, _MM_SHUFFLE(1, 0, 3, 2)));
+    mx = _mm_max_epu8(mx, _mm_shuffle_epi32(mx, _MM_SHUFFLE(2, 3, 0, 1)));
+    CKDWORD minColor = (CKDWORD)_mm_cvtsi128_si32(mn);
+    CKDWORD maxColor = (CKDWORD)_mm_cvtsi128_si32(mx);
+#else
+    CKDWORD minColor = 0xFFFFFFFF, maxColor = 0;
+    for (int i = 0; i < 16; ++i)
+    {
+        for (int shift = 0; shift < 24; shift += 8)
+        {
+            CKDWORD c = Pixels[i] & (0xFF << shift);
+            if (c < (minColor & (0xFF << shift)))
+                minColor = (minColor & ~(0xFF << shift)) | c;
+            if (c > (maxColor & (0xFF << shift)))
+                maxColor = (maxColor & ~(0xFF << shift)) | c;
+        }
+    }
+#endif
+    Min[0] = (minColor >> 16) & 0xFF;
+    Min[1] = (minColor >> 8) & 0xFF;
+    Min[2] = minColor & 0xFF;
+    Max[0] = (maxColor >> 16) & 0xFF;
+    Max[1] = (maxColor >> 8) & 0xFF;
+    Max[2] = maxColor & 0xFF;
+}
+
+static void GetFastEndpoints(const CKDWORD *Pixels, int *Max, int *Min)
+{
+    GetColorBox(Pixels, Min, Max);
+
+    // Pick the diagonal of the box the colors are along (relative to green)
+    int center[3];
+    int k;
+    for (k = 0; k < 3; ++k)
+        center[k] = (Min[k] + Max[k]) >> 1;
+    int covRG = 0, covBG = 0;
+    for (int i = 0; i < 16; ++i)
+    {
+        int r = (int)((Pixels[i] >> 16) & 0xFF) - center[0];
+        int g = (int)((Pixels[i] >> 8) & 0xFF) - center[1];
+        int b = (int)(Pixels[i] & 0xFF) - center[2];
+        covRG += r * g;
+        covBG += b * g;
+    }
+    if (covRG < 0)
+    {
+        int t = Min[0];
+        Min[0] = Max[0];
+        Max[0] = t;
+    }
+    if (covBG < 0)
+    {
+        int t = Min[2];
+        Min[2] = Max[2];
+        Max[2] = t;
+    }
+
+    // Inset the box by 1/16 of its size, the extremes are rarely worth an endpoint
+    for (k = 0; k < 3; ++k)
+    {
+        int inset = (Max[k] - Min[k]) / 16;
+        Max[k] = Clamp255(Max[k] - inset);
+        Min[k] = Clamp255(Min[k] + inset);
+    }
+}
+
+static void GetPrincipalAxisEndpoints(const CKDWORD *Pixels, int *Max, int *Min)
+{
+    float mean[3] = {0.0f, 0.0f, 0.0f};
+    int i, k;
+    for (i = 0; i < 16; ++i)
+    {
+        mean[0] += (float)((Pixels[i] >> 16) & 0xFF);
+        mean[1] += (float)((Pixels[i] >> 8) & 0xFF);
+        mean[2] += (float)(Pixels[i] & 0xFF);
+    }
+    for (k = 0; k < 3; ++k)
+        mean[k] /= 16.0f;
+
+    float cov[6] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+    for (i = 0; i < 16; ++i)
+    {
+        float r = (float)((Pixels[i] >> 16) & 0xFF) - mean[0];
+        float g = (float)((Pixels[i] >> 8) & 0xFF) - mean[1];
+        float b = (float)(Pixels[i] & 0xFF) - mean[2];
+        cov[0] += r * r;
+        cov[1] += r * g;
+        cov[2] += r * b;
+        cov[3] += g * g;
+        cov[4] += g * b;
+        cov[5] += b * b;
+    }
+
+    // Power iteration, starting from the box diagonal
+    int boxMin[3], boxMax[3];
+    GetColorBox(Pixels, boxMin, boxMax);
+    float axis[3] = {(float)(boxMax[0] - boxMin[0]), (float)(boxMax[1] - boxMin[1]), (float)(boxMax[2] - boxMin[2])};
+    for (int iter = 0; iter < 4; ++iter)
+    {
+        float x = axis[0] * cov[0] + axis[1] * cov[1] + axis[2] * cov[2];
+        float y = axis[0] * cov[1] + axis[1] * cov[3] + axis[2] * cov[4];
+        float z = axis[0] * cov[2] + axis[1] * cov[4] + axis[2] * cov[5];
+        float m = XMax((float)fabs(x), XMax((float)fabs(y), (float)fabs(z)));
+        if (m < 1e-6f)
+            break;
+        axis[0] = x / m;
+        axis[1] = y / m;
+        axis[2] = z / m;
+    }
+
+    float minDot = 1e30f, maxDot = -1e30f;
+    for (i = 0; i < 16; ++i)
+    {
+        float d = ((float)((Pixels[i] >> 16) & 0xFF) - mean[0]) * axis[0] +
+                  ((float)((Pixels[i] >> 8) & 0xFF) - mean[1]) * axis[1] +
+                  ((float)(Pixels[i] & 0xFF) - mean[2]) * axis[2];
+        if (d < minDot)
+            minDot = d;
+        if (d > maxDot)
+            maxDot = d;
+    }
+    float len2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+    if (len2 < 1e-6f)
+        len2 = 1.0f;
+    for (k = 0; k < 3; ++k)
+    {
+        Max[k] = Clamp255((int)(mean[k] + axis[k] * maxDot / len2 + 0.5f));
+        Min[k] = Clamp255((int)(mean[k] + axis[k] * minDot / len2 + 0.5f));
+    }
+}
+
+// Least squares endpoints for the given 4 colors mode indices, returns FALSE if they cannot be computed
+static CKBOOL RefineEndpoints(const CKDWORD *Pixels, CKDWORD Indices, int *Max, int *Min)
+{
+    static const float weights[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    float ax[3] = {0.0f, 0.0f, 0.0f}, bx[3] = {0.0f, 0.0f, 0.0f};
+    for (int i = 0; i < 16; ++i)
+    {
+        float a = weights[(Indices >> (2 * i)) & 3];
+        float b = 1.0f - a;
+        float c[3] = {(float)((Pixels[i] >> 16) & 0xFF), (float)((Pixels[i] >> 8) & 0xFF), (float)(Pixels[i] & 0xFF)};
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        for (int k = 0; k < 3; ++k)
+        {
+            ax[k] += a * c[k];
+            bx[k] += b * c[k];
+        }
+    }
+    float det = aa * bb - ab * ab;
+    if (fabs(det) < 1e-6f)
+        return FALSE;
+    float inv = 1.0f / det;
+    for (int k = 0; k < 3; ++k)
+    {
+        Max[k] = Clamp255((int)((ax[k] * bb - bx[k] * ab) * inv + 0.5f));
+        Min[k] = Clamp255((int)((bx[k] * aa - ax[k] * ab) * inv + 0.5f));
+    }
+    return TRUE;
+}
+
+static void CompressColorBlock(const CKDWORD *Pixels, CKBOOL AllowTransparent, CKBOOL HighQuality, CKBYTE *Dst)
+{
+    // Transparent pixels are replaced by an opaque one for the endpoints search
+    CKDWORD colors[16];
+    CKWORD transparent = 0;
+    int firstOpaque = -1;
+    int i;
+    for (i = 0; i < 16; ++i)
+    {
+        if (AllowTransparent && (Pixels[i] >> 24) < 128)
+            transparent |= (CKWORD)(1 << i);
+        else if (firstOpaque < 0)
+            firstOpaque = i;
+    }
+
+    CKWORD *color = (CKWORD *)Dst;
+    CKDWORD *indices = (CKDWORD *)(Dst + 4);
+    if (firstOpaque < 0)
+    {
+        color[0] = 0;
+        color[1] = 0xFFFF;
+        *indices = 0xFFFFFFFF;
+        return;
+    }
+    for (i = 0; i < 16; ++i)
+        colors[i] = (transparent & (1 << i)) ? Pixels[firstOpaque] : Pixels[i];
+
+    int maxColor[3], minColor[3];
+    CKWORD bestColor[2];
+    CKDWORD bestIndices;
+    if (!HighQuality)
+    {
+        GetFastEndpoints(colors, maxColor, minColor);
+        EncodeColorEndpoints(Pixels, transparent, maxColor, minColor, bestColor, bestIndices);
+    }
+    else
+    {
+        GetPrincipalAxisEndpoints(colors, maxColor, minColor);
+        int bestError = EncodeColorEndpoints(Pixels, transparent, maxColor, minColor, bestColor, bestIndices);
+
+        // Least squares refinement (4 colors mode only)
+        for (int iter = 0; iter < 2 && !transparent && bestError > 0; ++iter)
+        {
+            CKDWORD refIndices = bestIndices;
+            if (bestColor[0] == bestColor[1] || !RefineEndpoints(Pixels, refIndices, maxColor, minColor))
+                break;
+            CKWORD refColor[2];
+            int error = EncodeColorEndpoints(Pixels, transparent, maxColor, minColor, refColor, refIndices);
+            if (error >= bestError)
+                break;
+            bestError = error;
+            bestColor[0] = refColor[0];
+            bestColor[1] = refColor[1];
+            bestIndices = refIndices;
+        }
+    }
+
+    color[0] = bestColor[0];
+    color[1] = bestColor[1];
+    *indices = bestIndices;
+}
+
+static void CompressExplicitAlphaBlock(const CKDWORD *Pixels, CKBYTE *Dst)
+{
+    for (int i = 0; i < 16; i += 2)
+    {
+        int a0 = ((Pixels[i] >> 24) * 15 + 127) / 255;
+        int a1 = ((Pixels[i + 1] >> 24) * 15 + 127) / 255;
+        Dst[i / 2] = (CKBYTE)(a0 | (a1 << 4));
+    }
+}
+
+// Interpolated alpha block : returns the error, Indices receives the 3 bits indices of pixels 0-7 and 8-15
+static int EncodeAlphaEndpoints(const CKDWORD *Pixels, int A0, int A1, CKDWORD *Indices)
+{
+    int palette[8];
+    palette[0] = A0;
+    palette[1] = A1;
+    int k;
+    if (A0 > A1)
+    {
+        for (k = 1; k < 7; ++k)
+            palette[k + 1] = ((7 - k) * A0 + k * A1) / 7;
+    }
+    else
+    {
+        for (k = 1; k < 5; ++k)
+            palette[k + 1] = ((5 - k) * A0 + k * A1) / 5;
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+
+    int error = 0;
+    Indices[0] = Indices[1] = 0;
+    for (int i = 0; i < 16; ++i)
+    {
+        int a = (int)(Pixels[i] >> 24);
+        int best = 0;
+        int bestDist = (a - palette[0]) * (a - palette[0]);
+        for (k = 1; k < 8; ++k)
+        {
+            int dist = (a - palette[k]) * (a - palette[k]);
+            if (dist < bestDist)
+            {
+                bestDist = dist;
+                best = k;
+            }
+        }
+        error += bestDist;
+        Indices[i / 8] |= (CKDWORD)best << (3 * (i & 7));
+    }
+    return error;
+}
+
+static void CompressInterpolatedAlphaBlock(const CKDWORD *Pixels, CKBOOL HighQuality, CKBYTE *Dst)
+{
+    int minAlpha = 255, maxAlpha = 0;
+    int minInner = 255, maxInner = 0; // Without the 0 and 255 values
+    for (int i = 0; i < 16; ++i)
+    {
+        int a = (int)(Pixels[i] >> 24);
+        if (a < minAlpha)
+            minAlpha = a;
+        if (a > maxAlpha)
+            maxAlpha = a;
+        if (a != 0 && a != 255)
+        {
+            if (a < minInner)
+                minInner = a;
+            if (a > maxInner)
+                maxInner = a;
+        }
+    }
+
+    int a0 = maxAlpha, a1 = minAlpha;
+    CKDWORD indices[2] = {0, 0};
+    int error = 0;
+    if (a0 != a1)
+        error = EncodeAlphaEndpoints(Pixels, a0, a1, indices);
+
+    // 6 values mode (a0 <= a1) : exact 0 and 255 for blocks mixing them with other values
+    if (HighQuality && error > 0 && minInner <= maxInner)
+    {
+        CKDWORD indices6[2];
+        int error6 = EncodeAlphaEndpoints(Pixels, minInner, maxInner, indices6);
+        if (error6 < error)
+        {
+            a0 = minInner;
+            a1 = maxInner;
+            indices[0] = indices6[0];
+            indices[1] = indices6[1];
+        }
+    }
+
+    Dst[0] = (CKBYTE)a0;
+    Dst[1] = (CKBYTE)a1;
+    for (int b = 0; b < 3; ++b)
+    {
+        Dst[2 + b] = (CKBYTE)(indices[0] >> (8 * b));
+        Dst[5 + b] = (CKBYTE)(indices[1] >> (8 * b));
+    }
+}
+
+int CKRSTGetDXTBlockSize(VX_PIXELFORMAT Format)
+{
+    switch (Format)
+    {
+    case _DXT1:
+        return 8;
+    case _DXT2:
+    case _DXT3:
+    case _DXT4:
+    case _DXT5:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+int CKRSTGetDXTImageSize(VX_PIXELFORMAT Format, int Width, int Height)
+{
+    return ((Width + 3) / 4) * ((Height + 3) / 4) * CKRSTGetDXTBlockSize(Format);
+}
+
+void CKRSTCompressDXTBlock(const CKDWORD *Pixels, VX_PIXELFORMAT Format, CKBYTE *Dst, CKDWORD Flags)
+{
+    CKBOOL highQuality = (Flags & CKRST_DXTCOMPRESS_HIGHQUALITY) != 0;
+    switch (Format)
+    {
+    case _DXT1:
+        CompressColorBlock(Pixels, TRUE, highQuality, Dst);
+        break;
+    case _DXT3:
+        CompressExplicitAlphaBlock(Pixels, Dst);
+        CompressColorBlock(Pixels, FALSE, highQuality, Dst + 8);
+        break;
+    case _DXT5:
+        CompressInterpolatedAlphaBlock(Pixels, highQuality, Dst);
+        CompressColorBlock(Pixels, FALSE, highQuality, Dst + 8);
+        break;
+    default:
+        break;
+    }
+}
+
+struct CKDXTCompressJob
+{
+    const VxImageDescEx *Src;
+    CKRST_PIXELCONVERTFUNCTION Convert;
+    VX_PIXELFORMAT Format;
+    CKBYTE *Dst;
+    CKDWORD Flags;
+    int BlockSize;
+    int BlocksPerRow;
+};
+
+// Compresses a row of blocks (job of the thread pool)
+static void CompressDXTBlockRow(void *Data, int Index)
+{
+    const CKDXTCompressJob *job = (const CKDXTCompressJob *)Data;
+    const VxImageDescEx &src = *job->Src;
+    int srcBytes = src.BitsPerPixel / 8;
+    CKBYTE *dst = job->Dst + Index * job->BlocksPerRow * job->BlockSize;
+    CKDWORD convertFlags = job->Flags & CKRST_PIXELCONVERT_SWAPRB;
+
+    CKDWORD pixels[16];
+    for (int bx = 0; bx < job->BlocksPerRow; ++bx)
+    {
+        // Pixels outside the image repeat the last row or column
+        int x = bx * 4;
+        for (int r = 0; r < 4; ++r)
+        {
+            int y = Index * 4 + r;
+            if (y >= src.Height)
+                y = src.Height - 1;
+            const CKBYTE *row = src.Image + y * src.BytesPerLine;
+            if (x + 4 <= src.Width)
+            {
+                job->Convert(row + x * srcBytes, (CKBYTE *)&pixels[r * 4], 4, x, y, convertFlags);
+            }
+            else
+            {
+                for (int c = 0; c < 4; ++c)
+                {
+                    int px = (x + c < src.Width) ? x + c : src.Width - 1;
+                    job->Convert(row + px * srcBytes, (CKBYTE *)&pixels[r * 4 + c], 1, px, y, convertFlags);
+                }
+            }
+        }
+        CKRSTCompressDXTBlock(pixels, job->Format, dst, job->Flags);
+        dst += job->BlockSize;
+    }
+}
+
+CKBOOL CKRSTCompressDXT(const VxImageDescEx &Src, VX_PIXELFORMAT Format, CKBYTE *Dst, CKDWORD Flags, CKRasterizerThreadPool *Pool)
+{
+    if (!Src.Image || !Dst || Src.Width <= 0 || Src.Height <= 0)
+        return FALSE;
+    if (Format != _DXT1 && Format != _DXT3 && Format != _DXT5)
+        return FALSE;
+
+    CKDXTCompressJob job;
+    job.Src = &Src;
+    job.Convert = CKRSTGetPixelConverter(VxImageDesc2PixelFormat(Src), _32_ARGB8888);
+    if (!job.Convert)
+        return FALSE;
+    job.Format = Format;
+    job.Dst = Dst;
+    job.Flags = Flags;
+    job.BlockSize = CKRSTGetDXTBlockSize(Format);
+    job.BlocksPerRow = (Src.Width + 3) / 4;
+
+    int rows = (Src.Height + 3) / 4;
+    if (Pool)
+    {
+        Pool->ParallelFor(CompressDXTBlockRow, &job, rows);
+    }
+    else
+    {
+        for (int r = 0; r < rows; ++r)
+            CompressDXTBlockRow(&job, r);
+    }
+    return TRUE;
+}
+
+static void DecompressColorBlock(const CKBYTE *Block, CKBOOL AllowTransparent, CKDWORD *Pixels)
+{
+    CKWORD c0 = ((const CKWORD *)Block)[0];
+    CKWORD c1 = ((const CKWORD *)Block)[1];
+    CKBOOL fourColors = !AllowTransparent || c0 > c1;
+    int palette[4][3];
+    BuildColorPalette(c0, c1, fourColors, palette);
+
+    CKDWORD colors[4];
+    for (int k = 0; k < 4; ++k)
+        colors[k] = 0xFF000000 | (palette[k][0] << 16) | (palette[k][1] << 8) | palette[k][2];
+    if (!fourColors)
+        colors[3] = 0;
+
+    CKDWORD indices = *(const CKDWORD *)(Block + 4);
+#ifdef CKRST_SSE2
+    const __m128i p0 = _mm_set1_epi32((int)colors[0]);
+    const __m128i p1 = _mm_set1_epi32((int)colors[1]);
+    const __m128i p2 = _mm_set1_epi32((int)colors[2]);
+    const __m128i p3 = _mm_set1_epi32((int)colors[3]);
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i two = _mm_set1_epi32(2);
+    const __m128i three = _mm_set1_epi32(3);
+    for (int r = 0; r < 4; ++r)
+    {
+        int row = (int)(indices >> (8 * r));
+        __m128i i = _mm_set_epi32((row >> 6) & 3, (row >> 4) & 3, (row >> 2) & 3, row & 3);
+        __m128i c = _mm_and_si128(_mm_cmpeq_epi32(i, _mm_setzero_si128()), p0);
+        c = _mm_or_si128(c, _mm_and_si128(_mm_cmpeq_epi32(i, one), p1));
+        c = _mm_or_si128(c, _mm_and_si128(_mm_cmpeq_epi32(i, two), p2));
+        c = _mm_or_si128(c, _mm_and_si128(_mm_cmpeq_epi32(i, three), p3));
+        _mm_storeu_si128((__m128i *)(Pixels + 4 * r), c);
+    }
+#else
+    for (int i = 0; i < 16; ++i)
+        Pixels[i] = colors[(indices >> (2 * i)) & 3];
+#endif
+}
+
+static void DecompressExplicitAlphaBlock(const CKBYTE *Block, CKDWORD *Pixels)
+{
+    for (int i = 0; i < 16; ++i)
+    {
+        CKDWORD a = (Block[i / 2] >> (4 * (i & 1))) & 0xF;
+        Pixels[i] = (Pixels[i] & 0x00FFFFFF) | ((a * 17) << 24);
+    }
+}
+
+static void DecompressInterpolatedAlphaBlock(const CKBYTE *Block, CKDWORD *Pixels)
+{
+    int a0 = Block[0];
+    int a1 = Block[1];
+    CKDWORD palette[8];
+    palette[0] = a0;
+    palette[1] = a1;
+    int k;
+    if (a0 > a1)
+    {
+        for (k = 1; k < 7; ++k)
+            palette[k + 1] = ((7 - k) * a0 + k * a1) / 7;
+    }
+    else
+    {
+        for (k = 1; k < 5; ++k)
+            palette[k + 1] = ((5 - k) * a0 + k * a1) / 5;
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+
+    // Two halves of 8 pixels with 24 bits of indices each
+    for (int h = 0; h < 2; ++h)
+    {
+        const CKBYTE *b = Block + 2 + 3 * h;
+        CKDWORD indices = b[0] | (b[1] << 8) | (b[2] << 16);
+        for (int i = 0; i < 8; ++i)
+        {
+            CKDWORD &pixel = Pixels[h * 8 + i];
+            pixel = (pixel & 0x00FFFFFF) | (palette[(indices >> (3 * i)) & 7] << 24);
+        }
+    }
+}
+
+CKBOOL CKRSTDecompressDXTBlock(const CKBYTE *Block, VX_PIXELFORMAT Format, CKDWORD *Pixels)
+{
+    switch (Format)
+    {
+    case _DXT1:
+        DecompressColorBlock(Block, TRUE, Pixels);
+        return TRUE;
+    case _DXT2:
+    case _DXT3:
+        DecompressColorBlock(Block + 8, FALSE, Pixels);
+        DecompressExplicitAlphaBlock(Block, Pixels);
+        return TRUE;
+    case _DXT4:
+    case _DXT5:
+        DecompressColorBlock(Block + 8, FALSE, Pixels);
+        DecompressInterpolatedAlphaBlock(Block, Pixels);
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+struct CKDXTDecompressJob
+{
+    const CKBYTE *Src;
+    VX_PIXELFORMAT Format;
+    VxImageDescEx *Dst;
+    CKRST_PIXELCONVERTFUNCTION Convert;
+    int BlockSize;
+    int BlocksPerRow;
+};
+
+// Decompresses a row of blocks (job of the thread pool)
+static void DecompressDXTBlockRow(void *Data, int Index)
+{
+    const CKDXTDecompressJob *job = (const CKDXTDecompressJob *)Data;
+    VxImageDescEx &dst = *job->Dst;
+    int dstBytes = dst.BitsPerPixel / 8;
+    const CKBYTE *block = job->Src + Index * job->BlocksPerRow * job->BlockSize;
+    int rows = XMin(4, dst.Height - Index * 4);
+
+    CKDWORD pixels[16];
+    for (int bx = 0; bx < job->BlocksPerRow; ++bx, block += job->BlockSize)
+    {
+        CKRSTDecompressDXTBlock(block, job->Format, pixels);
+        int x = bx * 4;
+        int count = XMin(4, dst.Width - x);
+        for (int r = 0; r < rows; ++r)
+        {
+            int y = Index * 4 + r;
+            job->Convert((const CKBYTE *)&pixels[r * 4], dst.Image + y * dst.BytesPerLine + x * dstBytes, count, x, y, 0);
+        }
+    }
+}
+
+CKBOOL CKRSTDecompressDXT(const CKBYTE *Src, VX_PIXELFORMAT Format, VxImageDescEx &Dst, CKRasterizerThreadPool *Pool)
+{
+    if (!Src || !Dst.Image || Dst.Width <= 0 || Dst.Height <= 0)
+        return FALSE;
+
+    CKDXTDecompressJob job;
+    job.Src = Src;
+    job.Format = Format;
+    job.Dst = &Dst;
+    job.Convert = CKRSTGetPixelConverter(_32_ARGB8888, VxImageDesc2PixelFormat(Dst));
+    job.BlockSize = CKRSTGetDXTBlockSize(Format);
+    job.BlocksPerRow = (Dst.Width + 3) / 4;
+    if (!job.Convert || job.BlockSize == 0)
+        return FALSE;
+
+    int rows = (Dst.Height + 3) / 4;
+    if (Pool)
+    {
+        Pool->ParallelFor(DecompressDXTBlockRow, &job, rows);
+    }
+    else
+    {
+        for (int r = 0; r < rows; ++r)
+            DecompressDXTBlockRow(&job, r);
+    }
+    return TRUE;
+}
+
+/*******************************************************************
+ Decoded DXT blocks cache
+  - Least recently used blocks are replaced first (the tiles are
+    kept in a doubly linked list, most recently used at the head)
+*******************************************************************/
+
+CKDXTTileCache::CKDXTTileCache(int Capacity) : m_Capacity(1), m_Head(-1), m_Tail(-1), m_Hits(0), m_Misses(0)
+{
+    SetCapacity(Capacity);
+}
+
+void CKDXTTileCache::SetCapacity(int Capacity)
+{
+    m_Capacity = (Capacity > 0) ? Capacity : 1;
+    Invalidate();
+}
+
+void CKDXTTileCache::Invalidate(const CKBYTE *Image)
+{
+    if (!Image)
+    {
+        m_Tiles.Resize(0);
+        m_Index.Clear();
+        m_Head = m_Tail = -1;
+        return;
+    }
+
+    // Forgotten tiles are moved to the tail to be reused first
+    for (int t = 0; t < m_Tiles.Size(); ++t)
+    {
+        CKDXTTile &tile = m_Tiles[t];
+        if (tile.Key.Image != Image)
+            continue;
+        m_Index.Remove(tile.Key);
+        tile.Key.Image = NULL;
+        Unlink(t);
+        LinkBack(t);
+    }
+}
+
+const CKDWORD *CKDXTTileCache::GetTile(const CKBYTE *Image, VX_PIXELFORMAT Format, int Width, int BlockX, int BlockY)
+{
+    int blockSize = CKRSTGetDXTBlockSize(Format);
+    if (!Image || blockSize == 0)
+        return NULL;
+
+    CKDXTTileKey key(Image, BlockY * ((Width + 3) / 4) + BlockX);
+    int *found = m_Index.FindPtr(key);
+    if (found)
+    {
+        ++m_Hits;
+        if (*found != m_Head)
+        {
+            Unlink(*found);
+            LinkFront(*found);
+        }
+        return m_Tiles[*found].Pixels;
+    }
+
+    ++m_Misses;
+    int t;
+    if (m_Tiles.Size() < m_Capacity)
+    {
+        t = m_Tiles.Size();
+        m_Tiles.Resize(t + 1);
+    }
+    else
+    {
+        t = m_Tail;
+        if (m_Tiles[t].Key.Image)
+            m_Index.Remove(m_Tiles[t].Key);
+        Unlink(t);
+    }
+
+    CKDXTTile &tile = m_Tiles[t];
+    tile.Key = key;
+    CKRSTDecompressDXTBlock(Image + key.Block * blockSize, Format, tile.Pixels);
+    m_Index.Insert(key, t, TRUE);
+    LinkFront(t);
+    return tile.Pixels;
+}
+
+CKDWORD CKDXTTileCache::GetTexel(const CKBYTE *Image, VX_PIXELFORMAT Format, int Width, int Height, int X, int Y)
+{
+    X = XMax(0, XMin(X, Width - 1));
+    Y = XMax(0, XMin(Y, Height - 1));
+    const CKDWORD *tile = GetTile(Image, Format, Width, X >> 2, Y >> 2);
+    return tile ? tile[(Y & 3) * 4 + (X & 3)] : 0;
+}
+
+void CKDXTTileCache::Unlink(int Tile)
+{
+    CKDXTTile &tile = m_Tiles[Tile];
+    if (tile.Prev >= 0)
+        m_Tiles[tile.Prev].Next = tile.Next;
+    else
+        m_Head = tile.Next;
+    if (tile.Next >= 0)
+        m_Tiles[tile.Next].Prev = tile.Prev;
+    else
+        m_Tail = tile.Prev;
+    tile.Prev = tile.Next = -1;
+}
+
+void CKDXTTileCache::LinkFront(int Tile)
+{
+    CKDXTTile &tile = m_Tiles[Tile];
+    tile.Prev = -1;
+    tile.Next = m_Head;
+    if (m_Head >= 0)
+        m_Tiles[m_Head].Prev = Tile;
+    m_Head = Tile;
+    if (m_Tail < 0)
+        m_Tail = Tile;
+}
+
+void CKDXTTileCache::LinkBack(int Tile)
+{
+    CKDXTTile &tile = m_Tiles[Tile];
+    tile.Next = -1;
+    tile.Prev = m_Tail;
+    if (m_Tail >= 0)
+        m_Tiles[m_Tail].Next = Tile;
+    m_Tail = Tile;
+    if (m_Head < 0)
+        m_Head = Tile;
+}
@@ -0,0 +1,176 @@
+#include "CKRasterizer.h"
+#include "CKRasterizerSIMD.h"
+
+/*******************************************************************
+ Content hash
+  - 64 bits hash of the XXH3 family : stripes of 32 bytes are added
+    to four 64 bits accumulators (data ^ key, low half * high half,
+    plus the data of the neighbour lane), the accumulators are
+    scrambled every 512 bytes and merged at the end
+  - The SSE2 and the scalar code compute the same hash
+*******************************************************************/
+
+#if defined(_MSC_VER)
+typedef unsigned __int64 CKRSTUInt64;
+#define CKRST_UINT64(x) x##ui64
+#else
+typedef unsigned long long CKRSTUInt64;
+#define CKRST_UINT64(x) x##ULL
+#endif
+
+#define CKRST_HASH_STRIPE 32
+#define CKRST_HASH_STRIPESPERBLOCK 16
+
+static const CKRSTUInt64 HashKeys[4] = {
+    CKRST_UINT64(0xbe4ba423396cfeb8), CKRST_UINT64(0x1cad21f72c81017c),
+    CKRST_UINT64(0xdb979083e96dd4de), CKRST_UINT64(0x1f67b3b7a4a44072)};
+
+static const CKRSTUInt64 HashPrime1 = CKRST_UINT64(0x9E3779B185EBCA87);
+static const CKRSTUInt64 HashPrime2 = CKRST_UINT64(0xC2B2AE3D27D4EB4F);
+static const CKDWORD HashPrime32 = 0x9E3779B1;
+
+struct CKRSTHashState
+{
+    CKRSTUInt64 Acc[4];
+};
+
+#ifdef CKRST_SSE2
+static inline __m128i ScrambleLanes(__m128i Acc, __m128i Key)
+{
+    const __m128i prime = _mm_set1_epi32((int)HashPrime32);
+    Acc = _mm_xor_si128(Acc, _mm_srli_epi64(Acc, 47));
+    Acc = _mm_xor_si128(Acc, Key);
+    __m128i lo = _mm_mul_epu32(Acc, prime);
+    __m128i hi = _mm_mul_epu32(_mm_srli_epi64(Acc, 32), prime);
+    return _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+}
+
+static void HashStripes(CKRSTHashState &State, const CKBYTE *Data, int Count, CKBOOL Scramble)
+{
+    __m128i acc0 = _mm_loadu_si128((const __m128i *)&State.Acc[0]);
+    __m128i acc1 = _mm_loadu_si128((const __m128i *)&State.Acc[2]);
+    const __m128i key0 = _mm_loadu_si128((const __m128i *)&HashKeys[0]);
+    const __m128i key1 = _mm_loadu_si128((const __m128i *)&HashKeys[2]);
+    for (int i = 0; i < Count; ++i, Data += CKRST_HASH_STRIPE)
+    {
+        __m128i d0 = _mm_loadu_si128((const __m128i *)Data);
+        __m128i d1 = _mm_loadu_si128((const __m128i *)(Data + 16));
+        __m128i k0 = _mm_xor_si128(d0, key0);
+        __m128i k1 = _mm_xor_si128(d1, key1);
+        acc0 = _mm_add_epi64(acc0, _mm_mul_epu32(k0, _mm_shuffle_epi32(k0, _MM_SHUFFLE(2, 3, 0, 1))));
+        acc1 = _mm_add_epi64(acc1, _mm_mul_epu32(k1, _mm_shuffle_epi32(k1, _MM_SHUFFLE(2, 3, 0, 1))));
+        acc0 = _mm_add_epi64(acc0, _mm_shuffle_epi32(d0, _MM_SHUFFLE(1, 0, 3, 2)));
+        acc1 = _mm_add_epi64(acc1, _mm_shuffle_epi32(d1, _MM_SHUFFLE(1, 0, 3, 2)));
+    }
+    if (Scramble)
+    {
+        acc0 = ScrambleLanes(acc0, key0);
+        acc1 = ScrambleLanes(acc1, key1);
+    }
+    _mm_storeu_si128((__m128i *)&State.Acc[0], acc0);
+    _mm_storeu_si128((__m128i *)&State.Acc[2], acc1);
+}
+#else
+static inline CKRSTUInt64 ReadHashLane(const CKBYTE *Data)
+{
+    CKRSTUInt64 v = 0;
+    for (int i = 7; i >= 0; --i)
+        v = (v << 8) | Data[i];
+    return v;
+}
+
+static void HashStripes(CKRSTHashState &State, const CKBYTE *Data, int Count, CKBOOL Scramble)
+{
+    int i;
+    for (int s = 0; s < Count; ++s, Data += CKRST_HASH_STRIPE)
+    {
+        for (i = 0; i < 4; ++i)
+        {
+            CKRSTUInt64 d = ReadHashLane(Data + i * 8);
+            CKRSTUInt64 k = d ^ HashKeys[i];
+            State.Acc[i] += (k & 0xFFFFFFFF) * (k >> 32);
+            State.Acc[i ^ 1] += d;
+        }
+    }
+    if (Scramble)
+    {
+        for (i = 0; i < 4; ++i)
+        {
+            CKRSTUInt64 acc = State.Acc[i];
+            acc ^= acc >> 47;
+            acc ^= HashKeys[i];
+            State.Acc[i] = acc * HashPrime32;
+        }
+    }
+}
+#endif
+
+static CKRSTUInt64 HashAvalanche(CKRSTUInt64 h)
+{
+    h ^= h >> 37;
+    h *= CKRST_UINT64(0x165667919E3779F9);
+    h ^= h >> 32;
+    return h;
+}
+
+CKImageHash CKRSTHashMemory(const void *Data, int Size, const CKImageHash &Seed)
+{
+    CKRSTUInt64 seed = ((CKRSTUInt64)Seed.High << 32) | Seed.Low;
+    CKRSTHashState state;
+    state.Acc[0] = HashPrime1 + seed;
+    state.Acc[1] = HashPrime2 - seed;
+    state.Acc[2] = HashPrime1 ^ seed;
+    state.Acc[3] = HashPrime2 ^ (seed << 17);
+
+    const CKBYTE *data = (const CKBYTE *)Data;
+    int stripes = (Size > 0) ? Size / CKRST_HASH_STRIPE : 0;
+    while (stripes >= CKRST_HASH_STRIPESPERBLOCK)
+    {
+        HashStripes(state, data, CKRST_HASH_STRIPESPERBLOCK, TRUE);
+        data += CKRST_HASH_STRIPESPERBLOCK * CKRST_HASH_STRIPE;
+        stripes -= CKRST_HASH_STRIPESPERBLOCK;
+    }
+    HashStripes(state, data, stripes, FALSE);
+    data += stripes * CKRST_HASH_STRIPE;
+
+    // Last bytes, zero padded (the size is merged below)
+    int rest = (Size > 0) ? Size % CKRST_HASH_STRIPE : 0;
+    if (rest > 0)
+    {
+        CKBYTE last[CKRST_HASH_STRIPE];
+        memset(last, 0, sizeof(last));
+        memcpy(last, data, rest);
+        HashStripes(state, last, 1, FALSE);
+    }
+
+    CKRSTUInt64 h = (CKRSTUInt64)(CKDWORD)Size * HashPrime1;
+    for (int i = 0; i < 4; ++i)
+        h = (h ^ HashAvalanche(state.Acc[i] ^ HashKeys[i])) * HashPrime2;
+    h = HashAvalanche(h);
+
+    CKImageHash hash;
+    hash.Low = (CKDWORD)h;
+    hash.High = (CKDWORD)(h >> 32);
+    return hash;
+}
+
+CKImageHash CKRSTHashImage(const VxImageDescEx &Image, const CKImageHash &Seed)
+{
+    // The description is part of the hash
+    CKDWORD desc[7] = {(CKDWORD)Image.Width, (CKDWORD)Image.Height, (CKDWORD)Image.BitsPerPixel,
+                       Image.RedMask, Image.GreenMask, Image.BlueMask, Image.AlphaMask};
+    CKImageHash hash = CKRSTHashMemory(desc, sizeof(desc), Seed);
+    if (!Image.Image)
+        return hash;
+
+    VX_PIXELFORMAT format = VxImageDesc2PixelFormat(Image);
+    int size = CKRSTGetDXTImageSize(format, Image.Width, Image.Height);
+    if (size > 0)
+        return CKRSTHashMemory(Image.Image, size, hash);
+
+    // Rows are hashed one after the other so that padded rows give the same hash
+    int rowSize = Image.Width * (Image.BitsPerPixel / 8);
+    for (int y = 0; y < Image.Height; ++y)
+        hash = CKRSTHashMemory(Image.Image + y * Image.BytesPerLine, rowSize, hash);
+    return hash;
+}
@@ -0,0 +1,433 @@
+#include "CKRasterizer.h"
+
+/*******************************************************************
+ Mesh optimization for indexed triangle lists
+  - Vertex cache : triangles are reordered with Tom Forsyth's linear-speed
+                   algorithm (LRU cache model with a valence boost).
+  - Overdraw     : the cache optimized stream is cut into clusters where the
+                   cache restarts and the clusters are sorted so that the
+                   ones facing outward of the mesh are drawn first.
+  - Vertex fetch : vertices are reordered by first use and indices remapped.
+ The statistics use a FIFO cache of CKRST_VERTEXCACHE_SIZE entries,
+ the usual model of the hardware post-transform cache.
+*******************************************************************/
+
+#define FORSYTH_CACHE_SIZE 32
+#define FORSYTH_MAX_VALENCE 32
+
+static float g_ForsythCacheScore[FORSYTH_CACHE_SIZE];
+static float g_ForsythValenceScore[FORSYTH_MAX_VALENCE];
+static CKBOOL g_ForsythTablesReady = FALSE;
+
+static void InitForsythTables()
+{
+    if (g_ForsythTablesReady)
+        return;
+
+    for (int i = 0; i < FORSYTH_CACHE_SIZE; ++i)
+    {
+        // The last triangle's vertices get a fixed score so that the
+        // algorithm does not favor them over the rest of the cache
+        if (i < 3)
+            g_ForsythCacheScore[i] = 0.75f;
+        else
+            g_ForsythCacheScore[i] = powf(1.0f - (float)(i - 3) / (FORSYTH_CACHE_SIZE - 3), 1.5f);
+    }
+    g_ForsythValenceScore[0] = 0.0f;
+    for (int v = 1; v < FORSYTH_MAX_VALENCE; ++v)
+        g_ForsythValenceScore[v] = 2.0f / sqrtf((float)v);
+
+    g_ForsythTablesReady = TRUE;
+}
+
+static inline float ForsythVertexScore(int CachePos, int Remaining)
+{
+    if (Remaining == 0)
+        return -1.0f;
+    float score = (CachePos >= 0) ? g_ForsythCacheScore[CachePos] : 0.0f;
+    return score + g_ForsythValenceScore[(Remaining < FORSYTH_MAX_VALENCE) ? Remaining : FORSYTH_MAX_VALENCE - 1];
+}
+
+float CKRSTComputeACMR(const CKDWORD *Indices, int IndexCount, int CacheSize)
+{
+    int triCount = IndexCount / 3;
+    if (triCount == 0)
+        return 0.0f;
+    if (CacheSize <= 0 || CacheSize > 64)
+        CacheSize = CKRST_VERTEXCACHE_SIZE;
+
+    CKDWORD cache[64];
+    int cacheCount = 0;
+    int head = 0;
+    int misses = 0;
+    for (int i = 0; i < triCount * 3; ++i)
+    {
+        CKDWORD v = Indices[i];
+        CKBOOL hit = FALSE;
+        for (int c = 0; c < cacheCount; ++c)
+            if (cache[c] == v)
+            {
+                hit = TRUE;
+                break;
+            }
+        if (hit)
+            continue;
+
+        ++misses;
+        if (cacheCount < CacheSize)
+            cache[cacheCount++] = v;
+        else
+        {
+            cache[head] = v;
+            head = (head + 1) % CacheSize;
+        }
+    }
+    return (float)misses / (float)triCount;
+}
+
+void CKRSTOptimizeVertexCache(CKDWORD *Dest, const CKDWORD *Indices, int IndexCount, int VertexCount)
+{
+    int triCount = IndexCount / 3;
+    if (triCount == 0 || VertexCount <= 0)
+        return;
+
+    InitForsythTables();
+
+    // Vertex -> triangles adjacency
+    XArray<int> triStart;
+    XArray<int> vertexTris;
+    XArray<int> remaining;
+    triStart.Resize(VertexCount + 1);
+    remaining.Resize(VertexCount);
+    vertexTris.Resize(triCount * 3);
+    remaining.Fill(0);
+    int i;
+    for (i = 0; i < triCount * 3; ++i)
+        ++remaining[Indices[i]];
+    triStart[0] = 0;
+    for (i = 0; i < VertexCount; ++i)
+        triStart[i + 1] = triStart[i] + remaining[i];
+    XArray<int> fill;
+    fill.Resize(VertexCount);
+    for (i = 0; i < VertexCount; ++i)
+        fill[i] = triStart[i];
+    for (i = 0; i < triCount * 3; ++i)
+        vertexTris[fill[Indices[i]]++] = i / 3;
+
+    // Scores
+    XArray<float> vertexScore;
+    XArray<float> triScore;
+    XArray<CKBYTE> emitted;
+    vertexScore.Resize(VertexCount);
+    triScore.Resize(triCount);
+    emitted.Resize(triCount);
+    emitted.Fill(0);
+    for (i = 0; i < VertexCount; ++i)
+        vertexScore[i] = ForsythVertexScore(-1, remaining[i]);
+    for (i = 0; i < triCount; ++i)
+        triScore[i] = vertexScore[Indices[i * 3]] + vertexScore[Indices[i * 3 + 1]] + vertexScore[Indices[i * 3 + 2]];
+
+    int cache[FORSYTH_CACHE_SIZE + 3];
+    int cacheCount = 0;
+    int scan = 0;
+    int best = -1;
+    float bestScore = -1.0f;
+    for (i = 0; i < triCount; ++i)
+        if (triScore[i] > bestScore)
+        {
+            bestScore = triScore[i];
+            best = i;
+        }
+
+    for (int out = 0; out < triCount; ++out)
+    {
+        if (best < 0)
+        {
+            // No candidate in the cache : take the next triangle not yet emitted
+            while (emitted[scan])
+                ++scan;
+            best = scan;
+        }
+
+        const CKDWORD *tri = &Indices[best * 3];
+        Dest[out * 3] = tri[0];
+        Dest[out * 3 + 1] = tri[1];
+        Dest[out * 3 + 2] = tri[2];
+        emitted[best] = 1;
+
+        // Move the triangle vertices at the front of the LRU cache
+        int newCache[FORSYTH_CACHE_SIZE + 3];
+        int newCount = 0;
+        int k;
+        for (k = 0; k < 3; ++k)
+        {
+            // (a degenerate triangle uses a vertex twice)
+            if ((k == 0 || tri[k] != tri[0]) && (k < 2 || tri[k] != tri[1]))
+                newCache[newCount++] = (int)tri[k];
+            --remaining[tri[k]];
+
+            // Remove the triangle from the vertex adjacency
+            int *adj = &vertexTris[triStart[tri[k]]];
+            int adjCount = remaining[tri[k]] + 1;
+            for (int a = 0; a < adjCount; ++a)
+                if (adj[a] == best)
+                {
+                    adj[a] = adj[adjCount - 1];
+                    break;
+                }
+        }
+        for (k = 0; k < cacheCount; ++k)
+        {
+            int v = cache[k];
+            if (v != (int)tri[0] && v != (int)tri[1] && v != (int)tri[2])
+                newCache[newCount++] = v;
+        }
+        cacheCount = (newCount < FORSYTH_CACHE_SIZE) ? newCount : FORSYTH_CACHE_SIZE;
+        for (k = 0; k < cacheCount; ++k)
+            cache[k] = newCache[k];
+
+        // Update the scores of the vertices in cache and of their triangles,
+        // the best candidate is searched among these triangles
+        for (k = 0; k < cacheCount; ++k)
+            vertexScore[cache[k]] = ForsythVertexScore(k, remaining[cache[k]]);
+        for (k = FORSYTH_CACHE_SIZE; k < newCount; ++k)
+            vertexScore[newCache[k]] = ForsythVertexScore(-1, remaining[newCache[k]]);
+
+        best = -1;
+        bestScore = -1.0f;
+        for (k = 0; k < cacheCount; ++k)
+        {
+            int v = cache[k];
+            const int *adj = &vertexTris[triStart[v]];
+            for (int a = 0; a < remaining[v]; ++a)
+            {
+                int t = adj[a];
+                float s = vertexScore[Indices[t * 3]] + vertexScore[Indices[t * 3 + 1]] + vertexScore[Indices[t * 3 + 2]];
+                triScore[t] = s;
+                if (s > bestScore)
+                {
+                    bestScore = s;
+                    best = t;
+                }
+            }
+        }
+    }
+}
+
+void CKRSTOptimizeOverdraw(CKDWORD *Indices, int IndexCount, const CKBYTE *Positions, CKDWORD PositionStride, int VertexCount)
+{
+    int triCount = IndexCount / 3;
+    if (triCount < 2 || !Positions)
+        return;
+
+    // Cut the stream in clusters where the cache restarts (a triangle with 3 misses)
+    XArray<int> clusters;
+    {
+        CKDWORD cache[CKRST_VERTEXCACHE_SIZE];
+        int cacheCount = 0;
+        int head = 0;
+        for (int t = 0; t < triCount; ++t)
+        {
+            int misses = 0;
+            for (int k = 0; k < 3; ++k)
+            {
+                CKDWORD v = Indices[t * 3 + k];
+                CKBOOL hit = FALSE;
+                for (int c = 0; c < cacheCount; ++c)
+                    if (cache[c] == v)
+                    {
+                        hit = TRUE;
+                        break;
+                    }
+                if (hit)
+                    continue;
+                ++misses;
+                if (cacheCount < CKRST_VERTEXCACHE_SIZE)
+                    cache[cacheCount++] = v;
+                else
+                {
+                    cache[head] = v;
+                    head = (head + 1) % CKRST_VERTEXCACHE_SIZE;
+                }
+            }
+            if (t == 0 || misses == 3)
+                clusters.PushBack(t);
+        }
+    }
+    int clusterCount = clusters.Size();
+    if (clusterCount < 2)
+        return;
+    clusters.PushBack(triCount);
+
+#define OVERDRAW_POSITION(i) ((const float *)(Positions + (i) * PositionStride))
+
+    // Mesh centroid
+    float center[3] = {0.0f, 0.0f, 0.0f};
+    int v;
+    for (v = 0; v < VertexCount; ++v)
+    {
+        const float *p = OVERDRAW_POSITION(v);
+        center[0] += p[0];
+        center[1] += p[1];
+        center[2] += p[2];
+    }
+    center[0] /= (float)VertexCount;
+    center[1] /= (float)VertexCount;
+    center[2] /= (float)VertexCount;
+
+    // Sort key of a cluster : how much it faces outward (area weighted normal . (centroid - center))
+    XArray<float> keys;
+    XArray<int> order;
+    keys.Resize(clusterCount);
+    order.Resize(clusterCount);
+    int c;
+    for (c = 0; c < clusterCount; ++c)
+    {
+        float normal[3] = {0.0f, 0.0f, 0.0f};
+        float centroid[3] = {0.0f, 0.0f, 0.0f};
+        float area = 0.0f;
+        for (int t = clusters[c]; t < clusters[c + 1]; ++t)
+        {
+            const float *p0 = OVERDRAW_POSITION(Indices[t * 3]);
+            const float *p1 = OVERDRAW_POSITION(Indices[t * 3 + 1]);
+            const float *p2 = OVERDRAW_POSITION(Indices[t * 3 + 2]);
+            float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+            float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+            float n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+            float a = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            for (int k = 0; k < 3; ++k)
+            {
+                normal[k] += n[k];
+                centroid[k] += (p0[k] + p1[k] + p2[k]) * a;
+            }
+            area += a;
+        }
+        float key = 0.0f;
+        if (area > 0.0f)
+        {
+            float len = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+            if (len > 0.0f)
+                for (int k = 0; k < 3; ++k)
+                    key += (centroid[k] / (3.0f * area) - center[k]) * normal[k] / len;
+        }
+        keys[c] = key;
+        order[c] = c;
+    }
+
+#undef OVERDRAW_POSITION
+
+    // Insertion sort, outward facing clusters first (stable for equal keys)
+    for (c = 1; c < clusterCount; ++c)
+    {
+        int o = order[c];
+        int j = c - 1;
+        while (j >= 0 && keys[order[j]] < keys[o])
+        {
+            order[j + 1] = order[j];
+            --j;
+        }
+        order[j + 1] = o;
+    }
+
+    XArray<CKDWORD> sorted;
+    sorted.Resize(triCount * 3);
+    int out = 0;
+    for (c = 0; c < clusterCount; ++c)
+    {
+        int o = order[c];
+        for (int i = clusters[o] * 3; i < clusters[o + 1] * 3; ++i)
+            sorted[out++] = Indices[i];
+    }
+    memcpy(Indices, sorted.Begin(), triCount * 3 * sizeof(CKDWORD));
+}
+
+int CKRSTOptimizeVertexFetch(CKBYTE *Vertices, CKDWORD VertexSize, int VertexCount, CKDWORD *Indices, int IndexCount)
+{
+    if (VertexCount <= 0)
+        return 0;
+
+    // New position of each vertex : order of first use, unused vertices at the end
+    XArray<int> remap;
+    remap.Resize(VertexCount);
+    remap.Fill(-1);
+    int next = 0;
+    int i;
+    for (i = 0; i < IndexCount; ++i)
+    {
+        CKDWORD v = Indices[i];
+        if (remap[v] < 0)
+            remap[v] = next++;
+        Indices[i] = (CKDWORD)remap[v];
+    }
+    int used = next;
+    for (i = 0; i < VertexCount; ++i)
+        if (remap[i] < 0)
+            remap[i] = next++;
+
+    if (Vertices)
+    {
+        XArray<CKBYTE> copy;
+        copy.Resize(VertexCount * VertexSize);
+        memcpy(copy.Begin(), Vertices, VertexCount * VertexSize);
+        for (i = 0; i < VertexCount; ++i)
+            memcpy(&Vertices[remap[i] * VertexSize], &copy[i * VertexSize], VertexSize);
+    }
+    return used;
+}
+
+CKBOOL CKRSTOptimizeMesh(CKBYTE *Vertices, CKDWORD Compression, CKDWORD VertexSize, int VertexCount,
+                         void *Indices, CKDWORD IndexSize, int IndexCount, CKDWORD Flags, CKMeshOptimizeStats *Stats)
+{
+    if (!Vertices || !Indices || VertexCount <= 0 || IndexCount < 3)
+        return FALSE;
+    if (IndexSize != sizeof(CKWORD) && IndexSize != sizeof(CKDWORD))
+        return FALSE;
+
+    // Work on 32 bits indices
+    IndexCount -= IndexCount % 3;
+    XArray<CKDWORD> indices;
+    indices.Resize(IndexCount);
+    int i;
+    for (i = 0; i < IndexCount; ++i)
+    {
+        CKDWORD v = (IndexSize == sizeof(CKWORD)) ? ((CKWORD *)Indices)[i] : ((CKDWORD *)Indices)[i];
+        if (v >= (CKDWORD)VertexCount)
+            return FALSE;
+        indices[i] = v;
+    }
+
+    if (Stats)
+        Stats->ACMRBefore = CKRSTComputeACMR(indices.Begin(), IndexCount, CKRST_VERTEXCACHE_SIZE);
+
+    if (Flags & CKRST_MESHOPT_VERTEXCACHE)
+    {
+        XArray<CKDWORD> optimized;
+        optimized.Resize(IndexCount);
+        CKRSTOptimizeVertexCache(optimized.Begin(), indices.Begin(), IndexCount, VertexCount);
+        indices.Swap(optimized);
+    }
+
+    // Overdraw ordering needs float positions
+    if ((Flags & CKRST_MESHOPT_OVERDRAW) && !(Compression & CKRST_VC_POSITIONQ16))
+        CKRSTOptimizeOverdraw(indices.Begin(), IndexCount, Vertices, VertexSize, VertexCount);
+
+    int usedVertices = VertexCount;
+    if (Flags & CKRST_MESHOPT_VERTEXFETCH)
+        usedVertices = CKRSTOptimizeVertexFetch(Vertices, VertexSize, VertexCount, indices.Begin(), IndexCount);
+
+    if (Stats)
+    {
+        Stats->ACMRAfter = CKRSTComputeACMR(indices.Begin(), IndexCount, CKRST_VERTEXCACHE_SIZE);
+        Stats->TriangleCount = IndexCount / 3;
+        Stats->UsedVertexCount = usedVertices;
+    }
+
+    for (i = 0; i < IndexCount; ++i)
+    {
+        if (IndexSize == sizeof(CKWORD))
+            ((CKWORD *)Indices)[i] = (CKWORD)indices[i];
+        else
+            ((CKDWORD *)Indices)[i] = indices[i];
+    }
+    return TRUE;
+}
@@ -0,0 +1,327 @@
+#include "CKRasterizer.h"
+#include "CKRasterizerSIMD.h"
+
+#include <math.h>
+
+/*******************************************************************
+ Mipmap generation
+  - The filters are separable : a destination pixel is the weighted
+    sum of the source pixels given by a table of taps per axis (the
+    source indices are clamped to the image edges)
+  - The box filter weights each source pixel by the part of it covered
+    by the destination pixel, which handles odd sizes (a pixel of a
+    level of width 5 covers 2.5 pixels of the previous level)
+  - The Kaiser filter is a windowed sinc (width 3, alpha 4) evaluated
+    in destination pixels : sharper than the box filter but it can ring
+  - In linear light the color components are converted from sRGB to
+    linear floats before filtering and back to sRGB afterwards, alpha
+    is always filtered as is
+  - Destination rows are processed by bands, the horizontally filtered
+    source rows of a band are computed once per band
+*******************************************************************/
+
+#define CKRST_MIPMAP_KAISERWIDTH 3.0f
+#define CKRST_MIPMAP_KAISERALPHA 4.0f
+#define CKRST_MIPMAP_BANDROWS 16
+#define CKRST_MIPMAP_GAMMASTEPS 4096
+
+// 8 bits components to floats (linear or from sRGB) and linear floats to sRGB
+struct CKMipMapTables
+{
+    float Linear[256];
+    float FromGamma[256];
+    CKBYTE ToGamma[CKRST_MIPMAP_GAMMASTEPS + 1];
+
+    CKMipMapTables()
+    {
+        int i;
+        for (i = 0; i < 256; ++i)
+        {
+            float c = i / 255.0f;
+            Linear[i] = c;
+            FromGamma[i] = (c <= 0.04045f) ? c / 12.92f : (float)pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+        for (i = 0; i <= CKRST_MIPMAP_GAMMASTEPS; ++i)
+        {
+            float l = (float)i / CKRST_MIPMAP_GAMMASTEPS;
+            float c = (l <= 0.0031308f) ? l * 12.92f : 1.055f * (float)pow(l, 1.0f / 2.4f) - 0.055f;
+            ToGamma[i] = (CKBYTE)(c * 255.0f + 0.5f);
+        }
+    }
+};
+
+static const CKMipMapTables MipMapTables;
+
+// Taps of each destination pixel along an axis (Counts[i] taps stored from i * MaxTaps)
+struct CKMipMapTaps
+{
+    XArray<int> Counts;
+    XArray<int> Indices;
+    XArray<float> Weights;
+    int MaxTaps;
+};
+
+static float KaiserBessel0(float x)
+{
+    // Power series of the modified Bessel function of order 0
+    float sum = 1.0f;
+    float term = 1.0f;
+    float half = x * 0.5f;
+    for (int k = 1; k < 20; ++k)
+    {
+        term *= half / k;
+        sum += term * term;
+    }
+    return sum;
+}
+
+static float KaiserWeight(float x)
+{
+    float t = x / CKRST_MIPMAP_KAISERWIDTH;
+    if (t <= -1.0f || t >= 1.0f)
+        return 0.0f;
+    float sinc = (x == 0.0f) ? 1.0f : (float)sin(PI * x) / (PI * x);
+    return sinc * KaiserBessel0(CKRST_MIPMAP_KAISERALPHA * sqrtf(1.0f - t * t)) / KaiserBessel0(CKRST_MIPMAP_KAISERALPHA);
+}
+
+static void BuildMipMapTaps(int SrcSize, int DstSize, CKBOOL Kaiser, CKMipMapTaps &Taps)
+{
+    float scale = (float)SrcSize / DstSize;
+    float radius = Kaiser ? CKRST_MIPMAP_KAISERWIDTH * scale : scale * 0.5f;
+    Taps.MaxTaps = (int)ceilf(radius * 2.0f) + 2;
+    Taps.Counts.Resize(DstSize);
+    Taps.Indices.Resize(DstSize * Taps.MaxTaps);
+    Taps.Weights.Resize(DstSize * Taps.MaxTaps);
+
+    for (int i = 0; i < DstSize; ++i)
+    {
+        int *indices = &Taps.Indices[i * Taps.MaxTaps];
+        float *weights = &Taps.Weights[i * Taps.MaxTaps];
+        float center = (i + 0.5f) * scale;
+        int first = (int)floorf(center - radius);
+        int last = (int)ceilf(center + radius);
+        float total = 0.0f;
+        int count = 0;
+        for (int j = first; j < last && count < Taps.MaxTaps; ++j)
+        {
+            float w;
+            if (Kaiser)
+            {
+                w = KaiserWeight((j + 0.5f - center) / scale);
+            }
+            else
+            {
+                // Part of the source pixel [j, j + 1] inside the destination pixel
+                float lo = XMax((float)j, center - radius);
+                float hi = XMin((float)(j + 1), center + radius);
+                w = hi - lo;
+            }
+            if (w == 0.0f || (!Kaiser && w < 0.0f))
+                continue;
+            indices[count] = XMax(0, XMin(j, SrcSize - 1));
+            weights[count] = w;
+            total += w;
+            ++count;
+        }
+        for (int k = 0; k < count; ++k)
+            weights[k] /= total;
+        Taps.Counts[i] = count;
+    }
+}
+
+struct CKMipMapJob
+{
+    const VxImageDescEx *Src;
+    VxImageDescEx *Dst;
+    CKMipMapTaps Horizontal;
+    CKMipMapTaps Vertical;
+    const float *ToFloat;
+    CKBOOL Gamma;
+};
+
+// Loads an ARGB8888 pixel to 4 floats (b, g, r, a)
+#ifdef CKRST_SSE2
+static inline __m128 LoadMipMapPixel(CKDWORD Pixel, const float *ToFloat)
+{
+    return _mm_set_ps((Pixel >> 24) / 255.0f, ToFloat[(Pixel >> 16) & 0xFF], ToFloat[(Pixel >> 8) & 0xFF],
+                      ToFloat[Pixel & 0xFF]);
+}
+#endif
+
+static inline CKBYTE StoreMipMapColor(float c, CKBOOL Gamma)
+{
+    c = XMax(0.0f, XMin(c, 1.0f));
+    return Gamma ? MipMapTables.ToGamma[(int)(c * CKRST_MIPMAP_GAMMASTEPS + 0.5f)] : (CKBYTE)(c * 255.0f + 0.5f);
+}
+
+// Filters a band of destination rows (job of the thread pool)
+static void GenerateMipMapBand(void *Data, int Index)
+{
+    const CKMipMapJob *job = (const CKMipMapJob *)Data;
+    const VxImageDescEx &src = *job->Src;
+    VxImageDescEx &dst = *job->Dst;
+    const CKMipMapTaps &ht = job->Horizontal;
+    const CKMipMapTaps &vt = job->Vertical;
+
+    int y0 = Index * CKRST_MIPMAP_BANDROWS;
+    int y1 = XMin(y0 + CKRST_MIPMAP_BANDROWS, dst.Height);
+
+    // Source rows used by the band
+    int r0 = src.Height;
+    int r1 = -1;
+    int y, k;
+    for (y = y0; y < y1; ++y)
+        for (k = 0; k < vt.Counts[y]; ++k)
+        {
+            r0 = XMin(r0, vt.Indices[y * vt.MaxTaps + k]);
+            r1 = XMax(r1, vt.Indices[y * vt.MaxTaps + k]);
+        }
+    if (r1 < r0)
+        return;
+
+    // Horizontal pass : 4 floats per pixel
+    XArray<float> rows;
+    rows.Resize((r1 - r0 + 1) * dst.Width * 4 + 4);
+    float *base = (float *)(((size_t)rows.Begin() + 15) & ~(size_t)15);
+    for (int r = r0; r <= r1; ++r)
+    {
+        const CKDWORD *line = (const CKDWORD *)(src.Image + r * src.BytesPerLine);
+        float *out = base + (r - r0) * dst.Width * 4;
+        for (int x = 0; x < dst.Width; ++x, out += 4)
+        {
+            const int *indices = &ht.Indices[x * ht.MaxTaps];
+            const float *weights = &ht.Weights[x * ht.MaxTaps];
+#ifdef CKRST_SSE2
+            __m128 sum = _mm_setzero_ps();
+            for (k = 0; k < ht.Counts[x]; ++k)
+                sum = _mm_add_ps(sum, _mm_mul_ps(LoadMipMapPixel(line[indices[k]], job->ToFloat), _mm_set1_ps(weights[k])));
+            _mm_store_ps(out, sum);
+#else
+            out[0] = out[1] = out[2] = out[3] = 0.0f;
+            for (k = 0; k < ht.Counts[x]; ++k)
+            {
+                CKDWORD p = line[indices[k]];
+                float w = weights[k];
+                out[0] += job->ToFloat[p & 0xFF] * w;
+                out[1] += job->ToFloat[(p >> 8) & 0xFF] * w;
+                out[2] += job->ToFloat[(p >> 16) & 0xFF] * w;
+                out[3] += (p >> 24) / 255.0f * w;
+            }
+#endif
+        }
+    }
+
+    // Vertical pass
+    for (y = y0; y < y1; ++y)
+    {
+        const int *indices = &vt.Indices[y * vt.MaxTaps];
+        const float *weights = &vt.Weights[y * vt.MaxTaps];
+        CKDWORD *line = (CKDWORD *)(dst.Image + y * dst.BytesPerLine);
+        for (int x = 0; x < dst.Width; ++x)
+        {
+            float c[4];
+#ifdef CKRST_SSE2
+            __m128 sum = _mm_setzero_ps();
+            for (k = 0; k < vt.Counts[y]; ++k)
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_load_ps(base + ((indices[k] - r0) * dst.Width + x) * 4), _mm_set1_ps(weights[k])));
+            _mm_storeu_ps(c, sum);
+#else
+            c[0] = c[1] = c[2] = c[3] = 0.0f;
+            for (k = 0; k < vt.Counts[y]; ++k)
+            {
+                const float *p = base + ((indices[k] - r0) * dst.Width + x) * 4;
+                for (int i = 0; i < 4; ++i)
+                    c[i] += p[i] * weights[k];
+            }
+#endif
+            line[x] = ((CKDWORD)StoreMipMapColor(c[3], FALSE) << 24) | ((CKDWORD)StoreMipMapColor(c[2], job->Gamma) << 16) |
+                      ((CKDWORD)StoreMipMapColor(c[1], job->Gamma) << 8) | StoreMipMapColor(c[0], job->Gamma);
+        }
+    }
+}
+
+// Fraction of the pixels of an alpha histogram above Ref once scaled by Scale
+static float GetAlphaCoverage(const int *Histogram, int Count, float Scale, float Ref)
+{
+    int covered = 0;
+    for (int a = 0; a < 256; ++a)
+        if (XMin(a * Scale, 255.0f) > Ref)
+            covered += Histogram[a];
+    return (float)covered / Count;
+}
+
+static void GetAlphaHistogram(const VxImageDescEx &Image, int *Histogram)
+{
+    memset(Histogram, 0, 256 * sizeof(int));
+    for (int y = 0; y < Image.Height; ++y)
+    {
+        const CKDWORD *line = (const CKDWORD *)(Image.Image + y * Image.BytesPerLine);
+        for (int x = 0; x < Image.Width; ++x)
+            ++Histogram[line[x] >> 24];
+    }
+}
+
+// Scales the alpha of Image so that the same fraction of pixels pass the alpha test as in the previous level
+static void PreserveAlphaCoverage(const VxImageDescEx &Src, VxImageDescEx &Dst, float AlphaRef)
+{
+    int histogram[256];
+    float ref = AlphaRef * 255.0f;
+    GetAlphaHistogram(Src, histogram);
+    float coverage = GetAlphaCoverage(histogram, Src.Width * Src.Height, 1.0f, ref);
+
+    // The coverage grows with the scale
+    GetAlphaHistogram(Dst, histogram);
+    int count = Dst.Width * Dst.Height;
+    float lo = 0.0f;
+    float hi = 4.0f;
+    for (int i = 0; i < 16; ++i)
+    {
+        float mid = (lo + hi) * 0.5f;
+        if (GetAlphaCoverage(histogram, count, mid, ref) < coverage)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    float scale = hi;
+
+    CKBYTE table[256];
+    for (int a = 0; a < 256; ++a)
+        table[a] = (CKBYTE)XMin(a * scale + 0.5f, 255.0f);
+    for (int y = 0; y < Dst.Height; ++y)
+    {
+        CKDWORD *line = (CKDWORD *)(Dst.Image + y * Dst.BytesPerLine);
+        for (int x = 0; x < Dst.Width; ++x)
+            line[x] = (line[x] & 0x00FFFFFF) | ((CKDWORD)table[line[x] >> 24] << 24);
+    }
+}
+
+CKBOOL CKRSTGenerateMipMap(const VxImageDescEx &Src, VxImageDescEx &Dst, CKDWORD Flags, float AlphaRef, CKRasterizerThreadPool *Pool)
+{
+    if (!Src.Image || !Dst.Image || Src.BitsPerPixel != 32 || Dst.BitsPerPixel != 32)
+        return FALSE;
+    if (Dst.Width <= 0 || Dst.Height <= 0 || Dst.Width > Src.Width || Dst.Height > Src.Height)
+        return FALSE;
+
+    CKMipMapJob job;
+    job.Src = &Src;
+    job.Dst = &Dst;
+    job.Gamma = (Flags & CKRST_MIPMAP_LINEARLIGHT) != 0;
+    job.ToFloat = job.Gamma ? MipMapTables.FromGamma : MipMapTables.Linear;
+    BuildMipMapTaps(Src.Width, Dst.Width, (Flags & CKRST_MIPMAP_KAISER) != 0, job.Horizontal);
+    BuildMipMapTaps(Src.Height, Dst.Height, (Flags & CKRST_MIPMAP_KAISER) != 0, job.Vertical);
+
+    int bands = (Dst.Height + CKRST_MIPMAP_BANDROWS - 1) / CKRST_MIPMAP_BANDROWS;
+    if (Pool)
+    {
+        Pool->ParallelFor(GenerateMipMapBand, &job, bands);
+    }
+    else
+    {
+        for (int b = 0; b < bands; ++b)
+            GenerateMipMapBand(&job, b);
+    }
+
+    if (Flags & CKRST_MIPMAP_ALPHACOVERAGE)
+        PreserveAlphaCoverage(Src, Dst, AlphaRef);
+    return TRUE;
+}
@@ -0,0 +1,419 @@
+#include "CKRasterizer.h"
+#include "CKRasterizerSIMD.h"
+
+/*******************************************************************
+ Pixel format conversion
+  - Every conversion goes through ARGB8888 : source pixels are
+    expanded to 8 bits per component (by bit replication, so that
+    the maximum value stays the maximum value), R and B can then be
+    swapped and a 4x4 ordered dither added before the components are
+    truncated to the destination bits.
+  - A row converter is instantiated for each (source, destination)
+    pair and stored in a static table.
+*******************************************************************/
+
+enum CKRST_PIXELLAYOUT
+{
+    PL_ARGB8888,
+    PL_XRGB8888,
+    PL_RGB888,
+    PL_RGB565,
+    PL_RGB555,
+    PL_ARGB1555,
+    PL_ARGB4444,
+    PL_RGB332,
+    PL_ARGB2222,
+    PL_COUNT
+};
+
+template <int L>
+struct CKRSTPixelLayout;
+
+// Bytes per pixel, bits and shift of each component, bits always set when storing
+#define CKRST_PIXELLAYOUT(L, BYTES, AB, AS, RB, RS, GB, GS, BB, BS, FILL)                               \
+    template <>                                                                                        \
+    struct CKRSTPixelLayout<L>                                                                         \
+    {                                                                                                  \
+        enum { Bytes = BYTES, ABits = AB, AShift = AS, RBits = RB, RShift = RS, GBits = GB, GShift = GS, \
+               BBits = BB, BShift = BS };                                                              \
+        static CKDWORD Fill() { return FILL; }                                                         \
+    };
+
+CKRST_PIXELLAYOUT(PL_ARGB8888, 4, 8, 24, 8, 16, 8, 8, 8, 0, 0)
+CKRST_PIXELLAYOUT(PL_XRGB8888, 4, 0, 0, 8, 16, 8, 8, 8, 0, 0xFF000000)
+CKRST_PIXELLAYOUT(PL_RGB888, 3, 0, 0, 8, 16, 8, 8, 8, 0, 0)
+CKRST_PIXELLAYOUT(PL_RGB565, 2, 0, 0, 5, 11, 6, 5, 5, 0, 0)
+CKRST_PIXELLAYOUT(PL_RGB555, 2, 0, 0, 5, 10, 5, 5, 5, 0, 0)
+CKRST_PIXELLAYOUT(PL_ARGB1555, 2, 1, 15, 5, 10, 5, 5, 5, 0, 0)
+CKRST_PIXELLAYOUT(PL_ARGB4444, 2, 4, 12, 4, 8, 4, 4, 4, 0, 0)
+CKRST_PIXELLAYOUT(PL_RGB332, 1, 0, 0, 3, 5, 3, 2, 2, 0, 0)
+CKRST_PIXELLAYOUT(PL_ARGB2222, 1, 2, 6, 2, 4, 2, 2, 2, 0, 0)
+
+#undef CKRST_PIXELLAYOUT
+
+static int GetPixelLayout(VX_PIXELFORMAT Format)
+{
+    switch (Format)
+    {
+    case _32_ARGB8888: return PL_ARGB8888;
+    case _32_RGB888: return PL_XRGB8888;
+    case _24_RGB888: return PL_RGB888;
+    case _16_RGB565: return PL_RGB565;
+    case _16_RGB555: return PL_RGB555;
+    case _16_ARGB1555: return PL_ARGB1555;
+    case _16_ARGB4444: return PL_ARGB4444;
+    case _8_RGB332: return PL_RGB332;
+    case _8_ARGB2222: return PL_ARGB2222;
+    default: return -1;
+    }
+}
+
+// 4x4 Bayer matrix (0..15)
+static const CKBYTE CKRSTBayer4x4[4][4] = {
+    {0, 8, 2, 10},
+    {12, 4, 14, 6},
+    {3, 11, 1, 9},
+    {15, 7, 13, 5},
+};
+
+//--- Expands a N bits component to 8 bits by replicating its bits
+template <int N>
+inline CKDWORD ExpandBits(CKDWORD c)
+{
+    CKDWORD v = c << (8 - N);
+    if (N < 8)
+        v |= v >> (N < 8 ? N : 0);
+    if (2 * N < 8)
+        v |= v >> (2 * N < 8 ? 2 * N : 0);
+    if (4 * N < 8)
+        v |= v >> (4 * N < 8 ? 4 * N : 0);
+    return v;
+}
+
+//--- Value added to a 8 bits component before its truncation to N bits
+template <int N>
+inline CKDWORD DitherOffset(int d)
+{
+    return (N > 0 && N < 8) ? (CKDWORD)((d << (8 - (N > 0 ? N : 8))) >> 4) : 0;
+}
+
+inline CKDWORD LoadPixel(const CKBYTE *p, int Bytes)
+{
+    switch (Bytes)
+    {
+    case 4: return *(const CKDWORD *)p;
+    case 3: return p[0] | (p[1] << 8) | (p[2] << 16);
+    case 2: return *(const CKWORD *)p;
+    default: return *p;
+    }
+}
+
+inline void StorePixel(CKBYTE *p, int Bytes, CKDWORD v)
+{
+    switch (Bytes)
+    {
+    case 4: *(CKDWORD *)p = v; break;
+    case 3: p[0] = (CKBYTE)v; p[1] = (CKBYTE)(v >> 8); p[2] = (CKBYTE)(v >> 16); break;
+    case 2: *(CKWORD *)p = (CKWORD)v; break;
+    default: *p = (CKBYTE)v; break;
+    }
+}
+
+inline CKDWORD SwapRB(CKDWORD c)
+{
+    return (c & 0xFF00FF00) | ((c >> 16) & 0xFF) | ((c & 0xFF) << 16);
+}
+
+//--- Pixel to ARGB8888
+template <int L>
+inline CKDWORD UnpackPixel(CKDWORD p)
+{
+    typedef CKRSTPixelLayout<L> PL;
+    CKDWORD a = (PL::ABits != 0) ? ExpandBits<(PL::ABits != 0 ? PL::ABits : 8)>((p >> PL::AShift) & ((1 << PL::ABits) - 1)) : 0xFF;
+    CKDWORD r = ExpandBits<PL::RBits>((p >> PL::RShift) & ((1 << PL::RBits) - 1));
+    CKDWORD g = ExpandBits<PL::GBits>((p >> PL::GShift) & ((1 << PL::GBits) - 1));
+    CKDWORD b = ExpandBits<PL::BBits>((p >> PL::BShift) & ((1 << PL::BBits) - 1));
+    return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+//--- ARGB8888 to pixel (the components are truncated)
+template <int L>
+inline CKDWORD PackPixel(CKDWORD c)
+{
+    typedef CKRSTPixelLayout<L> PL;
+    CKDWORD p = PL::Fill();
+    if (PL::ABits != 0)
+        p |= ((c >> (32 - (PL::ABits != 0 ? PL::ABits : 8))) & ((1 << PL::ABits) - 1)) << PL::AShift;
+    p |= ((c >> (24 - PL::RBits)) & ((1 << PL::RBits) - 1)) << PL::RShift;
+    p |= ((c >> (16 - PL::GBits)) & ((1 << PL::GBits) - 1)) << PL::GShift;
+    p |= ((c >> (8 - PL::BBits)) & ((1 << PL::BBits) - 1)) << PL::BShift;
+    return p;
+}
+
+//--- Dither offsets of the 4 pixels starting at (X, Y) packed as ARGB8888
+template <int L>
+static void GetDitherRow(CKDWORD *Offsets, int X, int Y)
+{
+    typedef CKRSTPixelLayout<L> PL;
+    for (int i = 0; i < 4; ++i)
+    {
+        int d = CKRSTBayer4x4[Y & 3][(X + i) & 3];
+        Offsets[i] = (DitherOffset<PL::ABits>(d) << 24) | (DitherOffset<PL::RBits>(d) << 16) |
+                     (DitherOffset<PL::GBits>(d) << 8) | DitherOffset<PL::BBits>(d);
+    }
+}
+
+inline CKDWORD AddSaturate(CKDWORD c, CKDWORD d)
+{
+    CKDWORD r = 0;
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        CKDWORD v = ((c >> shift) & 0xFF) + ((d >> shift) & 0xFF);
+        r |= ((v > 0xFF) ? 0xFF : v) << shift;
+    }
+    return r;
+}
+
+#ifdef CKRST_SSE2
+
+// Isolates a N bits component at Shift in each 32 bits lane and expands it to 8 bits
+template <int N, int Shift>
+inline __m128i ExpandBits4(__m128i p)
+{
+    __m128i v = _mm_and_si128(_mm_srli_epi32(p, Shift), _mm_set1_epi32((1 << N) - 1));
+    v = _mm_slli_epi32(v, 8 - N);
+    if (N < 8)
+        v = _mm_or_si128(v, _mm_srli_epi32(v, N < 8 ? N : 0));
+    if (2 * N < 8)
+        v = _mm_or_si128(v, _mm_srli_epi32(v, 2 * N < 8 ? 2 * N : 0));
+    if (4 * N < 8)
+        v = _mm_or_si128(v, _mm_srli_epi32(v, 4 * N < 8 ? 4 * N : 0));
+    return v;
+}
+
+template <int L>
+inline __m128i UnpackPixel4(__m128i p)
+{
+    typedef CKRSTPixelLayout<L> PL;
+    __m128i c;
+    if (PL::ABits != 0)
+        c = _mm_slli_epi32(ExpandBits4<(PL::ABits != 0 ? PL::ABits : 8), PL::AShift>(p), 24);
+    else
+        c = _mm_set1_epi32(0xFF000000);
+    c = _mm_or_si128(c, _mm_slli_epi32(ExpandBits4<PL::RBits, PL::RShift>(p), 16));
+    c = _mm_or_si128(c, _mm_slli_epi32(ExpandBits4<PL::GBits, PL::GShift>(p), 8));
+    return _mm_or_si128(c, ExpandBits4<PL::BBits, PL::BShift>(p));
+}
+
+template <int N, int SrcShift, int DstShift>
+inline __m128i TruncateBits4(__m128i c)
+{
+    __m128i v = _mm_and_si128(_mm_srli_epi32(c, SrcShift + 8 - N), _mm_set1_epi32((1 << N) - 1));
+    return _mm_slli_epi32(v, DstShift);
+}
+
+template <int L>
+inline __m128i PackPixel4(__m128i c)
+{
+    typedef CKRSTPixelLayout<L> PL;
+    __m128i p = _mm_set1_epi32(PL::Fill());
+    if (PL::ABits != 0)
+        p = _mm_or_si128(p, TruncateBits4<(PL::ABits != 0 ? PL::ABits : 8), 24, PL::AShift>(c));
+    p = _mm_or_si128(p, TruncateBits4<PL::RBits, 16, PL::RShift>(c));
+    p = _mm_or_si128(p, TruncateBits4<PL::GBits, 8, PL::GShift>(c));
+    return _mm_or_si128(p, TruncateBits4<PL::BBits, 0, PL::BShift>(c));
+}
+
+inline __m128i SwapRB4(__m128i c)
+{
+    __m128i ag = _mm_and_si128(c, _mm_set1_epi32(0xFF00FF00));
+    __m128i r = _mm_and_si128(_mm_srli_epi32(c, 16), _mm_set1_epi32(0xFF));
+    __m128i b = _mm_slli_epi32(_mm_and_si128(c, _mm_set1_epi32(0xFF)), 16);
+    return _mm_or_si128(ag, _mm_or_si128(r, b));
+}
+
+#endif
+
+//--- Row of pixels to ARGB8888
+template <int L>
+static void UnpackRow(const CKBYTE *Src, CKDWORD *Dst, int Count)
+{
+    typedef CKRSTPixelLayout<L> PL;
+    int i = 0;
+    if (L == PL_ARGB8888)
+    {
+        memcpy(Dst, Src, Count * sizeof(CKDWORD));
+        return;
+    }
+#ifdef CKRST_SSE2
+    if (PL::Bytes != 3)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        for (; i + 4 <= Count; i += 4)
+        {
+            __m128i p;
+            if (PL::Bytes == 4)
+                p = _mm_loadu_si128((const __m128i *)(Src + i * 4));
+            else if (PL::Bytes == 2)
+                p = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)(Src + i * 2)), zero);
+            else
+                p = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(*(const int *)(Src + i)), zero), zero);
+            _mm_storeu_si128((__m128i *)(Dst + i), UnpackPixel4<L>(p));
+        }
+    }
+#endif
+    for (; i < Count; ++i)
+        Dst[i] = UnpackPixel<L>(LoadPixel(Src + i * PL::Bytes, PL::Bytes));
+}
+
+//--- Row of ARGB8888 to pixels, with an optional ordered dither
+template <int L>
+static void PackRow(const CKDWORD *Src, CKBYTE *Dst, int Count, int X, int Y, CKBOOL Dither)
+{
+    typedef CKRSTPixelLayout<L> PL;
+    CKDWORD offsets[4];
+    if (Dither)
+        GetDitherRow<L>(offsets, X, Y);
+
+    int i = 0;
+#ifdef CKRST_SSE2
+    if (PL::Bytes != 3)
+    {
+        const __m128i dither = Dither ? _mm_loadu_si128((const __m128i *)offsets) : _mm_setzero_si128();
+        const __m128i bias32 = _mm_set1_epi32(0x8000);
+        const __m128i bias16 = _mm_set1_epi16((short)0x8000);
+        for (; i + 4 <= Count; i += 4)
+        {
+            __m128i c = _mm_adds_epu8(_mm_loadu_si128((const __m128i *)(Src + i)), dither);
+            __m128i p = PackPixel4<L>(c);
+            if (PL::Bytes == 4)
+            {
+                _mm_storeu_si128((__m128i *)(Dst + i * 4), p);
+            }
+            else if (PL::Bytes == 2)
+            {
+                // No unsigned 32 -> 16 bits saturation in SSE2 : bias to signed values
+                p = _mm_add_epi16(_mm_packs_epi32(_mm_sub_epi32(p, bias32), bias32), bias16);
+                _mm_storel_epi64((__m128i *)(Dst + i * 2), p);
+            }
+            else
+            {
+                p = _mm_packus_epi16(_mm_packs_epi32(p, p), p);
+                *(int *)(Dst + i) = _mm_cvtsi128_si32(p);
+            }
+        }
+    }
+#endif
+    for (; i < Count; ++i)
+    {
+        CKDWORD c = Dither ? AddSaturate(Src[i], offsets[i & 3]) : Src[i];
+        StorePixel(Dst + i * PL::Bytes, PL::Bytes, PackPixel<L>(c));
+    }
+}
+
+static void SwapRBRow(CKDWORD *Pixels, int Count)
+{
+    int i = 0;
+#ifdef CKRST_SSE2
+    for (; i + 4 <= Count; i += 4)
+        _mm_storeu_si128((__m128i *)(Pixels + i), SwapRB4(_mm_loadu_si128((const __m128i *)(Pixels + i))));
+#endif
+    for (; i < Count; ++i)
+        Pixels[i] = SwapRB(Pixels[i]);
+}
+
+#define CKRST_PIXELCHUNK 256
+
+template <int S, int D>
+static void ConvertRow(const CKBYTE *Src, CKBYTE *Dst, int Count, int X, int Y, CKDWORD Flags)
+{
+    typedef CKRSTPixelLayout<S> SL;
+    typedef CKRSTPixelLayout<D> DL;
+    if (S == D && !(Flags & CKRST_PIXELCONVERT_SWAPRB))
+    {
+        memcpy(Dst, Src, Count * SL::Bytes);
+        return;
+    }
+
+    // The dither pattern repeats every 4 pixels so the chunks keep it aligned
+    CKDWORD chunk[CKRST_PIXELCHUNK];
+    CKBOOL dither = (Flags & CKRST_PIXELCONVERT_DITHER) != 0;
+    while (Count > 0)
+    {
+        int n = (Count < CKRST_PIXELCHUNK) ? Count : CKRST_PIXELCHUNK;
+        if (D == PL_ARGB8888)
+        {
+            UnpackRow<S>(Src, (CKDWORD *)Dst, n);
+            if (Flags & CKRST_PIXELCONVERT_SWAPRB)
+                SwapRBRow((CKDWORD *)Dst, n);
+        }
+        else
+        {
+            const CKDWORD *argb = (const CKDWORD *)Src;
+            if (S != PL_ARGB8888 || (Flags & CKRST_PIXELCONVERT_SWAPRB))
+            {
+                UnpackRow<S>(Src, chunk, n);
+                if (Flags & CKRST_PIXELCONVERT_SWAPRB)
+                    SwapRBRow(chunk, n);
+                argb = chunk;
+            }
+            PackRow<D>(argb, Dst, n, X, Y, dither);
+        }
+        Src += n * SL::Bytes;
+        Dst += n * DL::Bytes;
+        X += n;
+        Count -= n;
+    }
+}
+
+#define CKRST_CONVERTROW(S)                                                                             \
+    {                                                                                                   \
+        ConvertRow<S, PL_ARGB8888>, ConvertRow<S, PL_XRGB8888>, ConvertRow<S, PL_RGB888>,                \
+        ConvertRow<S, PL_RGB565>, ConvertRow<S, PL_RGB555>, ConvertRow<S, PL_ARGB1555>,                  \
+        ConvertRow<S, PL_ARGB4444>, ConvertRow<S, PL_RGB332>, ConvertRow<S, PL_ARGB2222>                 \
+    }
+
+static const CKRST_PIXELCONVERTFUNCTION CKRSTPixelConverters[PL_COUNT][PL_COUNT] = {
+    CKRST_CONVERTROW(PL_ARGB8888),
+    CKRST_CONVERTROW(PL_XRGB8888),
+    CKRST_CONVERTROW(PL_RGB888),
+    CKRST_CONVERTROW(PL_RGB565),
+    CKRST_CONVERTROW(PL_RGB555),
+    CKRST_CONVERTROW(PL_ARGB1555),
+    CKRST_CONVERTROW(PL_ARGB4444),
+    CKRST_CONVERTROW(PL_RGB332),
+    CKRST_CONVERTROW(PL_ARGB2222),
+};
+
+#undef CKRST_CONVERTROW
+
+CKRST_PIXELCONVERTFUNCTION CKRSTGetPixelConverter(VX_PIXELFORMAT SrcFormat, VX_PIXELFORMAT DstFormat)
+{
+    int src = GetPixelLayout(SrcFormat);
+    int dst = GetPixelLayout(DstFormat);
+    if (src < 0 || dst < 0)
+        return NULL;
+    return CKRSTPixelConverters[src][dst];
+}
+
+CKBOOL CKRSTConvertPixels(const VxImageDescEx &Src, VxImageDescEx &Dst, CKDWORD Flags)
+{
+    if (!Src.Image || !Dst.Image)
+        return FALSE;
+
+    CKRST_PIXELCONVERTFUNCTION convert = CKRSTGetPixelConverter(VxImageDesc2PixelFormat(Src), VxImageDesc2PixelFormat(Dst));
+    if (!convert)
+        return FALSE;
+
+    int width = (Src.Width < Dst.Width) ? Src.Width : Dst.Width;
+    int height = (Src.Height < Dst.Height) ? Src.Height : Dst.Height;
+    const CKBYTE *src = Src.Image;
+    CKBYTE *dst = Dst.Image;
+    for (int y = 0; y < height; ++y)
+    {
+        convert(src, dst, width, 0, y, Flags);
+        src += Src.BytesPerLine;
+        dst += Dst.BytesPerLine;
+    }
+    return TRUE;
+}
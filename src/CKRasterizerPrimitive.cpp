@@ -0,0 +1,197 @@
+#include "CKRasterizer.h"
+
+/*******************************************************************
+ Primitive conversion
+  - Strips and fans are expanded to lists (every other triangle
+    of a strip has its first two vertices swapped to keep the winding)
+  - Degenerate triangles (two identical indices) and lines are removed
+  - Triangle lists can be restitched into a single strip, the strips
+    found are joined with degenerate triangles
+*******************************************************************/
+
+VXPRIMITIVETYPE CKRSTGetListType(VXPRIMITIVETYPE pType)
+{
+    switch (pType)
+    {
+    case VX_TRIANGLESTRIP:
+    case VX_TRIANGLEFAN:
+        return VX_TRIANGLELIST;
+    case VX_LINESTRIP:
+        return VX_LINELIST;
+    default:
+        return pType;
+    }
+}
+
+int CKRSTGetListIndexCount(VXPRIMITIVETYPE pType, int IndexCount)
+{
+    switch (pType)
+    {
+    case VX_TRIANGLESTRIP:
+    case VX_TRIANGLEFAN:
+        return (IndexCount > 2) ? (IndexCount - 2) * 3 : 0;
+    case VX_LINESTRIP:
+        return (IndexCount > 1) ? (IndexCount - 1) * 2 : 0;
+    default:
+        return IndexCount;
+    }
+}
+
+int CKRSTConvertToList(CKDWORD *Dest, VXPRIMITIVETYPE pType, const void *Indices, CKDWORD IndexSize, int IndexCount,
+                       CKBOOL RemoveDegenerates)
+{
+    // Indices can be NULL for a non indexed primitive
+#define SRC_INDEX(i) (!Indices ? (CKDWORD)(i) : (IndexSize == sizeof(CKWORD)) ? (CKDWORD)((const CKWORD *)Indices)[i] : ((const CKDWORD *)Indices)[i])
+
+    int count = 0;
+    int i;
+    switch (pType)
+    {
+    case VX_TRIANGLELIST:
+    case VX_TRIANGLESTRIP:
+    case VX_TRIANGLEFAN:
+    {
+        int triCount = (pType == VX_TRIANGLELIST) ? IndexCount / 3 : IndexCount - 2;
+        for (i = 0; i < triCount; ++i)
+        {
+            CKDWORD a, b, c;
+            if (pType == VX_TRIANGLELIST)
+            {
+                a = SRC_INDEX(i * 3);
+                b = SRC_INDEX(i * 3 + 1);
+                c = SRC_INDEX(i * 3 + 2);
+            }
+            else if (pType == VX_TRIANGLEFAN)
+            {
+                a = SRC_INDEX(0);
+                b = SRC_INDEX(i + 1);
+                c = SRC_INDEX(i + 2);
+            }
+            else if (i & 1)
+            {
+                a = SRC_INDEX(i + 1);
+                b = SRC_INDEX(i);
+                c = SRC_INDEX(i + 2);
+            }
+            else
+            {
+                a = SRC_INDEX(i);
+                b = SRC_INDEX(i + 1);
+                c = SRC_INDEX(i + 2);
+            }
+            if (RemoveDegenerates && (a == b || b == c || a == c))
+                continue;
+            Dest[count++] = a;
+            Dest[count++] = b;
+            Dest[count++] = c;
+        }
+        break;
+    }
+    case VX_LINELIST:
+    case VX_LINESTRIP:
+    {
+        int lineCount = (pType == VX_LINELIST) ? IndexCount / 2 : IndexCount - 1;
+        for (i = 0; i < lineCount; ++i)
+        {
+            int first = (pType == VX_LINELIST) ? i * 2 : i;
+            CKDWORD a = SRC_INDEX(first);
+            CKDWORD b = SRC_INDEX(first + 1);
+            if (RemoveDegenerates && a == b)
+                continue;
+            Dest[count++] = a;
+            Dest[count++] = b;
+        }
+        break;
+    }
+    default:
+        for (i = 0; i < IndexCount; ++i)
+            Dest[count++] = SRC_INDEX(i);
+        break;
+    }
+
+#undef SRC_INDEX
+    return count;
+}
+
+int CKRSTStripifyTriangleList(CKDWORD *Dest, const CKDWORD *Indices, int IndexCount, int VertexCount)
+{
+    int triCount = IndexCount / 3;
+    if (triCount == 0 || VertexCount <= 0)
+        return 0;
+
+    // Vertex -> triangles adjacency
+    XArray<int> triStart;
+    XArray<int> vertexTris;
+    XArray<CKBYTE> used;
+    triStart.Resize(VertexCount + 1);
+    triStart.Fill(0);
+    vertexTris.Resize(triCount * 3);
+    used.Resize(triCount);
+    used.Fill(0);
+    int i;
+    for (i = 0; i < triCount * 3; ++i)
+        ++triStart[Indices[i] + 1];
+    for (i = 0; i < VertexCount; ++i)
+        triStart[i + 1] += triStart[i];
+    XArray<int> fill;
+    fill.Resize(VertexCount);
+    for (i = 0; i < VertexCount; ++i)
+        fill[i] = triStart[i];
+    for (i = 0; i < triCount * 3; ++i)
+        vertexTris[fill[Indices[i]]++] = i / 3;
+
+    int count = 0;
+    for (int start = 0; start < triCount; ++start)
+    {
+        if (used[start])
+            continue;
+        used[start] = 1;
+
+        // Join with the previous strip : repeat its last vertex and the first vertex of
+        // this one, plus one more time if needed so that this strip starts on an even triangle
+        const CKDWORD *tri = &Indices[start * 3];
+        if (count > 0)
+        {
+            Dest[count] = Dest[count - 1];
+            ++count;
+            Dest[count++] = tri[0];
+            if (count & 1)
+                Dest[count++] = tri[0];
+        }
+        int stripStart = count;
+        Dest[count++] = tri[0];
+        Dest[count++] = tri[1];
+        Dest[count++] = tri[2];
+
+        // Extend while a free triangle continues the strip with the right winding :
+        // triangle n of the strip is (p, q, x) with p, q the last two vertices swapped on odd triangles
+        for (;;)
+        {
+            CKBOOL odd = ((count - stripStart - 2) & 1) != 0;
+            CKDWORD p = odd ? Dest[count - 1] : Dest[count - 2];
+            CKDWORD q = odd ? Dest[count - 2] : Dest[count - 1];
+
+            int next = -1;
+            CKDWORD x = 0;
+            for (int a = triStart[p]; a < triStart[p + 1] && next < 0; ++a)
+            {
+                int t = vertexTris[a];
+                if (used[t])
+                    continue;
+                const CKDWORD *n = &Indices[t * 3];
+                for (int k = 0; k < 3; ++k)
+                    if (n[k] == p && n[(k + 1) % 3] == q)
+                    {
+                        next = t;
+                        x = n[(k + 2) % 3];
+                        break;
+                    }
+            }
+            if (next < 0)
+                break;
+            used[next] = 1;
+            Dest[count++] = x;
+        }
+    }
+    return count;
+}
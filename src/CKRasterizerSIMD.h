@@ -0,0 +1,50 @@
+#ifndef CKRASTERIZERSIMD_H
+#define CKRASTERIZERSIMD_H
+
+#include "VxDefines.h"
+
+/*******************************************************************
+ SSE2 is used when the compiler targets it (x64 or /arch:SSE2),
+ otherwise every kernel falls back to plain C code.
+ Define CKRST_NO_SIMD to force the scalar code paths.
+*******************************************************************/
+#if !defined(CKRST_NO_SIMD) && (defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define CKRST_SSE2
+#include <emmintrin.h>
+#endif
+
+//--- Copy 4, 8, 12 or 16 bytes of vertex data (no alignment requirement)
+inline void CKRSTCopy4(void *dst, const void *src)
+{
+    *(CKDWORD *)dst = *(const CKDWORD *)src;
+}
+
+inline void CKRSTCopy8(void *dst, const void *src)
+{
+#ifdef CKRST_SSE2
+    _mm_storel_epi64((__m128i *)dst, _mm_loadl_epi64((const __m128i *)src));
+#else
+    ((CKDWORD *)dst)[0] = ((const CKDWORD *)src)[0];
+    ((CKDWORD *)dst)[1] = ((const CKDWORD *)src)[1];
+#endif
+}
+
+inline void CKRSTCopy12(void *dst, const void *src)
+{
+    CKRSTCopy8(dst, src);
+    ((CKDWORD *)dst)[2] = ((const CKDWORD *)src)[2];
+}
+
+inline void CKRSTCopy16(void *dst, const void *src)
+{
+#ifdef CKRST_SSE2
+    _mm_storeu_si128((__m128i *)dst, _mm_loadu_si128((const __m128i *)src));
+#else
+    ((CKDWORD *)dst)[0] = ((const CKDWORD *)src)[0];
+    ((CKDWORD *)dst)[1] = ((const CKDWORD *)src)[1];
+    ((CKDWORD *)dst)[2] = ((const CKDWORD *)src)[2];
+    ((CKDWORD *)dst)[3] = ((const CKDWORD *)src)[3];
+#endif
+}
+
+#endif // CKRASTERIZERSIMD_H
@@ -0,0 +1,184 @@
+#include "CKRasterizer.h"
+
+/*******************************************************************
+ Staging memory arena
+  - Buddy allocator : a free block of order n is split in two blocks
+    of order n - 1 until it has the size asked, a freed block is
+    merged with its buddy (block index ^ (1 << n)) while it is free
+  - Pages are allocated when no page has a free block big enough,
+    an empty page is given back to the system unless it is the last one
+*******************************************************************/
+
+#define CKRST_STAGING_PAGESIZE ((CKDWORD)CKRST_STAGING_MINBLOCK << CKRST_STAGING_PAGEORDER)
+
+CKRasterizerStagingArena::CKRasterizerStagingArena(CKDWORD MaxSize) : m_MaxSize(MaxSize) {}
+
+CKRasterizerStagingArena::~CKRasterizerStagingArena()
+{
+    int i;
+    for (i = 0; i < m_Pages.Size(); ++i)
+    {
+        delete[] m_Pages[i]->Memory;
+        delete m_Pages[i];
+    }
+    for (i = 0; i < m_Blocks.Size(); ++i)
+        delete[] m_Blocks[i].Memory;
+}
+
+void *CKRasterizerStagingArena::Allocate(CKDWORD Size)
+{
+    if (Size == 0)
+        return NULL;
+
+    if (Size > CKRST_STAGING_PAGESIZE)
+    {
+        if (!Reserve(Size))
+            return NULL;
+        CKStagingBlock block;
+        block.Memory = new CKBYTE[Size];
+        block.Size = Size;
+        m_Blocks.PushBack(block);
+        m_Stats.UsedMemory += Size;
+        m_Stats.UsedHighWater = XMax(m_Stats.UsedHighWater, m_Stats.UsedMemory);
+        ++m_Stats.BlockCount;
+        return block.Memory;
+    }
+
+    int order = 0;
+    while (((CKDWORD)CKRST_STAGING_MINBLOCK << order) < Size)
+        ++order;
+
+    CKStagingPage *page = NULL;
+    int block = -1;
+    for (int i = 0; i < m_Pages.Size() && block < 0; ++i)
+    {
+        page = m_Pages[i];
+        block = AllocateBlock(page, order);
+    }
+    if (block < 0)
+    {
+        if (!Reserve(CKRST_STAGING_PAGESIZE))
+            return NULL;
+        page = new CKStagingPage;
+        page->Memory = new CKBYTE[CKRST_STAGING_PAGESIZE];
+        page->State.Resize(1 << CKRST_STAGING_PAGEORDER);
+        page->State.Fill(0);
+        page->State[0] = (CKRST_STAGING_PAGEORDER + 1) | CKRST_STAGING_FREE;
+        page->FreeBlocks[CKRST_STAGING_PAGEORDER].PushBack(0);
+        m_Pages.PushBack(page);
+        block = AllocateBlock(page, order);
+    }
+
+    CKDWORD size = (CKDWORD)CKRST_STAGING_MINBLOCK << order;
+    page->UsedMemory += size;
+    m_Stats.UsedMemory += size;
+    m_Stats.UsedHighWater = XMax(m_Stats.UsedHighWater, m_Stats.UsedMemory);
+    ++m_Stats.BlockCount;
+    return page->Memory + block * CKRST_STAGING_MINBLOCK;
+}
+
+void CKRasterizerStagingArena::Free(void *Memory)
+{
+    if (!Memory)
+        return;
+
+    CKBYTE *mem = (CKBYTE *)Memory;
+    int i;
+    for (i = 0; i < m_Pages.Size(); ++i)
+    {
+        CKStagingPage *page = m_Pages[i];
+        if (mem < page->Memory || mem >= page->Memory + CKRST_STAGING_PAGESIZE)
+            continue;
+
+        int block = (int)((mem - page->Memory) / CKRST_STAGING_MINBLOCK);
+        int order = page->State[block] - 1;
+        CKDWORD size = (CKDWORD)CKRST_STAGING_MINBLOCK << order;
+        page->UsedMemory -= size;
+        m_Stats.UsedMemory -= size;
+        --m_Stats.BlockCount;
+
+        // Merge with the free buddies
+        while (order < CKRST_STAGING_PAGEORDER)
+        {
+            int buddy = block ^ (1 << order);
+            if (page->State[buddy] != ((order + 1) | CKRST_STAGING_FREE))
+                break;
+            page->FreeBlocks[order].Remove(buddy);
+            page->State[buddy] = 0;
+            page->State[block] = 0;
+            block = XMin(block, buddy);
+            ++order;
+        }
+        page->State[block] = (CKBYTE)((order + 1) | CKRST_STAGING_FREE);
+        page->FreeBlocks[order].PushBack(block);
+
+        if (page->UsedMemory == 0 && m_Pages.Size() > 1)
+        {
+            delete[] page->Memory;
+            delete page;
+            m_Pages.RemoveAt(i);
+            Unreserve(CKRST_STAGING_PAGESIZE);
+        }
+        return;
+    }
+
+    for (i = 0; i < m_Blocks.Size(); ++i)
+    {
+        if (m_Blocks[i].Memory != mem)
+            continue;
+        delete[] m_Blocks[i].Memory;
+        m_Stats.UsedMemory -= m_Blocks[i].Size;
+        --m_Stats.BlockCount;
+        Unreserve(m_Blocks[i].Size);
+        m_Blocks.RemoveAt(i);
+        return;
+    }
+}
+
+void CKRasterizerStagingArena::ResetHighWaterMarks()
+{
+    m_Stats.UsedHighWater = m_Stats.UsedMemory;
+    m_Stats.ReservedHighWater = m_Stats.ReservedMemory;
+}
+
+CKBOOL CKRasterizerStagingArena::Reserve(CKDWORD Size)
+{
+    if (m_Stats.ReservedMemory + Size > m_MaxSize)
+    {
+        ++m_Stats.Failures;
+        return FALSE;
+    }
+    m_Stats.ReservedMemory += Size;
+    m_Stats.ReservedHighWater = XMax(m_Stats.ReservedHighWater, m_Stats.ReservedMemory);
+    return TRUE;
+}
+
+void CKRasterizerStagingArena::Unreserve(CKDWORD Size)
+{
+    m_Stats.ReservedMemory -= Size;
+}
+
+// Takes a block of the given order in a page, returns its first min block or -1
+int CKRasterizerStagingArena::AllocateBlock(CKStagingPage *Page, int Order)
+{
+    int order = Order;
+    while (order <= CKRST_STAGING_PAGEORDER && Page->FreeBlocks[order].Size() == 0)
+        ++order;
+    if (order > CKRST_STAGING_PAGEORDER)
+        return -1;
+
+    XArray<int> &freeBlocks = Page->FreeBlocks[order];
+    int block = freeBlocks[freeBlocks.Size() - 1];
+    freeBlocks.PopBack();
+
+    // Split it down to the order asked, the upper halves stay free
+    while (order > Order)
+    {
+        --order;
+        int buddy = block + (1 << order);
+        Page->State[buddy] = (CKBYTE)((order + 1) | CKRST_STAGING_FREE);
+        Page->FreeBlocks[order].PushBack(buddy);
+    }
+    Page->State[block] = (CKBYTE)(Order + 1);
+    return block;
+}
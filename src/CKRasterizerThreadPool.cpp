@@ -0,0 +1,264 @@
+#include "CKRasterizer.h"
+#include "CKRasterizerThreads.h"
+
+/*******************************************************************
+ Thread pool
+  - Each worker waits on a semaphore released once per submitted item
+  - Items are claimed one at a time under the pool lock, so jobs
+    should have reasonably coarse items (tiles, row bands, ...)
+*******************************************************************/
+
+#ifdef WIN32
+
+typedef HANDLE CKRSTThread;
+
+static int GetProcessorCount()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+}
+
+#else
+
+typedef pthread_t CKRSTThread;
+
+static int GetProcessorCount()
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (count > 0) ? (int)count : 1;
+}
+
+#endif
+
+struct CKRSTJob
+{
+    CKDWORD Ticket;
+    CKRST_JOBFUNCTION Function;
+    void *Data;
+    int Count;
+    int Next; // Next item to start
+    int Done; // Items finished
+    CKBOOL Waited; // A thread waits for the job and deletes it
+    CKRSTEvent Finished;
+};
+
+struct CKRSTThreadPoolData
+{
+    CKRSTMutex Lock;
+    CKRSTSemaphore Work;
+    XArray<CKRSTThread> Threads;
+    XArray<CKRSTJob *> Jobs; // Jobs not finished yet, in submission order
+    CKDWORD NextTicket;
+    CKBOOL Quit;
+
+    CKRSTThreadPoolData() : NextTicket(1), Quit(FALSE) {}
+
+    CKRSTJob *FindJob(CKDWORD Ticket)
+    {
+        for (int i = 0; i < Jobs.Size(); ++i)
+            if (Jobs[i]->Ticket == Ticket)
+                return Jobs[i];
+        return NULL;
+    }
+
+    // Runs one item of the given job (or of the oldest job with items left), returns FALSE if there was none
+    CKBOOL RunItem(CKRSTJob *job)
+    {
+        Lock.Lock();
+        if (!job)
+        {
+            for (int i = 0; i < Jobs.Size() && !job; ++i)
+                if (Jobs[i]->Next < Jobs[i]->Count)
+                    job = Jobs[i];
+        }
+        if (!job || job->Next >= job->Count)
+        {
+            Lock.Unlock();
+            return FALSE;
+        }
+        int index = job->Next++;
+        Lock.Unlock();
+
+        job->Function(job->Data, index);
+
+        Lock.Lock();
+        CKBOOL finished = (++job->Done == job->Count);
+        CKBOOL waited = job->Waited;
+        if (finished)
+            Jobs.Remove(job);
+        Lock.Unlock();
+
+        // The waiting thread deletes the job once signaled
+        if (finished)
+        {
+            if (waited)
+                job->Finished.Set();
+            else
+                delete job;
+        }
+        return TRUE;
+    }
+};
+
+#ifdef WIN32
+static DWORD WINAPI CKRSTWorkerThread(LPVOID param)
+#else
+static void *CKRSTWorkerThread(void *param)
+#endif
+{
+    CKRSTThreadPoolData *data = (CKRSTThreadPoolData *)param;
+    for (;;)
+    {
+        data->Work.Wait();
+        if (data->Quit)
+            break;
+        while (data->RunItem(NULL))
+            ;
+    }
+    return 0;
+}
+
+CKRasterizerThreadPool::CKRasterizerThreadPool() : m_Data(NULL) {}
+
+CKRasterizerThreadPool::~CKRasterizerThreadPool()
+{
+    Stop();
+}
+
+CKBOOL CKRasterizerThreadPool::Start(int ThreadCount)
+{
+    if (m_Data)
+        return TRUE;
+
+    if (ThreadCount < 0)
+        ThreadCount = GetProcessorCount() - 1;
+
+    m_Data = new CKRSTThreadPoolData;
+    for (int i = 0; i < ThreadCount; ++i)
+    {
+        CKRSTThread thread;
+#ifdef WIN32
+        thread = CreateThread(NULL, 0, CKRSTWorkerThread, m_Data, 0, NULL);
+        if (!thread)
+            break;
+#else
+        if (pthread_create(&thread, NULL, CKRSTWorkerThread, m_Data) != 0)
+            break;
+#endif
+        m_Data->Threads.PushBack(thread);
+    }
+    return TRUE;
+}
+
+void CKRasterizerThreadPool::Stop()
+{
+    if (!m_Data)
+        return;
+
+    // Finish the pending jobs before stopping the workers
+    for (;;)
+    {
+        m_Data->Lock.Lock();
+        CKDWORD ticket = (m_Data->Jobs.Size() > 0) ? m_Data->Jobs[0]->Ticket : 0;
+        m_Data->Lock.Unlock();
+        if (ticket == 0)
+            break;
+        Wait(ticket);
+    }
+
+    m_Data->Quit = TRUE;
+    m_Data->Work.Post(m_Data->Threads.Size());
+    for (int i = 0; i < m_Data->Threads.Size(); ++i)
+    {
+#ifdef WIN32
+        WaitForSingleObject(m_Data->Threads[i], INFINITE);
+        CloseHandle(m_Data->Threads[i]);
+#else
+        pthread_join(m_Data->Threads[i], NULL);
+#endif
+    }
+
+    delete m_Data;
+    m_Data = NULL;
+}
+
+int CKRasterizerThreadPool::GetThreadCount() const
+{
+    return m_Data ? m_Data->Threads.Size() : 0;
+}
+
+CKDWORD CKRasterizerThreadPool::Submit(CKRST_JOBFUNCTION Function, void *Data, int Count)
+{
+    if (!Function || Count <= 0)
+        return 0;
+
+    // No worker : run the job now
+    if (!m_Data || m_Data->Threads.Size() == 0)
+    {
+        for (int i = 0; i < Count; ++i)
+            Function(Data, i);
+        return 0;
+    }
+
+    CKRSTJob *job = new CKRSTJob;
+    job->Function = Function;
+    job->Data = Data;
+    job->Count = Count;
+    job->Next = 0;
+    job->Done = 0;
+    job->Waited = FALSE;
+
+    m_Data->Lock.Lock();
+    CKDWORD ticket = m_Data->NextTicket++;
+    if (m_Data->NextTicket == 0)
+        m_Data->NextTicket = 1;
+    job->Ticket = ticket;
+    m_Data->Jobs.PushBack(job);
+    m_Data->Lock.Unlock();
+
+    // The job can be finished (and deleted) as soon as a worker is woken up
+    m_Data->Work.Post((Count < m_Data->Threads.Size()) ? Count : m_Data->Threads.Size());
+    return ticket;
+}
+
+CKBOOL CKRasterizerThreadPool::IsComplete(CKDWORD Ticket)
+{
+    if (!m_Data || Ticket == 0)
+        return TRUE;
+
+    m_Data->Lock.Lock();
+    CKRSTJob *job = m_Data->FindJob(Ticket);
+    m_Data->Lock.Unlock();
+    return job == NULL;
+}
+
+void CKRasterizerThreadPool::Wait(CKDWORD Ticket)
+{
+    if (!m_Data || Ticket == 0)
+        return;
+
+    m_Data->Lock.Lock();
+    CKRSTJob *job = m_Data->FindJob(Ticket);
+    if (job)
+        job->Waited = TRUE;
+    m_Data->Lock.Unlock();
+    if (!job)
+        return;
+
+    // Help with the items nobody started, then wait for the others
+    while (m_Data->RunItem(job))
+        ;
+    job->Finished.Wait();
+    delete job;
+}
+
+void CKRasterizerThreadPool::ParallelFor(CKRST_JOBFUNCTION Function, void *Data, int Count)
+{
+    if (Count == 1)
+    {
+        Function(Data, 0);
+        return;
+    }
+    Wait(Submit(Function, Data, Count));
+}
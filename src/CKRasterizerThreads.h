@@ -0,0 +1,120 @@
+#ifndef CKRASTERIZERTHREADS_H
+#define CKRASTERIZERTHREADS_H
+
+#include "VxDefines.h"
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+#endif
+
+/*******************************************************************
+ Synchronization primitives of the thread pool, also used to guard
+ the few process-wide caches of the lib
+*******************************************************************/
+
+#ifdef WIN32
+
+struct CKRSTMutex
+{
+    CRITICAL_SECTION cs;
+    CKRSTMutex() { InitializeCriticalSection(&cs); }
+    ~CKRSTMutex() { DeleteCriticalSection(&cs); }
+    void Lock() { EnterCriticalSection(&cs); }
+    void Unlock() { LeaveCriticalSection(&cs); }
+};
+
+struct CKRSTSemaphore
+{
+    HANDLE h;
+    CKRSTSemaphore() { h = CreateSemaphore(NULL, 0, 0x7FFFFFFF, NULL); }
+    ~CKRSTSemaphore() { CloseHandle(h); }
+    void Post(int count) { ReleaseSemaphore(h, count, NULL); }
+    void Wait() { WaitForSingleObject(h, INFINITE); }
+};
+
+struct CKRSTEvent
+{
+    HANDLE h;
+    CKRSTEvent() { h = CreateEvent(NULL, TRUE, FALSE, NULL); }
+    ~CKRSTEvent() { CloseHandle(h); }
+    void Set() { SetEvent(h); }
+    void Wait() { WaitForSingleObject(h, INFINITE); }
+};
+
+#else
+
+struct CKRSTMutex
+{
+    pthread_mutex_t m;
+    CKRSTMutex() { pthread_mutex_init(&m, NULL); }
+    ~CKRSTMutex() { pthread_mutex_destroy(&m); }
+    void Lock() { pthread_mutex_lock(&m); }
+    void Unlock() { pthread_mutex_unlock(&m); }
+};
+
+struct CKRSTSemaphore
+{
+    sem_t s;
+    CKRSTSemaphore() { sem_init(&s, 0, 0); }
+    ~CKRSTSemaphore() { sem_destroy(&s); }
+    void Post(int count)
+    {
+        while (count-- > 0)
+            sem_post(&s);
+    }
+    void Wait()
+    {
+        while (sem_wait(&s) != 0)
+            ;
+    }
+};
+
+struct CKRSTEvent
+{
+    pthread_mutex_t m;
+    pthread_cond_t c;
+    int signaled;
+    CKRSTEvent() : signaled(0)
+    {
+        pthread_mutex_init(&m, NULL);
+        pthread_cond_init(&c, NULL);
+    }
+    ~CKRSTEvent()
+    {
+        pthread_cond_destroy(&c);
+        pthread_mutex_destroy(&m);
+    }
+    void Set()
+    {
+        pthread_mutex_lock(&m);
+        signaled = 1;
+        pthread_cond_broadcast(&c);
+        pthread_mutex_unlock(&m);
+    }
+    void Wait()
+    {
+        pthread_mutex_lock(&m);
+        while (!signaled)
+            pthread_cond_wait(&c, &m);
+        pthread_mutex_unlock(&m);
+    }
+};
+
+#endif
+
+//--- Locks a mutex for the lifetime of the object
+struct CKRSTScopedLock
+{
+    CKRSTMutex &mutex;
+    CKRSTScopedLock(CKRSTMutex &m) : mutex(m) { mutex.Lock(); }
+    ~CKRSTScopedLock() { mutex.Unlock(); }
+
+private:
+    CKRSTScopedLock &operator=(const CKRSTScopedLock &);
+};
+
+#endif // CKRASTERIZERTHREADS_H
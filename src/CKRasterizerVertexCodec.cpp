@@ -0,0 +1,402 @@
+#include "CKRasterizer.h"
+#include "CKRasterizerSIMD.h"
+
+/*******************************************************************
+ Compressed vertex attributes
+  - CKRST_VC_POSITIONQ16 : X,Y,Z as signed normalized shorts (+ 1 padding short)
+                           Position = (Q / 32767) * Scale + Bias
+  - CKRST_VC_NORMALPACKED : signed normalized 10:10:10:2 (X in the low bits)
+  - CKRST_VC_TEXHALF : 16 bits floats, padded to 2 or 4 components
+*******************************************************************/
+
+union CKFloatBits
+{
+    float f;
+    CKDWORD u;
+};
+
+// Float to half conversion (round to nearest even, handles denormals, Inf and NaN)
+static inline CKWORD CKRSTFloatToHalf(float value)
+{
+    const CKDWORD f32infty = 255U << 23;
+    const CKDWORD f16max = (127U + 16) << 23;
+    CKFloatBits denormMagic;
+    denormMagic.u = ((127U - 15) + (23 - 10) + 1) << 23;
+
+    CKFloatBits f;
+    f.f = value;
+    CKDWORD sign = f.u & 0x80000000U;
+    f.u ^= sign;
+
+    CKDWORD o;
+    if (f.u >= f16max)
+    {
+        o = (f.u > f32infty) ? 0x7E00 : 0x7C00;
+    }
+    else if (f.u < (113U << 23))
+    {
+        f.f += denormMagic.f;
+        o = f.u - denormMagic.u;
+    }
+    else
+    {
+        CKDWORD mantOdd = (f.u >> 13) & 1;
+        f.u += ((CKDWORD)(15 - 127) << 23) + 0xFFF;
+        f.u += mantOdd;
+        o = f.u >> 13;
+    }
+    return (CKWORD)(o | (sign >> 16));
+}
+
+static inline float CKRSTHalfToFloat(CKWORD h)
+{
+    const CKDWORD shiftedExp = 0x7C00U << 13;
+    CKFloatBits magic;
+    magic.u = 113U << 23;
+
+    CKFloatBits o;
+    o.u = (h & 0x7FFFU) << 13;
+    CKDWORD exp = shiftedExp & o.u;
+    o.u += (127U - 15) << 23;
+
+    if (exp == shiftedExp)
+    {
+        o.u += (128U - 16) << 23; // Inf / NaN
+    }
+    else if (exp == 0)
+    {
+        o.u += 1U << 23; // Denormal
+        o.f -= magic.f;
+    }
+    o.u |= (CKDWORD)(h & 0x8000U) << 16;
+    return o.f;
+}
+
+#ifdef CKRST_SSE2
+// 4 floats to 4 halves (in the low 16 bits of each 32 bits lane)
+static inline __m128i CKRSTFloatToHalf4(__m128 f)
+{
+    const __m128i maskSign = _mm_set1_epi32(0x80000000);
+    const __m128i f16max = _mm_set1_epi32((127 + 16) << 23);
+    const __m128i nanBit = _mm_set1_epi32(0x200);
+    const __m128i inftyAsHalf = _mm_set1_epi32(0x7C00);
+    const __m128i minNormal = _mm_set1_epi32((127 - 14) << 23);
+    const __m128i subnormMagic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+    const __m128i normalBias = _mm_set1_epi32(0xFFF - ((127 - 15) << 23));
+
+    __m128 justSign = _mm_and_ps(_mm_castsi128_ps(maskSign), f);
+    __m128 absf = _mm_xor_ps(f, justSign);
+    __m128i absi = _mm_castps_si128(absf);
+
+    __m128 isNan = _mm_cmpunord_ps(absf, absf);
+    __m128i isRegular = _mm_cmpgt_epi32(f16max, absi);
+    __m128i infOrNan = _mm_or_si128(_mm_and_si128(_mm_castps_si128(isNan), nanBit), inftyAsHalf);
+
+    __m128i isSub = _mm_cmpgt_epi32(minNormal, absi);
+    __m128 subnorm1 = _mm_add_ps(absf, _mm_castsi128_ps(subnormMagic));
+    __m128i subnorm2 = _mm_sub_epi32(_mm_castps_si128(subnorm1), subnormMagic);
+
+    __m128i mantOdd = _mm_srai_epi32(_mm_slli_epi32(absi, 31 - 13), 31);
+    __m128i round1 = _mm_add_epi32(absi, normalBias);
+    __m128i normal = _mm_srli_epi32(_mm_sub_epi32(round1, mantOdd), 13);
+
+    __m128i nonSpecial = _mm_or_si128(_mm_and_si128(subnorm2, isSub), _mm_andnot_si128(isSub, normal));
+    __m128i joined = _mm_or_si128(_mm_and_si128(nonSpecial, isRegular), _mm_andnot_si128(isRegular, infOrNan));
+    __m128i signShift = _mm_srli_epi32(_mm_castps_si128(justSign), 16);
+    return _mm_or_si128(joined, signShift);
+}
+
+// Loads 3 floats without reading past them
+static inline __m128 CKRSTLoad3(const float *v)
+{
+    __m128 xy = _mm_castsi128_ps(_mm_loadl_epi64((const __m128i *)v));
+    return _mm_movelh_ps(xy, _mm_load_ss(v + 2));
+}
+#endif
+
+static inline int CKRSTRoundClamp(float v, float range)
+{
+    if (v > 1.0f)
+        v = 1.0f;
+    else if (v < -1.0f)
+        v = -1.0f;
+    v *= range;
+    return (int)(v >= 0.0f ? v + 0.5f : v - 0.5f);
+}
+
+static inline void CKRSTEncodePosition(CKBYTE *dst, const float *pos, const float *invScale, const float *bias)
+{
+#ifdef CKRST_SSE2
+    __m128 p = _mm_sub_ps(CKRSTLoad3(pos), _mm_loadu_ps(bias));
+    p = _mm_mul_ps(p, _mm_loadu_ps(invScale));
+    p = _mm_min_ps(_mm_max_ps(p, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+    __m128i q = _mm_cvtps_epi32(_mm_mul_ps(p, _mm_set1_ps(32767.0f)));
+    _mm_storel_epi64((__m128i *)dst, _mm_packs_epi32(q, q));
+#else
+    short *q = (short *)dst;
+    q[0] = (short)CKRSTRoundClamp((pos[0] - bias[0]) * invScale[0], 32767.0f);
+    q[1] = (short)CKRSTRoundClamp((pos[1] - bias[1]) * invScale[1], 32767.0f);
+    q[2] = (short)CKRSTRoundClamp((pos[2] - bias[2]) * invScale[2], 32767.0f);
+    q[3] = 0;
+#endif
+}
+
+static inline CKDWORD CKRSTEncodeNormal(const float *n)
+{
+#ifdef CKRST_SSE2
+    __m128 v = _mm_min_ps(_mm_max_ps(CKRSTLoad3(n), _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+    __m128i q = _mm_and_si128(_mm_cvtps_epi32(_mm_mul_ps(v, _mm_set1_ps(511.0f))), _mm_set1_epi32(0x3FF));
+    CKDWORD x = (CKDWORD)_mm_cvtsi128_si32(q);
+    CKDWORD y = (CKDWORD)_mm_cvtsi128_si32(_mm_srli_si128(q, 4));
+    CKDWORD z = (CKDWORD)_mm_cvtsi128_si32(_mm_srli_si128(q, 8));
+    return x | (y << 10) | (z << 20);
+#else
+    CKDWORD x = (CKDWORD)CKRSTRoundClamp(n[0], 511.0f) & 0x3FF;
+    CKDWORD y = (CKDWORD)CKRSTRoundClamp(n[1], 511.0f) & 0x3FF;
+    CKDWORD z = (CKDWORD)CKRSTRoundClamp(n[2], 511.0f) & 0x3FF;
+    return x | (y << 10) | (z << 20);
+#endif
+}
+
+// Encodes FloatCount (1..4) floats as halves, padding to DstSize bytes with zeros
+static inline void CKRSTEncodeHalfs(CKBYTE *dst, const float *src, CKDWORD FloatCount, CKDWORD DstSize)
+{
+    if (FloatCount == 2 && DstSize == 2 * sizeof(CKWORD))
+    {
+#ifdef CKRST_SSE2
+        __m128 uv = _mm_castsi128_ps(_mm_loadl_epi64((const __m128i *)src));
+        __m128i h = CKRSTFloatToHalf4(uv);
+        h = _mm_srai_epi32(_mm_slli_epi32(h, 16), 16);
+        *(CKDWORD *)dst = (CKDWORD)_mm_cvtsi128_si32(_mm_packs_epi32(h, h));
+#else
+        ((CKWORD *)dst)[0] = CKRSTFloatToHalf(src[0]);
+        ((CKWORD *)dst)[1] = CKRSTFloatToHalf(src[1]);
+#endif
+        return;
+    }
+
+    CKWORD *h = (CKWORD *)dst;
+    CKDWORD halfCount = DstSize / sizeof(CKWORD);
+    for (CKDWORD i = 0; i < halfCount; ++i)
+        h[i] = (i < FloatCount) ? CKRSTFloatToHalf(src[i]) : 0;
+}
+
+void CKRSTComputePositionQuantization(VxDrawPrimitiveData *data, VxVector &Scale, VxVector &Bias)
+{
+    Scale = VxVector(1.0f, 1.0f, 1.0f);
+    Bias = VxVector(0.0f, 0.0f, 0.0f);
+    if (!data->PositionPtr || data->VertexCount <= 0)
+        return;
+
+    const CKBYTE *pos = (const CKBYTE *)data->PositionPtr;
+    VxVector vmin = *(const VxVector *)pos;
+    VxVector vmax = vmin;
+    for (int v = 1; v < data->VertexCount; ++v)
+    {
+        pos += data->PositionStride;
+        const VxVector &p = *(const VxVector *)pos;
+        for (int c = 0; c < 3; ++c)
+        {
+            if (p[c] < vmin[c])
+                vmin[c] = p[c];
+            if (p[c] > vmax[c])
+                vmax[c] = p[c];
+        }
+    }
+
+    for (int c = 0; c < 3; ++c)
+    {
+        Bias[c] = (vmin[c] + vmax[c]) * 0.5f;
+        Scale[c] = (vmax[c] - vmin[c]) * 0.5f;
+        if (Scale[c] < EPSILON)
+            Scale[c] = EPSILON;
+    }
+}
+
+CKBYTE *CKRSTLoadVertexBuffer(CKBYTE *VBMem, CKVertexBufferDesc *VB, VxDrawPrimitiveData *data)
+{
+    const CKDWORD VFormat = VB->m_VertexFormat;
+    const CKDWORD VSize = VB->m_VertexSize;
+    const CKDWORD Compression = VB->m_Compression;
+    if (!Compression)
+        return CKRSTLoadVertexBuffer(VBMem, VFormat, VSize, data);
+
+    const CKVertexLayout *layout = CKRSTGetVertexLayout(VFormat, Compression);
+    const CKVertexLayout *floatLayout = CKRSTGetVertexLayout(VFormat);
+
+    float invScale[4], bias[4];
+    for (int c = 0; c < 3; ++c)
+    {
+        invScale[c] = (VB->m_PositionScale[c] != 0.0f) ? 1.0f / VB->m_PositionScale[c] : 0.0f;
+        bias[c] = VB->m_PositionBias[c];
+    }
+    invScale[3] = bias[3] = 0.0f;
+
+    const CKBOOL quantizedPos = (layout->PositionSize == 4 * sizeof(short));
+    const CKBOOL packedNormal = layout->NormalSize && (Compression & CKRST_VC_NORMALPACKED);
+    const CKBOOL halfTex = (Compression & CKRST_VC_TEXHALF) != 0;
+
+    const CKBYTE *texPtr[CKRST_MAX_STAGES];
+    CKDWORD texStride[CKRST_MAX_STAGES];
+    for (CKDWORD i = 0; i < layout->TexCount; ++i)
+    {
+        texPtr[i] = (const CKBYTE *)((i == 0) ? data->TexCoordPtr : data->TexCoordPtrs[i - 1]);
+        texStride[i] = (i == 0) ? data->TexCoordStride : data->TexCoordStrides[i - 1];
+    }
+
+    const CKBYTE *pos = (const CKBYTE *)data->PositionPtr;
+    const CKBYTE *nrm = (const CKBYTE *)data->NormalPtr;
+    const CKBYTE *col = (const CKBYTE *)data->ColorPtr;
+    const CKBYTE *spe = (const CKBYTE *)data->SpecularColorPtr;
+
+    // Single pass over the vertices, every attribute being encoded in turn
+    CKBYTE *dst = VBMem;
+    for (int v = 0; v < data->VertexCount; ++v)
+    {
+        if (quantizedPos)
+            CKRSTEncodePosition(dst, (const float *)pos, invScale, bias);
+        else
+            memcpy(dst, pos, layout->PositionSize);
+        pos += data->PositionStride;
+
+        if (layout->NormalSize && nrm)
+        {
+            if (packedNormal)
+                *(CKDWORD *)(dst + layout->NormalOffset) = CKRSTEncodeNormal((const float *)nrm);
+            else
+                CKRSTCopy12(dst + layout->NormalOffset, nrm);
+            nrm += data->NormalStride;
+        }
+
+        if (layout->DiffuseSize)
+        {
+            if (col)
+            {
+                CKRSTCopy4(dst + layout->DiffuseOffset, col);
+                col += data->ColorStride;
+            }
+            else
+            {
+                *(CKDWORD *)(dst + layout->DiffuseOffset) = 0xFFFFFFFF;
+            }
+        }
+
+        if (layout->SpecularSize)
+        {
+            if (spe)
+            {
+                CKRSTCopy4(dst + layout->SpecularOffset, spe);
+                spe += data->SpecularColorStride;
+            }
+            else
+            {
+                *(CKDWORD *)(dst + layout->SpecularOffset) = 0;
+            }
+        }
+
+        for (CKDWORD i = 0; i < layout->TexCount; ++i)
+        {
+            if (!texPtr[i])
+                continue;
+            if (halfTex)
+                CKRSTEncodeHalfs(dst + layout->TexOffset[i], (const float *)texPtr[i], floatLayout->TexSize[i] / sizeof(float), layout->TexSize[i]);
+            else
+                memcpy(dst + layout->TexOffset[i], texPtr[i], layout->TexSize[i]);
+            texPtr[i] += texStride[i];
+        }
+
+        dst += VSize;
+    }
+
+    return dst;
+}
+
+CKBYTE *CKRSTDecodeVertexBuffer(CKBYTE *Dest, const CKBYTE *VBMem, CKVertexBufferDesc *VB, CKDWORD VertexCount)
+{
+    const CKDWORD VFormat = VB->m_VertexFormat;
+    const CKDWORD VSize = VB->m_VertexSize;
+    const CKDWORD Compression = VB->m_Compression;
+    const CKVertexLayout *layout = CKRSTGetVertexLayout(VFormat, Compression);
+    const CKVertexLayout *floatLayout = CKRSTGetVertexLayout(VFormat);
+    const CKDWORD DSize = floatLayout->VertexSize;
+
+    if (!Compression)
+    {
+        VxCopyStructure(VertexCount, Dest, DSize, layout->VertexSize, (void *)VBMem, VSize);
+        return Dest + VertexCount * DSize;
+    }
+
+    const CKBOOL quantizedPos = (layout->PositionSize == 4 * sizeof(short));
+    const CKBOOL packedNormal = layout->NormalSize && (Compression & CKRST_VC_NORMALPACKED);
+    const CKBOOL halfTex = (Compression & CKRST_VC_TEXHALF) != 0;
+    const VxVector &scale = VB->m_PositionScale;
+    const VxVector &bias = VB->m_PositionBias;
+
+    const CKBYTE *src = VBMem;
+    CKBYTE *dst = Dest;
+    for (CKDWORD v = 0; v < VertexCount; ++v)
+    {
+        if (quantizedPos)
+        {
+            const short *q = (const short *)src;
+            float *p = (float *)dst;
+            for (int c = 0; c < 3; ++c)
+                p[c] = (q[c] * (1.0f / 32767.0f)) * scale[c] + bias[c];
+        }
+        else
+        {
+            memcpy(dst, src, layout->PositionSize);
+        }
+
+        if (layout->WeightCount)
+            memcpy(dst + floatLayout->WeightOffset, src + layout->WeightOffset, layout->WeightCount * sizeof(float));
+
+        if (layout->NormalSize)
+        {
+            float *n = (float *)(dst + floatLayout->NormalOffset);
+            if (packedNormal)
+            {
+                CKDWORD packed = *(const CKDWORD *)(src + layout->NormalOffset);
+                for (int c = 0; c < 3; ++c)
+                {
+                    int q = (int)((packed >> (c * 10)) & 0x3FF);
+                    if (q & 0x200)
+                        q -= 0x400;
+                    n[c] = (q < -511 ? -511 : q) * (1.0f / 511.0f);
+                }
+            }
+            else
+            {
+                memcpy(n, src + layout->NormalOffset, sizeof(VxVector));
+            }
+        }
+
+        if (layout->PSizeSize)
+            CKRSTCopy4(dst + floatLayout->PSizeOffset, src + layout->PSizeOffset);
+        if (layout->DiffuseSize)
+            CKRSTCopy4(dst + floatLayout->DiffuseOffset, src + layout->DiffuseOffset);
+        if (layout->SpecularSize)
+            CKRSTCopy4(dst + floatLayout->SpecularOffset, src + layout->SpecularOffset);
+
+        for (CKDWORD i = 0; i < layout->TexCount; ++i)
+        {
+            if (halfTex)
+            {
+                const CKWORD *h = (const CKWORD *)(src + layout->TexOffset[i]);
+                float *t = (float *)(dst + floatLayout->TexOffset[i]);
+                CKDWORD floatCount = floatLayout->TexSize[i] / sizeof(float);
+                for (CKDWORD c = 0; c < floatCount; ++c)
+                    t[c] = CKRSTHalfToFloat(h[c]);
+            }
+            else
+            {
+                memcpy(dst + floatLayout->TexOffset[i], src + layout->TexOffset[i], layout->TexSize[i]);
+            }
+        }
+
+        src += VSize;
+        dst += DSize;
+    }
+
+    return dst;
+}
@@ -0,0 +1,857 @@
+#include "CKSoftRasterizer.h"
+#include "CKRasterizerSIMD.h"
+
+#include <math.h>
+
+CKSoftRasterizerDriver::CKSoftRasterizerDriver()
+{
+    m_Desc = "Software Rasterizer";
+}
+
+CKSoftRasterizerDriver::~CKSoftRasterizerDriver() {}
+
+CKRasterizerContext *CKSoftRasterizerDriver::CreateContext()
+{
+    CKSoftRasterizerContext *context = new CKSoftRasterizerContext();
+    context->m_Driver = this;
+    m_Contexts.PushBack(context);
+    return context;
+}
+
+void CKSoftRasterizerDriver::InitSoftRasterizerCaps(CKRasterizer *Owner)
+{
+    InitNULLRasterizerCaps(Owner);
+    m_Desc = "Software Rasterizer";
+    m_DriverIndex = Owner->m_Drivers.Size();
+
+    // Textures are converted to 32 bits ARGB when they are loaded
+    m_TextureFormats.Resize(2);
+    VxPixelFormat2ImageDesc(_32_ARGB8888, m_TextureFormats[0].Format);
+    VxPixelFormat2ImageDesc(_32_RGB888, m_TextureFormats[1].Format);
+
+    m_3DCaps.TextureCaps = CKRST_TEXTURECAPS_PERSPECTIVE | CKRST_TEXTURECAPS_ALPHA;
+    m_3DCaps.MinTextureWidth = 1;
+    m_3DCaps.MinTextureHeight = 1;
+    m_3DCaps.MaxTextureWidth = 4096;
+    m_3DCaps.MaxTextureHeight = 4096;
+    m_3DCaps.MaxTextureRatio = 4096;
+    m_3DCaps.MaxActiveLights = RST_MAX_LIGHT;
+    m_3DCaps.MaxNumberTextureStage = 1;
+    m_3DCaps.MaxNumberBlendStage = 1;
+    m_3DCaps.CKRasterizerSpecificCaps = CKRST_SPECIFICCAPS_SOFTWARE | CKRST_SPECIFICCAPS_CANDOVERTEXBUFFER |
+                                        CKRST_SPECIFICCAPS_INDEX32;
+    m_2DCaps.Caps = CKRST_2DCAPS_WINDOWED | CKRST_2DCAPS_3D;
+}
+
+CKSoftRasterizerContext::CKSoftRasterizerContext()
+{
+    m_ColorBuffer = NULL;
+    m_ColorPitch = 0;
+    m_TargetWidth = 0;
+    m_TargetHeight = 0;
+    m_TargetTexture = 0;
+    m_DepthBuffer = NULL;
+    m_DepthPitch = 0;
+    m_HiZ = NULL;
+    m_HiZBlocksX = 0;
+    m_HiZBlocksY = 0;
+
+    m_CurrentTexture = 0;
+    m_TextureFlags = 0;
+    m_MinFilter = VXTEXTUREFILTER_LINEAR;
+    m_MagFilter = VXTEXTUREFILTER_LINEAR;
+    memset(m_LightEnabled, 0, sizeof(m_LightEnabled));
+    m_DrawStateUptodate = FALSE;
+
+    m_TilesX = 0;
+    m_TilesY = 0;
+}
+
+CKSoftRasterizerContext::~CKSoftRasterizerContext()
+{
+    FlushObjects(CKRST_OBJ_ALL);
+}
+
+CKBOOL CKSoftRasterizerContext::Create(WIN_HANDLE Window, int PosX, int PosY, int Width, int Height, int Bpp,
+                                       CKBOOL Fullscreen, int RefreshRate, int Zbpp, int StencilBpp)
+{
+    if (Width <= 0 || Height <= 0)
+    {
+        Width = 640;
+        Height = 480;
+        if (m_Driver && m_Driver->m_DisplayModes.Size() > 0)
+        {
+            Width = m_Driver->m_DisplayModes[0].Width;
+            Height = m_Driver->m_DisplayModes[0].Height;
+        }
+    }
+
+    // Always 32 bits color and depth buffers, in memory
+    m_Window = Window;
+    m_PosX = PosX;
+    m_PosY = PosY;
+    m_Bpp = 32;
+    m_ZBpp = 32;
+    m_StencilBpp = 0;
+    m_PixelFormat = _32_ARGB8888;
+    m_Fullscreen = FALSE;
+    m_RefreshRate = 0;
+    if (!CreateBuffers(Width, Height))
+        return FALSE;
+
+    m_ViewportData.ViewX = 0;
+    m_ViewportData.ViewY = 0;
+    m_ViewportData.ViewWidth = Width;
+    m_ViewportData.ViewHeight = Height;
+    m_ViewportData.ViewZMin = 0.0f;
+    m_ViewportData.ViewZMax = 1.0f;
+
+    // Small draws are merged, each draw costs a transform setup and a draw state lookup
+    EnableBatching(TRUE);
+    return TRUE;
+}
+
+CKBOOL CKSoftRasterizerContext::Resize(int PosX, int PosY, int Width, int Height, CKDWORD Flags)
+{
+    if (Width <= 0 || Height <= 0)
+    {
+        Width = m_Width;
+        Height = m_Height;
+    }
+    m_PosX = PosX;
+    m_PosY = PosY;
+    return CreateBuffers(Width, Height);
+}
+
+// Allocates a depth buffer of Width x Height pixels, cleared to the far plane
+static void SoftCreateDepthBuffer(CKSoftDepthBuffer &Depth, int Width, int Height)
+{
+    // Depth rows are padded so that groups of 4 pixels never straddle two rows
+    Depth.Pitch = (Width + 3) & ~3;
+    Depth.Width = Width;
+    Depth.Height = Height;
+    Depth.Depth.Resize(Depth.Pitch * Height);
+    Depth.Depth.Fill(1.0f);
+
+    CKSoftHiZBlock farBlock = {1.0f, 1.0f};
+    Depth.BlocksX = (Width + CKRST_SOFT_HIZBLOCKSIZE - 1) / CKRST_SOFT_HIZBLOCKSIZE;
+    Depth.BlocksY = (Height + CKRST_SOFT_HIZBLOCKSIZE - 1) / CKRST_SOFT_HIZBLOCKSIZE;
+    Depth.HiZ.Resize(Depth.BlocksX * Depth.BlocksY);
+    Depth.HiZ.Fill(farBlock);
+}
+
+CKBOOL CKSoftRasterizerContext::CreateBuffers(int Width, int Height)
+{
+    if (Width <= 0 || Height <= 0)
+        return FALSE;
+
+    FlushTiles();
+    m_Width = Width;
+    m_Height = Height;
+    m_BackBuffer.Resize(Width * Height);
+    m_BackBuffer.Fill(0);
+    SoftCreateDepthBuffer(m_BackDepth, Width, Height);
+    if (m_TargetTexture == 0)
+        UseTarget(m_BackBuffer.Begin(), Width, Width, Height, m_BackDepth);
+    return TRUE;
+}
+
+void CKSoftRasterizerContext::UseTarget(CKDWORD *Color, int Pitch, int Width, int Height, CKSoftDepthBuffer &Depth)
+{
+    m_ColorBuffer = Color;
+    m_ColorPitch = Pitch;
+    m_TargetWidth = Width;
+    m_TargetHeight = Height;
+
+    // The depth of the target is kept, unless it has to be resized
+    if (Depth.Width != Width || Depth.Height != Height)
+        SoftCreateDepthBuffer(Depth, Width, Height);
+    m_DepthBuffer = Depth.Depth.Begin();
+    m_DepthPitch = Depth.Pitch;
+    m_HiZ = Depth.HiZ.Begin();
+    m_HiZBlocksX = Depth.BlocksX;
+    m_HiZBlocksY = Depth.BlocksY;
+
+    m_TilesX = (Width + CKRST_SOFT_TILESIZE - 1) / CKRST_SOFT_TILESIZE;
+    m_TilesY = (Height + CKRST_SOFT_TILESIZE - 1) / CKRST_SOFT_TILESIZE;
+}
+
+CKBOOL CKSoftRasterizerContext::BackToFront(CKBOOL vsync)
+{
+    // There is no window to present to : the frame is complete once its tiles are rasterized
+    FlushTiles();
+    NextFrame();
+    return TRUE;
+}
+
+CKBOOL CKSoftRasterizerContext::BeginScene()
+{
+    m_SceneBegined = TRUE;
+    return TRUE;
+}
+
+CKBOOL CKSoftRasterizerContext::EndScene()
+{
+    FlushTiles();
+    m_SceneBegined = FALSE;
+    return TRUE;
+}
+
+CKBOOL CKSoftRasterizerContext::EnableLight(CKDWORD LightIndex, CKBOOL Enable)
+{
+    if (LightIndex >= RST_MAX_LIGHT)
+        return FALSE;
+    FlushBatch();
+    m_LightEnabled[LightIndex] = Enable ? 1 : 0;
+    return TRUE;
+}
+
+CKBOOL CKSoftRasterizerContext::SetRenderState(VXRENDERSTATETYPE State, CKDWORD Value)
+{
+    if (InternalSetRenderState(State, Value))
+        return TRUE;
+    if (State == VXRENDERSTATE_INVERSEWINDING)
+        m_InverseWinding = (Value != 0);
+    m_DrawStateUptodate = FALSE;
+    return TRUE;
+}
+
+CKBOOL CKSoftRasterizerContext::SetTexture(CKDWORD Texture, int Stage)
+{
+    if (Stage != 0)
+        return FALSE;
+    if (Texture != m_CurrentTexture)
+        FlushBatch();
+    m_CurrentTexture = Texture;
+    m_DrawStateUptodate = FALSE;
+    return TRUE;
+}
+
+CKBOOL CKSoftRasterizerContext::SetTextureStageState(int Stage, CKRST_TEXTURESTAGESTATETYPE Tss, CKDWORD Value)
+{
+    if (Stage != 0)
+        return FALSE;
+    FlushBatch();
+
+    // Border addressing is done as clamping, mirror as wrapping
+    CKBOOL clamp = (Value == VXTEXTURE_ADDRESSCLAMP || Value == VXTEXTURE_ADDRESSBORDER);
+    switch (Tss)
+    {
+    case CKRST_TSS_ADDRESS:
+        m_TextureFlags = clamp ? (m_TextureFlags | CKRST_SOFT_CLAMPU | CKRST_SOFT_CLAMPV)
+                               : (m_TextureFlags & ~(CKRST_SOFT_CLAMPU | CKRST_SOFT_CLAMPV));
+        break;
+    case CKRST_TSS_ADDRESSU:
+        m_TextureFlags = clamp ? (m_TextureFlags | CKRST_SOFT_CLAMPU) : (m_TextureFlags & ~CKRST_SOFT_CLAMPU);
+        break;
+    case CKRST_TSS_ADDRESSV:
+        m_TextureFlags = clamp ? (m_TextureFlags | CKRST_SOFT_CLAMPV) : (m_TextureFlags & ~CKRST_SOFT_CLAMPV);
+        break;
+    case CKRST_TSS_MINFILTER:
+        m_MinFilter = Value;
+        break;
+    case CKRST_TSS_MAGFILTER:
+        m_MagFilter = Value;
+        break;
+    default:
+        return FALSE;
+    }
+    m_DrawStateUptodate = FALSE;
+    return TRUE;
+}
+
+int CKSoftRasterizerContext::GetDrawState()
+{
+    if (m_DrawStateUptodate && m_DrawStates.Size() > 0)
+        return m_DrawStates.Size() - 1;
+
+    CKSoftDrawState state;
+    memset(&state, 0, sizeof(state));
+    if (GetRSCacheValue(VXRENDERSTATE_ZENABLE))
+    {
+        state.Flags |= CKRST_SOFT_ZTEST;
+        if (GetRSCacheValue(VXRENDERSTATE_ZWRITEENABLE))
+            state.Flags |= CKRST_SOFT_ZWRITE;
+    }
+    state.ZFunc = (VXCMPFUNC)GetRSCacheValue(VXRENDERSTATE_ZFUNC);
+
+    if (GetRSCacheValue(VXRENDERSTATE_ALPHATESTENABLE))
+        state.Flags |= CKRST_SOFT_ALPHATEST;
+    state.AlphaFunc = (VXCMPFUNC)GetRSCacheValue(VXRENDERSTATE_ALPHAFUNC);
+    state.AlphaRef = GetRSCacheValue(VXRENDERSTATE_ALPHAREF) & 0xFF;
+
+    if (GetRSCacheValue(VXRENDERSTATE_ALPHABLENDENABLE))
+        state.Flags |= CKRST_SOFT_BLEND;
+    state.SrcBlend = (VXBLEND_MODE)GetRSCacheValue(VXRENDERSTATE_SRCBLEND);
+    state.DestBlend = (VXBLEND_MODE)GetRSCacheValue(VXRENDERSTATE_DESTBLEND);
+    if (state.SrcBlend == VXBLEND_BOTHSRCALPHA)
+    {
+        state.SrcBlend = VXBLEND_SRCALPHA;
+        state.DestBlend = VXBLEND_INVSRCALPHA;
+    }
+    else if (state.SrcBlend == VXBLEND_BOTHINVSRCALPHA)
+    {
+        state.SrcBlend = VXBLEND_INVSRCALPHA;
+        state.DestBlend = VXBLEND_SRCALPHA;
+    }
+
+    CKSoftTextureDesc *tex = (CKSoftTextureDesc *)GetTextureData(m_CurrentTexture);
+    if (tex && tex->Pixels.Size() > 0)
+    {
+        state.Flags |= CKRST_SOFT_TEXTURE | m_TextureFlags;
+        if (m_MinFilter != VXTEXTUREFILTER_NEAREST || m_MagFilter != VXTEXTUREFILTER_NEAREST)
+            state.Flags |= CKRST_SOFT_BILINEAR;
+        state.Texels = tex->Pixels.Begin();
+        state.TexWidth = tex->Format.Width;
+        state.TexHeight = tex->Format.Height;
+    }
+
+    m_DrawStateUptodate = TRUE;
+    if (m_DrawStates.Size() > 0 && memcmp(&m_DrawStates[m_DrawStates.Size() - 1], &state, sizeof(state)) == 0)
+        return m_DrawStates.Size() - 1;
+    m_DrawStates.PushBack(state);
+    return m_DrawStates.Size() - 1;
+}
+
+//------------------------------------------------------------------
+// Vertex processing
+
+static inline void UnpackColor(CKDWORD Color, float &R, float &G, float &B, float &A)
+{
+    const float scale = 1.0f / 255.0f;
+    A = (float)(Color >> 24) * scale;
+    R = (float)((Color >> 16) & 0xFF) * scale;
+    G = (float)((Color >> 8) & 0xFF) * scale;
+    B = (float)(Color & 0xFF) * scale;
+}
+
+CKBOOL CKSoftRasterizerContext::ProcessVertices(VxDrawPrimitiveData *data)
+{
+    int count = data->VertexCount;
+    if (count <= 0 || !data->PositionPtr)
+        return FALSE;
+    m_Vertices.Resize(count);
+    CKSoftVertex *out = m_Vertices.Begin();
+
+    const CKBYTE *pos = (const CKBYTE *)data->PositionPtr;
+    if (data->Flags & CKRST_DP_TRANSFORM)
+    {
+        UpdateMatrices(WORLD_TRANSFORM);
+        const float *m = (const float *)m_TotalMatrix;
+#ifdef CKRST_SSE2
+        __m128 row0 = _mm_loadu_ps(m);
+        __m128 row1 = _mm_loadu_ps(m + 4);
+        __m128 row2 = _mm_loadu_ps(m + 8);
+        __m128 row3 = _mm_loadu_ps(m + 12);
+        for (int v = 0; v < count; ++v, pos += data->PositionStride)
+        {
+            const float *p = (const float *)pos;
+            __m128 r = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(p[0]), row0), _mm_mul_ps(_mm_set1_ps(p[1]), row1));
+            r = _mm_add_ps(r, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(p[2]), row2), row3));
+            _mm_storeu_ps(&out[v].X, r);
+        }
+#else
+        for (int v = 0; v < count; ++v, pos += data->PositionStride)
+        {
+            const float *p = (const float *)pos;
+            out[v].X = p[0] * m[0] + p[1] * m[4] + p[2] * m[8] + m[12];
+            out[v].Y = p[0] * m[1] + p[1] * m[5] + p[2] * m[9] + m[13];
+            out[v].Z = p[0] * m[2] + p[1] * m[6] + p[2] * m[10] + m[14];
+            out[v].W = p[0] * m[3] + p[1] * m[7] + p[2] * m[11] + m[15];
+        }
+#endif
+    }
+    else
+    {
+        // Screen positions (X, Y, Z, 1/W) go back to clip space to be clipped like the others
+        float halfWidth = m_ViewportData.ViewWidth * 0.5f;
+        float halfHeight = m_ViewportData.ViewHeight * 0.5f;
+        if (halfWidth <= 0.0f || halfHeight <= 0.0f)
+            return FALSE;
+        float centerX = m_ViewportData.ViewX + halfWidth;
+        float centerY = m_ViewportData.ViewY + halfHeight;
+        for (int v = 0; v < count; ++v, pos += data->PositionStride)
+        {
+            const float *p = (const float *)pos;
+            float w = (p[3] != 0.0f) ? 1.0f / p[3] : 1.0f;
+            out[v].X = (p[0] - centerX) / halfWidth * w;
+            out[v].Y = (centerY - p[1]) / halfHeight * w;
+            out[v].Z = p[2] * w;
+            out[v].W = w;
+        }
+    }
+
+    if ((data->Flags & CKRST_DP_LIGHT) && data->NormalPtr)
+    {
+        LightVertices(data);
+    }
+    else if ((data->Flags & CKRST_DP_DIFFUSE) && data->ColorPtr)
+    {
+        const CKBYTE *col = (const CKBYTE *)data->ColorPtr;
+        for (int v = 0; v < count; ++v, col += data->ColorStride)
+            UnpackColor(*(const CKDWORD *)col, out[v].R, out[v].G, out[v].B, out[v].A);
+    }
+    else
+    {
+        // Lit without normals : material color, otherwise white
+        VxColor c(1.0f, 1.0f, 1.0f, 1.0f);
+        if (data->Flags & CKRST_DP_LIGHT)
+            c = m_CurrentMaterialData.Diffuse;
+        for (int v = 0; v < count; ++v)
+        {
+            out[v].R = c.r;
+            out[v].G = c.g;
+            out[v].B = c.b;
+            out[v].A = c.a;
+        }
+    }
+
+    const CKBYTE *uv = (const CKBYTE *)data->TexCoordPtr;
+    for (int v = 0; v < count; ++v)
+    {
+        if (uv)
+        {
+            out[v].U = ((const float *)uv)[0];
+            out[v].V = ((const float *)uv)[1];
+            uv += data->TexCoordStride;
+        }
+        else
+        {
+            out[v].U = out[v].V = 0.0f;
+        }
+    }
+    return TRUE;
+}
+
+// Diffuse and ambient lighting in world space
+void CKSoftRasterizerContext::LightVertices(VxDrawPrimitiveData *data)
+{
+    const CKMaterialData &mat = m_CurrentMaterialData;
+    float ambientR, ambientG, ambientB, ambientA;
+    UnpackColor(GetRSCacheValue(VXRENDERSTATE_AMBIENT), ambientR, ambientG, ambientB, ambientA);
+    float baseR = mat.Emissive.r + ambientR * mat.Ambient.r;
+    float baseG = mat.Emissive.g + ambientG * mat.Ambient.g;
+    float baseB = mat.Emissive.b + ambientB * mat.Ambient.b;
+
+    int lights[RST_MAX_LIGHT];
+    int lightCount = 0;
+    for (int l = 0; l < RST_MAX_LIGHT; ++l)
+        if (m_LightEnabled[l])
+            lights[lightCount++] = l;
+
+    const float *m = (const float *)m_WorldMatrix;
+    const CKBYTE *pos = (const CKBYTE *)data->PositionPtr;
+    const CKBYTE *nrm = (const CKBYTE *)data->NormalPtr;
+    CKSoftVertex *out = m_Vertices.Begin();
+    for (int v = 0; v < data->VertexCount; ++v, pos += data->PositionStride, nrm += data->NormalStride)
+    {
+        const float *p = (const float *)pos;
+        const float *n = (const float *)nrm;
+        float px = p[0] * m[0] + p[1] * m[4] + p[2] * m[8] + m[12];
+        float py = p[0] * m[1] + p[1] * m[5] + p[2] * m[9] + m[13];
+        float pz = p[0] * m[2] + p[1] * m[6] + p[2] * m[10] + m[14];
+        float nx = n[0] * m[0] + n[1] * m[4] + n[2] * m[8];
+        float ny = n[0] * m[1] + n[1] * m[5] + n[2] * m[9];
+        float nz = n[0] * m[2] + n[1] * m[6] + n[2] * m[10];
+        float len = sqrtf(nx * nx + ny * ny + nz * nz);
+        if (len > 0.0f)
+        {
+            nx /= len;
+            ny /= len;
+            nz /= len;
+        }
+
+        float r = baseR, g = baseG, b = baseB;
+        for (int i = 0; i < lightCount; ++i)
+        {
+            const CKLightData &light = m_CurrentLightData[lights[i]];
+            float lx, ly, lz;
+            float att = 1.0f;
+            if (light.Type == VX_LIGHTDIREC)
+            {
+                lx = -light.Direction.x;
+                ly = -light.Direction.y;
+                lz = -light.Direction.z;
+                float d = sqrtf(lx * lx + ly * ly + lz * lz);
+                if (d <= 0.0f)
+                    continue;
+                lx /= d;
+                ly /= d;
+                lz /= d;
+            }
+            else
+            {
+                lx = light.Position.x - px;
+                ly = light.Position.y - py;
+                lz = light.Position.z - pz;
+                float d = sqrtf(lx * lx + ly * ly + lz * lz);
+                if (d <= 0.0f || (light.Range > 0.0f && d > light.Range))
+                    continue;
+                lx /= d;
+                ly /= d;
+                lz /= d;
+                float a = light.Attenuation0 + light.Attenuation1 * d + light.Attenuation2 * d * d;
+                if (a > 0.0f)
+                    att = 1.0f / a;
+
+                if (light.Type == VX_LIGHTSPOT)
+                {
+                    const VxVector &dir = light.Direction;
+                    float dl = sqrtf(dir.x * dir.x + dir.y * dir.y + dir.z * dir.z);
+                    float spot = (dl > 0.0f) ? -(lx * dir.x + ly * dir.y + lz * dir.z) / dl : 1.0f;
+                    float outer = cosf(light.OuterSpotCone * 0.5f);
+                    float inner = cosf(light.InnerSpotCone * 0.5f);
+                    if (spot <= outer)
+                        continue;
+                    if (spot < inner && inner > outer)
+                        att *= powf((spot - outer) / (inner - outer), light.Falloff);
+                }
+            }
+
+            r += att * light.Ambient.r * mat.Ambient.r;
+            g += att * light.Ambient.g * mat.Ambient.g;
+            b += att * light.Ambient.b * mat.Ambient.b;
+            float ndotl = nx * lx + ny * ly + nz * lz;
+            if (ndotl > 0.0f)
+            {
+                float k = att * ndotl;
+                r += k * light.Diffuse.r * mat.Diffuse.r;
+                g += k * light.Diffuse.g * mat.Diffuse.g;
+                b += k * light.Diffuse.b * mat.Diffuse.b;
+            }
+        }
+
+        out[v].R = r;
+        out[v].G = g;
+        out[v].B = b;
+        out[v].A = mat.Diffuse.a;
+    }
+}
+
+CKBOOL CKSoftRasterizerContext::ProcessVertexBuffer(CKDWORD VB, CKDWORD StartVertex, CKDWORD VertexCount)
+{
+    CKSoftVertexBufferDesc *vb = (CKSoftVertexBufferDesc *)GetVertexBufferData(VB);
+    if (!vb || StartVertex + VertexCount > vb->m_MaxVertexCount)
+        return FALSE;
+
+    CKBYTE *mem = vb->Memory.Begin() + StartVertex * vb->m_VertexSize;
+    CKVertexBufferDesc desc;
+    desc = *vb;
+    if (vb->m_Compression)
+    {
+        desc.m_Compression = 0;
+        desc.m_VertexSize = CKRSTGetVertexSize(desc.m_VertexFormat);
+        m_DecodedVertices.Resize(VertexCount * desc.m_VertexSize);
+        CKRSTDecodeVertexBuffer(m_DecodedVertices.Begin(), mem, vb, VertexCount);
+        mem = m_DecodedVertices.Begin();
+    }
+
+    VxDrawPrimitiveData data;
+    memset(&data, 0, sizeof(data));
+    data.VertexCount = VertexCount;
+    CKRSTSetupDPFromVertexBuffer(mem, &desc, data);
+    if ((desc.m_VertexFormat & CKRST_VF_POSITIONMASK) != CKRST_VF_RASTERPOS)
+        data.Flags |= CKRST_DP_TRANSFORM;
+    if (data.NormalPtr && GetRSCacheValue(VXRENDERSTATE_LIGHTING))
+        data.Flags |= CKRST_DP_LIGHT;
+    if (data.ColorPtr)
+        data.Flags |= CKRST_DP_DIFFUSE;
+    return ProcessVertices(&data);
+}
+
+//------------------------------------------------------------------
+// Primitive assembly
+
+template <class T>
+static inline int SoftIndex(const T *Indices, int i, int BaseIndex)
+{
+    return Indices ? (int)Indices[i] - BaseIndex : i;
+}
+
+template <class T>
+void CKSoftRasterizerContext::DrawTriangles(VXPRIMITIVETYPE pType, const T *Indices, int IndexCount, int BaseIndex)
+{
+    const CKSoftVertex *v = m_Vertices.Begin();
+    unsigned int vertexCount = (unsigned int)m_Vertices.Size();
+
+    // Lines and points are not drawn
+    int step, count;
+    switch (pType)
+    {
+    case VX_TRIANGLELIST:
+        step = 3;
+        count = IndexCount - 2;
+        break;
+    case VX_TRIANGLESTRIP:
+    case VX_TRIANGLEFAN:
+        step = 1;
+        count = IndexCount - 2;
+        break;
+    default:
+        return;
+    }
+
+    for (int i = 0; i < count; i += step)
+    {
+        int a, b, c;
+        if (pType == VX_TRIANGLEFAN)
+        {
+            a = SoftIndex(Indices, 0, BaseIndex);
+            b = SoftIndex(Indices, i + 1, BaseIndex);
+            c = SoftIndex(Indices, i + 2, BaseIndex);
+        }
+        else if (pType == VX_TRIANGLESTRIP && (i & 1))
+        {
+            // Odd strip triangles keep the winding of the first one
+            a = SoftIndex(Indices, i + 1, BaseIndex);
+            b = SoftIndex(Indices, i, BaseIndex);
+            c = SoftIndex(Indices, i + 2, BaseIndex);
+        }
+        else
+        {
+            a = SoftIndex(Indices, i, BaseIndex);
+            b = SoftIndex(Indices, i + 1, BaseIndex);
+            c = SoftIndex(Indices, i + 2, BaseIndex);
+        }
+        if ((unsigned int)a >= vertexCount || (unsigned int)b >= vertexCount || (unsigned int)c >= vertexCount)
+            continue;
+        DrawTriangle(&v[a], &v[b], &v[c]);
+    }
+}
+
+CKBOOL CKSoftRasterizerContext::DrawPrimitive(VXPRIMITIVETYPE pType, CKWORD *indices, int indexcount, VxDrawPrimitiveData *data)
+{
+    // The batch is drawn from a vertex buffer, which only holds the texture coordinates of the
+    // stages given in the flags and whose normals are lit according to VXRENDERSTATE_LIGHTING :
+    // only batch the draws for which it gives the same result
+    CKBOOL batchable = data && (!data->TexCoordPtr || CKRST_DP_STAGEFLAGS(data->Flags));
+    if (batchable && (data->Flags & CKRST_DP_LIGHT))
+        batchable = data->NormalPtr && (data->Flags & CKRST_DP_TRANSFORM) && GetRSCacheValue(VXRENDERSTATE_LIGHTING);
+    if (batchable && BatchPrimitive(pType, indices, indexcount, data))
+        return TRUE;
+    FlushBatch();
+
+    if (!data || !ProcessVertices(data))
+        return FALSE;
+    DrawTriangles(pType, indices, indices ? indexcount : data->VertexCount, 0);
+    return TRUE;
+}
+
+CKBOOL CKSoftRasterizerContext::DrawPrimitive32(VXPRIMITIVETYPE pType, CKDWORD *indices, int indexcount, VxDrawPrimitiveData *data)
+{
+    FlushBatch();
+    if (!data || !ProcessVertices(data))
+        return FALSE;
+    DrawTriangles(pType, indices, indices ? indexcount : data->VertexCount, 0);
+    return TRUE;
+}
+
+CKBOOL CKSoftRasterizerContext::DrawPrimitiveVB(VXPRIMITIVETYPE pType, CKDWORD VertexBuffer, CKDWORD StartIndex, CKDWORD VertexCount,
+                                                CKWORD *indices, int indexcount)
+{
+    FlushBatch();
+    if (!ProcessVertexBuffer(VertexBuffer, StartIndex, VertexCount))
+        return FALSE;
+    DrawTriangles(pType, indices, indices ? indexcount : (int)VertexCount, 0);
+    return TRUE;
+}
+
+CKBOOL CKSoftRasterizerContext::DrawPrimitiveVB32(VXPRIMITIVETYPE pType, CKDWORD VertexBuffer, CKDWORD StartIndex, CKDWORD VertexCount,
+                                                  CKDWORD *indices, int indexcount)
+{
+    FlushBatch();
+    if (!ProcessVertexBuffer(VertexBuffer, StartIndex, VertexCount))
+        return FALSE;
+    DrawTriangles(pType, indices, indices ? indexcount : (int)VertexCount, 0);
+    return TRUE;
+}
+
+CKBOOL CKSoftRasterizerContext::DrawPrimitiveVBIB(VXPRIMITIVETYPE pType, CKDWORD VB, CKDWORD IB, CKDWORD MinVIndex, CKDWORD VertexCount,
+                                                  CKDWORD StartIndex, int Indexcount)
+{
+    FlushBatch();
+    CKSoftIndexBufferDesc *ib = (CKSoftIndexBufferDesc *)GetIndexBufferData(IB);
+    if (!ib || Indexcount <= 0 || StartIndex + Indexcount > ib->m_MaxIndexCount)
+        return FALSE;
+    if (!ProcessVertexBuffer(VB, MinVIndex, VertexCount))
+        return FALSE;
+
+    // Indices are relative to the start of the vertex buffer
+    if (ib->m_Flags & CKRST_VB_INDEX32)
+        DrawTriangles(pType, (const CKDWORD *)ib->Memory.Begin() + StartIndex, Indexcount, MinVIndex);
+    else
+        DrawTriangles(pType, (const CKWORD *)ib->Memory.Begin() + StartIndex, Indexcount, MinVIndex);
+    return TRUE;
+}
+
+//------------------------------------------------------------------
+// Objects
+
+CKBOOL CKSoftRasterizerContext::CreateObject(CKDWORD ObjIndex, CKRST_OBJECTTYPE Type, void *DesiredFormat)
+{
+    switch (Type)
+    {
+    case CKRST_OBJ_TEXTURE:
+    {
+        CKTextureDesc *format = (CKTextureDesc *)DesiredFormat;
+        if (!format || ObjIndex >= (CKDWORD)m_Textures.Size() || format->Format.Width <= 0 || format->Format.Height <= 0)
+            return FALSE;
+
+        // The binned triangles may use the previous texture
+        FlushTiles();
+        if (ObjIndex == m_TargetTexture)
+            SetTargetTexture(0);
+        // The desc of a shared texture is kept for the other textures
+        UnshareTexture(ObjIndex);
+        delete m_Textures[ObjIndex];
+
+        CKSoftTextureDesc *tex = new CKSoftTextureDesc;
+        tex->Flags = format->Flags | CKRST_TEXTURE_VALID;
+        VxPixelFormat2ImageDesc(_32_ARGB8888, tex->Format);
+        tex->Format.Width = format->Format.Width;
+        tex->Format.Height = format->Format.Height;
+        tex->Format.BytesPerLine = format->Format.Width * 4;
+        tex->MipMapCount = format->MipMapCount;
+        tex->Pixels.Resize(format->Format.Width * format->Format.Height);
+        tex->Pixels.Fill(0);
+        m_Textures[ObjIndex] = tex;
+        return TRUE;
+    }
+    case CKRST_OBJ_SPRITE:
+        return CreateSprite(ObjIndex, (CKSpriteDesc *)DesiredFormat);
+    case CKRST_OBJ_VERTEXBUFFER:
+    {
+        CKVertexBufferDesc *format = (CKVertexBufferDesc *)DesiredFormat;
+        if (!format || ObjIndex >= (CKDWORD)m_VertexBuffers.Size())
+            return FALSE;
+        delete m_VertexBuffers[ObjIndex];
+
+        CKSoftVertexBufferDesc *vb = new CKSoftVertexBufferDesc;
+        *(CKVertexBufferDesc *)vb = *format;
+        if (vb->m_VertexSize == 0)
+            vb->m_VertexSize = CKRSTGetVertexSize(vb->m_VertexFormat, vb->m_Compression);
+        vb->m_Flags |= CKRST_VB_VALID;
+        vb->Memory.Resize(vb->m_MaxVertexCount * vb->m_VertexSize);
+        m_VertexBuffers[ObjIndex] = vb;
+        return TRUE;
+    }
+    case CKRST_OBJ_INDEXBUFFER:
+    {
+        CKIndexBufferDesc *format = (CKIndexBufferDesc *)DesiredFormat;
+        if (!format || ObjIndex >= (CKDWORD)m_IndexBuffers.Size())
+            return FALSE;
+        delete m_IndexBuffers[ObjIndex];
+
+        CKSoftIndexBufferDesc *ib = new CKSoftIndexBufferDesc;
+        ib->m_Flags = format->m_Flags | CKRST_VB_VALID;
+        ib->m_MaxIndexCount = format->m_MaxIndexCount;
+        ib->m_CurrentICount = format->m_CurrentICount;
+        ib->Memory.Resize(ib->m_MaxIndexCount * ((ib->m_Flags & CKRST_VB_INDEX32) ? sizeof(CKDWORD) : sizeof(CKWORD)));
+        m_IndexBuffers[ObjIndex] = ib;
+        return TRUE;
+    }
+    default:
+        return FALSE;
+    }
+}
+
+CKBOOL CKSoftRasterizerContext::DeleteObject(CKDWORD ObjIndex, CKRST_OBJECTTYPE Type)
+{
+    FlushTiles();
+    if (Type == CKRST_OBJ_TEXTURE && ObjIndex == m_TargetTexture)
+        SetTargetTexture(0);
+    return CKRasterizerContext::DeleteObject(ObjIndex, Type);
+}
+
+CKBOOL CKSoftRasterizerContext::FlushObjects(CKDWORD TypeMask)
+{
+    FlushTiles();
+    if ((TypeMask & CKRST_OBJ_TEXTURE) && m_TargetTexture != 0)
+        SetTargetTexture(0);
+    return CKRasterizerContext::FlushObjects(TypeMask);
+}
+
+CKBOOL CKSoftRasterizerContext::LoadTexture(CKDWORD Texture, const VxImageDescEx &SurfDesc, int miplevel)
+{
+    CKSoftTextureDesc *tex = (CKSoftTextureDesc *)GetTextureData(Texture);
+    if (!tex || !SurfDesc.Image || tex->Pixels.Size() == 0)
+        return FALSE;
+    // Only the first level is sampled
+    if (miplevel > 0)
+        return TRUE;
+
+    FlushTiles();
+    VxImageDescEx dst = tex->Format;
+    dst.Image = (XBYTE *)tex->Pixels.Begin();
+
+    VX_PIXELFORMAT format = VxImageDesc2PixelFormat(SurfDesc);
+    if (CKRSTGetDXTBlockSize(format) > 0)
+    {
+        if (SurfDesc.Width == dst.Width && SurfDesc.Height == dst.Height)
+            return CKRSTDecompressDXT(SurfDesc.Image, format, dst);
+
+        XArray<CKDWORD> decoded;
+        decoded.Resize(SurfDesc.Width * SurfDesc.Height);
+        VxImageDescEx src;
+        VxPixelFormat2ImageDesc(_32_ARGB8888, src);
+        src.Width = SurfDesc.Width;
+        src.Height = SurfDesc.Height;
+        src.BytesPerLine = SurfDesc.Width * 4;
+        src.Image = (XBYTE *)decoded.Begin();
+        if (!CKRSTDecompressDXT(SurfDesc.Image, format, src))
+            return FALSE;
+        VxDoBlit(src, dst);
+        return TRUE;
+    }
+
+    VxDoBlit(SurfDesc, dst);
+    return TRUE;
+}
+
+CKBOOL CKSoftRasterizerContext::SetTargetTexture(CKDWORD TextureObject, int Width, int Height, CKRST_CUBEFACE Face)
+{
+    FlushTiles();
+    if (TextureObject == 0)
+    {
+        m_TargetTexture = 0;
+        UseTarget(m_BackBuffer.Begin(), m_Width, m_Width, m_Height, m_BackDepth);
+        return TRUE;
+    }
+
+    CKSoftTextureDesc *tex = (CKSoftTextureDesc *)GetTextureData(TextureObject);
+    if (!tex || tex->Pixels.Size() == 0 || (tex->Flags & CKRST_TEXTURE_CUBEMAP))
+        return FALSE;
+
+    int width = (Width > 0) ? XMin(Width, tex->Format.Width) : tex->Format.Width;
+    int height = (Height > 0) ? XMin(Height, tex->Format.Height) : tex->Format.Height;
+    m_TargetTexture = TextureObject;
+    UseTarget(tex->Pixels.Begin(), tex->Format.Width, width, height, m_TextureDepth);
+    return TRUE;
+}
+
+void *CKSoftRasterizerContext::LockVertexBuffer(CKDWORD VB, CKDWORD StartVertex, CKDWORD VertexCount, CKRST_LOCKFLAGS Lock)
+{
+    CKSoftVertexBufferDesc *vb = (CKSoftVertexBufferDesc *)GetVertexBufferData(VB);
+    if (!vb || StartVertex + VertexCount > vb->m_MaxVertexCount)
+        return NULL;
+    // The binned triangles were transformed when they were drawn
+    return vb->Memory.Begin() + StartVertex * vb->m_VertexSize;
+}
+
+CKBOOL CKSoftRasterizerContext::UnlockVertexBuffer(CKDWORD VB)
+{
+    return GetVertexBufferData(VB) != NULL;
+}
+
+void *CKSoftRasterizerContext::LockIndexBuffer(CKDWORD IB, CKDWORD StartIndex, CKDWORD IndexCount, CKRST_LOCKFLAGS Lock)
+{
+    CKSoftIndexBufferDesc *ib = (CKSoftIndexBufferDesc *)GetIndexBufferData(IB);
+    if (!ib || StartIndex + IndexCount > ib->m_MaxIndexCount)
+        return NULL;
+    return ib->Memory.Begin() + StartIndex * ((ib->m_Flags & CKRST_VB_INDEX32) ? sizeof(CKDWORD) : sizeof(CKWORD));
+}
+
+CKBOOL CKSoftRasterizerContext::UnlockIndexBuffer(CKDWORD IB)
+{
+    return GetIndexBufferData(IB) != NULL;
+}
@@ -0,0 +1,808 @@
+#include "CKSoftRasterizer.h"
+#include "CKRasterizerSIMD.h"
+
+#include <math.h>
+
+//------------------------------------------------------------------
+// Clipping
+
+#define CKRST_SOFT_MAXCLIPVERTICES 9
+
+static inline float ClipDistance(const CKSoftVertex &v, int Plane)
+{
+    switch (Plane)
+    {
+    case 0: return v.W + v.X;
+    case 1: return v.W - v.X;
+    case 2: return v.W + v.Y;
+    case 3: return v.W - v.Y;
+    case 4: return v.Z;
+    default: return v.W - v.Z;
+    }
+}
+
+static inline CKDWORD ClipOutcode(const CKSoftVertex &v)
+{
+    CKDWORD code = 0;
+    for (int p = 0; p < 6; ++p)
+        if (ClipDistance(v, p) < 0.0f)
+            code |= 1 << p;
+    return code;
+}
+
+static inline void LerpVertex(CKSoftVertex &Res, const CKSoftVertex &A, const CKSoftVertex &B, float t)
+{
+    const float *a = &A.X;
+    const float *b = &B.X;
+    float *r = &Res.X;
+    for (int i = 0; i < (int)(sizeof(CKSoftVertex) / sizeof(float)); ++i)
+        r[i] = a[i] + (b[i] - a[i]) * t;
+}
+
+void CKSoftRasterizerContext::DrawTriangle(const CKSoftVertex *v0, const CKSoftVertex *v1, const CKSoftVertex *v2)
+{
+    CKSoftVertex poly[2][CKRST_SOFT_MAXCLIPVERTICES];
+    poly[0][0] = *v0;
+    poly[0][1] = *v1;
+    poly[0][2] = *v2;
+    if (GetRSCacheValue(VXRENDERSTATE_SHADEMODE) == VXSHADE_FLAT)
+    {
+        for (int i = 1; i < 3; ++i)
+        {
+            poly[0][i].R = v0->R;
+            poly[0][i].G = v0->G;
+            poly[0][i].B = v0->B;
+            poly[0][i].A = v0->A;
+        }
+    }
+
+    CKDWORD c0 = ClipOutcode(*v0), c1 = ClipOutcode(*v1), c2 = ClipOutcode(*v2);
+    if (c0 & c1 & c2)
+        return;
+    if ((c0 | c1 | c2) == 0)
+    {
+        SetupTriangle(&poly[0][0], &poly[0][1], &poly[0][2]);
+        return;
+    }
+
+    // Sutherland-Hodgman against the crossed planes, each one adds at most one vertex
+    CKDWORD planes = c0 | c1 | c2;
+    int count = 3;
+    int cur = 0;
+    for (int p = 0; p < 6 && count >= 3; ++p)
+    {
+        if (!(planes & (1 << p)))
+            continue;
+        CKSoftVertex *in = poly[cur];
+        CKSoftVertex *out = poly[cur ^ 1];
+        int outCount = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            const CKSoftVertex &a = in[i];
+            const CKSoftVertex &b = in[(i + 1) % count];
+            float da = ClipDistance(a, p);
+            float db = ClipDistance(b, p);
+            if (da >= 0.0f)
+                out[outCount++] = a;
+            if ((da >= 0.0f) != (db >= 0.0f) && outCount < CKRST_SOFT_MAXCLIPVERTICES)
+                LerpVertex(out[outCount++], a, b, da / (da - db));
+        }
+        count = outCount;
+        cur ^= 1;
+    }
+
+    for (int i = 1; i + 1 < count; ++i)
+        SetupTriangle(&poly[cur][0], &poly[cur][i], &poly[cur][i + 1]);
+}
+
+//------------------------------------------------------------------
+// Triangle setup
+
+void CKSoftRasterizerContext::SetupTriangle(const CKSoftVertex *v0, const CKSoftVertex *v1, const CKSoftVertex *v2)
+{
+    if (v0->W <= 0.0f || v1->W <= 0.0f || v2->W <= 0.0f)
+        return;
+
+    float halfWidth = m_ViewportData.ViewWidth * 0.5f;
+    float halfHeight = m_ViewportData.ViewHeight * 0.5f;
+    float centerX = m_ViewportData.ViewX + halfWidth;
+    float centerY = m_ViewportData.ViewY + halfHeight;
+
+    const CKSoftVertex *v[3] = {v0, v1, v2};
+    float x[3], y[3], invW[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        invW[i] = 1.0f / v[i]->W;
+        x[i] = floorf((centerX + v[i]->X * invW[i] * halfWidth) * CKRST_SOFT_SUBPIXELS + 0.5f) / CKRST_SOFT_SUBPIXELS;
+        y[i] = floorf((centerY - v[i]->Y * invW[i] * halfHeight) * CKRST_SOFT_SUBPIXELS + 0.5f) / CKRST_SOFT_SUBPIXELS;
+    }
+
+    // Positive area for clockwise triangles on screen (y down)
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (area == 0.0f)
+        return;
+    VXCULL cull = (VXCULL)GetRSCacheValue(VXRENDERSTATE_CULLMODE);
+    if (m_InverseWinding)
+    {
+        if (cull == VXCULL_CW)
+            cull = VXCULL_CCW;
+        else if (cull == VXCULL_CCW)
+            cull = VXCULL_CW;
+    }
+    if ((cull == VXCULL_CCW && area < 0.0f) || (cull == VXCULL_CW && area > 0.0f))
+        return;
+    if (area < 0.0f)
+    {
+        const CKSoftVertex *tv = v[1];
+        v[1] = v[2];
+        v[2] = tv;
+        float t = x[1]; x[1] = x[2]; x[2] = t;
+        t = y[1]; y[1] = y[2]; y[2] = t;
+        t = invW[1]; invW[1] = invW[2]; invW[2] = t;
+        area = -area;
+    }
+
+    // Covered pixels, inside the viewport and the render target
+    float minX = XMin(x[0], XMin(x[1], x[2]));
+    float maxX = XMax(x[0], XMax(x[1], x[2]));
+    float minY = XMin(y[0], XMin(y[1], y[2]));
+    float maxY = XMax(y[0], XMax(y[1], y[2]));
+    int viewX1 = XMin(m_ViewportData.ViewX + m_ViewportData.ViewWidth, m_TargetWidth);
+    int viewY1 = XMin(m_ViewportData.ViewY + m_ViewportData.ViewHeight, m_TargetHeight);
+    int x0 = XMax((int)ceilf(minX - 0.5f), XMax(m_ViewportData.ViewX, 0));
+    int y0 = XMax((int)ceilf(minY - 0.5f), XMax(m_ViewportData.ViewY, 0));
+    int x1 = XMin((int)floorf(maxX - 0.5f) + 1, viewX1);
+    int y1 = XMin((int)floorf(maxY - 0.5f) + 1, viewY1);
+    if (x0 >= x1 || y0 >= y1)
+        return;
+
+    if (m_Triangles.Size() >= CKRST_SOFT_MAXTRIANGLES)
+        FlushTiles();
+
+    CKSoftTriangle tri;
+    tri.TopLeft = 0;
+    for (int e = 0; e < 3; ++e)
+    {
+        int a = e;
+        int b = (e + 1) % 3;
+        tri.EdgeA[e] = y[a] - y[b];
+        tri.EdgeB[e] = x[b] - x[a];
+        // The edges are evaluated from the same end point in both of the triangles sharing them
+        int r = (y[a] < y[b] || (y[a] == y[b] && x[a] < x[b])) ? a : b;
+        tri.EdgeX[e] = x[r];
+        tri.EdgeY[e] = y[r];
+        if (tri.EdgeA[e] > 0.0f || (tri.EdgeA[e] == 0.0f && tri.EdgeB[e] > 0.0f))
+            tri.TopLeft |= 1 << e;
+    }
+
+    float attr[3][CKRST_SOFT_PLANECOUNT];
+    for (int i = 0; i < 3; ++i)
+    {
+        attr[i][0] = v[i]->Z * invW[i];
+        attr[i][1] = invW[i];
+        attr[i][2] = v[i]->R * invW[i];
+        attr[i][3] = v[i]->G * invW[i];
+        attr[i][4] = v[i]->B * invW[i];
+        attr[i][5] = v[i]->A * invW[i];
+        attr[i][6] = v[i]->U * invW[i];
+        attr[i][7] = v[i]->V * invW[i];
+    }
+    tri.MinZ = XMin(attr[0][0], XMin(attr[1][0], attr[2][0]));
+    tri.MaxZ = XMax(attr[0][0], XMax(attr[1][0], attr[2][0]));
+
+    float invArea = 1.0f / area;
+    tri.X0 = x[0];
+    tri.Y0 = y[0];
+    for (int p = 0; p < CKRST_SOFT_PLANECOUNT; ++p)
+    {
+        float d1 = attr[1][p] - attr[0][p];
+        float d2 = attr[2][p] - attr[0][p];
+        tri.Planes[p][0] = attr[0][p];
+        tri.Planes[p][1] = (d1 * (y[2] - y[0]) - d2 * (y[1] - y[0])) * invArea;
+        tri.Planes[p][2] = (d2 * (x[1] - x[0]) - d1 * (x[2] - x[0])) * invArea;
+    }
+
+    tri.MinX = x0;
+    tri.MinY = y0;
+    tri.MaxX = x1;
+    tri.MaxY = y1;
+    tri.State = GetDrawState();
+    m_Triangles.PushBack(tri);
+}
+
+//------------------------------------------------------------------
+// Binning
+
+void CKSoftRasterizerContext::FlushTiles()
+{
+    // Bin the pending batched draws first (FlushBatch does nothing while the batch is being drawn)
+    FlushBatch();
+
+    int triangleCount = m_Triangles.Size();
+    int tileCount = m_TilesX * m_TilesY;
+    if (triangleCount > 0 && tileCount > 0)
+    {
+        // Counting sort of the triangles by tile, keeping the drawing order inside each tile
+        m_TileStart.Resize(tileCount + 1);
+        m_TileStart.Fill(0);
+        int total = 0;
+        for (int t = 0; t < triangleCount; ++t)
+        {
+            const CKSoftTriangle &tri = m_Triangles[t];
+            for (int ty = tri.MinY / CKRST_SOFT_TILESIZE; ty <= (tri.MaxY - 1) / CKRST_SOFT_TILESIZE; ++ty)
+                for (int tx = tri.MinX / CKRST_SOFT_TILESIZE; tx <= (tri.MaxX - 1) / CKRST_SOFT_TILESIZE; ++tx)
+                {
+                    ++m_TileStart[ty * m_TilesX + tx];
+                    ++total;
+                }
+        }
+        for (int i = 1; i < tileCount; ++i)
+            m_TileStart[i] += m_TileStart[i - 1];
+        m_TileStart[tileCount] = total;
+
+        m_TileTriangles.Resize(total);
+        for (int t = triangleCount - 1; t >= 0; --t)
+        {
+            const CKSoftTriangle &tri = m_Triangles[t];
+            for (int ty = tri.MinY / CKRST_SOFT_TILESIZE; ty <= (tri.MaxY - 1) / CKRST_SOFT_TILESIZE; ++ty)
+                for (int tx = tri.MinX / CKRST_SOFT_TILESIZE; tx <= (tri.MaxX - 1) / CKRST_SOFT_TILESIZE; ++tx)
+                    m_TileTriangles[--m_TileStart[ty * m_TilesX + tx]] = t;
+        }
+
+        // Tiles do not overlap : they are rasterized in parallel without synchronization
+        m_TileStats.Resize(tileCount);
+        m_TileStats.Memset(0);
+        if (m_Driver && m_Driver->m_Owner && tileCount > 1)
+            m_Driver->m_Owner->GetThreadPool()->ParallelFor(RasterizeTileJob, this, tileCount);
+        else
+            for (int i = 0; i < tileCount; ++i)
+                RasterizeTile(i);
+
+        for (int i = 0; i < tileCount; ++i)
+        {
+            m_FrameStats.HiZTriangles += m_TileStats[i].Triangles;
+            m_FrameStats.HiZRejectedTriangles += m_TileStats[i].RejectedTriangles;
+            m_FrameStats.HiZBlocks += m_TileStats[i].Blocks;
+            m_FrameStats.HiZRejectedBlocks += m_TileStats[i].RejectedBlocks;
+        }
+    }
+
+    m_Triangles.Resize(0);
+    m_DrawStates.Resize(0);
+    m_DrawStateUptodate = FALSE;
+}
+
+void CKSoftRasterizerContext::RasterizeTileJob(void *Data, int Tile)
+{
+    ((CKSoftRasterizerContext *)Data)->RasterizeTile(Tile);
+}
+
+//------------------------------------------------------------------
+// Pixel processing
+
+static inline CKBOOL SoftCompare(VXCMPFUNC Func, float a, float b)
+{
+    switch (Func)
+    {
+    case VXCMP_NEVER: return FALSE;
+    case VXCMP_LESS: return a < b;
+    case VXCMP_EQUAL: return a == b;
+    case VXCMP_LESSEQUAL: return a <= b;
+    case VXCMP_GREATER: return a > b;
+    case VXCMP_NOTEQUAL: return a != b;
+    case VXCMP_GREATEREQUAL: return a >= b;
+    default: return TRUE;
+    }
+}
+
+static inline void SoftUnpack(CKDWORD c, float *Rgba)
+{
+    const float scale = 1.0f / 255.0f;
+    Rgba[0] = (float)((c >> 16) & 0xFF) * scale;
+    Rgba[1] = (float)((c >> 8) & 0xFF) * scale;
+    Rgba[2] = (float)(c & 0xFF) * scale;
+    Rgba[3] = (float)(c >> 24) * scale;
+}
+
+static inline CKDWORD SoftPack(const float *Rgba)
+{
+    CKDWORD c[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        float v = Rgba[i];
+        v = (v < 0.0f) ? 0.0f : ((v > 1.0f) ? 1.0f : v);
+        c[i] = (CKDWORD)(v * 255.0f + 0.5f);
+    }
+    return (c[3] << 24) | (c[0] << 16) | (c[1] << 8) | c[2];
+}
+
+static inline int SoftAddress(int i, int Size, CKBOOL Clamp)
+{
+    if (Clamp)
+        return (i < 0) ? 0 : ((i >= Size) ? Size - 1 : i);
+    i %= Size;
+    return (i < 0) ? i + Size : i;
+}
+
+static void SoftSample(const CKSoftDrawState &State, float u, float v, float *Rgba)
+{
+    CKBOOL clampU = (State.Flags & CKRST_SOFT_CLAMPU) != 0;
+    CKBOOL clampV = (State.Flags & CKRST_SOFT_CLAMPV) != 0;
+    // Back in [0,1] first so that far coordinates do not overflow the texel indices
+    u = clampU ? XMax(0.0f, XMin(u, 1.0f)) : u - floorf(u);
+    v = clampV ? XMax(0.0f, XMin(v, 1.0f)) : v - floorf(v);
+    int w = State.TexWidth;
+    int h = State.TexHeight;
+    const CKDWORD *texels = State.Texels;
+
+    if (!(State.Flags & CKRST_SOFT_BILINEAR))
+    {
+        int x = SoftAddress((int)(u * w), w, TRUE);
+        int y = SoftAddress((int)(v * h), h, TRUE);
+        SoftUnpack(texels[y * w + x], Rgba);
+        return;
+    }
+
+    float fu = u * w - 0.5f;
+    float fv = v * h - 0.5f;
+    float bu = floorf(fu);
+    float bv = floorf(fv);
+    float fx = fu - bu;
+    float fy = fv - bv;
+    int x0 = SoftAddress((int)bu, w, clampU);
+    int x1 = SoftAddress((int)bu + 1, w, clampU);
+    int y0 = SoftAddress((int)bv, h, clampV);
+    int y1 = SoftAddress((int)bv + 1, h, clampV);
+
+    float c00[4], c10[4], c01[4], c11[4];
+    SoftUnpack(texels[y0 * w + x0], c00);
+    SoftUnpack(texels[y0 * w + x1], c10);
+    SoftUnpack(texels[y1 * w + x0], c01);
+    SoftUnpack(texels[y1 * w + x1], c11);
+    for (int i = 0; i < 4; ++i)
+    {
+        float top = c00[i] + (c10[i] - c00[i]) * fx;
+        float bottom = c01[i] + (c11[i] - c01[i]) * fx;
+        Rgba[i] = top + (bottom - top) * fy;
+    }
+}
+
+static inline void SoftBlendFactor(VXBLEND_MODE Mode, const float *Src, const float *Dst, float *Factor)
+{
+    switch (Mode)
+    {
+    case VXBLEND_ZERO:
+        Factor[0] = Factor[1] = Factor[2] = Factor[3] = 0.0f;
+        break;
+    case VXBLEND_SRCCOLOR:
+        for (int i = 0; i < 4; ++i) Factor[i] = Src[i];
+        break;
+    case VXBLEND_INVSRCCOLOR:
+        for (int i = 0; i < 4; ++i) Factor[i] = 1.0f - Src[i];
+        break;
+    case VXBLEND_SRCALPHA:
+        Factor[0] = Factor[1] = Factor[2] = Factor[3] = Src[3];
+        break;
+    case VXBLEND_INVSRCALPHA:
+        Factor[0] = Factor[1] = Factor[2] = Factor[3] = 1.0f - Src[3];
+        break;
+    case VXBLEND_DESTALPHA:
+        Factor[0] = Factor[1] = Factor[2] = Factor[3] = Dst[3];
+        break;
+    case VXBLEND_INVDESTALPHA:
+        Factor[0] = Factor[1] = Factor[2] = Factor[3] = 1.0f - Dst[3];
+        break;
+    case VXBLEND_DESTCOLOR:
+        for (int i = 0; i < 4; ++i) Factor[i] = Dst[i];
+        break;
+    case VXBLEND_INVDESTCOLOR:
+        for (int i = 0; i < 4; ++i) Factor[i] = 1.0f - Dst[i];
+        break;
+    case VXBLEND_SRCALPHASAT:
+        Factor[0] = Factor[1] = Factor[2] = XMin(Src[3], 1.0f - Dst[3]);
+        Factor[3] = 1.0f;
+        break;
+    default:
+        Factor[0] = Factor[1] = Factor[2] = Factor[3] = 1.0f;
+        break;
+    }
+}
+
+// Shades and writes a pixel which passed the coverage and depth tests, returns whether its depth was written
+static inline CKBOOL SoftShadePixel(const CKSoftTriangle &Tri, const CKSoftDrawState &State, float px, float py,
+                                  float z, CKDWORD *Color, float *Depth)
+{
+    float dx = px - Tri.X0;
+    float dy = py - Tri.Y0;
+    float p[CKRST_SOFT_PLANECOUNT];
+    for (int i = 1; i < CKRST_SOFT_PLANECOUNT; ++i)
+        p[i] = Tri.Planes[i][0] + Tri.Planes[i][1] * dx + Tri.Planes[i][2] * dy;
+    float w = (p[1] != 0.0f) ? 1.0f / p[1] : 0.0f;
+
+    float src[4] = {p[2] * w, p[3] * w, p[4] * w, p[5] * w};
+    if (State.Flags & CKRST_SOFT_TEXTURE)
+    {
+        float texel[4];
+        SoftSample(State, p[6] * w, p[7] * w, texel);
+        for (int i = 0; i < 4; ++i)
+            src[i] *= texel[i];
+    }
+    for (int i = 0; i < 4; ++i)
+        src[i] = (src[i] < 0.0f) ? 0.0f : ((src[i] > 1.0f) ? 1.0f : src[i]);
+
+    if (State.Flags & CKRST_SOFT_ALPHATEST)
+    {
+        if (!SoftCompare(State.AlphaFunc, (float)(int)(src[3] * 255.0f + 0.5f), (float)State.AlphaRef))
+            return FALSE;
+    }
+
+    if (State.Flags & CKRST_SOFT_BLEND)
+    {
+        float dst[4], sf[4], df[4];
+        SoftUnpack(*Color, dst);
+        SoftBlendFactor(State.SrcBlend, src, dst, sf);
+        SoftBlendFactor(State.DestBlend, src, dst, df);
+        for (int i = 0; i < 4; ++i)
+            src[i] = src[i] * sf[i] + dst[i] * df[i];
+    }
+    *Color = SoftPack(src);
+
+    if (!(State.Flags & CKRST_SOFT_ZWRITE))
+        return FALSE;
+    *Depth = z;
+    return TRUE;
+}
+
+// Widens the depth range of a triangle before the hierarchical Z tests : the interpolated
+// pixel depths can round outside the range of the vertex depths
+#define CKRST_SOFT_HIZMARGIN 1e-5f
+
+// Can a depth in [MinZ, MaxZ] pass the depth test against a block whose depths are in [Block.MinZ, Block.MaxZ] ?
+static inline CKBOOL SoftHiZReject(VXCMPFUNC Func, float MinZ, float MaxZ, const CKSoftHiZBlock &Block)
+{
+    switch (Func)
+    {
+    case VXCMP_NEVER: return TRUE;
+    case VXCMP_LESS: return MinZ >= Block.MaxZ;
+    case VXCMP_LESSEQUAL: return MinZ > Block.MaxZ;
+    case VXCMP_GREATER: return MaxZ <= Block.MinZ;
+    case VXCMP_GREATEREQUAL: return MaxZ < Block.MinZ;
+    case VXCMP_EQUAL: return MinZ > Block.MaxZ || MaxZ < Block.MinZ;
+    default: return FALSE;
+    }
+}
+
+// Depth range of a Width x Height area of the depth buffer
+static void SoftDepthRange(const float *Depth, int Pitch, int Width, int Height, CKSoftHiZBlock &Range)
+{
+    float minZ = Depth[0];
+    float maxZ = Depth[0];
+    for (int y = 0; y < Height; ++y, Depth += Pitch)
+    {
+        int x = 0;
+#ifdef CKRST_SSE2
+        if (Width >= 4)
+        {
+            __m128 vmin = _mm_set1_ps(minZ);
+            __m128 vmax = _mm_set1_ps(maxZ);
+            for (; x + 4 <= Width; x += 4)
+            {
+                __m128 d = _mm_loadu_ps(Depth + x);
+                vmin = _mm_min_ps(vmin, d);
+                vmax = _mm_max_ps(vmax, d);
+            }
+            float mins[4], maxs[4];
+            _mm_storeu_ps(mins, vmin);
+            _mm_storeu_ps(maxs, vmax);
+            minZ = XMin(XMin(mins[0], mins[1]), XMin(mins[2], mins[3]));
+            maxZ = XMax(XMax(maxs[0], maxs[1]), XMax(maxs[2], maxs[3]));
+        }
+#endif
+        for (; x < Width; ++x)
+        {
+            minZ = XMin(minZ, Depth[x]);
+            maxZ = XMax(maxZ, Depth[x]);
+        }
+    }
+    Range.MinZ = minZ;
+    Range.MaxZ = maxZ;
+}
+
+void CKSoftRasterizerContext::UpdateHiZ(int X0, int Y0, int X1, int Y1)
+{
+    if (X0 >= X1 || Y0 >= Y1)
+        return;
+    for (int by = Y0 / CKRST_SOFT_HIZBLOCKSIZE; by <= (Y1 - 1) / CKRST_SOFT_HIZBLOCKSIZE; ++by)
+    {
+        int y = by * CKRST_SOFT_HIZBLOCKSIZE;
+        int height = XMin(CKRST_SOFT_HIZBLOCKSIZE, m_TargetHeight - y);
+        for (int bx = X0 / CKRST_SOFT_HIZBLOCKSIZE; bx <= (X1 - 1) / CKRST_SOFT_HIZBLOCKSIZE; ++bx)
+        {
+            int x = bx * CKRST_SOFT_HIZBLOCKSIZE;
+            int width = XMin(CKRST_SOFT_HIZBLOCKSIZE, m_TargetWidth - x);
+            SoftDepthRange(m_DepthBuffer + y * m_DepthPitch + x, m_DepthPitch, width, height, m_HiZ[by * m_HiZBlocksX + bx]);
+        }
+    }
+}
+
+// Is the pixel center most inside one of the edges outside of it ?
+static inline CKBOOL SoftAreaOutside(const CKSoftTriangle &Tri, int X0, int Y0, int X1, int Y1)
+{
+    for (int e = 0; e < 3; ++e)
+    {
+        float cx = (Tri.EdgeA[e] >= 0.0f) ? X1 - 0.5f : X0 + 0.5f;
+        float cy = (Tri.EdgeB[e] >= 0.0f) ? Y1 - 0.5f : Y0 + 0.5f;
+        if (Tri.EdgeA[e] * (cx - Tri.EdgeX[e]) + Tri.EdgeB[e] * (cy - Tri.EdgeY[e]) < 0.0f)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+void CKSoftRasterizerContext::RasterizeTile(int Tile)
+{
+    int begin = m_TileStart[Tile];
+    int end = m_TileStart[Tile + 1];
+    if (begin == end)
+        return;
+
+    int tileX0 = (Tile % m_TilesX) * CKRST_SOFT_TILESIZE;
+    int tileY0 = (Tile / m_TilesX) * CKRST_SOFT_TILESIZE;
+    int tileX1 = XMin(tileX0 + CKRST_SOFT_TILESIZE, m_TargetWidth);
+    int tileY1 = XMin(tileY0 + CKRST_SOFT_TILESIZE, m_TargetHeight);
+    CKSoftTileStats &stats = m_TileStats[Tile];
+
+    // Depth range of the whole tile, recomputed from its blocks after depth writes
+    CKSoftHiZBlock tileRange = {0.0f, 1.0f};
+    CKBOOL tileRangeUptodate = FALSE;
+
+    for (int t = begin; t < end; ++t)
+    {
+        const CKSoftTriangle &tri = m_Triangles[m_TileTriangles[t]];
+        const CKSoftDrawState &state = m_DrawStates[tri.State];
+        int x0 = XMax(tri.MinX, tileX0);
+        int y0 = XMax(tri.MinY, tileY0);
+        int x1 = XMin(tri.MaxX, tileX1);
+        int y1 = XMin(tri.MaxY, tileY1);
+        if (x0 >= x1 || y0 >= y1)
+            continue;
+        if (SoftAreaOutside(tri, x0, y0, x1, y1))
+            continue;
+
+        CKBOOL depthTest = (state.Flags & CKRST_SOFT_ZTEST) != 0;
+        CKBOOL hiZ = depthTest && state.ZFunc != VXCMP_ALWAYS && state.ZFunc != VXCMP_NOTEQUAL;
+        if (hiZ)
+        {
+            ++stats.Triangles;
+            if (!tileRangeUptodate)
+            {
+                int bx0 = tileX0 / CKRST_SOFT_HIZBLOCKSIZE;
+                int by0 = tileY0 / CKRST_SOFT_HIZBLOCKSIZE;
+                int bx1 = (tileX1 - 1) / CKRST_SOFT_HIZBLOCKSIZE;
+                int by1 = (tileY1 - 1) / CKRST_SOFT_HIZBLOCKSIZE;
+                tileRange = m_HiZ[by0 * m_HiZBlocksX + bx0];
+                for (int by = by0; by <= by1; ++by)
+                    for (int bx = bx0; bx <= bx1; ++bx)
+                    {
+                        const CKSoftHiZBlock &block = m_HiZ[by * m_HiZBlocksX + bx];
+                        tileRange.MinZ = XMin(tileRange.MinZ, block.MinZ);
+                        tileRange.MaxZ = XMax(tileRange.MaxZ, block.MaxZ);
+                    }
+                tileRangeUptodate = TRUE;
+            }
+            if (SoftHiZReject(state.ZFunc, tri.MinZ - CKRST_SOFT_HIZMARGIN, tri.MaxZ + CKRST_SOFT_HIZMARGIN, tileRange))
+            {
+                ++stats.RejectedTriangles;
+                continue;
+            }
+        }
+
+        int groupX0 = x0 & ~3;
+
+#ifdef CKRST_SSE2
+        __m128 lanes = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+        __m128 edgeA[3], edgeB[3], edgeX[3], edgeY[3], topLeft[3];
+        for (int e = 0; e < 3; ++e)
+        {
+            edgeA[e] = _mm_set1_ps(tri.EdgeA[e]);
+            edgeB[e] = _mm_set1_ps(tri.EdgeB[e]);
+            edgeX[e] = _mm_set1_ps(tri.EdgeX[e]);
+            edgeY[e] = _mm_set1_ps(tri.EdgeY[e]);
+            topLeft[e] = (tri.TopLeft & (1 << e)) ? _mm_castsi128_ps(_mm_set1_epi32(-1)) : _mm_setzero_ps();
+        }
+        __m128 zx = _mm_set1_ps(tri.Planes[0][1]);
+        __m128 zy = _mm_set1_ps(tri.Planes[0][2]);
+        __m128 z0 = _mm_set1_ps(tri.Planes[0][0]);
+        __m128 originX = _mm_set1_ps(tri.X0);
+#endif
+
+        // The triangle is rejected when all the blocks it covers are rejected
+        CKBOOL tested = FALSE, visible = FALSE;
+        for (int by = y0 / CKRST_SOFT_HIZBLOCKSIZE; by <= (y1 - 1) / CKRST_SOFT_HIZBLOCKSIZE; ++by)
+        {
+            int blockY0 = XMax(y0, by * CKRST_SOFT_HIZBLOCKSIZE);
+            int blockY1 = XMin(y1, (by + 1) * CKRST_SOFT_HIZBLOCKSIZE);
+            for (int bx = groupX0 / CKRST_SOFT_HIZBLOCKSIZE; bx <= (x1 - 1) / CKRST_SOFT_HIZBLOCKSIZE; ++bx)
+            {
+                int blockX0 = XMax(x0, bx * CKRST_SOFT_HIZBLOCKSIZE);
+                int blockX1 = XMin(x1, (bx + 1) * CKRST_SOFT_HIZBLOCKSIZE);
+                if (SoftAreaOutside(tri, blockX0, blockY0, blockX1, blockY1))
+                    continue;
+
+                CKSoftHiZBlock &block = m_HiZ[by * m_HiZBlocksX + bx];
+                if (hiZ)
+                {
+                    // Depth range of the triangle plane over the block, with a margin for the rounding of the pixel depths
+                    float dx0 = blockX0 + 0.5f - tri.X0, dx1 = blockX1 - 0.5f - tri.X0;
+                    float dy0 = blockY0 + 0.5f - tri.Y0, dy1 = blockY1 - 0.5f - tri.Y0;
+                    float zx0 = tri.Planes[0][1] * dx0, zx1 = tri.Planes[0][1] * dx1;
+                    float zy0 = tri.Planes[0][2] * dy0, zy1 = tri.Planes[0][2] * dy1;
+                    float minZ = XMax(tri.Planes[0][0] + XMin(zx0, zx1) + XMin(zy0, zy1), tri.MinZ) - CKRST_SOFT_HIZMARGIN;
+                    float maxZ = XMin(tri.Planes[0][0] + XMax(zx0, zx1) + XMax(zy0, zy1), tri.MaxZ) + CKRST_SOFT_HIZMARGIN;
+                    ++stats.Blocks;
+                    tested = TRUE;
+                    if (SoftHiZReject(state.ZFunc, minZ, maxZ, block))
+                    {
+                        ++stats.RejectedBlocks;
+                        continue;
+                    }
+                }
+                visible = TRUE;
+
+#ifdef CKRST_SSE2
+                __m128 left = _mm_set1_ps((float)blockX0);
+                __m128 right = _mm_set1_ps((float)blockX1);
+#endif
+                CKBOOL written = FALSE;
+                for (int y = blockY0; y < blockY1; ++y)
+                {
+                    float py = y + 0.5f;
+                    CKDWORD *colorRow = m_ColorBuffer + y * m_ColorPitch;
+                    float *depthRow = m_DepthBuffer + y * m_DepthPitch;
+
+                    for (int gx = blockX0 & ~3; gx < blockX1; gx += 4)
+                    {
+                        float z[4];
+                        int mask;
+#ifdef CKRST_SSE2
+                        __m128 px = _mm_add_ps(_mm_set1_ps((float)gx), lanes);
+                        __m128 vpy = _mm_set1_ps(py);
+                        // Lanes in [blockX0, blockX1)
+                        __m128 inside = _mm_and_ps(_mm_cmpgt_ps(px, left), _mm_cmplt_ps(px, right));
+                        for (int e = 0; e < 3; ++e)
+                        {
+                            __m128 ev = _mm_add_ps(_mm_mul_ps(edgeA[e], _mm_sub_ps(px, edgeX[e])),
+                                                   _mm_mul_ps(edgeB[e], _mm_sub_ps(vpy, edgeY[e])));
+                            __m128 zero = _mm_setzero_ps();
+                            inside = _mm_and_ps(inside, _mm_or_ps(_mm_cmpgt_ps(ev, zero), _mm_and_ps(_mm_cmpeq_ps(ev, zero), topLeft[e])));
+                        }
+                        mask = _mm_movemask_ps(inside);
+                        if (!mask)
+                            continue;
+                        __m128 vz = _mm_add_ps(z0, _mm_add_ps(_mm_mul_ps(zx, _mm_sub_ps(px, originX)),
+                                                              _mm_mul_ps(zy, _mm_set1_ps(py - tri.Y0))));
+                        _mm_storeu_ps(z, vz);
+#else
+                        mask = 0;
+                        for (int l = 0; l < 4; ++l)
+                        {
+                            int x = gx + l;
+                            if (x < blockX0 || x >= blockX1)
+                                continue;
+                            float px = x + 0.5f;
+                            int covered = 1;
+                            for (int e = 0; e < 3 && covered; ++e)
+                            {
+                                float ev = tri.EdgeA[e] * (px - tri.EdgeX[e]) + tri.EdgeB[e] * (py - tri.EdgeY[e]);
+                                covered = ev > 0.0f || (ev == 0.0f && (tri.TopLeft & (1 << e)));
+                            }
+                            if (covered)
+                                mask |= 1 << l;
+                            z[l] = tri.Planes[0][0] + (tri.Planes[0][1] * (px - tri.X0) + tri.Planes[0][2] * (py - tri.Y0));
+                        }
+                        if (!mask)
+                            continue;
+#endif
+                        for (int l = 0; l < 4; ++l)
+                        {
+                            if (!(mask & (1 << l)))
+                                continue;
+                            int x = gx + l;
+                            if (depthTest && !SoftCompare(state.ZFunc, z[l], depthRow[x]))
+                                continue;
+                            written |= SoftShadePixel(tri, state, x + 0.5f, py, z[l], colorRow + x, depthRow + x);
+                        }
+                    }
+                }
+
+                if (written)
+                {
+                    UpdateHiZ(blockX0, blockY0, blockX1, blockY1);
+                    tileRangeUptodate = FALSE;
+                }
+            }
+        }
+
+        if (hiZ && tested && !visible)
+            ++stats.RejectedTriangles;
+    }
+}
+
+//------------------------------------------------------------------
+// Buffers
+
+CKBOOL CKSoftRasterizerContext::Clear(CKDWORD Flags, CKDWORD Ccol, float Z, CKDWORD Stencil, int RectCount, CKRECT *rects)
+{
+    FlushTiles();
+    if (!m_ColorBuffer)
+        return FALSE;
+
+    CKRECT area = {0, 0, m_TargetWidth, m_TargetHeight};
+    if (Flags & CKRST_CTXCLEAR_VIEWPORT)
+    {
+        area.left = XMax(area.left, m_ViewportData.ViewX);
+        area.top = XMax(area.top, m_ViewportData.ViewY);
+        area.right = XMin(area.right, m_ViewportData.ViewX + m_ViewportData.ViewWidth);
+        area.bottom = XMin(area.bottom, m_ViewportData.ViewY + m_ViewportData.ViewHeight);
+    }
+
+    int count = (rects && RectCount > 0) ? RectCount : 1;
+    for (int i = 0; i < count; ++i)
+    {
+        CKRECT r = area;
+        if (rects && RectCount > 0)
+        {
+            r.left = XMax(r.left, rects[i].left);
+            r.top = XMax(r.top, rects[i].top);
+            r.right = XMin(r.right, rects[i].right);
+            r.bottom = XMin(r.bottom, rects[i].bottom);
+        }
+        if (r.left >= r.right || r.top >= r.bottom)
+            continue;
+
+        for (int y = r.top; y < r.bottom; ++y)
+        {
+            if (Flags & CKRST_CTXCLEAR_COLOR)
+            {
+                CKDWORD *color = m_ColorBuffer + y * m_ColorPitch;
+                for (int x = r.left; x < r.right; ++x)
+                    color[x] = Ccol;
+            }
+            if (Flags & CKRST_CTXCLEAR_DEPTH)
+            {
+                float *depth = m_DepthBuffer + y * m_DepthPitch;
+                for (int x = r.left; x < r.right; ++x)
+                    depth[x] = Z;
+            }
+        }
+        if (Flags & CKRST_CTXCLEAR_DEPTH)
+            UpdateHiZ(r.left, r.top, r.right, r.bottom);
+    }
+    return TRUE;
+}
+
+int CKSoftRasterizerContext::CopyToMemoryBuffer(CKRECT *rect, VXBUFFER_TYPE buffer, VxImageDescEx &img_desc)
+{
+    if (buffer != VXBUFFER_BACKBUFFER || !m_ColorBuffer || !img_desc.Image)
+        return 0;
+    FlushTiles();
+
+    CKRECT r = {0, 0, m_TargetWidth, m_TargetHeight};
+    if (rect)
+    {
+        r.left = XMax(r.left, rect->left);
+        r.top = XMax(r.top, rect->top);
+        r.right = XMin(r.right, rect->right);
+        r.bottom = XMin(r.bottom, rect->bottom);
+    }
+    if (r.left >= r.right || r.top >= r.bottom)
+        return 0;
+
+    VxImageDescEx src;
+    VxPixelFormat2ImageDesc(_32_ARGB8888, src);
+    src.Width = r.right - r.left;
+    src.Height = r.bottom - r.top;
+    src.BytesPerLine = m_ColorPitch * 4;
+    src.Image = (XBYTE *)(m_ColorBuffer + r.top * m_ColorPitch + r.left);
+    VxDoBlit(src, img_desc);
+    return img_desc.BytesPerLine * img_desc.Height;
+}